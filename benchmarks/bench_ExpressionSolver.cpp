@@ -0,0 +1,655 @@
+#include "../src/ExpressionSolver.hpp"
+#include "../src/Memoization.hpp"
+#include "../src/Streaming.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace expression_solver;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Runs fn repeatedly for at least minSeconds and returns the mean seconds
+// per run.
+double timeIt(const std::function<void()> &fn, double minSeconds = 0.5) {
+  size_t runs = 0;
+  auto start = Clock::now();
+  double elapsed = 0;
+  do {
+    fn();
+    runs++;
+    elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  } while (elapsed < minSeconds);
+  return elapsed / runs;
+}
+
+// Flat, machine-generated sum of many small terms.
+std::string wideExpression(size_t bytes) {
+  std::string result = "x";
+  const char *terms[] = {"+1.25*x", "-sin(x)*0.5", "+(x-3)/7", "+abs(x-2)",
+                         "-x^2*0.001", "+sqrt(x+4)"};
+  for (size_t i = 0; result.size() < bytes; i++) {
+    result += terms[i % 6];
+  }
+  return result;
+}
+
+// Thousands of nested levels.
+std::string deepExpression(size_t bytes) {
+  std::string open, close;
+  const char *wrappers[] = {"sin(", "(x*0.5+", "abs(x-", "cos("};
+  for (size_t i = 0; open.size() + close.size() < bytes; i++) {
+    open += wrappers[i % 4];
+    close += ")";
+  }
+  return open + "x" + close;
+}
+
+void benchmarkLarge(const char *name, const std::string &expression,
+                    const ExpressionSolver &solver) {
+  double megabytes = expression.size() / (1024.0 * 1024.0);
+  ExpressionPtr compiled;
+  double compileSeconds = timeIt([&] { compiled = solver.compile(expression); });
+  double value = 0;
+  double evaluateSeconds = timeIt([&] { value += compiled->evaluate(); });
+  std::printf("%-22s %7.2f MB  compile %8.2f ms (%6.1f MB/s)  evaluate %8.3f ms\n",
+              name, megabytes, compileSeconds * 1e3, megabytes / compileSeconds,
+              evaluateSeconds * 1e3);
+}
+
+// Scalar and batch time per row, and the largest error against the exact
+// compile, for each tolerance.
+void benchmarkAccuracy(const std::string &expression, Context context,
+                       const PlaceHolderPtr &x) {
+  const size_t rows = 1 << 16;
+  std::vector<double> inputs(rows), exact(rows), results(rows);
+  for (size_t i = 0; i < rows; i++) {
+    inputs[i] = 20.0 * i / rows;
+  }
+  Binding binding{x.get(), inputs};
+
+  std::printf("%s\n", expression.c_str());
+  for (double tolerance : {0.0, 1e-12, 1e-9, 1e-6, 1e-3}) {
+    context.setTolerance(tolerance);
+    ExpressionSolver solver(context);
+    auto compiled = solver.compile(expression);
+    double scalarSeconds = timeIt([&] {
+      double sum = 0;
+      for (size_t i = 0; i < rows; i++) {
+        x->setValue(inputs[i]);
+        sum += compiled->evaluate();
+      }
+      results[0] = sum;
+    });
+    double batchSeconds = timeIt([&] { solver.solve(compiled, {&binding, 1}, results); });
+    if (tolerance == 0) {
+      exact = results;
+    }
+    double worst = 0;
+    for (size_t i = 0; i < rows; i++) {
+      worst = std::max(worst, std::abs(results[i] - exact[i]) / std::max(1.0, std::abs(exact[i])));
+    }
+    std::printf("  tolerance %-6.0e  scalar %6.1f ns/row  batch %6.1f ns/row  max error %.1e\n",
+                tolerance, scalarSeconds * 1e9 / rows, batchSeconds * 1e9 / rows, worst);
+  }
+}
+
+// Many small rule-like formulas, as loaded at startup.
+std::vector<std::string> ruleExpressions(size_t count) {
+  const char *shapes[] = {"x * %d + 3", "sin(x / %d) ^ 2 + cos(x)",
+                          "(x + %d) * (x - 1) / (x + 2)", "max(x, %d) + abs(x - 5)",
+                          "exp(x / %d) * log(x + 2) + sqrt(x + 4)"};
+  std::vector<std::string> result;
+  result.reserve(count);
+  char buffer[128];
+  for (size_t i = 0; i < count; i++) {
+    std::snprintf(buffer, sizeof(buffer), shapes[i % 5], static_cast<int>(i % 1000 + 1));
+    result.emplace_back(buffer);
+  }
+  return result;
+}
+
+// One compile() call per expression, then compileAll on pools of 1, 2, 4,
+// ... threads up to the hardware thread count.
+void benchmarkBulk(const std::vector<std::string> &expressions,
+                   const ExpressionSolver &solver) {
+  double sequential = timeIt([&] {
+    std::vector<ExpressionPtr> compiled;
+    compiled.reserve(expressions.size());
+    for (const auto &expression : expressions) {
+      compiled.push_back(solver.compile(expression));
+    }
+  });
+  std::printf("%zu expressions  sequential %8.1f ms (%7.0f expr/ms)\n",
+              expressions.size(), sequential * 1e3, expressions.size() / (sequential * 1e3));
+  size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t threads = 1;; threads = std::min(threads * 2, hardware)) {
+    ThreadPool pool(threads);
+    double seconds = timeIt([&] { solver.compileAll(expressions, pool); });
+    std::printf("  compileAll %3zu threads %8.1f ms (%7.0f expr/ms, %.2fx)\n", threads,
+                seconds * 1e3, expressions.size() / (seconds * 1e3), sequential / seconds);
+    if (threads == hardware) {
+      break;
+    }
+  }
+}
+
+// Filter-like rules over whole-number inputs, which can run the int64
+// kernels, and over the same inputs shifted by 0.5, which keep the
+// arithmetic in doubles. Logical operations use bitmasks in both.
+void benchmarkTyped(const char *expression, Context context) {
+  auto a = std::make_shared<PlaceHolder>("a", 0.0);
+  auto b = std::make_shared<PlaceHolder>("b", 0.0);
+  auto c = std::make_shared<PlaceHolder>("c", 0.0);
+  context.addPlaceholder(a);
+  context.addPlaceholder(b);
+  context.addPlaceholder(c);
+  ExpressionSolver solver(context);
+  auto compiled = solver.compile(expression);
+
+  size_t rows = 1 << 16;
+  std::vector<double> whole[3], shifted[3];
+  for (size_t k = 0; k < 3; k++) {
+    for (size_t i = 0; i < rows; i++) {
+      whole[k].push_back(static_cast<double>((i * 7919 + k * 104729) % (10 + 45 * k)));
+      shifted[k].push_back(whole[k].back() + 0.5);
+    }
+  }
+  std::vector<double> results(rows);
+  auto time = [&](std::vector<double> *columns) {
+    Binding bindings[] = {{a.get(), columns[0]}, {b.get(), columns[1]}, {c.get(), columns[2]}};
+    return timeIt([&] { solver.solve(compiled, bindings, results); }) * 1e9 / rows;
+  };
+  std::printf("%-60s whole %5.1f ns/row  fractional %5.1f ns/row\n", expression,
+              time(whole), time(shifted));
+}
+
+// "if guard then formula" with the guard passing about 5% of rows: the
+// formula over every row, against solveWhere scattering and compacting.
+void benchmarkGuarded(Context context) {
+  auto a = std::make_shared<PlaceHolder>("a", 0.0);
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  context.addPlaceholder(a);
+  context.addPlaceholder(x);
+  ExpressionSolver solver(context);
+  auto guard = solver.compile("a == 3");
+  auto formula = solver.compile("exp(x / 10) * log(x + 2) + sqrt(x + 4) * sin(x) ^ 2");
+
+  size_t rows = 1 << 16;
+  std::vector<double> as(rows), xs(rows), results(rows);
+  for (size_t i = 0; i < rows; i++) {
+    as[i] = static_cast<double>((i * 7919) % 20);
+    xs[i] = 0.001 * i;
+  }
+  Binding bindings[] = {{a.get(), as}, {x.get(), xs}};
+  double all = timeIt([&] { solver.solve(formula, bindings, results); });
+  double scatter = timeIt([&] { solver.solveWhere(guard, formula, bindings, results); });
+  double compact = timeIt([&] {
+    solver.solveWhere(guard, formula, bindings, results, SelectionOutput::Compact);
+  });
+  std::printf("every row %5.1f ns/row  scatter %5.1f ns/row (%.1fx)  compact %5.1f ns/row "
+              "(%.1fx)\n",
+              all * 1e9 / rows, scatter * 1e9 / rows, all / scatter, compact * 1e9 / rows,
+              all / compact);
+}
+
+// A costly term of a category code with 200 distinct values, times a
+// per-row input, with and without a cache keyed by the category.
+void benchmarkMemoized(Context context) {
+  auto k = std::make_shared<PlaceHolder>("k", 0.0);
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  context.addPlaceholder(k);
+  context.addPlaceholder(x);
+  const char *expression = "exp(sin(k / 7) * 2) * log(k + 2) ^ 1.5 * x + atan2(k, 10)";
+  ExpressionSolver plain(context);
+  context.setMemoized({"k"});
+  ExpressionSolver memoized(context);
+  auto uncached = plain.compile(expression);
+  auto cached = memoized.compile(expression);
+
+  size_t rows = 1 << 16;
+  std::vector<double> ks(rows), xs(rows), results(rows);
+  for (size_t i = 0; i < rows; i++) {
+    ks[i] = static_cast<double>((i * 7919) % 200);
+    xs[i] = 0.001 * i;
+  }
+  Binding bindings[] = {{k.get(), ks}, {x.get(), xs}};
+  double before = timeIt([&] { plain.solve(uncached, bindings, results); });
+  double after = timeIt([&] { memoized.solve(cached, bindings, results); });
+  std::printf("uncached %5.1f ns/row  memoized %5.1f ns/row (%.1fx, hit rate %.3f)\n",
+              before * 1e9 / rows, after * 1e9 / rows, before / after,
+              memoStatistics(*cached).hitRate());
+}
+
+// Cost per sample of a streaming operation in batches, for a short and a
+// long window; both should be about the same.
+void benchmarkStreaming(const char *operation, Context context) {
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  context.addPlaceholder(x);
+  ExpressionSolver solver(context);
+
+  size_t rows = 1 << 16;
+  std::vector<double> xs(rows), results(rows);
+  for (size_t i = 0; i < rows; i++) {
+    xs[i] = std::sin(0.001 * i) * 100 + static_cast<double>((i * 7919) % 13);
+  }
+  Binding bindings[] = {{x.get(), xs}};
+  auto time = [&](size_t window) {
+    auto compiled =
+        solver.compile(std::string(operation) + "(x, " + std::to_string(window) + ")");
+    return timeIt([&] { solver.solve(compiled, bindings, results); }) * 1e9 / rows;
+  };
+  std::printf("%-14s window 10 %5.1f ns/sample  window 10000 %5.1f ns/sample\n", operation,
+              time(10), time(10000));
+}
+
+// Implied yields of 64k bonds from their prices: the batch with Newton and
+// with Brent, against one root-finding call per row.
+void benchmarkRoots(Context context) {
+  auto r = std::make_shared<PlaceHolder>("r", 0.0);
+  auto c = std::make_shared<PlaceHolder>("c", 0.0);
+  auto n = std::make_shared<PlaceHolder>("n", 0.0);
+  context.addPlaceholder(r);
+  context.addPlaceholder(c);
+  context.addPlaceholder(n);
+  ExpressionSolver solver(context);
+  auto price = solver.compile("c * (1 - (1 + r) ^ (0 - n)) / r + 100 * (1 + r) ^ (0 - n)");
+
+  size_t rows = 1 << 16;
+  std::vector<double> coupons(rows), periods(rows), rates(rows), prices(rows), roots(rows);
+  for (size_t i = 0; i < rows; i++) {
+    coupons[i] = 1 + static_cast<double>(i % 9);
+    periods[i] = 1 + static_cast<double>(i % 30);
+    rates[i] = 0.001 + 0.15 * static_cast<double>((i * 7919) % 1000) / 1000;
+  }
+  Binding withRates[] = {{r.get(), rates}, {c.get(), coupons}, {n.get(), periods}};
+  solver.solve(price, withRates, prices);
+  Binding bindings[] = {{c.get(), coupons}, {n.get(), periods}};
+
+  RootFinder finder(price, *r);
+  auto batch = [&](bool derivative) {
+    return timeIt([&] {
+             finder.solve(bindings, prices, 1e-6, 1, roots, {}, {.useDerivative = derivative});
+           }) *
+           1e9 / rows;
+  };
+  double newton = batch(true);
+  double brent = batch(false);
+  double perRow = timeIt([&] {
+                    for (size_t i = 0; i < rows; i++) {
+                      c->setValue(coupons[i]);
+                      n->setValue(periods[i]);
+                      roots[i] = solver.solveFor(price, *r, prices[i], 1e-6, 1);
+                    }
+                  }) *
+                  1e9 / rows;
+  std::printf("batch Newton %6.1f ns/row  batch Brent %6.1f ns/row  per-row calls %6.1f ns/row\n",
+              newton, brent, perRow);
+}
+
+void benchmarkShortCircuit(Context context) {
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  auto y = std::make_shared<PlaceHolder>("y", 0.0);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  ExpressionSolver solver(context);
+  // The costly comparison is written first; one row in ten passes the cheap
+  // one.
+  auto rule = solver.compile("(floor(sin(x) * 4 + cos(x) * 4 + exp(x / 8)) == 3) && (y == 1)");
+
+  size_t rows = 1 << 16;
+  std::vector<double> xs(rows), ys(rows), results(rows);
+  for (size_t i = 0; i < rows; i++) {
+    xs[i] = static_cast<double>(i % 1000) / 100;
+    ys[i] = i % 10 == 0;
+  }
+  Binding bindings[] = {{x.get(), xs}, {y.get(), ys}};
+  double seconds = timeIt([&] { solver.solve(rule, bindings, results); });
+  std::printf("estimated cost %5.0f  %6.2f ns/row\n", estimateCost(*rule), seconds * 1e9 / rows);
+}
+
+void benchmarkVectors(Context context) {
+  auto a = std::make_shared<VectorPlaceHolder>("a", 3);
+  auto b = std::make_shared<VectorPlaceHolder>("b", 3);
+  context.addVector(a);
+  context.addVector(b);
+  ExpressionSolver solver(context);
+
+  size_t rows = 1 << 16;
+  std::vector<double> as(rows * 3), bs(rows * 3), results(rows);
+  for (size_t i = 0; i < rows * 3; i++) {
+    as[i] = static_cast<double>(i % 101) / 10;
+    bs[i] = static_cast<double>(i % 37) / 10;
+  }
+  auto bindings = a->bind(as);
+  auto more = b->bind(bs);
+  bindings.insert(bindings.end(), more.begin(), more.end());
+
+  const char *pairs[][2] = {
+      {"sqrt(a_x*b_x + a_y*b_y + a_z*b_z)", "sqrt(dot(a, b))"},
+      {"(a_x*b_x + a_y*b_y + a_z*b_z) / sqrt(a_x*a_x + a_y*a_y + a_z*a_z)",
+       "dot(normalize(a), b)"},
+  };
+  for (const auto &pair : pairs) {
+    double seconds[2];
+    for (int k = 0; k < 2; k++) {
+      auto compiled = solver.compile(pair[k]);
+      seconds[k] = timeIt([&] { solver.solve(compiled, bindings, results); });
+    }
+    std::printf("%-28s %6.2f ns/row  written out %6.2f ns/row\n", pair[1],
+                seconds[1] * 1e9 / rows, seconds[0] * 1e9 / rows);
+  }
+}
+
+void benchmarkMonteCarlo(Context context) {
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  auto y = std::make_shared<PlaceHolder>("y", 0.0);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  ExpressionSolver solver(context);
+  auto payoff = solver.compile("max(x * exp(y * 0.2 - 0.02) - 1, 0)");
+  MonteCarlo simulation(payoff, {{x.get(), Distribution::uniform(0.9, 1.1)},
+                                 {y.get(), Distribution::normal(0, 1)}});
+
+  MonteCarloOptions options{.samples = 1 << 20};
+  double serial = timeIt([&] { simulation.run(options); });
+  double pooled = timeIt([&] { simulation.run(options, &ThreadPool::shared()); });
+  // Drawn outside the library and evaluated one row at a time, with the
+  // moments accumulated by the caller.
+  std::mt19937_64 engine(0);
+  std::uniform_real_distribution<double> uniform(0.9, 1.1);
+  std::normal_distribution<double> normal;
+  volatile double sink = 0;
+  double rows = timeIt([&] {
+    double sum = 0, squares = 0;
+    for (size_t i = 0; i < options.samples; i++) {
+      x->setValue(uniform(engine));
+      y->setValue(normal(engine));
+      double value = payoff->evaluate();
+      sum += value;
+      squares += value * value;
+    }
+    sink = sum + squares;
+  });
+  std::printf("simulate %6.2f ns/sample  on %zu threads %6.2f ns/sample  row at a time %6.2f "
+              "ns/sample\n",
+              serial * 1e9 / options.samples, ThreadPool::shared().size(),
+              pooled * 1e9 / options.samples, rows * 1e9 / options.samples);
+}
+
+void benchmarkGrid(Context context) {
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  auto y = std::make_shared<PlaceHolder>("y", 0.0);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  ExpressionSolver solver(context);
+  auto surface = solver.compile("sin(x) * cos(y) + exp(0 - x * x / 4) * sqrt(y + 1) + x * y");
+
+  GridAxis axes[] = {GridAxis::range(*x, -3, 3, 512), GridAxis::range(*y, 0, 10, 2048)};
+  size_t points = axes[0].values.size() * axes[1].values.size();
+  std::vector<double> xs(points), ys(points), results(points);
+  for (size_t p = 0; p < points; p++) {
+    xs[p] = axes[0].values[p / axes[1].values.size()];
+    ys[p] = axes[1].values[p % axes[1].values.size()];
+  }
+  Binding bindings[] = {{x.get(), xs}, {y.get(), ys}};
+  double batch = timeIt([&] { solver.solve(surface, bindings, results); });
+  double grid = timeIt([&] { solver.solveGrid(surface, axes, results); });
+  std::printf("512 x 2048  batch over every point %6.2f ns/point  grid %6.2f ns/point\n",
+              batch * 1e9 / points, grid * 1e9 / points);
+}
+
+void benchmarkSelection(Context context) {
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  auto y = std::make_shared<PlaceHolder>("y", 0.0);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  ExpressionSolver solver(context);
+  auto score = solver.compile("sin(x) * 100 + y * y - x / 3");
+
+  size_t rows = 1 << 22;
+  std::mt19937_64 engine(7);
+  std::uniform_real_distribution<double> uniform(-10, 10);
+  std::vector<double> xs(rows), ys(rows), values(rows);
+  for (size_t i = 0; i < rows; i++) {
+    xs[i] = uniform(engine);
+    ys[i] = uniform(engine);
+  }
+  Binding bindings[] = {{x.get(), xs}, {y.get(), ys}};
+  RowSelector selector(score);
+  std::vector<RankedRow> ranked(rows);
+  // Every value stored, then ranked or scanned by the caller.
+  double materializedTop = timeIt([&] {
+    solver.solve(score, bindings, values);
+    for (size_t i = 0; i < rows; i++) {
+      ranked[i] = {static_cast<uint32_t>(i), values[i]};
+    }
+    std::partial_sort(ranked.begin(), ranked.begin() + 100, ranked.end(),
+                      [](const RankedRow &a, const RankedRow &b) { return a.value > b.value; });
+  });
+  double fusedTop = timeIt([&] { selector.top(bindings, rows, 100); });
+  std::vector<uint32_t> passing;
+  double materializedAbove = timeIt([&] {
+    solver.solve(score, bindings, values);
+    passing.clear();
+    for (size_t i = 0; i < rows; i++) {
+      if (values[i] > 150) {
+        passing.push_back(static_cast<uint32_t>(i));
+      }
+    }
+  });
+  double fusedAbove = timeIt([&] { selector.above(bindings, rows, 150); });
+  std::printf("top 100   materialized %6.2f ns/row  fused %6.2f ns/row\n",
+              materializedTop * 1e9 / rows, fusedTop * 1e9 / rows);
+  std::printf("above     materialized %6.2f ns/row  fused %6.2f ns/row\n",
+              materializedAbove * 1e9 / rows, fusedAbove * 1e9 / rows);
+}
+
+void benchmarkTables(Context context) {
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  auto y = std::make_shared<PlaceHolder>("y", 0.0);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  auto curve = [](double v) { return std::sin(v) * std::exp(v / 10); };
+  auto even = TableAxis::range(0, 10, 256);
+  std::vector<double> knots(256);
+  for (size_t i = 0; i < knots.size(); i++) {
+    double s = static_cast<double>(i) / 255;
+    knots[i] = 10 * s * s; // Denser near 0
+  }
+  TableAxis uneven(knots);
+  auto sample = [&](const TableAxis &axis) {
+    std::vector<double> values;
+    for (double k : axis.getKnots()) {
+      values.push_back(curve(k));
+    }
+    return values;
+  };
+  std::vector<double> grid;
+  auto coarse = TableAxis::range(0, 10, 64);
+  for (double a : coarse.getKnots()) {
+    for (double b : coarse.getKnots()) {
+      grid.push_back(curve(a) * curve(b));
+    }
+  }
+  context.addTable("even", std::make_shared<Table>(even, sample(even)));
+  context.addTable("uneven", std::make_shared<Table>(uneven, sample(uneven)));
+  context.addTable("smooth", std::make_shared<Table>(even, sample(even), Interpolation::Cubic));
+  context.addTable("surface",
+                   std::make_shared<Table>(coarse, coarse, grid, Interpolation::Cubic));
+  ExpressionSolver solver(context);
+
+  size_t rows = 1 << 16;
+  std::mt19937_64 engine(5);
+  std::uniform_real_distribution<double> uniform(0, 10);
+  std::vector<double> xs(rows), ys(rows), results(rows);
+  for (size_t i = 0; i < rows; i++) {
+    xs[i] = uniform(engine);
+    ys[i] = uniform(engine);
+  }
+  Binding bindings[] = {{x.get(), xs}, {y.get(), ys}};
+  const char *expressions[] = {"sin(x) * exp(x / 10)", "interp(even, x)", "interp(uneven, x)",
+                               "interp(smooth, x)", "interp(surface, x, y)"};
+  for (const char *text : expressions) {
+    auto expression = solver.compile(text);
+    double batch = timeIt([&] { solver.solve(expression, bindings, results); });
+    std::printf("%-24s %6.2f ns/row\n", text, batch * 1e9 / rows);
+  }
+}
+
+void benchmarkSurrogate(Context context) {
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  auto y = std::make_shared<PlaceHolder>("y", 0.0);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  ExpressionSolver solver(context);
+  size_t rows = 1 << 16;
+  std::mt19937_64 engine(9);
+  std::vector<double> xs(rows), ys(rows), results(rows);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  for (size_t i = 0; i < rows; i++) {
+    xs[i] = 5 * uniform(engine);
+    ys[i] = 3 * uniform(engine);
+  }
+  Binding bindings[] = {{x.get(), xs}, {y.get(), ys}};
+  struct Case {
+    const char *expression;
+    std::vector<SurrogateAxis> axes;
+  } cases[] = {
+      {"exp(sin(x) * cos(x / 3)) + log(2 + sin(x * x)) * atan(x) + sqrt(1 + exp(0 - x))",
+       {{x.get(), 0, 5}}},
+      {"sin(x) * exp(0 - y / 2) + cos(x * y / 4) * log(1 + y)", {{x.get(), 0, 5}, {y.get(), 0, 3}}},
+  };
+  for (const auto &test : cases) {
+    auto expression = solver.compile(test.expression);
+    Surrogate surrogate;
+    double build = timeIt([&] { surrogate = solver.surrogate(expression, test.axes, {.tolerance = 1e-9}); });
+    double original = timeIt([&] { solver.solve(expression, bindings, results); });
+    double fitted = timeIt([&] { solver.solve(surrogate.expression, bindings, results); });
+    std::printf("%zuD  original %6.2f ns/row  surrogate %6.2f ns/row  (%zu pieces of degree %zu, "
+                "error %.1e, built in %.1f ms)\n",
+                test.axes.size(), original * 1e9 / rows, fitted * 1e9 / rows, surrogate.pieces,
+                surrogate.degree, surrogate.maxError, build * 1e3);
+  }
+}
+
+void benchmarkBudgets(const ExpressionSolver &solver) {
+  auto expressions = ruleExpressions(10000);
+  double plain = timeIt([&] {
+    for (const auto &expression : expressions) {
+      solver.compile(expression);
+    }
+  });
+  CompileOptions options;
+  double budgeted = timeIt([&] {
+    for (const auto &expression : expressions) {
+      auto result = solver.tryCompile(expression, options);
+    }
+  });
+  std::printf("compile %7.1f ns/expression  tryCompile with budgets %7.1f ns/expression\n",
+              plain * 1e9 / expressions.size(), budgeted * 1e9 / expressions.size());
+  // Inputs a worker would otherwise spend its time on.
+  std::string deep = std::string(1 << 20, '(') + "x" + std::string(1 << 20, ')');
+  std::string wide = wideExpression(1 << 20);
+  options.maxLength = std::numeric_limits<size_t>::max();
+  double rejectDeep = timeIt([&] { auto result = solver.tryCompile(deep, options); });
+  double rejectWide = timeIt([&] { auto result = solver.tryCompile(wide, options); });
+  double compileWide = timeIt([&] { solver.compile(wide); });
+  std::printf("1 MB input: rejected on depth %7.1f us  on tokens %7.1f us  compiled %9.1f us\n",
+              rejectDeep * 1e6, rejectWide * 1e6, compileWide * 1e6);
+}
+
+void benchmarkContext() {
+  double construct = timeIt([] { ExpressionSolver solver; }) * 1e9;
+  const auto &defaults = Context::getDefaultContext();
+  const char *names[] = {"sin", "rolling_mean", "hypot", "PI", "EPSILON", "unknown"};
+  size_t found = 0;
+  double lookup = timeIt([&] {
+                    for (const char *name : names) {
+                      found += defaults.hasOperation(name) + defaults.hasVariable(name);
+                    }
+                  }) *
+                  1e9 / std::size(names);
+  ExpressionSolver solver;
+  double parse = timeIt([&] { solver.compile("sin(PI / 4) * 2 + max(E, 3) % 2"); }) * 1e9;
+  std::printf("solver from default context %6.1f ns  name lookup %5.1f ns  small compile %7.1f ns\n",
+              construct, lookup, parse);
+}
+
+} // namespace
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.75);
+  context.addPlaceholder(x);
+  ExpressionSolver solver(context);
+
+  std::printf("== Large expressions ==\n");
+  benchmarkLarge("wide (1 MB)", wideExpression(1 << 20), solver);
+  benchmarkLarge("wide (4 MB)", wideExpression(4 << 20), solver);
+  benchmarkLarge("deep (1 MB)", deepExpression(1 << 20), solver);
+
+  std::printf("\n== Bulk compile ==\n");
+  benchmarkBulk(ruleExpressions(40000), solver);
+
+  std::printf("\n== Approximation accuracy ==\n");
+  benchmarkAccuracy("sin(x) * exp(x / 10) + log(x + 2) * cos(x) + (x + 1) ^ 1.5",
+                    context, x);
+  benchmarkAccuracy("exp(0 - x^2 / 8) * cos(3 * x)", context, x);
+
+  std::printf("\n== Typed batches ==\n");
+  benchmarkTyped("((a == 3) || (b == 2)) && !(c == 7) && ((a == b) || (c == 1))", context);
+  benchmarkTyped("(floor(c) % 7 == 3) && (a == 1)", context);
+  benchmarkTyped("(c % 7) + (a * b) - min(a, b)", context);
+
+  std::printf("\n== Guarded evaluation (5%% selected) ==\n");
+  benchmarkGuarded(context);
+
+  std::printf("\n== Memoized subexpressions (200 distinct keys) ==\n");
+  benchmarkMemoized(context);
+
+  std::printf("\n== Streaming windows ==\n");
+  for (const char *operation : {"lag", "rolling_mean", "rolling_max", "rolling_min"}) {
+    benchmarkStreaming(operation, context);
+  }
+
+  std::printf("\n== Root finding (implied yields) ==\n");
+  benchmarkRoots(context);
+
+  std::printf("\n== Short circuit (10%% pass the cheap side) ==\n");
+  benchmarkShortCircuit(context);
+
+  std::printf("\n== Vector operations (3D, SoA columns) ==\n");
+  benchmarkVectors(context);
+
+  std::printf("\n== Monte Carlo (2 draws per sample) ==\n");
+  benchmarkMonteCarlo(context);
+
+  std::printf("\n== Grid evaluation (separable terms hoisted) ==\n");
+  benchmarkGrid(context);
+
+  std::printf("\n== Row selection (4M rows) ==\n");
+  benchmarkSelection(context);
+
+  std::printf("\n== Table interpolation (batches of 64K rows) ==\n");
+  benchmarkTables(context);
+
+  std::printf("\n== Chebyshev surrogates (tolerance 1e-9) ==\n");
+  benchmarkSurrogate(context);
+
+  std::printf("\n== Compile budgets ==\n");
+  benchmarkBudgets(solver);
+
+  std::printf("\n== Default context ==\n");
+  benchmarkContext();
+  return 0;
+}
@@ -0,0 +1,75 @@
+#include "../src/EvaluationServer.hpp"
+#include <csignal>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <string>
+
+using namespace expression_solver;
+
+// Usage: ExpressionSolverServer <socket path> <rules file> [workers]
+//
+// The rules file holds one definition per line, such as
+// "price(qty, rate) = qty * rate"; blank lines and lines starting with #
+// are skipped. The server runs until SIGINT or SIGTERM and then prints its
+// statistics.
+int main(int argc, char *argv[]) {
+  if (argc < 3 || argc > 4) {
+    std::fprintf(stderr, "Usage: %s <socket path> <rules file> [workers]\n", argv[0]);
+    return 2;
+  }
+
+  // Block the signals before any thread starts so that only sigwait sees them.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  EvaluationServer::Options options;
+  options.socketPath = argv[1];
+  if (argc == 4) {
+    options.workers = std::stoul(argv[3]);
+  }
+
+  try {
+    EvaluationServer server(options);
+    std::ifstream rules(argv[2]);
+    if (!rules) {
+      std::fprintf(stderr, "Cannot open %s\n", argv[2]);
+      return 1;
+    }
+    std::string line;
+    size_t count = 0;
+    while (std::getline(rules, line)) {
+      auto first = line.find_first_not_of(" \t\r");
+      if (first == std::string::npos || line[first] == '#') {
+        continue;
+      }
+      server.define(line);
+      count++;
+    }
+
+    server.start();
+    std::printf("Serving %zu programs on %s\n", count, options.socketPath.c_str());
+    std::fflush(stdout);
+
+    int signal = 0;
+    sigwait(&signals, &signal);
+    server.stop();
+
+    auto statistics = server.statistics();
+    std::printf("requests: %llu, rows: %llu, batches: %llu\n",
+                static_cast<unsigned long long>(statistics.requests),
+                static_cast<unsigned long long>(statistics.rows),
+                static_cast<unsigned long long>(statistics.batches));
+    std::printf("latency p50: %.1f us, p99: %.1f us\n", statistics.p50Microseconds,
+                statistics.p99Microseconds);
+    std::printf("throughput: %.0f requests/s, %.0f rows/s\n",
+                statistics.requestsPerSecond, statistics.rowsPerSecond);
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,396 @@
+#include "Approximation.hpp"
+#include "Traversal.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <typeinfo>
+
+namespace expression_solver {
+
+namespace approximation {
+
+namespace {
+
+// Allowance for the rounding of range reduction and polynomial evaluation,
+// a few units in the last place.
+constexpr double rounding = 1e-15;
+
+// Adding and subtracting 1.5 * 2^52 rounds to the nearest integer, without a
+// libm call, for |x| < 2^51.
+constexpr double shifter = 6755399441055744.0;
+
+constexpr double log2e = 1.44269504088896338700e+00;
+constexpr double ln2 = 6.93147180559945286227e-01;
+// ln2 split so that k * ln2Hi is exact for |k| < 2^20.
+constexpr double ln2Hi = 6.93147180369123816490e-01;
+constexpr double ln2Lo = 1.90821492927058770002e-10;
+constexpr double expLimit = 708; // exp stays a normal number
+
+constexpr double sqrt2 = 1.41421356237309504880;
+
+constexpr double pi4 = 0.785398163397448309616;
+constexpr double twoOverPi = 6.36619772367581382433e-01;
+// pi/2 split in three 33-bit parts (Cody and Waite), so k * part is exact.
+constexpr double pio2_1 = 1.57079632673412561417e+00;
+constexpr double pio2_2 = 6.07710050630396597660e-11;
+constexpr double pio2_3 = 2.02226624871116645580e-21;
+constexpr double reducedLimit = 1e5;
+
+constexpr size_t block = 256;
+
+double factorial(int n) {
+  double result = 1;
+  for (int i = 2; i <= n; i++) {
+    result *= i;
+  }
+  return result;
+}
+
+double roundToInteger(double x) { return (x + shifter) - shifter; }
+
+// 2^k for an integral k in the normal exponent range.
+double scale(double k) {
+  return std::bit_cast<double>(static_cast<uint64_t>(static_cast<int64_t>(k) + 1023)
+                               << 52);
+}
+
+double horner(const double *coefficients, int degree, double x) {
+  double result = coefficients[degree];
+  for (int j = degree - 1; j >= 0; j--) {
+    result = result * x + coefficients[j];
+  }
+  return result;
+}
+
+// result[i] = polynomial at x[i], one coefficient at a time over the block.
+void horner(const double *coefficients, int degree, const double *x,
+            double *result, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    result[i] = coefficients[degree];
+  }
+  for (int j = degree - 1; j >= 0; j--) {
+    double c = coefficients[j];
+    for (size_t i = 0; i < count; i++) {
+      result[i] = result[i] * x[i] + c;
+    }
+  }
+}
+
+} // namespace
+
+// Taylor remainder r^(n+1)/(n+1)! * e^xi, relative to e^r: at most
+// sqrt(2) * (ln2/2)^(n+1)/(n+1)!.
+double Exp::bound(int degree) {
+  return sqrt2 * std::pow(ln2 / 2, degree + 1) / factorial(degree + 1) + rounding;
+}
+
+Exp::Exp(double tolerance) {
+  for (int d = minDegree; d <= maxDegree; d++) {
+    if (bound(d) <= tolerance) {
+      degree = d;
+      for (int j = 0; j <= d; j++) {
+        coefficients[j] = 1 / factorial(j);
+      }
+      return;
+    }
+  }
+}
+
+double Exp::operator()(double x) const {
+  if (!(std::abs(x) <= expLimit)) {
+    return std::exp(x);
+  }
+  double k = roundToInteger(x * log2e);
+  double r = (x - k * ln2Hi) - k * ln2Lo;
+  return horner(coefficients, degree, r) * scale(k);
+}
+
+void Exp::operator()(const double *x, double *out, size_t count) const {
+  double k[block], r[block];
+  for (size_t start = 0; start < count; start += block) {
+    size_t n = std::min(block, count - start);
+    const double *in = x + start;
+    double *result = out + start;
+    for (size_t i = 0; i < n; i++) {
+      double v = std::abs(in[i]) <= expLimit ? in[i] : 0.0;
+      k[i] = roundToInteger(v * log2e);
+      r[i] = (v - k[i] * ln2Hi) - k[i] * ln2Lo;
+    }
+    horner(coefficients, degree, r, result, n);
+    for (size_t i = 0; i < n; i++) {
+      result[i] *= scale(k[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (!(std::abs(in[i]) <= expLimit)) {
+        result[i] = std::exp(in[i]);
+      }
+    }
+  }
+}
+
+namespace {
+
+constexpr double sMax = (sqrt2 - 1) / (sqrt2 + 1);
+constexpr uint64_t mantissaMask = (uint64_t(1) << 52) - 1;
+constexpr uint64_t exponentOne = uint64_t(1023) << 52;
+
+bool inLogRange(double x) {
+  return x >= std::numeric_limits<double>::min() &&
+         x <= std::numeric_limits<double>::max();
+}
+
+} // namespace
+
+// Truncating 2*atanh(s) after s^(2n-1) leaves less than
+// 2|s|^(2n+1) / ((2n+1)(1-s^2)). Relative to |2s| when e = 0, or to
+// |log x| >= ln2/2 otherwise, that is at most the expression below.
+double Log::bound(int terms) {
+  return std::pow(sMax, 2 * terms) / ((2 * terms + 1) * (1 - sMax * sMax)) +
+         rounding;
+}
+
+Log::Log(double tolerance) {
+  for (int n = minTerms; n <= maxTerms; n++) {
+    if (bound(n) <= tolerance) {
+      terms = n;
+      for (int j = 0; j < n; j++) {
+        coefficients[j] = 2.0 / (2 * j + 1);
+      }
+      return;
+    }
+  }
+}
+
+double Log::operator()(double x) const {
+  if (!inLogRange(x)) {
+    return std::log(x);
+  }
+  uint64_t bits = std::bit_cast<uint64_t>(x);
+  double e = static_cast<double>(static_cast<int64_t>(bits >> 52) - 1023);
+  double m = std::bit_cast<double>((bits & mantissaMask) | exponentOne);
+  if (m > sqrt2) {
+    m *= 0.5;
+    e += 1;
+  }
+  double s = (m - 1) / (m + 1);
+  return e * ln2Hi + (s * horner(coefficients, terms - 1, s * s) + e * ln2Lo);
+}
+
+void Log::operator()(const double *x, double *out, size_t count) const {
+  double e[block], s[block], z[block];
+  for (size_t start = 0; start < count; start += block) {
+    size_t n = std::min(block, count - start);
+    const double *in = x + start;
+    double *result = out + start;
+    for (size_t i = 0; i < n; i++) {
+      uint64_t bits = std::bit_cast<uint64_t>(inLogRange(in[i]) ? in[i] : 1.0);
+      double exponent = static_cast<double>(static_cast<int64_t>(bits >> 52) - 1023);
+      double m = std::bit_cast<double>((bits & mantissaMask) | exponentOne);
+      bool high = m > sqrt2;
+      m = high ? m * 0.5 : m;
+      e[i] = high ? exponent + 1 : exponent;
+      s[i] = (m - 1) / (m + 1);
+      z[i] = s[i] * s[i];
+    }
+    horner(coefficients, terms - 1, z, result, n);
+    for (size_t i = 0; i < n; i++) {
+      result[i] = e[i] * ln2Hi + (s[i] * result[i] + e[i] * ln2Lo);
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (!inLogRange(in[i])) {
+        result[i] = std::log(in[i]);
+      }
+    }
+  }
+}
+
+// With sin(r) taken to r^(2n+1) and cos(r) to r^(2n), the larger Taylor
+// remainder on |r| <= pi/4 is the one of cos.
+double SinCos::bound(int terms) {
+  return std::pow(pi4, 2 * terms + 2) / factorial(2 * terms + 2) + rounding;
+}
+
+SinCos::SinCos(double tolerance) {
+  for (int n = minTerms; n <= maxTerms; n++) {
+    if (bound(n) <= tolerance) {
+      terms = n;
+      for (int j = 0; j <= n; j++) {
+        double sign = j % 2 ? -1 : 1;
+        sinCoefficients[j] = sign / factorial(2 * j + 1);
+        cosCoefficients[j] = sign / factorial(2 * j);
+      }
+      return;
+    }
+  }
+}
+
+namespace {
+
+double reduce(double x, double k) {
+  return ((x - k * pio2_1) - k * pio2_2) - k * pio2_3;
+}
+
+// sin(r + offset * pi/2) from the polynomials of sin(r) and cos(r).
+double quadrant(int64_t offset, double sin, double cos) {
+  switch (offset & 3) {
+  case 0:
+    return sin;
+  case 1:
+    return cos;
+  case 2:
+    return -sin;
+  default:
+    return -cos;
+  }
+}
+
+} // namespace
+
+double SinCos::sin(double x) const {
+  if (!(std::abs(x) <= reducedLimit)) {
+    return std::sin(x);
+  }
+  double k = roundToInteger(x * twoOverPi);
+  double r = reduce(x, k);
+  double z = r * r;
+  auto q = static_cast<int64_t>(k);
+  return q & 1 ? quadrant(q, 0, horner(cosCoefficients, terms, z))
+               : quadrant(q, r * horner(sinCoefficients, terms, z), 0);
+}
+
+double SinCos::cos(double x) const {
+  if (!(std::abs(x) <= reducedLimit)) {
+    return std::cos(x);
+  }
+  double k = roundToInteger(x * twoOverPi);
+  double r = reduce(x, k);
+  double z = r * r;
+  auto q = static_cast<int64_t>(k) + 1;
+  return q & 1 ? quadrant(q, 0, horner(cosCoefficients, terms, z))
+               : quadrant(q, r * horner(sinCoefficients, terms, z), 0);
+}
+
+namespace {
+
+// Both polynomials for the whole block, then a branch-free pick per row.
+void sinCosBatch(const double *sinCoefficients, const double *cosCoefficients,
+                 int terms, int64_t offset, const double *x, double *out,
+                 size_t count, double (*exact)(double)) {
+  double r[block], z[block], s[block], c[block];
+  int64_t q[block];
+  for (size_t start = 0; start < count; start += block) {
+    size_t n = std::min(block, count - start);
+    const double *in = x + start;
+    double *result = out + start;
+    for (size_t i = 0; i < n; i++) {
+      double v = std::abs(in[i]) <= reducedLimit ? in[i] : 0.0;
+      double k = roundToInteger(v * twoOverPi);
+      q[i] = static_cast<int64_t>(k) + offset;
+      r[i] = reduce(v, k);
+      z[i] = r[i] * r[i];
+    }
+    horner(sinCoefficients, terms, z, s, n);
+    horner(cosCoefficients, terms, z, c, n);
+    for (size_t i = 0; i < n; i++) {
+      double value = q[i] & 1 ? c[i] : r[i] * s[i];
+      result[i] = q[i] & 2 ? -value : value;
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (!(std::abs(in[i]) <= reducedLimit)) {
+        result[i] = exact(in[i]);
+      }
+    }
+  }
+}
+
+} // namespace
+
+void SinCos::sin(const double *x, double *out, size_t count) const {
+  sinCosBatch(sinCoefficients, cosCoefficients, terms, 0, x, out, count,
+              [](double v) { return std::sin(v); });
+}
+
+void SinCos::cos(const double *x, double *out, size_t count) const {
+  sinCosBatch(sinCoefficients, cosCoefficients, terms, 1, x, out, count,
+              [](double v) { return std::cos(v); });
+}
+
+// An error d in b*log(a) becomes a relative error of about d in the result,
+// so the log gets the share of the tolerance left after the rounding of the
+// product, divided by the largest exponent.
+Pow::Pow(double tolerance)
+    : log(tolerance / (2 * maxExponent) - std::numeric_limits<double>::epsilon()),
+      exp(tolerance / 2) {}
+
+double Pow::operator()(double a, double b) const {
+  if (a > 0 && inLogRange(a) && std::abs(b) <= std::numeric_limits<double>::max()) {
+    double t = b * log(a);
+    if (std::abs(t) <= maxExponent) {
+      return exp(t);
+    }
+  }
+  return std::pow(a, b);
+}
+
+void Pow::operator()(const double *a, const double *b, double *out,
+                     size_t count) const {
+  double t[block];
+  for (size_t start = 0; start < count; start += block) {
+    size_t n = std::min(block, count - start);
+    double *result = out + start;
+    log(a + start, t, n);
+    for (size_t i = 0; i < n; i++) {
+      t[i] *= b[start + i];
+    }
+    exp(t, result, n);
+    for (size_t i = 0; i < n; i++) {
+      double x = a[start + i], y = b[start + i];
+      if (!(x > 0 && inLogRange(x) && std::abs(t[i]) <= maxExponent)) {
+        result[i] = std::pow(x, y);
+      }
+    }
+  }
+}
+
+} // namespace approximation
+
+ExpressionPtr approximate(ExpressionPtr root, double tolerance) {
+  using namespace operations;
+
+  if (!(tolerance > 0)) {
+    return root;
+  }
+  approximation::SinCos sinCos(tolerance);
+  approximation::Exp exp(tolerance);
+  approximation::Log log(tolerance);
+  approximation::Pow pow(tolerance);
+
+  return transform(std::move(root), [&](const ExpressionPtr &node) -> ExpressionPtr {
+    // Exact type matches, so already approximated nodes are left alone.
+    const auto &type = typeid(*node);
+    auto operand = [&node](size_t index) {
+      return static_cast<const Operation &>(*node).getOperandAt(index);
+    };
+    if (type == typeid(SinOperation) && sinCos.valid()) {
+      return std::make_shared<ApproximateSinOperation>(operand(0), sinCos);
+    }
+    if (type == typeid(CosOperation) && sinCos.valid()) {
+      return std::make_shared<ApproximateCosOperation>(operand(0), sinCos);
+    }
+    if (type == typeid(ExpOperation) && exp.valid()) {
+      return std::make_shared<ApproximateExpOperation>(operand(0), exp);
+    }
+    if (type == typeid(LogOperation) && log.valid()) {
+      return std::make_shared<ApproximateLogOperation>(operand(0), log);
+    }
+    if (type == typeid(PowerOperation) && pow.valid()) {
+      return std::make_shared<ApproximatePowerOperation>(operand(0), operand(1), pow);
+    }
+    return node;
+  });
+}
+
+} // namespace expression_solver
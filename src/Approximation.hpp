@@ -0,0 +1,237 @@
+#pragma once
+
+#include <cstddef>
+
+#include "Operation.hpp"
+
+namespace expression_solver {
+
+namespace approximation {
+
+// Polynomial replacements for libm functions, each with a proven bound on
+// its error. A kernel is built for a tolerance and picks the lowest degree
+// whose bound, plus an allowance for rounding, stays within it; valid() is
+// false when no degree can (tolerances near machine precision). Inputs out
+// of the reduced range (huge, negative, subnormal, infinite or NaN) fall back
+// to the C library, so results there are exact.
+//
+// Batch forms evaluate the polynomial coefficient by coefficient across a
+// block of inputs, which the compiler turns into vector code.
+
+// exp(x) = 2^k * p(r), x = k*ln2 + r, |r| <= ln2/2, p the Taylor polynomial.
+// Relative error.
+class Exp {
+  int degree = 0;
+  double coefficients[14];
+
+public:
+  static constexpr int minDegree = 3;
+  static constexpr int maxDegree = 13;
+
+  explicit Exp(double tolerance);
+
+  static double bound(int degree);
+
+  bool valid() const { return degree > 0; }
+  double maxError() const { return bound(degree); }
+
+  double operator()(double x) const;
+  void operator()(const double *x, double *out, size_t count) const;
+};
+
+// log(x) = e*ln2 + 2*atanh(s), x = m*2^e, m in [sqrt(1/2), sqrt(2)),
+// s = (m-1)/(m+1), atanh by its truncated series. Relative error.
+class Log {
+  int terms = 0;
+  double coefficients[13];
+
+public:
+  static constexpr int minTerms = 2;
+  static constexpr int maxTerms = 12;
+
+  explicit Log(double tolerance);
+
+  static double bound(int terms);
+
+  bool valid() const { return terms > 0; }
+  double maxError() const { return bound(terms); }
+
+  double operator()(double x) const;
+  void operator()(const double *x, double *out, size_t count) const;
+};
+
+// sin and cos from x = k*pi/2 + r, |r| <= pi/4, with Taylor polynomials of
+// sin(r) and cos(r) picked by the quadrant k. Absolute error, for
+// |x| <= 1e5.
+class SinCos {
+  int terms = 0;
+  double sinCoefficients[10];
+  double cosCoefficients[10];
+
+public:
+  static constexpr int minTerms = 2;
+  static constexpr int maxTerms = 9;
+
+  explicit SinCos(double tolerance);
+
+  static double bound(int terms);
+
+  bool valid() const { return terms > 0; }
+  double maxError() const { return bound(terms); }
+
+  double sin(double x) const;
+  double cos(double x) const;
+  void sin(const double *x, double *out, size_t count) const;
+  void cos(const double *x, double *out, size_t count) const;
+};
+
+// pow(a, b) = exp(b*log(a)) for a > 0 and |b*log(a)| <= 64, with the log
+// accurate enough that its error, scaled by b*log(a), keeps the result
+// within the tolerance. Relative error.
+class Pow {
+  Log log;
+  Exp exp;
+
+public:
+  static constexpr double maxExponent = 64;
+
+  explicit Pow(double tolerance);
+
+  bool valid() const { return log.valid() && exp.valid(); }
+  double maxError() const {
+    return maxExponent * log.maxError() + exp.maxError();
+  }
+
+  double operator()(double a, double b) const;
+  void operator()(const double *a, const double *b, double *out,
+                  size_t count) const;
+};
+
+} // namespace approximation
+
+namespace operations {
+
+class ApproximateSinOperation : public SinOperation {
+  approximation::SinCos kernel;
+
+public:
+  ApproximateSinOperation(ExpressionPtr operand, approximation::SinCos kernel)
+      : SinOperation(std::move(operand)), kernel(kernel) {}
+
+  double apply(double x) const override { return kernel.sin(x); }
+
+  void applyBatch(const double *const *operands, double *out,
+                  size_t count) const override {
+    kernel.sin(operands[0], out, count);
+  }
+
+  ExpressionPtr create(ExpressionPtr operand) const override {
+    return std::make_shared<ApproximateSinOperation>(std::move(operand), kernel);
+  }
+
+  double cost() const override { return 4; }
+
+  double maxError() const { return kernel.maxError(); }
+};
+
+class ApproximateCosOperation : public CosOperation {
+  approximation::SinCos kernel;
+
+public:
+  ApproximateCosOperation(ExpressionPtr operand, approximation::SinCos kernel)
+      : CosOperation(std::move(operand)), kernel(kernel) {}
+
+  double apply(double x) const override { return kernel.cos(x); }
+
+  void applyBatch(const double *const *operands, double *out,
+                  size_t count) const override {
+    kernel.cos(operands[0], out, count);
+  }
+
+  ExpressionPtr create(ExpressionPtr operand) const override {
+    return std::make_shared<ApproximateCosOperation>(std::move(operand), kernel);
+  }
+
+  double cost() const override { return 4; }
+
+  double maxError() const { return kernel.maxError(); }
+};
+
+class ApproximateExpOperation : public ExpOperation {
+  approximation::Exp kernel;
+
+public:
+  ApproximateExpOperation(ExpressionPtr operand, approximation::Exp kernel)
+      : ExpOperation(std::move(operand)), kernel(kernel) {}
+
+  double apply(double x) const override { return kernel(x); }
+
+  void applyBatch(const double *const *operands, double *out,
+                  size_t count) const override {
+    kernel(operands[0], out, count);
+  }
+
+  ExpressionPtr create(ExpressionPtr operand) const override {
+    return std::make_shared<ApproximateExpOperation>(std::move(operand), kernel);
+  }
+
+  double cost() const override { return 4; }
+
+  double maxError() const { return kernel.maxError(); }
+};
+
+class ApproximateLogOperation : public LogOperation {
+  approximation::Log kernel;
+
+public:
+  ApproximateLogOperation(ExpressionPtr operand, approximation::Log kernel)
+      : LogOperation(std::move(operand)), kernel(kernel) {}
+
+  double apply(double x) const override { return kernel(x); }
+
+  void applyBatch(const double *const *operands, double *out,
+                  size_t count) const override {
+    kernel(operands[0], out, count);
+  }
+
+  ExpressionPtr create(ExpressionPtr operand) const override {
+    return std::make_shared<ApproximateLogOperation>(std::move(operand), kernel);
+  }
+
+  double cost() const override { return 4; }
+
+  double maxError() const { return kernel.maxError(); }
+};
+
+class ApproximatePowerOperation : public PowerOperation {
+  approximation::Pow kernel;
+
+public:
+  ApproximatePowerOperation(ExpressionPtr left, ExpressionPtr right,
+                            approximation::Pow kernel)
+      : PowerOperation(std::move(left), std::move(right)), kernel(kernel) {}
+
+  double apply(double a, double b) const override { return kernel(a, b); }
+
+  void applyBatch(const double *const *operands, double *out,
+                  size_t count) const override {
+    kernel(operands[0], operands[1], out, count);
+  }
+
+  ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
+    return std::make_shared<ApproximatePowerOperation>(std::move(left),
+                                                       std::move(right), kernel);
+  }
+
+  double cost() const override { return 8; }
+
+  double maxError() const { return kernel.maxError(); }
+};
+
+} // namespace operations
+
+// Replaces sin, cos, exp, log and pow nodes with their approximate versions
+// for the given tolerance. Functions whose kernel cannot meet it are kept.
+ExpressionPtr approximate(ExpressionPtr root, double tolerance);
+
+} // namespace expression_solver
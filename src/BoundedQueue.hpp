@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+namespace expression_solver {
+
+// Fixed-capacity multi-producer, multi-consumer queue without locks
+// (D. Vyukov's bounded queue). Each slot carries a sequence number that
+// tells producers and consumers whose turn it is, so push and pop are one
+// compare-and-swap on the shared position plus a store to the slot.
+template <typename T> class BoundedQueue {
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  static constexpr size_t cacheLine = 64;
+
+  std::unique_ptr<Slot[]> slots;
+  size_t mask;
+  alignas(cacheLine) std::atomic<size_t> head{0}; // next position to pop
+  alignas(cacheLine) std::atomic<size_t> tail{0}; // next position to push
+
+public:
+  // capacity is rounded up to a power of two.
+  explicit BoundedQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size *= 2;
+    }
+    slots = std::make_unique<Slot[]>(size);
+    mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+      slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  size_t capacity() const { return mask + 1; }
+
+  // False when the queue is full.
+  bool tryPush(T value) {
+    size_t position = tail.load(std::memory_order_relaxed);
+    while (true) {
+      auto &slot = slots[position & mask];
+      size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+      if (difference == 0) {
+        if (tail.compare_exchange_weak(position, position + 1,
+                                       std::memory_order_relaxed)) {
+          slot.value = std::move(value);
+          slot.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // False when the queue is empty.
+  bool tryPop(T &value) {
+    size_t position = head.load(std::memory_order_relaxed);
+    while (true) {
+      auto &slot = slots[position & mask];
+      size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      auto difference = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+      if (difference == 0) {
+        if (head.compare_exchange_weak(position, position + 1,
+                                       std::memory_order_relaxed)) {
+          value = std::move(slot.value);
+          slot.sequence.store(position + mask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+};
+
+} // namespace expression_solver
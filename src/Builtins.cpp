@@ -0,0 +1,168 @@
+#include "Builtins.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "Streaming.hpp"
+#include "Tables.hpp"
+#include "Vectors.hpp"
+
+namespace expression_solver {
+
+namespace builtins {
+
+namespace {
+
+using namespace operations;
+
+template <typename T> OperationPtr unary() { return std::make_shared<T>(nullptr); }
+template <typename T> OperationPtr binary() { return std::make_shared<T>(nullptr, nullptr); }
+template <typename T> OperationPtr variadic() {
+  return std::make_shared<T>(std::vector<ExpressionPtr>{});
+}
+
+struct OperationEntry {
+  std::string_view identifier;
+  OperationPtr (*create)();
+};
+
+struct VariableEntry {
+  std::string_view name;
+  double value;
+};
+
+constexpr double pi = 3.14159265358979323846;
+
+constexpr OperationEntry operationEntries[] = {
+    {"+", binary<AddOperation>},
+    {"-", binary<SubtractOperation>},
+    {"*", binary<MultiplyOperation>},
+    {"/", binary<DivideOperation>},
+    {"^", binary<PowerOperation>},
+    {"%", binary<ModuloOperation>},
+    {"atan2", binary<Atan2Operation>},
+    {"sin", unary<SinOperation>},
+    {"cos", unary<CosOperation>},
+    {"tan", unary<TanOperation>},
+    {"asin", unary<AsinOperation>},
+    {"acos", unary<AcosOperation>},
+    {"atan", unary<AtanOperation>},
+    {"log", unary<LogOperation>},
+    {"sqrt", unary<SqrtOperation>},
+    {"abs", unary<AbsOperation>},
+    {"exp", unary<ExpOperation>},
+    {"ceil", unary<CeilOperation>},
+    {"floor", unary<FloorOperation>},
+    {"round", unary<RoundOperation>},
+    {"trunc", unary<TruncOperation>},
+    {"max", binary<MaxOperation>},
+    {"min", binary<MinOperation>},
+    {"hypot", binary<HypotOperation>},
+    {"sum", variadic<SumOperation>},
+    {"product", variadic<ProductOperation>},
+    {"&&", binary<LogicalAndOperation>},
+    {"||", binary<LogicalOrOperation>},
+    {"!", unary<LogicalNotOperation>},
+    {"==", binary<LogicalEqualOperation>},
+    {"lag", binary<LagOperation>},
+    {"ema", binary<EmaOperation>},
+    {"rolling_mean", binary<RollingMeanOperation>},
+    {"rolling_max", binary<RollingMaxOperation>},
+    {"rolling_min", binary<RollingMinOperation>},
+    {"delta", unary<DeltaOperation>},
+    {"dot", variadic<DotOperation>},
+    {"norm", variadic<NormOperation>},
+    {"cross", variadic<CrossOperation>},
+    {"normalize", variadic<NormalizeOperation>},
+    {"interp", variadic<InterpolateOperation>},
+};
+
+constexpr VariableEntry variableEntries[] = {
+    {"PI", pi},
+    {"E", 2.71828182845904523536},
+    {"PHI", 1.61803398874989484820},
+    {"GAMMA", 0.57721566490153286060},
+    {"DEG", 180.0 / pi},
+    {"RAD", pi / 180.0},
+    {"INF", std::numeric_limits<double>::infinity()},
+    {"NAN", std::numeric_limits<double>::quiet_NaN()},
+    {"TRUE", 1},
+    {"FALSE", 0},
+    {"NULL", 0},
+    {"EPSILON", std::numeric_limits<double>::epsilon()},
+};
+
+static_assert(std::size(operationEntries) == operationCount);
+static_assert(std::size(variableEntries) == variableCount);
+
+template <size_t N, typename Entry, typename Key>
+constexpr std::array<std::string_view, N> keysOf(const Entry (&entries)[N], Key key) {
+  std::array<std::string_view, N> keys;
+  for (size_t i = 0; i < N; i++) {
+    keys[i] = entries[i].*key;
+  }
+  return keys;
+}
+
+constexpr PerfectHash operationIndex(keysOf(operationEntries, &OperationEntry::identifier));
+constexpr PerfectHash variableIndex(keysOf(variableEntries, &VariableEntry::name));
+
+// Bit n of prefixLengths[c] is set when an operation identifier of length n
+// starts with c, so matching a prefix hashes only lengths that can match.
+constexpr auto prefixLengths = [] {
+  std::array<uint16_t, 256> lengths{};
+  for (const auto &entry : operationEntries) {
+    lengths[static_cast<uint8_t>(entry.identifier[0])] |= uint16_t(1) << entry.identifier.size();
+  }
+  return lengths;
+}();
+
+static_assert(std::ranges::all_of(operationEntries,
+                                  [](const auto &entry) { return entry.identifier.size() < 16; }),
+              "Identifier lengths are bits of a 16-bit mask");
+
+} // namespace
+
+std::optional<size_t> findOperation(std::string_view identifier) {
+  return operationIndex.find(identifier);
+}
+
+std::optional<size_t> findVariable(std::string_view name) { return variableIndex.find(name); }
+
+std::string_view operationIdentifier(size_t index) { return operationIndex[index]; }
+
+std::string_view variableName(size_t index) { return variableIndex[index]; }
+
+const OperationPtr &operation(size_t index) {
+  static const auto prototypes = [] {
+    std::array<OperationPtr, operationCount> prototypes;
+    for (size_t i = 0; i < operationCount; i++) {
+      prototypes[i] = operationEntries[i].create();
+    }
+    return prototypes;
+  }();
+  return prototypes[index];
+}
+
+double variable(size_t index) { return variableEntries[index].value; }
+
+std::optional<size_t> matchOperation(std::string_view text) {
+  if (text.empty()) {
+    return std::nullopt;
+  }
+  // Longest first, so the first prefix found is the match.
+  uint32_t lengths = prefixLengths[static_cast<uint8_t>(text[0])];
+  lengths &= text.size() < 16 ? (uint32_t(2) << text.size()) - 1 : 0xFFFF;
+  while (lengths != 0) {
+    size_t length = std::bit_width(lengths) - 1;
+    if (auto index = operationIndex.find(text.substr(0, length))) {
+      return index;
+    }
+    lengths &= ~(uint32_t(1) << length);
+  }
+  return std::nullopt;
+}
+
+} // namespace builtins
+
+} // namespace expression_solver
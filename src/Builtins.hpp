@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "Operation.hpp"
+
+namespace expression_solver {
+
+namespace builtins {
+
+// FNV-1a over the bytes of the name, starting from a seed.
+constexpr uint32_t hash(std::string_view name, uint32_t seed) {
+  uint32_t h = 2166136261u ^ seed;
+  for (char c : name) {
+    h = (h ^ static_cast<uint8_t>(c)) * 16777619u;
+  }
+  return h ^ (h >> 15);
+}
+
+// Collision-free hash of a fixed set of names, found at compile time: the
+// constructor tries seeds until every name lands in its own slot of a table
+// four times larger than the set. A lookup is one hash and one comparison.
+template <size_t N> class PerfectHash {
+  static_assert(N < 255, "Slots hold indices in a byte");
+  static constexpr size_t size = std::bit_ceil(N * 4);
+
+  std::array<std::string_view, N> keys;
+  std::array<uint8_t, size> slots{}; // Index of the key plus one, zero when empty
+  uint32_t seed = 0;
+
+public:
+  constexpr explicit PerfectHash(const std::array<std::string_view, N> &keys) : keys(keys) {
+    for (;; seed++) {
+      slots.fill(0);
+      size_t i = 0;
+      for (; i < N; i++) {
+        auto &slot = slots[hash(keys[i], seed) & (size - 1)];
+        if (slot != 0) {
+          break;
+        }
+        slot = static_cast<uint8_t>(i + 1);
+      }
+      if (i == N) {
+        return;
+      }
+    }
+  }
+
+  // Index of the name in the set.
+  constexpr std::optional<size_t> find(std::string_view name) const {
+    uint8_t slot = slots[hash(name, seed) & (size - 1)];
+    if (slot == 0 || keys[slot - 1] != name) {
+      return std::nullopt;
+    }
+    return slot - 1;
+  }
+
+  constexpr std::string_view operator[](size_t index) const { return keys[index]; }
+};
+
+// The operations and constants of the default context. Their names, values
+// and lookup tables are constants of the program, so nothing runs before
+// main. The operation prototypes are objects with a vtable and are created
+// together on first use, once per process, then shared by every context.
+constexpr size_t operationCount = 41;
+constexpr size_t variableCount = 12;
+
+std::optional<size_t> findOperation(std::string_view identifier);
+std::optional<size_t> findVariable(std::string_view name);
+
+std::string_view operationIdentifier(size_t index);
+std::string_view variableName(size_t index);
+
+const operations::OperationPtr &operation(size_t index);
+double variable(size_t index);
+
+// Index of the built-in operation with the longest identifier that starts
+// text.
+std::optional<size_t> matchOperation(std::string_view text);
+
+} // namespace builtins
+
+} // namespace expression_solver
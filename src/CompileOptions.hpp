@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace expression_solver {
+
+// Budgets for compiling expressions from untrusted sources, such as user
+// input, so one pathological input cannot stall a worker or exhaust its
+// memory. Each is checked as early as it can be: the length before reading
+// the input, tokens and nesting while reading it, nodes as user functions
+// are inlined and again after parsing, samples after parsing, both before
+// the optimization passes, and cost on the compiled result.
+struct CompileOptions {
+  size_t maxLength = size_t(1) << 16;   // Characters of the input
+  size_t maxTokens = size_t(1) << 14;   // Numbers, names, operators, parentheses
+  size_t maxDepth = 128;                // Parentheses open at once
+  size_t maxNodes = size_t(1) << 14;    // Distinct nodes of the parsed tree
+  size_t maxSamples = size_t(1) << 20;  // Kept by the windows of lag, rolling_*, in total
+  double maxCost = 1e6;                 // Per value, in additions; see estimateCost
+};
+
+// Why an expression was not compiled.
+struct CompileError {
+  enum class Kind : uint8_t {
+    Length,
+    Tokens,
+    Depth,
+    Nodes,
+    Samples,
+    Cost,
+    Memory, // An allocation failed
+    Syntax, // Anything else rejected, such as an unknown name
+  };
+
+  Kind kind;
+  std::string message;
+  size_t position = std::string::npos; // Offset in the input, when known
+};
+
+} // namespace expression_solver
@@ -0,0 +1,199 @@
+#include "CompiledExpression.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace expression_solver {
+
+double CompiledExpression::evaluate() const {
+  // Small programs keep their values on the stack.
+  constexpr size_t inlineValues = 256;
+  constexpr size_t inlineArgs = 8;
+
+  double valuesBuffer[inlineValues];
+  double argsBuffer[inlineArgs];
+  std::vector<double> heapValues;
+  std::vector<double> heapArgs;
+  double *values = valuesBuffer;
+  double *args = argsBuffer;
+  if (code.nodes.size() > inlineValues) {
+    heapValues.resize(code.nodes.size());
+    values = heapValues.data();
+  }
+  if (code.maxArity > inlineArgs) {
+    heapArgs.resize(code.maxArity);
+    args = heapArgs.data();
+  }
+
+  const uint32_t *operands = code.operands.data();
+  for (size_t i = 0; i < code.nodes.size(); i++) {
+    const auto &node = code.nodes[i];
+    if (!node.operation) {
+      values[i] = node.expression->evaluate();
+      continue;
+    }
+    for (uint32_t k = 0; k < node.arity; k++) {
+      args[k] = values[operands[node.firstOperand + k]];
+    }
+    values[i] = node.operation->applyOperands(args);
+  }
+  return values[code.nodes.size() - 1];
+}
+
+namespace {
+
+// Input column of every leaf that has a binding, nullptr for the others.
+std::vector<const double *> bindLeaves(const Linearization &code,
+                                       std::span<const Binding> bindings) {
+  std::vector<const double *> bound(code.nodes.size(), nullptr);
+  for (size_t i = 0; i < code.nodes.size(); i++) {
+    const auto &node = code.nodes[i];
+    if (node.operation) {
+      continue;
+    }
+    auto binding = std::find_if(bindings.begin(), bindings.end(), [&](const auto &b) {
+      return b.placeholder == node.expression;
+    });
+    if (binding != bindings.end()) {
+      bound[i] = binding->values.data();
+    }
+  }
+  return bound;
+}
+
+} // namespace
+
+std::vector<ValueInfo> CompiledExpression::leafInfos(std::span<const double *const> bound,
+                                                     size_t rows, bool scan) const {
+  std::vector<ValueInfo> infos(code.nodes.size());
+  for (size_t i = 0; i < code.nodes.size(); i++) {
+    if (code.nodes[i].operation) {
+      continue;
+    }
+    if (!bound[i]) {
+      infos[i] = ValueInfo::constant(code.nodes[i].expression->evaluate());
+    } else if (scan) {
+      infos[i] = ValueInfo::of({bound[i], rows});
+    }
+  }
+  return infos;
+}
+
+std::vector<ValueInfo> CompiledExpression::inferTypes(std::span<const Binding> bindings,
+                                                      size_t rows) const {
+  for (const auto &binding : bindings) {
+    if (binding.values.size() < rows) {
+      throw std::invalid_argument("Binding has fewer values than rows");
+    }
+  }
+  auto infos = leafInfos(bindLeaves(code, bindings), rows, true);
+  typed.infer(code, infos);
+  return infos;
+}
+
+void CompiledExpression::evaluate(std::span<const Binding> bindings,
+                                  std::span<double> results) const {
+  size_t rows = results.size();
+  for (const auto &binding : bindings) {
+    if (binding.values.size() < rows) {
+      throw std::invalid_argument("Binding has fewer values than results");
+    }
+  }
+
+  // Rows per block. Each node costs a virtual call per block, so programs
+  // whose operations cost about an addition each take longer blocks to
+  // spread it. Large programs get fewer rows, so the columns stay around a
+  // few megabytes, and so do short batches.
+  size_t count = code.nodes.size();
+  size_t operations = std::count_if(code.nodes.begin(), code.nodes.end(),
+                                    [](const auto &node) { return node.operation; });
+  double average = operations > 0 ? estimatedCost / static_cast<double>(operations) : 1;
+  size_t block =
+      std::clamp<size_t>(static_cast<size_t>(1024 / std::max(average, 1.0)), 256, 1024);
+  block = std::clamp<size_t>((size_t(1) << 18) / count, 1, block);
+  block = std::clamp<size_t>(rows, 1, block);
+  auto bound = bindLeaves(code, bindings);
+
+  // Logical operations run on bitmasks, and the ranges of this batch's
+  // inputs decide which nodes are Integer. The inputs are scanned only when
+  // the program has an operation that can start an integer chain.
+  if (typed.candidates() && rows > 0) {
+    auto infos = leafInfos(bound, rows, typed.usesRanges());
+    typed.infer(code, infos);
+    if (typed.applies(code, infos)) {
+      typed.evaluate(code, infos, bound, results, block);
+      return;
+    }
+  }
+
+  std::vector<double> columns(count * block);
+  std::vector<const double *> column(count);
+  std::vector<const double *> args(std::max<size_t>(code.maxArity, 1));
+
+  // Leaves are either bound to an input column or constant over the batch.
+  for (size_t i = 0; i < count; i++) {
+    if (!code.nodes[i].operation && !bound[i]) {
+      std::fill_n(&columns[i * block], block, code.nodes[i].expression->evaluate());
+    }
+  }
+
+  const uint32_t *operands = code.operands.data();
+  for (size_t start = 0; start < rows; start += block) {
+    size_t n = std::min(block, rows - start);
+    for (size_t i = 0; i < count; i++) {
+      const auto &node = code.nodes[i];
+      if (!node.operation) {
+        column[i] = bound[i] ? bound[i] + start : &columns[i * block];
+        continue;
+      }
+      for (uint32_t k = 0; k < node.arity; k++) {
+        args[k] = column[operands[node.firstOperand + k]];
+      }
+      double *out = i + 1 == count ? results.data() + start : &columns[i * block];
+      node.operation->applyBatch(args.data(), out, n);
+      column[i] = out;
+    }
+    if (!code.nodes.back().operation) {
+      std::copy_n(column[count - 1], n, results.data() + start);
+    }
+  }
+}
+
+void CompiledExpression::evaluate(std::span<const Binding> bindings,
+                                  std::span<const uint32_t> selection,
+                                  std::span<double> results) const {
+  if (selection.size() != results.size()) {
+    throw std::invalid_argument("Selection and results differ in size");
+  }
+  if (selection.empty()) {
+    return;
+  }
+  size_t last = *std::max_element(selection.begin(), selection.end());
+  for (const auto &binding : bindings) {
+    if (binding.values.size() <= last) {
+      throw std::invalid_argument("Selection refers past the end of a binding");
+    }
+  }
+
+  // Gathers a few thousand rows at a time, so the short columns stay in
+  // cache while they are evaluated.
+  constexpr size_t chunk = 4096;
+  size_t chunkRows = std::min(chunk, selection.size());
+  std::vector<double> gathered(bindings.size() * chunkRows);
+  std::vector<Binding> compact(bindings.size());
+  for (size_t start = 0; start < selection.size(); start += chunk) {
+    size_t n = std::min(chunk, selection.size() - start);
+    const uint32_t *rows = selection.data() + start;
+    for (size_t k = 0; k < bindings.size(); k++) {
+      double *column = gathered.data() + k * chunkRows;
+      const double *values = bindings[k].values.data();
+      for (size_t j = 0; j < n; j++) {
+        column[j] = values[rows[j]];
+      }
+      compact[k] = {bindings[k].placeholder, {column, n}};
+    }
+    evaluate(compact, results.subspan(start, n));
+  }
+}
+
+} // namespace expression_solver
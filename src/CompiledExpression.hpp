@@ -0,0 +1,74 @@
+#pragma once
+
+#include <span>
+
+#include "Expression.hpp"
+#include "Traversal.hpp"
+#include "TypeInference.hpp"
+
+namespace expression_solver {
+
+// Column of input values for a placeholder in batch evaluation: row i reads
+// values[i]. Placeholders without a binding keep their current value.
+struct Binding {
+  const PlaceHolder *placeholder;
+  std::span<const double> values;
+};
+
+// Where guarded batch evaluation writes the value of a selected row: at the
+// row's own index, leaving the other rows untouched, or packed one after
+// the other in row order.
+enum class SelectionOutput { Scatter, Compact };
+
+// Result of ExpressionSolver::compile for non-trivial expressions. Keeps the
+// optimized tree alive and evaluates its linearization in a flat loop, so
+// evaluation cost does not depend on call depth and nested inputs of any
+// depth are safe. Nodes shared by several parents are evaluated once.
+class CompiledExpression : public Expression {
+  ExpressionPtr root;
+  Linearization code;
+  TypedEvaluator typed;
+  double estimatedCost;
+
+  // Infos of the leaves for a batch: the current value of an unbound leaf,
+  // and the range of a bound column when scan is set, unknown otherwise.
+  std::vector<ValueInfo> leafInfos(std::span<const double *const> bound, size_t rows,
+                                   bool scan) const;
+
+public:
+  explicit CompiledExpression(ExpressionPtr root)
+      : root(std::move(root)), code(linearize(*this->root)), typed(code),
+        estimatedCost(estimateCost(code)) {}
+
+  double evaluate() const override;
+
+  // Evaluates one row per element of results, a block of rows per node at a
+  // time, so each operation runs its applyBatch loop instead of a virtual
+  // call per value. Every binding must hold at least results.size() values.
+  // Nodes that the inputs of the batch make Boolean or Integer run the
+  // bitmask and int64 kernels of TypedEvaluator.
+  void evaluate(std::span<const Binding> bindings, std::span<double> results) const;
+
+  // Batch evaluation of the listed rows only: results[j] is the value of row
+  // selection[j] of the bindings. The inputs of the selected rows are
+  // gathered into short columns first, so the cost follows the number of
+  // selected rows rather than the size of the bindings.
+  void evaluate(std::span<const Binding> bindings, std::span<const uint32_t> selection,
+                std::span<double> results) const;
+
+  // Type and range of every node of getCode() over a batch with these
+  // bindings of rows values.
+  std::vector<ValueInfo> inferTypes(std::span<const Binding> bindings = {},
+                                    size_t rows = 0) const;
+
+  const ExpressionPtr &getRoot() const { return root; }
+  const Linearization &getCode() const { return code; }
+  size_t size() const { return code.nodes.size(); }
+
+  // Estimated time of one row, in additions; see Operation::cost.
+  double cost() const { return estimatedCost; }
+};
+
+typedef std::shared_ptr<CompiledExpression> CompiledExpressionPtr;
+
+} // namespace expression_solver
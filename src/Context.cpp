@@ -1,64 +1,106 @@
-
 #include "Context.hpp"
+#include "Builtins.hpp"
 
 namespace expression_solver {
-// Initialize DefaultContext
-Context Context::DefaultContext = Context();
 
-// Add all operations to the DefaultContext
-void InitializeDefaultContext() {
-  using namespace operations;
-  auto &dc = Context::getDefaultContext();
+static_assert(builtins::variableCount <= 64 && builtins::operationCount <= 64,
+              "Removed built-ins are kept in 64-bit masks");
+
+std::optional<size_t> Context::builtinVariable(std::string_view name) const {
+  if (!builtins) {
+    return std::nullopt;
+  }
+  auto index = builtins::findVariable(name);
+  if (index && (removedVariables >> *index & 1)) {
+    return std::nullopt;
+  }
+  return index;
+}
+
+std::optional<size_t> Context::builtinOperation(std::string_view identifier) const {
+  if (!builtins) {
+    return std::nullopt;
+  }
+  auto index = builtins::findOperation(identifier);
+  if (index && (removedOperations >> *index & 1)) {
+    return std::nullopt;
+  }
+  return index;
+}
+
+std::optional<double> Context::getVariable(std::string_view name) const {
+  if (!variables.empty()) {
+    auto it = variables.find(name);
+    if (it != variables.end()) {
+      return it->second;
+    }
+  }
+  if (auto index = builtinVariable(name)) {
+    return builtins::variable(*index);
+  }
+  return std::nullopt;
+}
+
+void Context::removeVariable(const std::string &name) {
+  variables.erase(name);
+  if (auto index = builtinVariable(name)) {
+    removedVariables |= uint64_t(1) << *index;
+  }
+}
+
+void Context::addOperation(operations::OperationPtr operation) {
+  auto identifier = operation->identifier();
+  auto &sameFirst = operationFirstChar[identifier[0]];
+  std::erase_if(sameFirst, [&](const auto &op) { return op->identifier() == identifier; });
+  sameFirst.push_back(operation);
+  operations[std::string(identifier)] = std::move(operation);
+}
 
-  // Operations
-  dc.addOperation(std::make_shared<AddOperation>(nullptr, nullptr));
-  dc.addOperation(std::make_shared<SubtractOperation>(nullptr, nullptr));
-  dc.addOperation(std::make_shared<MultiplyOperation>(nullptr, nullptr));
-  dc.addOperation(std::make_shared<DivideOperation>(nullptr, nullptr));
-  dc.addOperation(std::make_shared<PowerOperation>(nullptr, nullptr));
-  dc.addOperation(std::make_shared<ModuloOperation>(nullptr, nullptr));
-  //dc.addOperation(std::make_shared<NegateOperation>(nullptr));
-  dc.addOperation(std::make_shared<Atan2Operation>(nullptr, nullptr));
-  dc.addOperation(std::make_shared<SinOperation>(nullptr));
-  dc.addOperation(std::make_shared<CosOperation>(nullptr));
-  dc.addOperation(std::make_shared<TanOperation>(nullptr));
-  dc.addOperation(std::make_shared<AsinOperation>(nullptr));
-  dc.addOperation(std::make_shared<AcosOperation>(nullptr));
-  dc.addOperation(std::make_shared<AtanOperation>(nullptr));
-  dc.addOperation(std::make_shared<LogOperation>(nullptr));
-  dc.addOperation(std::make_shared<SqrtOperation>(nullptr));
-  dc.addOperation(std::make_shared<AbsOperation>(nullptr));
-  dc.addOperation(std::make_shared<ExpOperation>(nullptr));
-  dc.addOperation(std::make_shared<CeilOperation>(nullptr));
-  dc.addOperation(std::make_shared<FloorOperation>(nullptr));
-  dc.addOperation(std::make_shared<RoundOperation>(nullptr));
-  dc.addOperation(std::make_shared<TruncOperation>(nullptr));
-  dc.addOperation(std::make_shared<MaxOperation>(nullptr, nullptr));
-  dc.addOperation(std::make_shared<MinOperation>(nullptr, nullptr));
-  dc.addOperation(std::make_shared<HypotOperation>(nullptr, nullptr));
-  dc.addOperation(std::make_shared<LogicalAndOperation>(nullptr, nullptr));
-  dc.addOperation(std::make_shared<LogicalOrOperation>(nullptr, nullptr));
-  dc.addOperation(std::make_shared<LogicalNotOperation>(nullptr));
-  dc.addOperation(std::make_shared<LogicalEqualOperation>(nullptr, nullptr));
+std::optional<operations::OperationPtr> Context::matchOperation(std::string_view text) const {
+  std::optional<operations::OperationPtr> best;
+  size_t length = 0;
+  auto it = text.empty() ? operationFirstChar.end() : operationFirstChar.find(text[0]);
+  if (it != operationFirstChar.end()) {
+    for (const auto &operation : it->second) {
+      auto identifier = operation->identifier();
+      if (identifier.size() > length && text.starts_with(identifier)) {
+        best = operation;
+        length = identifier.size();
+      }
+    }
+  }
+  if (builtins) {
+    auto index = builtins::matchOperation(text);
+    if (index && !(removedOperations >> *index & 1) &&
+        builtins::operationIdentifier(*index).size() > length) {
+      best = builtins::operation(*index);
+    }
+  }
+  return best;
+}
 
-  // Variables
-  dc.setVariable("PI", 3.14159265358979323846);
-  dc.setVariable("E", 2.71828182845904523536);
-  dc.setVariable("PHI", 1.61803398874989484820);
-  dc.setVariable("GAMMA", 0.57721566490153286060);
-  dc.setVariable("DEG", 180.0 / 3.14159265358979323846);
-  dc.setVariable("RAD", 3.14159265358979323846 / 180.0);
-  dc.setVariable("INF", std::numeric_limits<double>::infinity());
-  dc.setVariable("NAN", std::numeric_limits<double>::quiet_NaN());
-  dc.setVariable("TRUE", 1);
-  dc.setVariable("FALSE", 0);
-  dc.setVariable("NULL", 0);
-  dc.setVariable("EPSILON", std::numeric_limits<double>::epsilon());}
+void Context::removeOperation(const std::string &identifier) {
+  if (operations.erase(identifier)) {
+    auto &sameFirst = operationFirstChar[identifier[0]];
+    std::erase_if(sameFirst, [&](const auto &op) { return op->identifier() == identifier; });
+  }
+  if (auto index = builtinOperation(identifier)) {
+    removedOperations |= uint64_t(1) << *index;
+  }
+}
 
-// A função InitializeDefaultContext é chamada uma vez para inicializar
-// DefaultContext
-struct DefaultContextInitializer {
-  DefaultContextInitializer() { InitializeDefaultContext(); }
-} defaultContextInitializerInstance;
+std::optional<operations::OperationPtr>
+Context::getOperation(std::string_view identifier) const {
+  if (!operations.empty()) {
+    auto it = operations.find(identifier);
+    if (it != operations.end()) {
+      return it->second;
+    }
+  }
+  if (auto index = builtinOperation(identifier)) {
+    return builtins::operation(*index);
+  }
+  return std::nullopt;
+}
 
-} // namespace expression_solver
\ No newline at end of file
+} // namespace expression_solver
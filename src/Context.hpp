@@ -1,34 +1,86 @@
 #pragma once
+#include <cstdint>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <set>
+#include <vector>
 
+#include "Function.hpp"
 #include "Operation.hpp"
+#include "Tables.hpp"
+#include "Vectors.hpp"
 
 namespace expression_solver {
-class Context {
-  static Context DefaultContext;
+// Lets the maps below be searched with a std::string_view, so the tokenizer
+// and parser look up names without allocating.
+struct StringHash {
+  using is_transparent = void;
+  size_t operator()(std::string_view value) const {
+    return std::hash<std::string_view>{}(value);
+  }
+};
 
-  std::unordered_map<std::string, double> variables;
-  std::unordered_map<std::string, operations::OperationPtr> operations;
-  std::unordered_map<std::string, PlaceHolderPtr> placeholders;
+template <typename T>
+using StringMap = std::unordered_map<std::string, T, StringHash, std::equal_to<>>;
+
+// Variables and operations of a context are its own, added by the user, and
+// in the default context and its copies also the built-in ones of
+// Builtins.hpp. The built-ins are shared, not copied: a context holds only a
+// flag for them and masks of the ones removed from it, so creating a solver
+// from the default context copies a few empty maps.
+class Context {
+  StringMap<double> variables;
+  StringMap<operations::OperationPtr> operations;
+  // The user operations again, by the first character of their identifier,
+  // for matchOperation.
   std::unordered_map<char, std::vector<operations::OperationPtr>> operationFirstChar;
+  StringMap<PlaceHolderPtr> placeholders;
+  StringMap<FunctionPtr> functions;
+  StringMap<VectorPlaceHolderPtr> vectors;
+  StringMap<TablePtr> tables;
+  bool builtins = false;
+  uint64_t removedVariables = 0;  // Bit i hides built-in variable i
+  uint64_t removedOperations = 0; // Bit i hides built-in operation i
+  double tolerance = 0;
+  std::set<std::string, std::less<>> memoized;
+  size_t memoCapacity = 4096;
+
+  struct Builtins {};
+  explicit Context(Builtins) : builtins(true) {}
+
+  std::optional<size_t> builtinVariable(std::string_view name) const;
+  std::optional<size_t> builtinOperation(std::string_view identifier) const;
 
 public:
   Context() = default;
 
   Context(const Context &other)
       : variables(other.variables), operations(other.operations),
-        placeholders(other.placeholders), operationFirstChar(other.operationFirstChar) {}
+        operationFirstChar(other.operationFirstChar), placeholders(other.placeholders), functions(other.functions),
+        vectors(other.vectors), tables(other.tables), builtins(other.builtins),
+        removedVariables(other.removedVariables),
+        removedOperations(other.removedOperations),
+        tolerance(other.tolerance), memoized(other.memoized),
+        memoCapacity(other.memoCapacity) {}
 
   Context &operator=(const Context &other) {
     if (this != &other) {
       variables = other.variables;
       operations = other.operations;
-      placeholders = other.placeholders;
       operationFirstChar = other.operationFirstChar;
+      placeholders = other.placeholders;
+      functions = other.functions;
+      vectors = other.vectors;
+      tables = other.tables;
+      builtins = other.builtins;
+      removedVariables = other.removedVariables;
+      removedOperations = other.removedOperations;
+      tolerance = other.tolerance;
+      memoized = other.memoized;
+      memoCapacity = other.memoCapacity;
     }
     return *this;
   }
@@ -37,91 +89,181 @@ public:
     if (this != &other) {
       variables = std::move(other.variables);
       operations = std::move(other.operations);
-      placeholders = std::move(other.placeholders);
       operationFirstChar = std::move(other.operationFirstChar);
+      placeholders = std::move(other.placeholders);
+      functions = std::move(other.functions);
+      vectors = std::move(other.vectors);
+      tables = std::move(other.tables);
+      builtins = other.builtins;
+      removedVariables = other.removedVariables;
+      removedOperations = other.removedOperations;
+      tolerance = other.tolerance;
+      memoized = std::move(other.memoized);
+      memoCapacity = other.memoCapacity;
     }
     return *this;
   }
 
   virtual ~Context() = default;
 
-  static Context &getDefaultContext() { return DefaultContext; }
-
-  virtual std::optional<double> getVariable(const std::string &name) const {
-    auto it = variables.find(name);
-    if (it == variables.end()) {
-      return std::nullopt;
-    }
-    return it->second;
+  // The built-in variables and operations. Created on first use, so there is
+  // no order of static initialization to depend on.
+  static Context &getDefaultContext() {
+    static Context context{Builtins{}};
+    return context;
   }
 
+  virtual std::optional<double> getVariable(std::string_view name) const;
+
   virtual void setVariable(std::string name, double value) {
     variables[name] = value;
   }
 
-  virtual void removeVariable(const std::string &name) {
-    variables.erase(name);
+  virtual void removeVariable(const std::string &name);
+
+  virtual void clearVariables() {
+    variables.clear();
+    removedVariables = ~uint64_t(0);
   }
 
-  virtual void clearVariables() { variables.clear(); }
+  virtual bool hasVariable(std::string_view name) const {
+    return (!variables.empty() && variables.find(name) != variables.end()) ||
+           builtinVariable(name);
+  }
 
-  virtual bool hasVariable(const std::string &name) const {
-    return variables.find(name) != variables.end();
+  virtual void addOperation(operations::OperationPtr operation);
+
+  // The operation with the longest identifier that starts text, as the
+  // tokenizer reads symbols like + and ==.
+  virtual std::optional<operations::OperationPtr> matchOperation(std::string_view text) const;
+
+  virtual void removeOperation(const std::string &identifier);
+
+  virtual std::optional<operations::OperationPtr>
+  getOperation(std::string_view identifier) const;
+
+  virtual bool hasOperation(std::string_view identifier) const {
+    return (!operations.empty() && operations.find(identifier) != operations.end()) ||
+           builtinOperation(identifier);
   }
 
-  virtual void addOperation(operations::OperationPtr operation) {
-    for (char c : operation->identifier()) {
-      if(operationFirstChar.find(c) == operationFirstChar.end()) {
-        operationFirstChar[c] = { operation };
-      } else {
-        operationFirstChar[c].emplace_back(operation);
-      }
-    }
-    operations[operation->identifier().data()] = std::move(operation);
+  virtual void addPlaceholder(PlaceHolderPtr placeholder) {
+    placeholders[std::string(placeholder->getIdentifier())] =
+        std::move(placeholder);
   }
 
-  virtual const std::vector<operations::OperationPtr> &getOperationsStartingWith(char c) const {
-    static std::vector<operations::OperationPtr> empty;
-    auto it = operationFirstChar.find(c);
-    if (it == operationFirstChar.end()) {
-      return empty;
+  virtual void removePlaceholder(const std::string &identifier) {
+    placeholders.erase(identifier);
+  }
+
+  virtual std::optional<PlaceHolderPtr>
+  getPlaceholder(std::string_view identifier) const {
+    auto it = placeholders.find(identifier);
+    if (it == placeholders.end()) {
+      return std::nullopt;
     }
     return it->second;
   }
 
-  virtual void removeOperation(const std::string &identifier) {
-    operations.erase(identifier);
+  // A vector placeholder, and its components as placeholders of their own.
+  virtual void addVector(VectorPlaceHolderPtr vector) {
+    for (const auto &component : vector->getComponents()) {
+      addPlaceholder(component);
+    }
+    vectors[std::string(vector->getIdentifier())] = std::move(vector);
   }
 
-  virtual std::optional<operations::OperationPtr>
-  getOperation(const std::string &identifier) const {
-    auto it = operations.find(identifier);
-    if (it == operations.end()) {
+  virtual void removeVector(const std::string &identifier) {
+    auto it = vectors.find(identifier);
+    if (it == vectors.end()) {
+      return;
+    }
+    for (const auto &component : it->second->getComponents()) {
+      removePlaceholder(std::string(component->getIdentifier()));
+    }
+    vectors.erase(it);
+  }
+
+  virtual std::optional<VectorPlaceHolderPtr> getVector(std::string_view identifier) const {
+    if (vectors.empty()) {
+      return std::nullopt;
+    }
+    auto it = vectors.find(identifier);
+    if (it == vectors.end()) {
       return std::nullopt;
     }
     return it->second;
   }
 
-  virtual bool hasOperation(const std::string &identifier) const {
-    return operations.find(identifier) != operations.end();
+  // A table for interp(name, ...). Contexts and compiled expressions share
+  // it; see Tables.hpp.
+  virtual void addTable(std::string name, TablePtr table) {
+    if (!table) {
+      throw std::invalid_argument("Table must not be null");
+    }
+    tables[std::move(name)] = std::move(table);
   }
 
-  virtual void addPlaceholder(PlaceHolderPtr placeholder) {
-    placeholders[std::string(placeholder->getIdentifier())] =
-        std::move(placeholder);
+  virtual void removeTable(const std::string &name) { tables.erase(name); }
+
+  virtual std::optional<TablePtr> getTable(std::string_view name) const {
+    if (tables.empty()) {
+      return std::nullopt;
+    }
+    auto it = tables.find(name);
+    if (it == tables.end()) {
+      return std::nullopt;
+    }
+    return it->second;
   }
 
-  virtual void removePlaceholder(const std::string &identifier) {
-    placeholders.erase(identifier);
+  virtual void addFunction(FunctionPtr function) {
+    functions[std::string(function->getName())] = std::move(function);
   }
 
-  virtual std::optional<PlaceHolderPtr>
-  getPlaceholder(const std::string &identifier) const {
-    auto it = placeholders.find(identifier);
-    if (it == placeholders.end()) {
+  virtual void removeFunction(const std::string &name) {
+    functions.erase(name);
+  }
+
+  virtual std::optional<FunctionPtr> getFunction(std::string_view name) const {
+    auto it = functions.find(name);
+    if (it == functions.end()) {
       return std::nullopt;
     }
     return it->second;
   }
+
+  virtual bool hasFunction(std::string_view name) const {
+    return functions.find(name) != functions.end();
+  }
+
+  // Largest error accepted from sin, cos, exp, log and pow in expressions
+  // compiled with this context. Above zero, compile swaps them for faster
+  // polynomial approximations that stay within it; see Approximation.hpp.
+  // Zero, the default, keeps the full accuracy of the C library.
+  virtual void setTolerance(double tolerance) {
+    if (!(tolerance >= 0)) {
+      throw std::invalid_argument("Tolerance must not be negative");
+    }
+    this->tolerance = tolerance;
+  }
+
+  virtual double getTolerance() const { return tolerance; }
+
+  // Placeholders whose values repeat a lot, like category codes. Expensive
+  // subtrees that depend on nothing else get a cache of capacity entries
+  // keyed by their values in expressions compiled with this context; see
+  // Memoization.hpp. Empty, the default, compiles no caches.
+  virtual void setMemoized(std::set<std::string, std::less<>> placeholders,
+                           size_t capacity = 4096) {
+    if (capacity == 0) {
+      throw std::invalid_argument("Memoization capacity must be positive");
+    }
+    memoized = std::move(placeholders);
+    memoCapacity = capacity;
+  }
+
+  virtual const std::set<std::string, std::less<>> &getMemoized() const { return memoized; }
+  virtual size_t getMemoCapacity() const { return memoCapacity; }
 };
 } // namespace expression_solver
\ No newline at end of file
@@ -0,0 +1,260 @@
+#include "CostModel.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+#include <typeinfo>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Tape.hpp"
+
+namespace expression_solver {
+
+namespace operations {
+
+ShortCircuitOperation::ShortCircuitOperation(bool conjunction, ExpressionPtr condition,
+                                             ExpressionPtr body,
+                                             std::vector<PlaceHolderPtr> placeholders)
+    : conjunction(conjunction), body(std::make_shared<CompiledExpression>(std::move(body))) {
+  if (placeholders.size() > maxPlaceholders) {
+    throw std::invalid_argument("Too many placeholders in a short-circuit body");
+  }
+  operands.push_back(std::move(condition));
+  for (auto &placeholder : placeholders) {
+    this->placeholders.push_back(placeholder.get());
+    operands.push_back(std::move(placeholder));
+  }
+}
+
+double ShortCircuitOperation::evaluate() const {
+  double a = operands[0]->evaluate();
+  if (decides(a)) {
+    return conjunction ? 0 : 1;
+  }
+  double values[maxPlaceholders + 1];
+  values[0] = a;
+  for (size_t k = 1; k < operands.size(); k++) {
+    values[k] = operands[k]->evaluate();
+  }
+  return applyOperands(values);
+}
+
+double ShortCircuitOperation::applyOperands(const double *values) const {
+  if (decides(values[0])) {
+    return conjunction ? 0 : 1;
+  }
+  // The body reads its placeholders, which hold these values unless the
+  // caller evaluates other rows. Compared bit for bit, so NaN matches NaN.
+  bool current = true;
+  for (size_t k = 0; k < placeholders.size() && current; k++) {
+    current = std::bit_cast<uint64_t>(placeholders[k]->evaluate()) ==
+              std::bit_cast<uint64_t>(values[k + 1]);
+  }
+  if (current) {
+    return body->evaluate() != 0;
+  }
+  const double *columns[maxPlaceholders + 1];
+  for (size_t k = 0; k < operands.size(); k++) {
+    columns[k] = values + k;
+  }
+  double result;
+  applyBatch(columns, &result, 1);
+  return result;
+}
+
+void ShortCircuitOperation::applyBatch(const double *const *operands, double *out,
+                                       size_t count) const {
+  const double *a = operands[0];
+  std::vector<uint32_t> undecided;
+  for (size_t i = 0; i < count; i++) {
+    if (decides(a[i])) {
+      out[i] = conjunction ? 0 : 1;
+    } else {
+      undecided.push_back(static_cast<uint32_t>(i));
+    }
+  }
+  if (undecided.empty()) {
+    return;
+  }
+
+  std::vector<Binding> bindings(placeholders.size());
+  for (size_t k = 0; k < placeholders.size(); k++) {
+    bindings[k] = {placeholders[k], {operands[k + 1], count}};
+  }
+  if (undecided.size() == count) {
+    body->evaluate(bindings, {out, count});
+    for (size_t i = 0; i < count; i++) {
+      out[i] = out[i] != 0;
+    }
+    return;
+  }
+  std::vector<double> results(undecided.size());
+  body->evaluate(bindings, undecided, results);
+  for (size_t j = 0; j < undecided.size(); j++) {
+    out[undecided[j]] = results[j] != 0;
+  }
+}
+
+size_t ShortCircuitOperation::record(Tape &tape, const size_t *operands) const {
+  // Logical results are flat in every input.
+  double values[maxPlaceholders + 1];
+  for (size_t k = 0; k < arity(); k++) {
+    values[k] = tape.valueAt(operands[k]);
+  }
+  return tape.constant(applyOperands(values));
+}
+
+ExpressionPtr ShortCircuitOperation::rebuild(const ExpressionPtr *operands) const {
+  std::vector<PlaceHolderPtr> renamed;
+  std::unordered_map<const Expression *, ExpressionPtr> replacements;
+  for (size_t k = 0; k < placeholders.size(); k++) {
+    if (auto placeholder = std::dynamic_pointer_cast<PlaceHolder>(operands[k + 1])) {
+      renamed.push_back(std::move(placeholder));
+    }
+    if (operands[k + 1].get() != placeholders[k]) {
+      replacements.emplace(placeholders[k], operands[k + 1]);
+    }
+  }
+  auto copy = copyTree(getBody(), replacements);
+  if (renamed.size() == placeholders.size()) {
+    return std::make_shared<ShortCircuitOperation>(conjunction, operands[0], std::move(copy),
+                                                   std::move(renamed));
+  }
+  if (conjunction) {
+    return std::make_shared<LogicalAndOperation>(operands[0], std::move(copy));
+  }
+  return std::make_shared<LogicalOrOperation>(operands[0], std::move(copy));
+}
+
+} // namespace operations
+
+double estimateCost(const Expression &expression) {
+  if (auto compiled = dynamic_cast<const CompiledExpression *>(&expression)) {
+    return compiled->cost();
+  }
+  return estimateCost(linearize(expression));
+}
+
+namespace {
+
+// Operands this costly are worth a selection vector and gathered columns.
+constexpr double minimumCost = 16;
+
+struct Info {
+  double cost; // Of the subtree, counting shared nodes every time
+  bool pure;
+};
+
+// Distinct placeholders of a tree.
+std::vector<PlaceHolderPtr> placeholdersOf(const ExpressionPtr &root) {
+  std::vector<PlaceHolderPtr> found;
+  std::unordered_set<const Expression *> seen;
+  std::vector<const ExpressionPtr *> pending{&root};
+  while (!pending.empty()) {
+    const auto &node = *pending.back();
+    pending.pop_back();
+    if (!seen.insert(node.get()).second) {
+      continue;
+    }
+    if (auto placeholder = std::dynamic_pointer_cast<PlaceHolder>(node)) {
+      found.push_back(std::move(placeholder));
+    } else if (auto operation = dynamic_cast<const operations::Operation *>(node.get())) {
+      for (size_t i = 0; i < operation->arity(); i++) {
+        pending.push_back(&operation->getOperandAt(i));
+      }
+    }
+  }
+  return found;
+}
+
+bool isLogical(const Expression &node) {
+  const auto &type = typeid(node);
+  return type == typeid(operations::LogicalAndOperation) ||
+         type == typeid(operations::LogicalOrOperation);
+}
+
+} // namespace
+
+ExpressionPtr shortCircuit(ExpressionPtr root) {
+  using namespace operations;
+
+  std::unordered_map<const Expression *, Info> infos;
+  auto measure = [&](const ExpressionPtr &node) {
+    Info info{0, true};
+    if (auto operation = dynamic_cast<const Operation *>(node.get())) {
+      info = {operation->cost(), operation->isPure()};
+      for (size_t i = 0; i < operation->arity(); i++) {
+        const auto &operand = infos.at(operation->getOperandAt(i).get());
+        info.cost += operand.cost;
+        info.pure &= operand.pure;
+      }
+    }
+    infos[node.get()] = info;
+  };
+
+  // Cheapest operand of each chain first.
+  root = transform(std::move(root), [&](const ExpressionPtr &node) -> ExpressionPtr {
+    if (!isLogical(*node)) {
+      measure(node);
+      return node;
+    }
+    // Links of the chain shared with other parents stay whole, as operands.
+    const auto &type = typeid(*node);
+    auto link = static_cast<const BinaryOperation *>(node.get());
+    std::vector<ExpressionPtr> terms;
+    std::vector<const ExpressionPtr *> pending{&link->getOperandAt(1), &link->getOperandAt(0)};
+    while (!pending.empty()) {
+      const auto &term = *pending.back();
+      pending.pop_back();
+      if (typeid(*term) == type && term.use_count() == 1) {
+        auto inner = static_cast<const BinaryOperation *>(term.get());
+        pending.push_back(&inner->getOperandAt(1));
+        pending.push_back(&inner->getOperandAt(0));
+      } else {
+        terms.push_back(term);
+      }
+    }
+    auto cheaper = [&](const ExpressionPtr &a, const ExpressionPtr &b) {
+      return infos.at(a.get()).cost < infos.at(b.get()).cost;
+    };
+    bool pure = std::all_of(terms.begin(), terms.end(),
+                            [&](const ExpressionPtr &term) { return infos.at(term.get()).pure; });
+    if (!pure || std::is_sorted(terms.begin(), terms.end(), cheaper)) {
+      measure(node);
+      return node;
+    }
+    std::stable_sort(terms.begin(), terms.end(), cheaper);
+    ExpressionPtr chain = terms[0];
+    for (size_t i = 1; i < terms.size(); i++) {
+      chain = link->create(std::move(chain), terms[i]);
+      measure(chain);
+    }
+    return chain;
+  });
+
+  // Costly right operands run only for the rows the left one leaves open.
+  infos.clear();
+  return transform(std::move(root), [&](const ExpressionPtr &node) -> ExpressionPtr {
+    if (isLogical(*node)) {
+      auto link = static_cast<const BinaryOperation *>(node.get());
+      const auto &right = link->getOperandAt(1);
+      const auto &info = infos.at(right.get());
+      if (info.pure && info.cost >= minimumCost && right.use_count() == 1) {
+        auto placeholders = placeholdersOf(right);
+        if (placeholders.size() <= ShortCircuitOperation::maxPlaceholders) {
+          ExpressionPtr guarded = std::make_shared<ShortCircuitOperation>(
+              typeid(*node) == typeid(LogicalAndOperation), link->getOperandAt(0), right,
+              std::move(placeholders));
+          measure(guarded);
+          return guarded;
+        }
+      }
+    }
+    measure(node);
+    return node;
+  });
+}
+
+} // namespace expression_solver
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "CompiledExpression.hpp"
+
+namespace expression_solver {
+
+namespace operations {
+
+// a && b or a || b whose right operand is costly: b runs only for the rows
+// that a leaves undecided, as the tree's own evaluate does for one value.
+// The operands are a, then the placeholders of b; b is compiled on its own
+// and evaluated over a selection vector of the undecided rows of a batch.
+class ShortCircuitOperation : public Operation {
+  bool conjunction; // && rather than ||
+  std::vector<ExpressionPtr> operands;
+  std::vector<const PlaceHolder *> placeholders;
+  std::shared_ptr<const CompiledExpression> body;
+
+  // Value of the rows that a decides on its own.
+  bool decides(double a) const { return conjunction ? a == 0 : a != 0; }
+
+public:
+  // Operands are kept on the stack when evaluating one value, so the body
+  // may read at most this many placeholders.
+  static constexpr size_t maxPlaceholders = 15;
+
+  // placeholders must be the distinct placeholders of body, at most
+  // maxPlaceholders of them.
+  ShortCircuitOperation(bool conjunction, ExpressionPtr condition, ExpressionPtr body,
+                        std::vector<PlaceHolderPtr> placeholders);
+
+  constexpr std::string_view identifier() const override {
+    return conjunction ? "&&" : "||";
+  }
+  constexpr int precedence() const override { return 0; }
+
+  double evaluate() const override;
+  size_t record(Tape &tape, const size_t *operands) const override;
+
+  size_t arity() const override { return operands.size(); }
+  const ExpressionPtr &getOperandAt(size_t index) const override { return operands[index]; }
+  void setOperandAt(size_t index, ExpressionPtr operand) override {
+    operands[index] = std::move(operand);
+  }
+
+  double applyOperands(const double *values) const override;
+  void applyBatch(const double *const *operands, double *out, size_t count) const override;
+
+  // Operands replaced by other placeholders give a new node over the same
+  // body; any other replacement gives the plain && or || of the condition
+  // and the body with it substituted.
+  ExpressionPtr rebuild(const ExpressionPtr *operands) const override;
+
+  // As if every row took the body.
+  double cost() const override { return 1 + body->cost(); }
+
+  bool isConjunction() const { return conjunction; }
+  const ExpressionPtr &getBody() const { return body->getRoot(); }
+};
+
+} // namespace operations
+
+// Estimated time to evaluate one row of expression, in additions: the sum
+// of Operation::cost over its operation nodes, each shared node once. Zero
+// for constants and placeholders.
+double estimateCost(const Expression &expression);
+
+// Reorders every chain of && or || with pure operands, such as
+// a && b && c, so the cheapest operand comes first, then puts each operand
+// that costs at least a call to the C library's sin behind a
+// ShortCircuitOperation. Values are unchanged.
+ExpressionPtr shortCircuit(ExpressionPtr root);
+
+} // namespace expression_solver
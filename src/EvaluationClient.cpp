@@ -0,0 +1,130 @@
+#include "EvaluationClient.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace expression_solver {
+
+using namespace protocol;
+
+namespace {
+
+void sendAll(int fd, const void *data, size_t size) {
+  auto bytes = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t sent = ::send(fd, bytes, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      throw std::runtime_error("Connection to the evaluation server lost");
+    }
+    bytes += sent;
+    size -= static_cast<size_t>(sent);
+  }
+}
+
+void receiveAll(int fd, void *data, size_t size) {
+  auto bytes = static_cast<char *>(data);
+  while (size > 0) {
+    ssize_t received = ::recv(fd, bytes, size, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      throw std::runtime_error("Connection to the evaluation server lost");
+    }
+    bytes += received;
+    size -= static_cast<size_t>(received);
+  }
+}
+
+} // namespace
+
+EvaluationClient::EvaluationClient(const std::string &socketPath) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)) {
+    throw std::invalid_argument("Invalid socket path: " + socketPath);
+  }
+  std::memcpy(address.sun_path, socketPath.data(), socketPath.size());
+  fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 ||
+      ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+    std::string error = std::strerror(errno);
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    throw std::runtime_error("Cannot connect to " + socketPath + ": " + error);
+  }
+}
+
+EvaluationClient::~EvaluationClient() { ::close(fd); }
+
+std::vector<char> EvaluationClient::call(MessageType type,
+                                         const std::vector<char> &payload) {
+  FrameHeader header{static_cast<uint32_t>(payload.size()), nextId++, type, Status::Ok};
+  sendAll(fd, &header, sizeof(header));
+  sendAll(fd, payload.data(), payload.size());
+
+  FrameHeader response;
+  receiveAll(fd, &response, sizeof(response));
+  if (response.id != header.id || response.size > maxFrameSize) {
+    throw std::runtime_error("Unexpected response from the evaluation server");
+  }
+  std::vector<char> result(response.size);
+  receiveAll(fd, result.data(), result.size());
+  if (response.status != Status::Ok) {
+    throw std::invalid_argument(std::string(result.begin(), result.end()));
+  }
+  return result;
+}
+
+EvaluationClient::Program EvaluationClient::lookup(const std::string &name) {
+  auto response = call(MessageType::Lookup, std::vector<char>(name.begin(), name.end()));
+  Reader reader(response.data(), response.size());
+  Program program;
+  program.id = reader.get<uint32_t>();
+  uint32_t inputs = reader.get<uint32_t>();
+  for (uint32_t i = 0; i < inputs && reader.ok(); i++) {
+    program.inputs.push_back(reader.getString());
+  }
+  if (!reader.ok()) {
+    throw std::runtime_error("Malformed lookup response");
+  }
+  return program;
+}
+
+std::vector<double> EvaluationClient::evaluate(uint32_t program,
+                                               std::span<const double> columns,
+                                               size_t rows) {
+  std::vector<char> payload;
+  Writer writer(payload);
+  writer.put(program);
+  writer.put(static_cast<uint32_t>(rows));
+  writer.put(columns.data(), columns.size_bytes());
+  auto response = call(MessageType::Evaluate, payload);
+  if (response.size() != rows * sizeof(double)) {
+    throw std::runtime_error("Malformed evaluate response");
+  }
+  std::vector<double> results(rows);
+  std::memcpy(results.data(), response.data(), response.size());
+  return results;
+}
+
+Statistics EvaluationClient::statistics() {
+  auto response = call(MessageType::Statistics, {});
+  Reader reader(response.data(), response.size());
+  auto result = reader.get<Statistics>();
+  if (!reader.ok()) {
+    throw std::runtime_error("Malformed statistics response");
+  }
+  return result;
+}
+
+} // namespace expression_solver
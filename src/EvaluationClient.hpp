@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Protocol.hpp"
+
+namespace expression_solver {
+
+// Blocking client of an EvaluationServer, one request in flight at a time.
+// Use one client per thread; the server coalesces requests across clients.
+class EvaluationClient {
+  int fd = -1;
+  uint32_t nextId = 1;
+
+  // Sends a request and waits for its response payload. Throws
+  // std::invalid_argument with the server's message when it reports an
+  // error, and std::runtime_error when the connection fails.
+  std::vector<char> call(protocol::MessageType type, const std::vector<char> &payload);
+
+public:
+  struct Program {
+    uint32_t id;
+    std::vector<std::string> inputs; // Column order for evaluate
+  };
+
+  // Connects to the server listening on socketPath.
+  explicit EvaluationClient(const std::string &socketPath);
+  ~EvaluationClient();
+
+  EvaluationClient(const EvaluationClient &) = delete;
+  EvaluationClient &operator=(const EvaluationClient &) = delete;
+
+  Program lookup(const std::string &name);
+
+  // Evaluates rows rows of a program. columns holds one column of rows
+  // values per input, in the order given by lookup.
+  std::vector<double> evaluate(uint32_t program, std::span<const double> columns,
+                               size_t rows);
+
+  protocol::Statistics statistics();
+};
+
+} // namespace expression_solver
@@ -0,0 +1,488 @@
+#include "EvaluationServer.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "CompiledExpression.hpp"
+#include "Traversal.hpp"
+
+namespace expression_solver {
+
+using namespace protocol;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+bool sendAll(int fd, const void *data, size_t size) {
+  auto bytes = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t sent = ::send(fd, bytes, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    bytes += sent;
+    size -= static_cast<size_t>(sent);
+  }
+  return true;
+}
+
+} // namespace
+
+struct EvaluationServer::Connection {
+  int fd;
+  std::mutex writing;         // Workers and the I/O thread share the socket
+  std::vector<char> received; // Bytes read but not yet a whole frame
+
+  explicit Connection(int fd) : fd(fd) {}
+  ~Connection() { ::close(fd); }
+
+  // Writes one whole frame. False once the peer is gone.
+  bool send(const FrameHeader &header, const void *payload) {
+    std::lock_guard lock(writing);
+    return sendAll(fd, &header, sizeof(header)) &&
+           sendAll(fd, payload, header.size);
+  }
+
+  bool fail(uint32_t id, MessageType type, Status status,
+            const std::string &message) {
+    return send({static_cast<uint32_t>(message.size()), id, type, status},
+                message.data());
+  }
+};
+
+struct EvaluationServer::Request {
+  std::shared_ptr<Connection> connection;
+  uint32_t id;
+  uint32_t program;
+  uint32_t rows;
+  std::vector<double> columns; // inputs * rows, one column per input
+  Clock::time_point received;
+};
+
+size_t EvaluationServer::LatencyHistogram::bucketOf(uint64_t nanoseconds) {
+  if (nanoseconds < 4) {
+    return nanoseconds;
+  }
+  size_t exponent = std::bit_width(nanoseconds) - 1;
+  size_t sub = (nanoseconds >> (exponent - 2)) & 3;
+  return std::min(bucketCount - 1, (exponent - 1) * 4 + sub);
+}
+
+double EvaluationServer::LatencyHistogram::lowerBound(size_t bucket) {
+  if (bucket < 4) {
+    return static_cast<double>(bucket);
+  }
+  size_t exponent = bucket / 4 + 1;
+  return std::ldexp(1.0 + (bucket % 4) / 4.0, static_cast<int>(exponent));
+}
+
+void EvaluationServer::LatencyHistogram::record(uint64_t nanoseconds) {
+  buckets[bucketOf(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+}
+
+double EvaluationServer::LatencyHistogram::quantile(double fraction) const {
+  uint64_t counts[bucketCount];
+  uint64_t total = 0;
+  for (size_t i = 0; i < bucketCount; i++) {
+    counts[i] = buckets[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  auto rank = static_cast<uint64_t>(std::ceil(fraction * total));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < bucketCount; i++) {
+    seen += counts[i];
+    if (seen >= std::max<uint64_t>(rank, 1)) {
+      // Middle of the bucket.
+      return (lowerBound(i) + lowerBound(i + 1)) / 2;
+    }
+  }
+  return lowerBound(bucketCount - 1);
+}
+
+EvaluationServer::EvaluationServer(Options options, ExpressionSolver solver)
+    : options(std::move(options)), solver(std::move(solver)),
+      queue(this->options.queueCapacity) {}
+
+EvaluationServer::~EvaluationServer() { stop(); }
+
+void EvaluationServer::define(const std::string &definition) {
+  if (running) {
+    throw std::logic_error("Programs must be defined before the server starts");
+  }
+  auto function = solver.parseFunction(definition);
+  std::string name(function->getName());
+  if (findProgram(name) >= 0) {
+    throw std::invalid_argument("Program already defined: " + name);
+  }
+  // specialize with no values runs the compile passes over the body.
+  auto expression = solver.specialize(function->getBody(), {});
+  // Workers evaluate a program concurrently and coalesce rows of different
+  // clients, so the state of a streaming operation would be shared by both.
+  auto compiled = std::dynamic_pointer_cast<const CompiledExpression>(expression);
+  for (const auto &node : linearize(compiled ? *compiled->getRoot() : *expression).nodes) {
+    if (node.operation && !node.operation->isPure()) {
+      throw std::invalid_argument("Program " + name + " has streaming operations");
+    }
+  }
+  double cost = estimateCost(*expression);
+  if (options.maxCost > 0 && cost > options.maxCost) {
+    throw std::invalid_argument("Program " + name + " costs " + std::to_string(cost) +
+                                " per row, above the limit of " +
+                                std::to_string(options.maxCost));
+  }
+  programs.push_back({name, function->getParameters(), std::move(expression)});
+}
+
+int EvaluationServer::findProgram(const std::string &name) const {
+  for (size_t i = 0; i < programs.size(); i++) {
+    if (programs[i].name == name) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+void EvaluationServer::start() {
+  if (running) {
+    return;
+  }
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (options.socketPath.empty() ||
+      options.socketPath.size() >= sizeof(address.sun_path)) {
+    throw std::invalid_argument("Invalid socket path: " + options.socketPath);
+  }
+  std::memcpy(address.sun_path, options.socketPath.data(), options.socketPath.size());
+
+  // A socket left behind by a previous run would make bind fail.
+  struct stat status;
+  if (::stat(options.socketPath.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+    ::unlink(options.socketPath.c_str());
+  }
+
+  listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listener < 0 ||
+      ::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+      ::listen(listener, 128) < 0 || ::pipe2(wakeup, O_CLOEXEC) < 0) {
+    std::string error = std::strerror(errno);
+    if (listener >= 0) {
+      ::close(listener);
+      listener = -1;
+    }
+    throw std::runtime_error("Cannot listen on " + options.socketPath + ": " + error);
+  }
+
+  started = Clock::now();
+  ioStopped = false;
+  running = true;
+  io = std::thread([this] { serve(); });
+  for (size_t i = 0; i < std::max<size_t>(options.workers, 1); i++) {
+    workers.emplace_back([this] { work(); });
+  }
+}
+
+void EvaluationServer::stop() {
+  if (!running.exchange(false)) {
+    return;
+  }
+  char byte = 0;
+  while (::write(wakeup[1], &byte, 1) < 0 && errno == EINTR) {
+  }
+  io.join();
+  // The I/O thread no longer queues requests; workers drain the queue.
+  ioStopped = true;
+  queued.fetch_add(1, std::memory_order_release);
+  queued.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+  ::close(listener);
+  ::close(wakeup[0]);
+  ::close(wakeup[1]);
+  listener = wakeup[0] = wakeup[1] = -1;
+  ::unlink(options.socketPath.c_str());
+}
+
+void EvaluationServer::serve() {
+  std::vector<std::shared_ptr<Connection>> connections;
+  std::vector<pollfd> polled;
+  char buffer[1 << 16];
+
+  while (true) {
+    polled.clear();
+    polled.push_back({wakeup[0], POLLIN, 0});
+    polled.push_back({listener, POLLIN, 0});
+    for (const auto &connection : connections) {
+      polled.push_back({connection->fd, POLLIN, 0});
+    }
+    if (::poll(polled.data(), polled.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (polled[0].revents) {
+      break;
+    }
+    if (polled[1].revents & POLLIN) {
+      int fd = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd >= 0) {
+        connections.push_back(std::make_shared<Connection>(fd));
+      }
+    }
+
+    std::vector<bool> closed(connections.size(), false);
+    for (size_t i = 0; i < connections.size(); i++) {
+      if (!polled[i + 2].revents) {
+        continue;
+      }
+      auto &connection = connections[i];
+      ssize_t count = ::recv(connection->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+      if (count < 0 && (errno == EAGAIN || errno == EINTR)) {
+        continue;
+      }
+      if (count <= 0) {
+        closed[i] = true;
+        continue;
+      }
+      auto &received = connection->received;
+      received.insert(received.end(), buffer, buffer + count);
+
+      // Handle every whole frame received so far.
+      size_t offset = 0;
+      while (received.size() - offset >= sizeof(FrameHeader)) {
+        FrameHeader header;
+        std::memcpy(&header, received.data() + offset, sizeof(header));
+        if (header.size > maxFrameSize) {
+          closed[i] = true;
+          break;
+        }
+        if (received.size() - offset - sizeof(header) < header.size) {
+          break;
+        }
+        auto begin = received.begin() + offset + sizeof(header);
+        std::vector<char> payload(begin, begin + header.size);
+        offset += sizeof(header) + header.size;
+        if (!handle(connection, header, std::move(payload))) {
+          closed[i] = true;
+          break;
+        }
+      }
+      received.erase(received.begin(), received.begin() + offset);
+    }
+
+    // Requests still queued keep their connection alive until answered.
+    size_t kept = 0;
+    for (size_t i = 0; i < connections.size(); i++) {
+      if (!closed[i]) {
+        connections[kept++] = std::move(connections[i]);
+      }
+    }
+    connections.resize(kept);
+  }
+}
+
+bool EvaluationServer::handle(const std::shared_ptr<Connection> &connection,
+                              const FrameHeader &header, std::vector<char> payload) {
+  Reader reader(payload.data(), payload.size());
+  std::vector<char> response;
+  Writer writer(response);
+
+  switch (header.type) {
+  case MessageType::Lookup: {
+    std::string name(payload.begin(), payload.end());
+    int index = findProgram(name);
+    if (index < 0) {
+      return connection->fail(header.id, header.type, Status::UnknownProgram,
+                              "Unknown program: " + name);
+    }
+    const auto &program = programs[index];
+    writer.put(static_cast<uint32_t>(index));
+    writer.put(static_cast<uint32_t>(program.inputs.size()));
+    for (const auto &input : program.inputs) {
+      writer.putString(input->getIdentifier());
+    }
+    break;
+  }
+  case MessageType::Statistics: {
+    writer.put(statistics());
+    break;
+  }
+  case MessageType::Evaluate: {
+    auto request = std::make_unique<Request>();
+    request->connection = connection;
+    request->id = header.id;
+    request->program = reader.get<uint32_t>();
+    request->rows = reader.get<uint32_t>();
+    request->received = Clock::now();
+    if (!reader.ok() || request->program >= programs.size()) {
+      return connection->fail(header.id, header.type, Status::UnknownProgram,
+                              "Unknown program");
+    }
+    // The response must fit in a frame; this also bounds programs with no
+    // inputs, whose requests carry no columns to check the rows against.
+    if (request->rows > maxFrameSize / sizeof(double)) {
+      return connection->fail(header.id, header.type, Status::BadRequest,
+                              "Too many rows in one request");
+    }
+    size_t values = programs[request->program].inputs.size() * size_t(request->rows);
+    if (reader.remaining() != values * sizeof(double)) {
+      return connection->fail(header.id, header.type, Status::BadRequest,
+                              "Expected one column of rows values per input");
+    }
+    request->columns.resize(values);
+    reader.get(request->columns.data(), values * sizeof(double));
+
+    Request *queuedRequest = request.release();
+    while (!queue.tryPush(queuedRequest)) {
+      std::this_thread::yield(); // Back-pressure while workers catch up
+    }
+    queued.fetch_add(1, std::memory_order_release);
+    queued.notify_one();
+    return true;
+  }
+  default:
+    return connection->fail(header.id, header.type, Status::BadRequest,
+                            "Unknown message type");
+  }
+
+  return connection->send(
+      {static_cast<uint32_t>(response.size()), header.id, header.type, Status::Ok},
+      response.data());
+}
+
+void EvaluationServer::work() {
+  std::vector<Request *> taken;
+  std::vector<Request *> group;
+  while (true) {
+    uint32_t seen = queued.load(std::memory_order_acquire);
+    Request *first;
+    if (!queue.tryPop(first)) {
+      if (ioStopped) {
+        return;
+      }
+      queued.wait(seen, std::memory_order_acquire);
+      continue;
+    }
+
+    // Take what else is waiting, then evaluate each program's requests as
+    // one batch.
+    taken.assign(1, first);
+    size_t total = first->rows;
+    Request *next;
+    while (total < options.maxBatchRows && queue.tryPop(next)) {
+      taken.push_back(next);
+      total += next->rows;
+    }
+    std::stable_sort(taken.begin(), taken.end(), [](const Request *a, const Request *b) {
+      return a->program < b->program;
+    });
+    for (size_t begin = 0; begin < taken.size();) {
+      size_t end = begin + 1;
+      while (end < taken.size() && taken[end]->program == taken[begin]->program) {
+        end++;
+      }
+      group.assign(taken.begin() + begin, taken.begin() + end);
+      evaluate(programs[taken[begin]->program], group);
+      begin = end;
+    }
+    for (auto request : taken) {
+      delete request;
+    }
+  }
+}
+
+void EvaluationServer::evaluate(const Program &program, std::vector<Request *> &group) {
+  size_t inputs = program.inputs.size();
+  size_t total = 0;
+  for (auto request : group) {
+    total += request->rows;
+  }
+
+  // A failed allocation answers the group with an error, like a failed
+  // evaluation, instead of ending the server.
+  std::vector<double> results;
+  try {
+    std::vector<double> merged;
+    std::vector<Binding> bindings(inputs);
+    if (group.size() == 1) {
+      for (size_t k = 0; k < inputs; k++) {
+        bindings[k] = {program.inputs[k].get(),
+                       {group[0]->columns.data() + k * total, total}};
+      }
+    } else {
+      merged.resize(inputs * total);
+      for (size_t k = 0; k < inputs; k++) {
+        size_t offset = k * total;
+        for (auto request : group) {
+          std::copy_n(request->columns.data() + k * request->rows, request->rows,
+                      merged.data() + offset);
+          offset += request->rows;
+        }
+        bindings[k] = {program.inputs[k].get(), {merged.data() + k * total, total}};
+      }
+    }
+    results.resize(total);
+    solver.solve(program.expression, bindings, results);
+  } catch (const std::exception &error) {
+    for (auto request : group) {
+      request->connection->fail(request->id, MessageType::Evaluate,
+                                Status::BadRequest, error.what());
+    }
+    return;
+  }
+  batches.fetch_add(1, std::memory_order_relaxed);
+
+  size_t offset = 0;
+  for (auto request : group) {
+    respond(*request, results.data() + offset);
+    offset += request->rows;
+  }
+}
+
+void EvaluationServer::respond(Request &request, const double *results) {
+  // Counted before the write so a client sees its own requests in the
+  // statistics it asks for next.
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now() - request.received);
+  latency.record(static_cast<uint64_t>(elapsed.count()));
+  requests.fetch_add(1, std::memory_order_relaxed);
+  rows.fetch_add(request.rows, std::memory_order_relaxed);
+  request.connection->send({static_cast<uint32_t>(request.rows * sizeof(double)),
+                            request.id, MessageType::Evaluate, Status::Ok},
+                           results);
+}
+
+Statistics EvaluationServer::statistics() const {
+  double seconds = std::chrono::duration<double>(Clock::now() - started).count();
+  Statistics result{};
+  result.requests = requests.load(std::memory_order_relaxed);
+  result.rows = rows.load(std::memory_order_relaxed);
+  result.batches = batches.load(std::memory_order_relaxed);
+  result.p50Microseconds = latency.quantile(0.5) / 1e3;
+  result.p99Microseconds = latency.quantile(0.99) / 1e3;
+  result.requestsPerSecond = seconds > 0 ? result.requests / seconds : 0;
+  result.rowsPerSecond = seconds > 0 ? result.rows / seconds : 0;
+  return result;
+}
+
+} // namespace expression_solver
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BoundedQueue.hpp"
+#include "ExpressionSolver.hpp"
+#include "Protocol.hpp"
+
+namespace expression_solver {
+
+// Serves compiled programs to other processes on the host over a Unix
+// domain socket, so they share one compiled copy of the rules.
+//
+// One I/O thread accepts connections and reads frames from all of them.
+// Evaluate requests go through a lock-free queue to the workers; a worker
+// takes every request waiting in the queue, up to maxBatchRows rows, and
+// coalesces the requests for the same program into one batch evaluation.
+// Lookup and Statistics are answered by the I/O thread.
+class EvaluationServer {
+public:
+  struct Options {
+    std::string socketPath;
+    size_t workers = 2;
+    size_t maxBatchRows = 4096;
+    size_t queueCapacity = 4096;
+    // Programs whose estimated cost per row is above this are rejected by
+    // define; see estimateCost. Zero for no limit.
+    double maxCost = 0;
+  };
+
+  EvaluationServer(Options options, ExpressionSolver solver = ExpressionSolver());
+
+  // Stops the server if it is running.
+  ~EvaluationServer();
+
+  EvaluationServer(const EvaluationServer &) = delete;
+  EvaluationServer &operator=(const EvaluationServer &) = delete;
+
+  // Adds a program from a definition such as "price(qty, rate) = qty * rate".
+  // Its parameters are the inputs clients send, in order. Programs must be
+  // defined before start(). Throws std::invalid_argument for programs above
+  // Options::maxCost or with streaming operations.
+  void define(const std::string &definition);
+
+  // Binds the socket and starts the I/O and worker threads. Throws
+  // std::runtime_error when the socket cannot be bound.
+  void start();
+
+  // Closes the socket, finishes queued requests and joins the threads.
+  void stop();
+
+  protocol::Statistics statistics() const;
+
+private:
+  struct Program {
+    std::string name;
+    std::vector<PlaceHolderPtr> inputs;
+    ExpressionPtr expression;
+  };
+
+  struct Connection;
+  struct Request;
+
+  // Log-linear latency buckets: four sub-buckets per power of two of
+  // nanoseconds, so percentiles are within about 20%.
+  class LatencyHistogram {
+    static constexpr size_t bucketCount = 64 * 4;
+    std::atomic<uint64_t> buckets[bucketCount] = {};
+
+    static size_t bucketOf(uint64_t nanoseconds);
+    static double lowerBound(size_t bucket);
+
+  public:
+    void record(uint64_t nanoseconds);
+    // Latency below which the given fraction of the recorded ones fall.
+    double quantile(double fraction) const;
+  };
+
+  Options options;
+  ExpressionSolver solver;
+  std::vector<Program> programs;
+
+  int listener = -1;
+  int wakeup[2] = {-1, -1}; // Pipe that interrupts the I/O thread's poll
+  std::atomic<bool> running = false;
+  std::thread io;
+  std::vector<std::thread> workers;
+  BoundedQueue<Request *> queue;
+  std::atomic<uint32_t> queued = 0; // Waited on by idle workers
+  std::atomic<bool> ioStopped = false; // No more requests will be queued
+
+  std::chrono::steady_clock::time_point started;
+  std::atomic<uint64_t> requests = 0;
+  std::atomic<uint64_t> rows = 0;
+  std::atomic<uint64_t> batches = 0;
+  LatencyHistogram latency;
+
+  void serve();
+  void work();
+  bool handle(const std::shared_ptr<Connection> &connection,
+              const protocol::FrameHeader &header, std::vector<char> payload);
+  void evaluate(const Program &program, std::vector<Request *> &group);
+  void respond(Request &request, const double *results);
+  int findProgram(const std::string &name) const;
+};
+
+} // namespace expression_solver
@@ -1,13 +1,23 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
 #include <memory>
 
 namespace expression_solver {
+  class Tape;
+
   class Expression {
   public:
     virtual ~Expression() = default;
     virtual double evaluate() const = 0;
+
+    // Writes the expression to the tape, given the tape indices of its
+    // already recorded operands, and returns the index of its result.
+    // Throws std::logic_error by default: a custom expression that reads
+    // placeholders would otherwise be recorded as a constant and get zero
+    // gradients.
+    virtual size_t record(Tape &tape, const size_t *operands) const;
   };
 
   typedef std::shared_ptr<Expression> ExpressionPtr;
@@ -23,6 +33,7 @@ namespace expression_solver {
     double evaluate() const override {
       return value;
     }
+    size_t record(Tape &tape, const size_t *operands) const override;
   };
 
   class IdentifiedExpression : public Expression { 
@@ -38,10 +49,11 @@ namespace expression_solver {
   class PlaceHolder : public IdentifiedExpression {
     double value;
   public:
-    explicit PlaceHolder(std::string identifier, double value) : IdentifiedExpression(identifier) {}
+    explicit PlaceHolder(std::string identifier, double value) : IdentifiedExpression(identifier), value(value) {}
     double evaluate() const override {
       return value;
     }
+    size_t record(Tape &tape, const size_t *operands) const override;
     void setValue(double value) {
       this->value = value;
     }
@@ -1,9 +1,23 @@
-#include <queue>
-#include <stack>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <optional>
 #include <string_view>
+#include <typeinfo>
+#include <unordered_map>
 
+#include "Approximation.hpp"
+#include "CompiledExpression.hpp"
+#include "CostModel.hpp"
 #include "ExpressionSolver.hpp"
+#include "Memoization.hpp"
 #include "Operation.hpp"
+#include "Streaming.hpp"
+#include "Traversal.hpp"
 
 namespace expression_solver {
 using BinaryOperationPtr = std::shared_ptr<operations::BinaryOperation>;
@@ -16,22 +30,37 @@ struct Token {
 
   std::string_view value;
 
+  // Set on function names followed by "(", with the number of arguments
+  // once the call is closed.
+  bool call = false;
+  uint32_t arguments = 0;
+
   // Token(std::string_view source) { value = source; }
 
-  Token(const Token &other) { value = other.value; }
+  Token(const Token &other) {
+    value = other.value;
+    call = other.call;
+    arguments = other.arguments;
+  }
 
-  Token(Token &&other) : value(std::move(other.value)) {}
+  Token(Token &&other)
+      : value(std::move(other.value)), call(other.call),
+        arguments(other.arguments) {}
   Token(const std::string &source, size_t start, size_t end)
       : value(source.data() + start, end - start) {}
   Token() = default;
 
   Token &operator=(const Token &other) {
     value = other.value;
+    call = other.call;
+    arguments = other.arguments;
     return *this;
   }
 
   Token &operator=(Token &&other) {
     value = std::move(other.value);
+    call = other.call;
+    arguments = other.arguments;
     return *this;
   }
 
@@ -40,7 +69,7 @@ struct Token {
   bool operator!=(const Token &other) const { return value != other.value; }
 
   bool isBinaryOperation(const Context &context, BinaryOperationPtr &op) const {
-    auto optOp = context.getOperation(std::string(value));
+    auto optOp = context.getOperation(value);
     if (optOp.has_value()) {
       auto isBinaryOp =
           std::dynamic_pointer_cast<BinaryOperation>(optOp.value());
@@ -53,7 +82,7 @@ struct Token {
   }
 
   bool isUnaryOperation(const Context &context, UnaryOperationPtr &op) const {
-    auto optOp = context.getOperation(std::string(value));
+    auto optOp = context.getOperation(value);
     if (optOp.has_value()) {
       auto isUnaryOp =
           std::dynamic_pointer_cast<operations::UnaryOperation>(optOp.value());
@@ -66,7 +95,7 @@ struct Token {
   }
 
   bool isOperation(const Context &context, OperationPtr &op) const {
-    auto optOp = context.getOperation(std::string(value));
+    auto optOp = context.getOperation(value);
     if (optOp.has_value()) {
       op = optOp.value();
       return true;
@@ -75,7 +104,7 @@ struct Token {
   }
 
   bool isVariable(const Context &context, double &Value) const {
-    auto optVal = context.getVariable(std::string(value));
+    auto optVal = context.getVariable(value);
     if (optVal.has_value()) {
       Value = optVal.value();
       return true;
@@ -84,7 +113,7 @@ struct Token {
   }
 
   bool isPlaceholder(const Context &context, PlaceHolderPtr &Value) const {
-    auto optVal = context.getPlaceholder(std::string(value));
+    auto optVal = context.getPlaceholder(value);
     if (optVal.has_value()) {
       Value = optVal.value();
       return true;
@@ -92,30 +121,103 @@ struct Token {
     return false;
   }
 
-  bool isConst(double &Value) const {
-    try {
-      Value = std::stod(std::string(value));
+  bool isVector(const Context &context, VectorPlaceHolderPtr &vector) const {
+    auto optVec = context.getVector(value);
+    if (optVec.has_value()) {
+      vector = optVec.value();
+      return true;
+    }
+    return false;
+  }
+
+  bool isTable(const Context &context, TablePtr &table) const {
+    auto optTable = context.getTable(value);
+    if (optTable.has_value()) {
+      table = optTable.value();
       return true;
-    } catch (std::invalid_argument &e) {
+    }
+    return false;
+  }
+
+  bool isFunction(const Context &context, FunctionPtr &function) const {
+    if (!call) {
       return false;
     }
+    auto optFn = context.getFunction(value);
+    if (optFn.has_value()) {
+      function = optFn.value();
+      return true;
+    }
+    return false;
+  }
+
+  // The whole token must be a number, so names such as "info" are not read
+  // as a prefix of infinity.
+  bool isConst(double &Value) const {
+    auto end = value.data() + value.size();
+    auto [ptr, ec] = std::from_chars(value.data(), end, Value);
+    return ec == std::errc() && ptr == end;
   }
 };
 
-std::vector<Token> tokenize(const std::string &expression,
-                            const Context &context) {
+// Buffers of one compile, kept per thread and cleared between compiles so
+// compiling many expressions reuses their capacity instead of allocating.
+struct Scratch {
   std::vector<Token> tokens;
+  std::vector<Token> postfix;
+  std::vector<Token> operators;
+  // Commas seen in each open parenthesis, or noCall for one that groups
+  // instead of opening a call.
+  std::vector<uint32_t> calls;
+  static constexpr uint32_t noCall = std::numeric_limits<uint32_t>::max();
+  std::vector<ExpressionPtr> expressions;
+  std::vector<ExpressionPtr> arguments;
+  // Nodes added by inlining user functions, and their budget.
+  size_t inlined = 0;
+  size_t maxInlined = std::numeric_limits<size_t>::max();
+
+  static Scratch &local() {
+    thread_local Scratch scratch;
+    return scratch;
+  }
+};
+
+// Thrown by parse when inlining passes Scratch::maxInlined.
+struct NodeBudgetExceeded {
+  size_t nodes;
+};
+
+// Stops at the first budget of options the input exceeds, when given.
+std::optional<CompileError> tokenize(const std::string &expression, const Context &context,
+                                     std::vector<Token> &tokens,
+                                     const CompileOptions *options = nullptr) {
+  tokens.clear();
+  size_t maxTokens = options ? options->maxTokens : std::numeric_limits<size_t>::max();
+  size_t maxDepth = options ? options->maxDepth : std::numeric_limits<size_t>::max();
+  size_t depth = 0;
 
   for (int i = 0; i < expression.size(); i++) {
     char c = expression[i];
 
+    if (tokens.size() > maxTokens) {
+      return CompileError{CompileError::Kind::Tokens,
+                          "More than " + std::to_string(maxTokens) + " tokens",
+                          static_cast<size_t>(i)};
+    }
+
     // Skip whitespace
     if (c == ' ') { // finish token
       continue;
     }
 
-    // Check for parentheses
-    if (c == '(' || c == ')') {
+    // Check for parentheses and argument separators
+    if (c == '(' || c == ')' || c == ',') {
+      if (c == '(' && ++depth > maxDepth) {
+        return CompileError{CompileError::Kind::Depth,
+                            "More than " + std::to_string(maxDepth) + " nested parentheses",
+                            static_cast<size_t>(i)};
+      }
+      depth -= c == ')' && depth > 0;
       tokens.emplace_back(Token(expression, i, i + 1));
       continue;
     }
@@ -136,7 +238,7 @@ std::vector<Token> tokenize(const std::string &expression,
     // Check for variables and placeholders
     if (std::isalpha(c) || c == '_') {
       while (j < expression.size() &&
-             (std::isalnum(expression[j]) || c == '_' || c == '.')) {
+             (std::isalnum(expression[j]) || expression[j] == '_' || c == '.')) {
         j++;
       }
       tokens.emplace_back(Token(expression, i, j));
@@ -145,162 +247,917 @@ std::vector<Token> tokenize(const std::string &expression,
     }
 
     // Check for operations
-    bool cont = false;
-    auto possible_ops = context.getOperationsStartingWith(c);
-    for (auto op : possible_ops) {
-      std::string id(op->identifier());
-      if (expression.substr(i, id.size()) == id) {
-        tokens.emplace_back(Token(expression, i, i + id.size()));
-        i += static_cast<int>(id.size()) - 1;
-        cont = true;
-        break;
-      }
-    }
-    if (cont)
+    std::string_view rest(expression.data() + i, expression.size() - i);
+    if (auto op = context.matchOperation(rest)) {
+      auto id = (*op)->identifier();
+      tokens.emplace_back(Token(expression, i, i + id.size()));
+      i += static_cast<int>(id.size()) - 1;
       continue;
+    }
 
     throw std::invalid_argument("Invalid character in expression");
   }
 
-  return tokens;
+  if (tokens.size() > maxTokens) {
+    return CompileError{CompileError::Kind::Tokens,
+                        "More than " + std::to_string(maxTokens) + " tokens", expression.size()};
+  }
+  return std::nullopt;
+}
+
+// Inlines a user function, or creates the operation that takes this many
+// arguments: its unary or binary form, or the n-ary form of an associative
+// binary operation. Calls with vector arguments are made once per component,
+// except for the vector operations of Vectors.hpp. Tables are arguments of
+// interp only.
+ExpressionPtr build_call(const Token &token,
+                         std::vector<ExpressionPtr> &arguments,
+                         const Context &context, Scratch &scratch) {
+  using namespace operations;
+
+  FunctionPtr function;
+  OperationPtr op;
+  if (!token.isFunction(context, function) && token.isOperation(context, op)) {
+    if (auto interpolate = std::dynamic_pointer_cast<InterpolateOperation>(op)) {
+      return interpolate->call(std::move(arguments));
+    }
+  }
+  if (std::any_of(arguments.begin(), arguments.end(), isTable)) {
+    throw std::invalid_argument("Tables can only be passed to interp");
+  }
+  if (auto vectorOp = std::dynamic_pointer_cast<VectorFunction>(op)) {
+    return vectorOp->call(std::move(arguments));
+  }
+  if (std::any_of(arguments.begin(), arguments.end(), isVector)) {
+    return componentwise(arguments, [&](std::vector<ExpressionPtr> &slice) {
+      return build_call(token, slice, context, scratch);
+    });
+  }
+  auto count = arguments.size();
+  if (function) {
+    if (count == function->arity()) {
+      // Checked before copying the body, so a call cannot build a tree
+      // beyond the budget first.
+      scratch.inlined += function->inlinedNodes();
+      if (scratch.inlined > scratch.maxInlined) {
+        throw NodeBudgetExceeded{scratch.inlined};
+      }
+      return function->inlineCall(arguments.data());
+    }
+  } else if (op) {
+    if (auto variadicOp = std::dynamic_pointer_cast<VariadicOperation>(op)) {
+      if (count > 0) {
+        return variadicOp->create(std::move(arguments));
+      }
+    } else if (auto binaryOp = std::dynamic_pointer_cast<BinaryOperation>(op)) {
+      if (count == 2) {
+        return binaryOp->create(arguments[0], arguments[1]);
+      }
+      if (count > 2 && binaryOp->variadic()) {
+        return binaryOp->variadic()->create(std::move(arguments));
+      }
+    } else if (auto unaryOp = std::dynamic_pointer_cast<UnaryOperation>(op)) {
+      if (count == 1) {
+        return unaryOp->create(arguments[0]);
+      }
+    }
+  }
+  throw std::invalid_argument("Wrong number of arguments in call to " +
+                              std::string(token.value));
 }
 
-ExpressionPtr build_tree(std::queue<Token> &postfixTokens,
-                         const Context &context) {
-  std::stack<ExpressionPtr> expressions;
+ExpressionPtr build_tree(const std::vector<Token> &postfixTokens,
+                         const Context &context, Scratch &scratch) {
+  auto &expressions = scratch.expressions;
+  auto &arguments = scratch.arguments;
+  expressions.clear();
   double value;
   BinaryOperationPtr bop;
   UnaryOperationPtr uop;
   PlaceHolderPtr placeholder;
+  VectorPlaceHolderPtr vector;
+  TablePtr table;
+  auto scalar = [](const ExpressionPtr &operand) {
+    if (isTable(operand)) {
+      throw std::invalid_argument("Tables can only be passed to interp");
+    }
+    return operand;
+  };
 
-  while (!postfixTokens.empty()) {
-    auto &token = postfixTokens.front();
-    if (token.isConst(value)) {
-      expressions.push(std::make_shared<ConstExpression>(value));
+  for (const auto &token : postfixTokens) {
+    if (token.call) {
+      if (expressions.size() < token.arguments) {
+        throw std::invalid_argument("Missing arguments in call to " +
+                                    std::string(token.value));
+      }
+      arguments.resize(token.arguments);
+      for (size_t i = token.arguments; i-- > 0;) {
+        arguments[i] = std::move(expressions.back());
+        expressions.pop_back();
+      }
+      expressions.push_back(build_call(token, arguments, context, scratch));
+    } else if (token.isConst(value)) {
+      expressions.push_back(std::make_shared<ConstExpression>(value));
     } else if (token.isBinaryOperation(context, bop)) {
-      auto right = expressions.top();
-      expressions.pop();
-      auto left = expressions.top();
-      expressions.pop();
-      expressions.push(bop->create(left, right));
+      if (expressions.size() < 2) {
+        throw std::invalid_argument("Missing operand for " +
+                                    std::string(token.value));
+      }
+      auto right = scalar(expressions.back());
+      expressions.pop_back();
+      auto left = scalar(expressions.back());
+      expressions.pop_back();
+      if (isVector(left) || isVector(right)) {
+        expressions.push_back(componentwise({left, right}, [&](const auto &operands) {
+          return bop->create(operands[0], operands[1]);
+        }));
+      } else {
+        expressions.push_back(bop->create(left, right));
+      }
     } else if (token.isUnaryOperation(context, uop)) {
-      auto operand = expressions.top();
-      expressions.pop();
-      expressions.push(uop->create(operand));
+      if (expressions.empty()) {
+        throw std::invalid_argument("Missing operand for " +
+                                    std::string(token.value));
+      }
+      auto operand = scalar(expressions.back());
+      expressions.pop_back();
+      if (isVector(operand)) {
+        expressions.push_back(componentwise({operand}, [&](const auto &operands) {
+          return uop->create(operands[0]);
+        }));
+      } else {
+        expressions.push_back(uop->create(operand));
+      }
     } else if (token.isVariable(context, value)) {
-      expressions.push(std::make_shared<ConstExpression>(value));
+      expressions.push_back(std::make_shared<ConstExpression>(value));
     } else if (token.isPlaceholder(context, placeholder)) {
-      expressions.push(placeholder);
+      expressions.push_back(placeholder);
+    } else if (token.isVector(context, vector)) {
+      const auto &components = vector->getComponents();
+      expressions.push_back(std::make_shared<VectorExpression>(
+          std::vector<ExpressionPtr>(components.begin(), components.end())));
+    } else if (token.isTable(context, table)) {
+      expressions.push_back(std::make_shared<TableReference>(table));
     } else if (token.isVariable(context, value)) {
-      expressions.push(std::make_shared<ConstExpression>(value));
+      expressions.push_back(std::make_shared<ConstExpression>(value));
     } else if (token.isPlaceholder(context, placeholder)) {
-      expressions.push(placeholder);
+      expressions.push_back(placeholder);
     }
     // else if (token.value == "-") {
-    //   if (expressions.empty() || expressions.top()->getSymbol() == "(") {
+    //   if (expressions.empty() || expressions.back()->getSymbol() == "(") {
     //     // Unary negation
     //     auto operand = std::make_shared<ConstExpression>(0);
-    //     expressions.push(operand);
-    //     expressions.push(std::make_shared<BinaryMinusExpression>());
+    //     expressions.push_back(operand);
+    //     expressions.push_back(std::make_shared<BinaryMinusExpression>());
     //   } else {
     //     // Binary subtraction
-    //     expressions.push(std::make_shared<BinaryMinusExpression>());
+    //     expressions.push_back(std::make_shared<BinaryMinusExpression>());
     //   }
     // }
     else {
       throw std::invalid_argument("Invalid token in postfix expression");
     }
-    postfixTokens.pop();
   }
 
-  return expressions.top();
+  if (expressions.size() != 1) {
+    throw std::invalid_argument("Malformed expression");
+  }
+  auto root = scalar(std::move(expressions.back()));
+  expressions.clear();
+  arguments.clear();
+  return root;
 }
 
-ExpressionPtr parse(std::vector<Token> &tokens, const Context &context) {
-  std::stack<Token> operators;
-  std::queue<Token> postfixTokens;
+// Stops once user functions inline more nodes than the budget of options,
+// when given.
+ExpressionPtr parse(std::vector<Token> &tokens, const Context &context,
+                    Scratch &scratch, const CompileOptions *options = nullptr) {
+  auto &operators = scratch.operators;
+  auto &postfixTokens = scratch.postfix;
+  auto &calls = scratch.calls;
+  operators.clear();
+  postfixTokens.clear();
+  calls.clear();
+  scratch.inlined = 0;
+  scratch.maxInlined = options ? options->maxNodes : std::numeric_limits<size_t>::max();
 
   OperationPtr curr_op;
+  const Token *previous = nullptr;
+
+  // A name followed by "(" is a call: a user function, or a named operation
+  // where an operand is expected, as in max(a, b, c). Infix uses such as
+  // "a max (b)" keep working, and functions may share their name with a
+  // placeholder or variable.
+  for (size_t i = 0; i + 1 < tokens.size(); i++) {
+    auto &token = tokens[i];
+    if (tokens[i + 1].value != "(") {
+      continue;
+    }
+    if (context.hasFunction(token.value)) {
+      token.call = true;
+      continue;
+    }
+    bool operandExpected =
+        i == 0 || tokens[i - 1].value == "(" || tokens[i - 1].value == "," ||
+        (!tokens[i - 1].call && context.hasOperation(tokens[i - 1].value));
+    token.call = operandExpected && std::isalpha(token.value[0]) &&
+                 context.hasOperation(token.value);
+  }
 
   for (auto &token : tokens) {
+    const Token *before = previous;
+    previous = &token;
     if (token.value == "(") {
-      operators.emplace(token);
+      calls.push_back(before && before->call ? 0 : Scratch::noCall);
+      operators.emplace_back(token);
       continue;
     }
-    if (token.value == ")") {
-      while (operators.top().value != "(") {
-        postfixTokens.emplace(operators.top());
-        operators.pop();
+    if (token.value == ")" || token.value == ",") {
+      while (!operators.empty() && operators.back().value != "(") {
+        postfixTokens.emplace_back(operators.back());
+        operators.pop_back();
+      }
+      if (operators.empty()) {
+        throw std::invalid_argument("Unbalanced parentheses");
+      }
+      if (token.value == ",") {
+        if (calls.back() == Scratch::noCall) {
+          throw std::invalid_argument("Argument separator outside of a call");
+        }
+        calls.back()++;
+        continue;
+      }
+      operators.pop_back();
+      uint32_t commas = calls.back();
+      calls.pop_back();
+      if (commas != Scratch::noCall) {
+        auto call = operators.back();
+        operators.pop_back();
+        call.arguments = commas + (before->value == "(" ? 0 : 1);
+        postfixTokens.emplace_back(call);
       }
-      operators.pop();
+      continue;
+    }
+    if (token.call) {
+      operators.emplace_back(token);
       continue;
     }
     if (token.isOperation(context, curr_op)) {
       while (!operators.empty()) {
-        auto topOp = operators.top();
-        auto op = context.getOperation(std::string(topOp.value));
+        auto topOp = operators.back();
+        auto op = context.getOperation(topOp.value);
         if (!op.has_value())
           break;
         if (op.value()->precedence() < curr_op->precedence())
           break;
-        postfixTokens.emplace(topOp);
-        operators.pop();
+        postfixTokens.emplace_back(topOp);
+        operators.pop_back();
       }
-      operators.emplace(token);
+      operators.emplace_back(token);
       continue;
     }
-    postfixTokens.push(token);
+    postfixTokens.push_back(token);
   }
 
   while (!operators.empty()) {
-    postfixTokens.emplace(operators.top());
-    operators.pop();
+    postfixTokens.emplace_back(operators.back());
+    operators.pop_back();
   }
 
-  return build_tree(postfixTokens, context);
+  return build_tree(postfixTokens, context, scratch);
 }
 
-ExpressionPtr optimize(ExpressionPtr expression, const Context &context,
-                       int recursionDepth = 0) {
-  if (recursionDepth >= 20) {
-    return expression;
+// Folds constant operands of a commutative n-ary node into one, as in
+// sum(x, 2, 3) -> sum(x, 5). nullptr when there is nothing to fold.
+ExpressionPtr foldConstants(const operations::VariadicOperation &op) {
+  if (!op.commutative()) {
+    return nullptr;
+  }
+  std::vector<ExpressionPtr> operands;
+  std::vector<double> constants;
+  for (size_t i = 0; i < op.arity(); i++) {
+    const auto &operand = op.getOperandAt(i);
+    if (dynamic_cast<const ConstExpression *>(operand.get())) {
+      constants.push_back(operand->evaluate());
+    } else {
+      operands.push_back(operand);
+    }
   }
+  if (constants.size() < 2) {
+    return nullptr;
+  }
+  operands.push_back(std::make_shared<ConstExpression>(
+      op.apply(constants.data(), constants.size())));
+  return operands.size() == 1 ? operands[0] : op.create(std::move(operands));
+}
+
+// Folds every operation whose operands are all constants. Walks the tree
+// with an explicit stack, so there is no depth limit.
+ExpressionPtr optimize(ExpressionPtr expression, const Context &) {
+  return transform(std::move(expression), [](const ExpressionPtr &node) {
+    auto op = dynamic_cast<const operations::Operation *>(node.get());
+    if (!op || op->arity() == 0 || !op->isPure()) {
+      return node;
+    }
+    for (size_t i = 0; i < op->arity(); i++) {
+      if (!dynamic_cast<const ConstExpression *>(op->getOperandAt(i).get())) {
+        auto variadic = dynamic_cast<const operations::VariadicOperation *>(op);
+        auto folded = variadic ? foldConstants(*variadic) : nullptr;
+        return folded ? folded : node;
+      }
+    }
+    return ExpressionPtr(std::make_shared<ConstExpression>(node->evaluate()));
+  });
+}
 
-  auto constExp = std::dynamic_pointer_cast<ConstExpression>(expression);
-  if (constExp) {
-    return expression;
+// Merges chains of an associative binary operation, such as a+b+c+d, into
+// one n-ary node that evaluates with a balanced reduction instead of a
+// serial chain. Shared subtrees are kept as they are.
+ExpressionPtr flatten(ExpressionPtr expression) {
+  using namespace operations;
+
+  return transform(std::move(expression), [](const ExpressionPtr &node) {
+    auto binaryOp = dynamic_cast<const BinaryOperation *>(node.get());
+    auto nary = binaryOp ? binaryOp->variadic() : nullptr;
+    if (!nary) {
+      return node;
+    }
+    // Operands of a merged child, or the operand itself. The n-ary operands
+    // of a child are moved, not copied, so a long chain flattens in linear
+    // time.
+    auto expand = [&](const ExpressionPtr &operand) {
+      std::vector<ExpressionPtr> operands;
+      if (operand.use_count() == 1) {
+        if (typeid(*operand) == typeid(*nary)) {
+          return static_cast<VariadicOperation &>(*operand).takeOperands();
+        }
+        if (typeid(*operand) == typeid(*binaryOp)) {
+          auto &op = static_cast<const BinaryOperation &>(*operand);
+          return std::vector<ExpressionPtr>{op.getLeft(), op.getRight()};
+        }
+      }
+      operands.push_back(operand);
+      return operands;
+    };
+    auto operands = expand(binaryOp->getOperandAt(0));
+    auto right = expand(binaryOp->getOperandAt(1));
+    if (operands.size() + right.size() < 3) {
+      return node;
+    }
+    if (operands.size() < right.size()) {
+      right.insert(right.begin(), std::make_move_iterator(operands.begin()),
+                   std::make_move_iterator(operands.end()));
+      operands = std::move(right);
+    } else {
+      operands.insert(operands.end(), std::make_move_iterator(right.begin()),
+                      std::make_move_iterator(right.end()));
+    }
+    return nary->create(std::move(operands));
+  });
+}
+
+// Dense polynomial in a single placeholder; coefficients[k] multiplies x^k.
+struct Polynomial {
+  static constexpr size_t maxDegree = 16;
+
+  PlaceHolderPtr variable;
+  std::vector<double> coefficients;
+  size_t operations = 0; // Operation nodes in the source subtree
+  bool hasPower = false;  // Source calls std::pow, always worth replacing
+
+  size_t degree() const {
+    return coefficients.empty() ? 0 : coefficients.size() - 1;
   }
+};
+
+bool isFinite(const std::vector<double> &coefficients) {
+  return std::all_of(coefficients.begin(), coefficients.end(),
+                     [](double c) { return std::isfinite(c); });
+}
+
+// Product of two polynomials. Fails when a coefficient is not finite, before
+// or after: the zero coefficients would turn 0 * inf into NaN where the
+// source gives inf.
+bool multiply(const std::vector<double> &left, const std::vector<double> &right,
+              std::vector<double> &result) {
+  if (left.size() + right.size() - 1 > Polynomial::maxDegree + 1 || !isFinite(left) ||
+      !isFinite(right)) {
+    return false;
+  }
+  result.assign(left.size() + right.size() - 1, 0.0);
+  for (size_t i = 0; i < left.size(); i++) {
+    for (size_t j = 0; j < right.size(); j++) {
+      result[i + j] += left[i] * right[j];
+    }
+  }
+  return isFinite(result);
+}
+
+// Combines the polynomials of the operands of +, -, *, unary minus, division
+// by a constant and non-negative integer powers.
+bool combine(const ExpressionPtr &expression, Polynomial *operands,
+             size_t count, Polynomial &poly) {
+  using namespace operations;
 
-  auto unaryOp = std::dynamic_pointer_cast<UnaryOperation>(expression);
-  if (unaryOp) {
-    auto operand = optimize(unaryOp->getOperand(), context, recursionDepth + 1);
-    unaryOp->setOperand(operand);
-    if (std::dynamic_pointer_cast<ConstExpression>(operand)) {
-      return std::make_shared<ConstExpression>(unaryOp->evaluate());
+  auto &left = operands[0];
+  if (count == 1) {
+    if (!std::dynamic_pointer_cast<NegateOperation>(expression)) {
+      return false;
+    }
+    poly = std::move(left);
+    for (auto &c : poly.coefficients) {
+      c = -c;
     }
-    return expression;
+    poly.operations++;
+    return true;
+  }
+
+  if (count != 2) {
+    return false;
+  }
+  auto &right = operands[1];
+  if (left.variable && right.variable && left.variable != right.variable) {
+    return false;
   }
+  poly.variable = left.variable ? left.variable : right.variable;
+  poly.operations = left.operations + right.operations + 1;
+  poly.hasPower = left.hasPower || right.hasPower;
 
-  auto binaryOp = std::dynamic_pointer_cast<BinaryOperation>(expression);
-  if (binaryOp) {
-    auto left = optimize(binaryOp->getLeft(), context, recursionDepth + 1);
-    auto right = optimize(binaryOp->getRight(), context, recursionDepth + 1);
-    binaryOp->setLeft(left);
-    binaryOp->setRight(right);
-    if (std::dynamic_pointer_cast<ConstExpression>(left) &&
-        std::dynamic_pointer_cast<ConstExpression>(right)) {
-      return std::make_shared<ConstExpression>(binaryOp->evaluate());
+  if (std::dynamic_pointer_cast<AddOperation>(expression) ||
+      std::dynamic_pointer_cast<SubtractOperation>(expression)) {
+    double sign = std::dynamic_pointer_cast<AddOperation>(expression) ? 1 : -1;
+    poly.coefficients = std::move(left.coefficients);
+    poly.coefficients.resize(
+        std::max(poly.coefficients.size(), right.coefficients.size()), 0.0);
+    for (size_t i = 0; i < right.coefficients.size(); i++) {
+      poly.coefficients[i] += sign * right.coefficients[i];
     }
-    return expression;
+    return true;
+  }
+  if (std::dynamic_pointer_cast<MultiplyOperation>(expression)) {
+    return multiply(left.coefficients, right.coefficients, poly.coefficients);
   }
 
+  // Division and power need a constant right operand.
+  if (right.variable || right.coefficients.size() != 1) {
+    return false;
+  }
+  double value = right.coefficients[0];
+  if (std::dynamic_pointer_cast<DivideOperation>(expression)) {
+    // Dividing the zero coefficients by zero or infinity would give NaN.
+    if (value == 0 || !std::isfinite(value)) {
+      return false;
+    }
+    poly.coefficients = std::move(left.coefficients);
+    for (auto &c : poly.coefficients) {
+      c /= value;
+    }
+    return true;
+  }
+  if (std::dynamic_pointer_cast<PowerOperation>(expression)) {
+    if (value < 0 || value != std::floor(value) ||
+        left.degree() * value > Polynomial::maxDegree) {
+      return false;
+    }
+    poly.hasPower = true;
+    poly.coefficients = {1};
+    for (int i = 0; i < static_cast<int>(value); i++) {
+      std::vector<double> product;
+      if (!multiply(poly.coefficients, left.coefficients, product)) {
+        return false;
+      }
+      poly.coefficients = std::move(product);
+    }
+    return true;
+  }
+  return false;
+}
+
+// Evaluates the polynomial as ((c[n] * x + c[n-1]) * x + ...) + c[0], one
+// fused multiply-add per degree, or a plain multiply where the coefficient
+// is zero.
+ExpressionPtr buildHorner(const Polynomial &poly) {
+  using namespace operations;
+
+  auto &c = poly.coefficients;
+  ExpressionPtr result = std::make_shared<ConstExpression>(c.back());
+  for (size_t k = c.size() - 1; k-- > 0;) {
+    if (c[k] == 0) {
+      result = std::make_shared<MultiplyOperation>(result, poly.variable);
+    } else {
+      result = std::make_shared<FusedMultiplyAddOperation>(
+          result, poly.variable, std::make_shared<ConstExpression>(c[k]));
+    }
+  }
+  return result;
+}
+
+// Replaces a maximal polynomial subtree by its Horner form when the source
+// calls pow or spends more operations than Horner needs.
+void rewritePolynomial(ExpressionPtr &expression, Polynomial &poly) {
+  while (poly.coefficients.size() > 1 && poly.coefficients.back() == 0) {
+    poly.coefficients.pop_back();
+  }
+  if (poly.variable && poly.degree() >= 2 &&
+      (poly.hasPower || poly.operations > poly.degree())) {
+    expression = buildHorner(poly);
+  }
+}
+
+// Rewrites polynomial subtrees into Horner form. The polynomial of every
+// subtree is computed bottom-up with an explicit stack, and only the largest
+// ones are rewritten. Shared subtrees, such as the arguments of inlined
+// calls, are inspected once and their polynomial reused, so the pass is
+// linear in the distinct nodes rather than in the paths to them. Runs after
+// optimize, so coefficient subexpressions are already folded to constants.
+ExpressionPtr horner(ExpressionPtr expression) {
+  using operations::Operation;
+
+  struct Frame {
+    ExpressionPtr node;
+    Operation *operation;
+    size_t next;
+  };
+  std::vector<Frame> stack;
+  std::vector<std::optional<Polynomial>> results;
+  // Keyed by the node, which the entry keeps alive so its address is not
+  // reused by a rewritten one.
+  std::unordered_map<const Expression *, std::pair<ExpressionPtr, std::optional<Polynomial>>>
+      shared;
+
+  auto push = [&stack](ExpressionPtr node) {
+    auto operation = dynamic_cast<Operation *>(node.get());
+    stack.push_back({std::move(node), operation, 0});
+  };
+
+  push(expression);
+  while (!stack.empty()) {
+    auto &frame = stack.back();
+    if (frame.operation && frame.next < frame.operation->arity()) {
+      const auto &operand = frame.operation->getOperandAt(frame.next++);
+      auto it = shared.find(operand.get());
+      if (it != shared.end()) {
+        results.push_back(it->second.second);
+      } else {
+        push(operand);
+      }
+      continue;
+    }
+
+    std::optional<Polynomial> poly;
+    if (auto constExp = dynamic_cast<const ConstExpression *>(frame.node.get())) {
+      poly.emplace();
+      poly->coefficients = {constExp->evaluate()};
+    } else if (auto placeholder =
+                   std::dynamic_pointer_cast<PlaceHolder>(frame.node)) {
+      poly.emplace();
+      poly->variable = placeholder;
+      poly->coefficients = {0, 1};
+    } else if (frame.operation) {
+      size_t arity = frame.operation->arity();
+      auto operands = results.end() - arity;
+      bool all = arity <= 2 &&
+                 std::all_of(operands, results.end(),
+                             [](const auto &p) { return p.has_value(); });
+      if (all) {
+        Polynomial values[2];
+        for (size_t i = 0; i < arity; i++) {
+          values[i] = std::move(**(operands + i));
+        }
+        poly.emplace();
+        if (!combine(frame.node, values, arity, *poly)) {
+          poly.reset();
+          // Restore the operands so they can be rewritten below.
+          for (size_t i = 0; i < arity; i++) {
+            *(operands + i) = std::move(values[i]);
+          }
+        }
+      }
+      if (!poly) {
+        for (size_t i = 0; i < arity; i++) {
+          if (auto &operandPoly = *(operands + i)) {
+            auto operand = frame.operation->getOperandAt(i);
+            rewritePolynomial(operand, *operandPoly);
+            frame.operation->setOperandAt(i, std::move(operand));
+          }
+        }
+      }
+      results.erase(operands, results.end());
+      // Held by its parent and by this frame, and by more parents when
+      // shared.
+      if (frame.node.use_count() > 2) {
+        shared.emplace(frame.node.get(), std::make_pair(frame.node, poly));
+      }
+    }
+    results.push_back(std::move(poly));
+    stack.pop_back();
+  }
+
+  if (results.back()) {
+    rewritePolynomial(expression, *results.back());
+  }
   return expression;
 }
 
+std::string_view trim(std::string_view text) {
+  auto begin = text.find_first_not_of(' ');
+  if (begin == std::string_view::npos) {
+    return {};
+  }
+  return text.substr(begin, text.find_last_not_of(' ') - begin + 1);
+}
+
+bool isIdentifier(std::string_view name) {
+  return !name.empty() && (std::isalpha(name[0]) || name[0] == '_') &&
+         std::all_of(name.begin(), name.end(),
+                     [](char c) { return std::isalnum(c) || c == '_'; });
+}
+
+FunctionPtr ExpressionSolver::parseFunction(const std::string &definition) const {
+  auto equals = definition.find('=');
+  auto open = definition.find('(');
+  auto close = definition.find(')');
+  if (equals == std::string::npos || open > close || close > equals) {
+    throw std::invalid_argument("Expected a definition like f(x, y) = body");
+  }
+
+  std::string_view header(definition);
+  auto name = trim(header.substr(0, open));
+  if (!isIdentifier(name)) {
+    throw std::invalid_argument("Invalid function name");
+  }
+
+  // Parameters are placeholders visible only while parsing the body.
+  Context scope = context;
+  std::vector<PlaceHolderPtr> parameters;
+  auto list = header.substr(open + 1, close - open - 1);
+  while (!trim(list).empty()) {
+    auto comma = list.find(',');
+    auto parameter = trim(list.substr(0, comma));
+    if (!isIdentifier(parameter) || scope.hasVariable(parameter)) {
+      throw std::invalid_argument("Invalid function parameter: " +
+                                  std::string(parameter));
+    }
+    for (const auto &other : parameters) {
+      if (other->getIdentifier() == parameter) {
+        throw std::invalid_argument("Duplicate function parameter: " +
+                                    std::string(parameter));
+      }
+    }
+    parameters.push_back(std::make_shared<PlaceHolder>(std::string(parameter), 0));
+    scope.addPlaceholder(parameters.back());
+    if (comma == std::string_view::npos) {
+      break;
+    }
+    list = list.substr(comma + 1);
+  }
+
+  auto body = definition.substr(equals + 1);
+  auto &scratch = Scratch::local();
+  tokenize(body, scope, scratch.tokens);
+  auto parsed = parse(scratch.tokens, scope, scratch);
+  if (isVector(parsed)) {
+    throw std::invalid_argument("Function bodies must be scalar");
+  }
+  parsed = optimize(std::move(parsed), scope);
+  return std::make_shared<Function>(std::string(name), std::move(parameters),
+                                    std::move(parsed));
+}
+
+// Runs the optimization passes and wraps the result for flat evaluation.
+ExpressionPtr finish(ExpressionPtr tree, const Context &context) {
+  auto optimized = shortCircuit(
+      memoize(approximate(flatten(horner(optimize(std::move(tree), context))),
+                          context.getTolerance()),
+              context.getMemoized(), context.getMemoCapacity()));
+  if (std::dynamic_pointer_cast<operations::Operation>(optimized)) {
+    return std::make_shared<CompiledExpression>(std::move(optimized));
+  }
+  return optimized;
+}
+
 ExpressionPtr ExpressionSolver::compile(const std::string &expression) const {
-  auto tokens = tokenize(expression, context);
-  auto parsed = parse(tokens, context);
-  return optimize(parsed, context);
+  auto &scratch = Scratch::local();
+  tokenize(expression, context, scratch.tokens);
+  auto parsed = parse(scratch.tokens, context, scratch);
+  if (isVector(parsed)) {
+    throw std::invalid_argument("Expression is a vector; use compileVector");
+  }
+  return finish(std::move(parsed), context);
+}
+
+std::expected<ExpressionPtr, CompileError>
+ExpressionSolver::tryCompile(const std::string &expression, const CompileOptions &options) const {
+  using Kind = CompileError::Kind;
+  if (expression.size() > options.maxLength) {
+    return std::unexpected(CompileError{
+        Kind::Length, "Longer than " + std::to_string(options.maxLength) + " characters",
+        options.maxLength});
+  }
+  try {
+    auto &scratch = Scratch::local();
+    if (auto error = tokenize(expression, context, scratch.tokens, &options)) {
+      return std::unexpected(std::move(*error));
+    }
+    auto parsed = parse(scratch.tokens, context, scratch, &options);
+    if (isVector(parsed)) {
+      return std::unexpected(
+          CompileError{Kind::Syntax, "Expression is a vector; use compileVector"});
+    }
+    // Counting is a pass over the tree, skipped without a budget.
+    if (options.maxNodes < std::numeric_limits<size_t>::max() ||
+        options.maxSamples < std::numeric_limits<size_t>::max()) {
+      auto code = linearize(*parsed);
+      size_t nodes = code.nodes.size();
+      if (nodes > options.maxNodes) {
+        return std::unexpected(CompileError{Kind::Nodes, std::to_string(nodes) + " nodes, above " +
+                                                             std::to_string(options.maxNodes)});
+      }
+      size_t samples = 0;
+      for (const auto &node : code.nodes) {
+        if (auto streaming = dynamic_cast<const operations::StreamingOperation *>(node.operation)) {
+          samples += streaming->samples();
+        }
+      }
+      if (samples > options.maxSamples) {
+        return std::unexpected(CompileError{Kind::Samples, "Keeps " + std::to_string(samples) +
+                                                               " samples, above " +
+                                                               std::to_string(options.maxSamples)});
+      }
+    }
+    auto compiled = finish(std::move(parsed), context);
+    if (options.maxCost < std::numeric_limits<double>::infinity()) {
+      auto program = std::dynamic_pointer_cast<const CompiledExpression>(compiled);
+      double cost = program ? program->cost() : 0;
+      if (cost > options.maxCost) {
+        return std::unexpected(CompileError{Kind::Cost, "Costs " + std::to_string(cost) +
+                                                            " per value, above " +
+                                                            std::to_string(options.maxCost)});
+      }
+    }
+    return compiled;
+  } catch (const NodeBudgetExceeded &error) {
+    return std::unexpected(CompileError{Kind::Nodes, std::to_string(error.nodes) +
+                                                         " nodes from inlined functions, above " +
+                                                         std::to_string(options.maxNodes)});
+  } catch (const std::bad_alloc &) {
+    return std::unexpected(CompileError{Kind::Memory, "Out of memory"});
+  } catch (const std::exception &error) {
+    return std::unexpected(CompileError{Kind::Syntax, error.what()});
+  }
+}
+
+std::vector<ExpressionPtr>
+ExpressionSolver::compileVector(const std::string &expression) const {
+  auto &scratch = Scratch::local();
+  tokenize(expression, context, scratch.tokens);
+  auto parsed = parse(scratch.tokens, context, scratch);
+  std::vector<ExpressionPtr> components;
+  if (auto vector = std::dynamic_pointer_cast<VectorExpression>(parsed)) {
+    for (const auto &component : vector->getComponents()) {
+      components.push_back(finish(component, context));
+    }
+  } else {
+    components.push_back(finish(std::move(parsed), context));
+  }
+  return components;
+}
+
+ExpressionPtr ExpressionSolver::specialize(
+    const ExpressionPtr &expression,
+    const std::unordered_map<std::string, double> &values) const {
+  auto compiled = std::dynamic_pointer_cast<CompiledExpression>(expression);
+  const auto &root = compiled ? compiled->getRoot() : expression;
+
+  std::unordered_map<const Expression *, ExpressionPtr> replacements;
+  for (const auto &node : linearize(*root).nodes) {
+    auto placeholder = dynamic_cast<const PlaceHolder *>(node.expression);
+    if (!placeholder || replacements.contains(placeholder)) {
+      continue;
+    }
+    auto it = values.find(std::string(placeholder->getIdentifier()));
+    if (it != values.end()) {
+      replacements.emplace(placeholder,
+                           std::make_shared<ConstExpression>(it->second));
+    }
+  }
+  return finish(copyTree(root, replacements), context);
+}
+
+std::vector<std::expected<ExpressionPtr, std::string>>
+ExpressionSolver::compileAll(std::span<const std::string> expressions,
+                             ThreadPool &pool) const {
+  std::vector<std::expected<ExpressionPtr, std::string>> results(expressions.size());
+
+  // A few chunks per worker evens out inputs of different sizes.
+  size_t chunks = std::min(expressions.size(), pool.size() * 8);
+  std::vector<std::future<void>> pending;
+  pending.reserve(chunks);
+  for (size_t chunk = 0; chunk < chunks; chunk++) {
+    size_t begin = expressions.size() * chunk / chunks;
+    size_t end = expressions.size() * (chunk + 1) / chunks;
+    pending.push_back(pool.submit([this, expressions, &results, begin, end] {
+      for (size_t i = begin; i < end; i++) {
+        try {
+          results[i] = compile(expressions[i]);
+        } catch (const std::exception &error) {
+          results[i] = std::unexpected(std::string(error.what()));
+        }
+      }
+    }));
+  }
+  for (auto &future : pending) {
+    future.wait();
+  }
+  for (auto &future : pending) {
+    future.get();
+  }
+  return results;
+}
+
+std::future<ExpressionPtr>
+ExpressionSolver::compileAsync(std::string expression, ThreadPool &pool) const {
+  return pool.submit([solver = *this, expression = std::move(expression)] {
+    return solver.compile(expression);
+  });
+}
+
+std::future<std::vector<ExpressionPtr>>
+ExpressionSolver::compileAsync(std::vector<std::string> expressions,
+                               ThreadPool &pool) const {
+  return pool.submit([solver = *this, expressions = std::move(expressions)] {
+    std::vector<ExpressionPtr> compiled;
+    compiled.reserve(expressions.size());
+    for (const auto &expression : expressions) {
+      compiled.push_back(solver.compile(expression));
+    }
+    return compiled;
+  });
+}
+
+size_t ExpressionSolver::solveWhere(const ExpressionPtr &guard,
+                                   const ExpressionPtr &expression,
+                                   std::span<const Binding> bindings,
+                                   std::span<double> results, SelectionOutput output,
+                                   std::vector<uint32_t> *selected) const {
+  size_t rows = results.size();
+  if (rows > std::numeric_limits<uint32_t>::max()) {
+    throw std::invalid_argument("Too many rows for a selection vector");
+  }
+  for (const auto &binding : bindings) {
+    if (binding.values.size() < rows) {
+      throw std::invalid_argument("Binding has fewer values than results");
+    }
+  }
+  auto compiledOf = [](const ExpressionPtr &e) {
+    auto compiled = std::dynamic_pointer_cast<const CompiledExpression>(e);
+    return compiled ? compiled : std::make_shared<const CompiledExpression>(e);
+  };
+  auto compiledGuard = compiledOf(guard);
+  auto compiledExpression = compiledOf(expression);
+
+  // Rows go through in chunks: the guard fills a selection vector of the
+  // chunk's passing rows, and the expression runs on those alone.
+  constexpr size_t chunk = 4096;
+  std::vector<double> conditions(std::min(chunk, rows));
+  std::vector<uint32_t> selection(std::min(chunk, rows));
+  std::vector<double> values(std::min(chunk, rows));
+  std::vector<Binding> window(bindings.begin(), bindings.end());
+  size_t total = 0;
+  for (size_t start = 0; start < rows; start += chunk) {
+    size_t n = std::min(chunk, rows - start);
+    for (size_t k = 0; k < bindings.size(); k++) {
+      window[k].values = bindings[k].values.subspan(start, n);
+    }
+    compiledGuard->evaluate(window, std::span(conditions).first(n));
+
+    // Branch-free: every row is written, only passing rows advance.
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+      selection[count] = static_cast<uint32_t>(i);
+      count += conditions[i] != 0;
+    }
+    if (count == 0) {
+      continue;
+    }
+
+    auto passing = std::span(selection).first(count);
+    if (output == SelectionOutput::Compact) {
+      compiledExpression->evaluate(window, passing, results.subspan(total, count));
+    } else {
+      compiledExpression->evaluate(window, passing, std::span(values).first(count));
+      for (size_t j = 0; j < count; j++) {
+        results[start + passing[j]] = values[j];
+      }
+    }
+    if (selected) {
+      for (uint32_t row : passing) {
+        selected->push_back(static_cast<uint32_t>(start + row));
+      }
+    }
+    total += count;
+  }
+  return total;
 }
 
-} // namespace expression_solver
\ No newline at end of file
+} // namespace expression_solver
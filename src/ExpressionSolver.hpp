@@ -1,9 +1,25 @@
 #pragma once
 
+#include <expected>
+#include <future>
+#include <limits>
+#include <span>
 #include <string_view>
+#include <unordered_map>
+#include <vector>
 
+#include "CompileOptions.hpp"
+#include "CompiledExpression.hpp"
 #include "Context.hpp"
+#include "CostModel.hpp"
 #include "Expression.hpp"
+#include "Grid.hpp"
+#include "MonteCarlo.hpp"
+#include "RootFinding.hpp"
+#include "RowSelection.hpp"
+#include "Surrogate.hpp"
+#include "Tape.hpp"
+#include "ThreadPool.hpp"
 
 namespace expression_solver {
 
@@ -15,6 +31,56 @@ public:
 
   ExpressionPtr compile(const std::string &expression) const;
 
+  // Compiles input from an untrusted source within the budgets of options.
+  // Budget violations, syntax errors and failed allocations are returned
+  // rather than thrown, and the work spent on a rejected input is bounded by
+  // its budgets.
+  std::expected<ExpressionPtr, CompileError>
+  tryCompile(const std::string &expression, const CompileOptions &options = {}) const;
+
+  // Compiles an expression whose value is a vector, such as
+  // "normalize(cross(a, b)) * 2", to one expression per component. A scalar
+  // expression gives one. compile rejects vector expressions.
+  std::vector<ExpressionPtr> compileVector(const std::string &expression) const;
+
+  // Compiles the expressions in parallel on pool. Workers share this
+  // solver's context read-only and reuse per-thread scratch buffers. Each
+  // result holds the compiled expression or the message of the error its
+  // input raised, so one bad input does not stop the others. Blocks until
+  // all are done; do not call it from a task running on pool.
+  std::vector<std::expected<ExpressionPtr, std::string>>
+  compileAll(std::span<const std::string> expressions,
+             ThreadPool &pool = ThreadPool::shared()) const;
+
+  // Copy of a compiled expression with the named placeholders fixed to the
+  // given values and folded away, so evaluating it only computes the parts
+  // that still vary. The original is left unchanged.
+  ExpressionPtr
+  specialize(const ExpressionPtr &expression,
+             const std::unordered_map<std::string, double> &values) const;
+
+  // Compiles on a pool thread, keeping the caller free. The solver is copied,
+  // so definitions added afterwards do not affect the pending compile. get()
+  // rethrows compile errors.
+  std::future<ExpressionPtr>
+  compileAsync(std::string expression,
+               ThreadPool &pool = ThreadPool::shared()) const;
+
+  // Compiles the expressions in order as one background task.
+  std::future<std::vector<ExpressionPtr>>
+  compileAsync(std::vector<std::string> expressions,
+               ThreadPool &pool = ThreadPool::shared()) const;
+
+  // Parses a definition such as "f(x, y) = x*x + y" against this solver's
+  // context. Register the result in a Context to make it callable.
+  FunctionPtr parseFunction(const std::string &definition) const;
+
+  // Parses a function definition and registers it in this solver's context,
+  // so later compiles can call it. Calls are inlined at compile time.
+  void define(const std::string &definition) {
+    context.addFunction(parseFunction(definition));
+  }
+
   double solve(const std::string &expression) const {
     return solve(compile(expression));
   }
@@ -26,6 +92,112 @@ public:
   double solve(ExpressionPtr expression) const {
     return expression->evaluate();
   }
+
+  // Evaluates expression once per row of the bound columns; see
+  // CompiledExpression::evaluate.
+  void solve(const ExpressionPtr &expression, std::span<const Binding> bindings,
+             std::span<double> results) const {
+    if (auto compiled = std::dynamic_pointer_cast<CompiledExpression>(expression)) {
+      compiled->evaluate(bindings, results);
+    } else {
+      CompiledExpression(expression).evaluate(bindings, results);
+    }
+  }
+
+  // Guarded batch evaluation, for rules of the form "if guard then
+  // expression": guard is evaluated for every row of results, then
+  // expression only for the rows where it is non-zero (NaN included, as in a
+  // condition). With Scatter the value of a selected row goes to its own
+  // index and the other rows keep their contents; with Compact the values
+  // are packed at the front of results in row order. Returns the number of
+  // selected rows; when selected is given, their indices are appended to it.
+  size_t solveWhere(const ExpressionPtr &guard, const ExpressionPtr &expression,
+                    std::span<const Binding> bindings, std::span<double> results,
+                    SelectionOutput output = SelectionOutput::Scatter,
+                    std::vector<uint32_t> *selected = nullptr) const;
+
+  // The k rows of the bindings where expression is highest (or lowest),
+  // best first, evaluated in parallel on pool without storing every value;
+  // see RowSelector.
+  std::vector<RankedRow> solveTop(const ExpressionPtr &expression,
+                                  std::span<const Binding> bindings, size_t rows, size_t k,
+                                  Rank rank = Rank::Highest,
+                                  ThreadPool &pool = ThreadPool::shared()) const {
+    return RowSelector(expression).top(bindings, rows, k, rank, &pool);
+  }
+
+  // The rows of the bindings where expression is above threshold, in row
+  // order; see RowSelector.
+  std::vector<uint32_t> solveAbove(const ExpressionPtr &expression,
+                                   std::span<const Binding> bindings, size_t rows,
+                                   double threshold,
+                                   ThreadPool &pool = ThreadPool::shared()) const {
+    return RowSelector(expression).above(bindings, rows, threshold, &pool);
+  }
+
+  // Solves expression = targets[i] for the unknown placeholder on every row
+  // of the bindings, searching [lower, upper]; see RootFinder. Returns the
+  // number of rows that converged. For many batches over one expression,
+  // keep a RootFinder instead.
+  size_t solveFor(const ExpressionPtr &expression, const PlaceHolder &unknown,
+                  std::span<const Binding> bindings, std::span<const double> targets,
+                  double lower, double upper, std::span<double> roots,
+                  std::span<RootStatus> status = {}, const RootOptions &options = {}) const {
+    return RootFinder(expression, unknown)
+        .solve(bindings, targets, lower, upper, roots, status, options);
+  }
+
+  // Value of the unknown in [lower, upper] where expression equals target,
+  // with the other placeholders at their current values. NaN when there is
+  // no root there or it does not converge.
+  double solveFor(const ExpressionPtr &expression, const PlaceHolder &unknown, double target,
+                  double lower, double upper, const RootOptions &options = {}) const {
+    double root;
+    RootStatus status;
+    RootFinder(expression, unknown)
+        .solve({}, std::span(&target, 1), lower, upper, std::span(&root, 1),
+               std::span(&status, 1), options);
+    return status == RootStatus::Converged ? root : std::numeric_limits<double>::quiet_NaN();
+  }
+
+  // Value of expression at every point of the grid spanned by axes, the
+  // last axis varying fastest; see GridEvaluator. For many grids over one
+  // expression, keep a GridEvaluator instead.
+  void solveGrid(const ExpressionPtr &expression, std::span<const GridAxis> axes,
+                 std::span<double> results) const {
+    std::vector<const PlaceHolder *> placeholders;
+    std::vector<std::span<const double>> values;
+    for (const auto &axis : axes) {
+      placeholders.push_back(axis.placeholder);
+      values.push_back(axis.values);
+    }
+    GridEvaluator(expression, std::move(placeholders)).evaluate(values, results);
+  }
+
+  // Statistics of expression over random draws of the placeholders in
+  // draws, computed in parallel on pool; see MonteCarlo. The same seed gives
+  // the same statistics whatever the size of the pool.
+  SampleStatistics simulate(const ExpressionPtr &expression, std::vector<Draw> draws,
+                            const MonteCarloOptions &options = {},
+                            ThreadPool &pool = ThreadPool::shared()) const {
+    return MonteCarlo(expression, std::move(draws)).run(options, &pool);
+  }
+
+  // A piecewise polynomial standing in for expression over the domain of
+  // axes, within options.tolerance; see buildSurrogate.
+  Surrogate surrogate(const ExpressionPtr &expression, std::span<const SurrogateAxis> axes,
+                      const SurrogateOptions &options = {}) const {
+    return buildSurrogate(expression, axes, options);
+  }
+
+  // Value and gradient with respect to every placeholder in one evaluation.
+  // For repeated use, record into a long-lived Tape instead.
+  GradientResult differentiate(const Expression &expression) const {
+    Tape tape;
+    double value = tape.record(expression);
+    tape.backward();
+    return {value, tape.gradient()};
+  }
 };
 
 } // namespace expression_solver
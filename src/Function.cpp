@@ -0,0 +1,25 @@
+#include "Function.hpp"
+
+#include <algorithm>
+
+#include "Traversal.hpp"
+
+namespace expression_solver {
+
+Function::Function(std::string name, std::vector<PlaceHolderPtr> parameters,
+                   ExpressionPtr body)
+    : name(std::move(name)), parameters(std::move(parameters)), body(std::move(body)) {
+  auto code = linearize(*this->body);
+  operations = std::count_if(code.nodes.begin(), code.nodes.end(),
+                             [](const auto &node) { return node.operation != nullptr; });
+}
+
+ExpressionPtr Function::inlineCall(const ExpressionPtr *arguments) const {
+  std::unordered_map<const Expression *, ExpressionPtr> replacements;
+  for (size_t i = 0; i < parameters.size(); i++) {
+    replacements.emplace(parameters[i].get(), arguments[i]);
+  }
+  return copyTree(body, replacements);
+}
+
+} // namespace expression_solver
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Expression.hpp"
+
+namespace expression_solver {
+
+// A function written in the expression language, such as
+// "f(x, y) = x*x + y". The body is parsed once, with each parameter bound to
+// a placeholder private to the function. Calls are inlined while the caller
+// is parsed, so the optimizer sees through them and they cost nothing at
+// evaluation time.
+class Function {
+  std::string name;
+  std::vector<PlaceHolderPtr> parameters;
+  ExpressionPtr body;
+  size_t operations; // Operation nodes of the body
+
+public:
+  Function(std::string name, std::vector<PlaceHolderPtr> parameters,
+           ExpressionPtr body);
+
+  std::string_view getName() const { return name; }
+  size_t arity() const { return parameters.size(); }
+  const std::vector<PlaceHolderPtr> &getParameters() const { return parameters; }
+  const ExpressionPtr &getBody() const { return body; }
+  // Nodes each call adds to the caller's tree.
+  size_t inlinedNodes() const { return operations; }
+
+  // Copy of the body with every parameter replaced by its argument. An
+  // argument used more than once is shared, not duplicated, so it is still
+  // evaluated once.
+  ExpressionPtr inlineCall(const ExpressionPtr *arguments) const;
+};
+
+typedef std::shared_ptr<const Function> FunctionPtr;
+
+} // namespace expression_solver
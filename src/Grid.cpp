@@ -0,0 +1,235 @@
+#include "Grid.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace expression_solver {
+
+GridAxis GridAxis::range(const PlaceHolder &placeholder, double first, double last,
+                         size_t count) {
+  GridAxis axis{&placeholder, std::vector<double>(count)};
+  for (size_t i = 0; i < count; i++) {
+    axis.values[i] = count == 1 ? first
+                                : first + (last - first) * static_cast<double>(i) /
+                                              static_cast<double>(count - 1);
+  }
+  return axis;
+}
+
+GridEvaluator::GridEvaluator(ExpressionPtr expression, std::vector<const PlaceHolder *> axes)
+    : axes(std::move(axes)) {
+  if (this->axes.empty() || this->axes.size() > maxAxes) {
+    throw std::invalid_argument("A grid has 1 to 16 axes");
+  }
+  for (size_t a = 0; a < this->axes.size(); a++) {
+    if (!this->axes[a] ||
+        std::find(this->axes.begin(), this->axes.begin() + a, this->axes[a]) !=
+            this->axes.begin() + a) {
+      throw std::invalid_argument("Axes must be distinct placeholders");
+    }
+  }
+  compiled = std::dynamic_pointer_cast<const CompiledExpression>(expression);
+  if (!compiled) {
+    compiled = std::make_shared<const CompiledExpression>(std::move(expression));
+  }
+
+  const auto &code = compiled->getCode();
+  uint32_t last = uint32_t(1) << (this->axes.size() - 1);
+  masks.resize(code.nodes.size());
+  inner.resize(code.nodes.size());
+  for (size_t i = 0; i < code.nodes.size(); i++) {
+    const auto &node = code.nodes[i];
+    if (!node.operation) {
+      auto it = std::find(this->axes.begin(), this->axes.end(), node.expression);
+      if (it != this->axes.end()) {
+        masks[i] = uint32_t(1) << (it - this->axes.begin());
+      }
+      continue;
+    }
+    if (!node.operation->isPure()) {
+      throw std::invalid_argument("Grid evaluation needs an expression without streaming operations");
+    }
+    for (uint32_t k = 0; k < node.arity; k++) {
+      masks[i] |= masks[code.operands[node.firstOperand + k]];
+    }
+    inner[i] = (masks[i] & last) && (masks[i] & ~last);
+  }
+}
+
+size_t GridEvaluator::innerCount() const {
+  return std::count(inner.begin(), inner.end(), true);
+}
+
+void GridEvaluator::evaluate(std::span<const std::span<const double>> values,
+                             std::span<double> results) const {
+  size_t dimensions = axes.size();
+  if (values.size() != dimensions) {
+    throw std::invalid_argument("Expected the values of every axis");
+  }
+  std::vector<size_t> sizes(dimensions);
+  size_t points = 1;
+  for (size_t a = 0; a < dimensions; a++) {
+    sizes[a] = values[a].size();
+    points *= sizes[a];
+  }
+  if (results.size() != points) {
+    throw std::invalid_argument("Results must hold one value per grid point");
+  }
+  if (points == 0) {
+    return;
+  }
+  // One axis leaves nothing to hoist but constants, which batches already
+  // evaluate once.
+  if (dimensions == 1) {
+    Binding binding{axes[0], values[0]};
+    compiled->evaluate(std::span(&binding, 1), results);
+    return;
+  }
+
+  const auto &code = compiled->getCode();
+  const uint32_t *operands = code.operands.data();
+  size_t count = code.nodes.size();
+  size_t last = dimensions - 1;
+  size_t width = sizes[last];
+
+  // Tables of the hoisted nodes are laid out over their own axes, the last
+  // one fastest; strides are zero for the other axes.
+  std::vector<size_t> strides(count * dimensions);
+  std::vector<std::vector<double>> tables(count);
+  for (size_t i = 0; i < count; i++) {
+    size_t stride = 1;
+    for (size_t a = dimensions; a-- > 0;) {
+      if (masks[i] >> a & 1) {
+        strides[i * dimensions + a] = stride;
+        stride *= sizes[a];
+      }
+    }
+    if (!inner[i]) {
+      tables[i].resize(stride);
+    }
+  }
+  // Position in the table of node i of the grid point index, ignoring the
+  // axes it does not depend on.
+  auto offset = [&](size_t i, const std::vector<size_t> &index) {
+    size_t position = 0;
+    for (size_t a = 0; a < dimensions; a++) {
+      position += index[a] * strides[i * dimensions + a];
+    }
+    return position;
+  };
+
+  size_t longest = *std::max_element(sizes.begin(), sizes.end());
+  std::vector<double> broadcasts(std::max<size_t>(code.maxArity, 1) * longest);
+  std::vector<const double *> args(std::max<size_t>(code.maxArity, 1));
+  std::vector<double> scalars(args.size());
+  std::vector<size_t> index(dimensions);
+
+  // Hoisted nodes, one row along the last of their axes at a time.
+  for (size_t i = 0; i < count; i++) {
+    if (inner[i]) {
+      continue;
+    }
+    const auto &node = code.nodes[i];
+    auto &table = tables[i];
+    uint32_t mask = masks[i];
+    if (!node.operation) {
+      if (mask == 0) {
+        table[0] = node.expression->evaluate();
+      } else {
+        auto axis = std::countr_zero(mask);
+        std::copy(values[axis].begin(), values[axis].end(), table.begin());
+      }
+      continue;
+    }
+    if (mask == 0) {
+      for (uint32_t k = 0; k < node.arity; k++) {
+        scalars[k] = tables[operands[node.firstOperand + k]][0];
+      }
+      table[0] = node.operation->applyOperands(scalars.data());
+      continue;
+    }
+    size_t row = 31 - std::countl_zero(mask);
+    size_t n = sizes[row];
+    std::fill(index.begin(), index.end(), 0);
+    for (size_t start = 0; start < table.size(); start += n) {
+      for (uint32_t k = 0; k < node.arity; k++) {
+        uint32_t operand = operands[node.firstOperand + k];
+        const double *source = tables[operand].data() + offset(operand, index);
+        if (masks[operand] >> row & 1) {
+          args[k] = source;
+        } else {
+          std::fill_n(&broadcasts[k * longest], n, *source);
+          args[k] = &broadcasts[k * longest];
+        }
+      }
+      node.operation->applyBatch(args.data(), table.data() + start, n);
+      // Next row: advance the other axes of the node, the last one fastest.
+      for (size_t a = row; a-- > 0;) {
+        if (!(mask >> a & 1)) {
+          continue;
+        }
+        if (++index[a] < sizes[a]) {
+          break;
+        }
+        index[a] = 0;
+      }
+    }
+  }
+
+  // Inner nodes, for every point of the other axes, in tiles of the last.
+  size_t tile = std::min<size_t>(width, 1024);
+  std::vector<double> columns(count * tile);
+  std::vector<double> repeated(count * tile); // Hoisted values broadcast along the row
+  std::vector<size_t> repeatedAt(count, SIZE_MAX);
+  bool rootInner = inner[count - 1];
+  std::fill(index.begin(), index.end(), 0);
+  for (size_t outer = 0; outer < points / width; outer++) {
+    double *row = results.data() + outer * width;
+    if (!rootInner) {
+      const double *root = tables[count - 1].data() + offset(count - 1, index);
+      if (masks[count - 1] >> last & 1) {
+        std::copy_n(root, width, row);
+      } else {
+        std::fill_n(row, width, *root);
+      }
+    } else {
+      for (size_t start = 0; start < width; start += tile) {
+        size_t n = std::min(tile, width - start);
+        for (size_t i = 0; i < count; i++) {
+          if (!inner[i]) {
+            continue;
+          }
+          const auto &node = code.nodes[i];
+          for (uint32_t k = 0; k < node.arity; k++) {
+            uint32_t operand = operands[node.firstOperand + k];
+            if (inner[operand]) {
+              args[k] = &columns[operand * tile];
+            } else if (masks[operand] >> last & 1) {
+              args[k] = tables[operand].data() + offset(operand, index) + start;
+            } else {
+              if (repeatedAt[operand] != outer) {
+                std::fill_n(&repeated[operand * tile], tile,
+                            tables[operand][offset(operand, index)]);
+                repeatedAt[operand] = outer;
+              }
+              args[k] = &repeated[operand * tile];
+            }
+          }
+          double *out = i + 1 == count ? row + start : &columns[i * tile];
+          node.operation->applyBatch(args.data(), out, n);
+        }
+      }
+    }
+    for (size_t a = last; a-- > 0;) {
+      if (++index[a] < sizes[a]) {
+        break;
+      }
+      index[a] = 0;
+    }
+  }
+}
+
+} // namespace expression_solver
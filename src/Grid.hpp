@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "CompiledExpression.hpp"
+
+namespace expression_solver {
+
+// The values a placeholder takes along one axis of a grid.
+struct GridAxis {
+  const PlaceHolder *placeholder;
+  std::vector<double> values;
+
+  // count evenly spaced values from first to last, both included.
+  static GridAxis range(const PlaceHolder &placeholder, double first, double last, size_t count);
+};
+
+// Evaluates an expression at every point of a grid, the Cartesian product of
+// the values of some of its placeholders, the axes. Results are row-major:
+// the last axis varies fastest.
+//
+// Every node depends on a subset of the axes, and is evaluated once per
+// point of that subset only: in f(x, y) = sin(x) * cos(y) + x * y, sin(x)
+// runs once per x and cos(y) once per y. Nodes that depend on the last axis
+// and on another one are the inner nodes, evaluated along rows of the last
+// axis in tiles, with the hoisted values of the other nodes read from their
+// tables or broadcast. The other nodes fill tables over their own axes
+// first, which are at most as large as the grid without its last axis.
+class GridEvaluator {
+  std::shared_ptr<const CompiledExpression> compiled;
+  std::vector<const PlaceHolder *> axes;
+  std::vector<uint32_t> masks; // Per node: bit a is set when it depends on axes[a]
+  std::vector<bool> inner;
+
+public:
+  static constexpr size_t maxAxes = 16;
+
+  // Expressions with streaming operations are rejected, since hoisting
+  // changes how many times each node is evaluated. Placeholders that are
+  // not axes keep their current values.
+  GridEvaluator(ExpressionPtr expression, std::vector<const PlaceHolder *> axes);
+
+  // values holds the values of each axis, in the order of the axes; results
+  // holds one value per grid point.
+  void evaluate(std::span<const std::span<const double>> values, std::span<double> results) const;
+
+  // Operations evaluated at every point of the grid.
+  size_t innerCount() const;
+};
+
+} // namespace expression_solver
@@ -0,0 +1,345 @@
+#include "Memoization.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+#include <typeinfo>
+#include <unordered_map>
+
+#include "Tape.hpp"
+
+namespace expression_solver {
+
+namespace memoization {
+
+MemoTable::MemoTable(size_t keys, size_t capacity)
+    : keyCount(keys), stride(keys + 2), mask(std::bit_ceil(std::max<size_t>(capacity, probes)) - 1),
+      words(std::make_unique<std::atomic<uint64_t>[]>((mask + 1) * stride)) {
+  if (keys == 0 || keys > maxKeys) {
+    throw std::invalid_argument("Memoization needs between 1 and 8 keys");
+  }
+}
+
+size_t MemoTable::hash(const uint64_t *key) const {
+  // Small integers and round numbers differ only in their high bits, so
+  // every key word is mixed down into the low bits the table indexes with.
+  uint64_t h = 0x9E3779B97F4A7C15ull;
+  for (size_t k = 0; k < keyCount; k++) {
+    h ^= key[k];
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+  }
+  return static_cast<size_t>(h);
+}
+
+bool MemoTable::lookup(const uint64_t *key, double &value) const {
+  size_t home = hash(key);
+  for (size_t p = 0; p < probes; p++) {
+    auto *entry = slot((home + p) & mask);
+    uint64_t sequence = entry[0].load(std::memory_order_acquire);
+    if (sequence == 0) {
+      return false; // Entries are never removed, so the key is not further on
+    }
+    if (sequence & 1) {
+      continue;
+    }
+    bool match = true;
+    for (size_t k = 0; k < keyCount; k++) {
+      match &= entry[k + 2].load(std::memory_order_relaxed) == key[k];
+    }
+    uint64_t bits = entry[1].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (match && entry[0].load(std::memory_order_relaxed) == sequence) {
+      value = std::bit_cast<double>(bits);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool MemoTable::insert(const uint64_t *key, double value) {
+  size_t home = hash(key);
+  std::atomic<uint64_t> *target = nullptr;
+  uint64_t sequence = 0;
+  for (size_t p = 0; p < probes && !target; p++) {
+    auto *entry = slot((home + p) & mask);
+    sequence = entry[0].load(std::memory_order_acquire);
+    if (sequence == 0) {
+      target = entry;
+    } else if (!(sequence & 1)) {
+      bool match = true;
+      for (size_t k = 0; k < keyCount; k++) {
+        match &= entry[k + 2].load(std::memory_order_relaxed) == key[k];
+      }
+      if (match) {
+        target = entry;
+      }
+    }
+  }
+  if (!target) {
+    target = slot(home & mask);
+    sequence = target[0].load(std::memory_order_acquire);
+    evictions.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  if ((sequence & 1) ||
+      !target[0].compare_exchange_strong(sequence, sequence | 1, std::memory_order_acq_rel)) {
+    return false;
+  }
+  target[1].store(std::bit_cast<uint64_t>(value), std::memory_order_relaxed);
+  for (size_t k = 0; k < keyCount; k++) {
+    target[k + 2].store(key[k], std::memory_order_relaxed);
+  }
+  target[0].store((sequence | 1) + 1, std::memory_order_release);
+  return true;
+}
+
+MemoStatistics MemoTable::statistics() const {
+  return {hits.load(std::memory_order_relaxed), misses.load(std::memory_order_relaxed),
+          evictions.load(std::memory_order_relaxed), capacity()};
+}
+
+void MemoTable::count(uint64_t hitCount, uint64_t missCount) {
+  hits.fetch_add(hitCount, std::memory_order_relaxed);
+  misses.fetch_add(missCount, std::memory_order_relaxed);
+}
+
+} // namespace memoization
+
+namespace operations {
+
+MemoizedOperation::MemoizedOperation(ExpressionPtr body, std::vector<PlaceHolderPtr> keys,
+                                     size_t capacity)
+    : keys(keys.begin(), keys.end()),
+      body(std::make_shared<CompiledExpression>(std::move(body))),
+      table(keys.size(), capacity) {
+  for (const auto &key : keys) {
+    placeholders.push_back(key.get());
+  }
+}
+
+double MemoizedOperation::evaluate() const {
+  double values[memoization::MemoTable::maxKeys];
+  for (size_t k = 0; k < keys.size(); k++) {
+    values[k] = keys[k]->evaluate();
+  }
+  return applyOperands(values);
+}
+
+double MemoizedOperation::applyOperands(const double *values) const {
+  const double *operands[memoization::MemoTable::maxKeys];
+  for (size_t k = 0; k < keys.size(); k++) {
+    operands[k] = values + k;
+  }
+  double result;
+  applyBatch(operands, &result, 1);
+  return result;
+}
+
+void MemoizedOperation::applyBatch(const double *const *operands, double *out,
+                                   size_t count) const {
+  uint64_t key[memoization::MemoTable::maxKeys] = {};
+  std::vector<uint32_t> missed;
+  for (size_t i = 0; i < count; i++) {
+    for (size_t k = 0; k < keys.size(); k++) {
+      key[k] = std::bit_cast<uint64_t>(operands[k][i]);
+    }
+    if (!table.lookup(key, out[i])) {
+      missed.push_back(static_cast<uint32_t>(i));
+    }
+  }
+  if (!missed.empty()) {
+    computeMisses(operands, missed.data(), missed.size(), out);
+  }
+  table.count(count - missed.size(), missed.size());
+}
+
+void MemoizedOperation::computeMisses(const double *const *operands, const uint32_t *rows,
+                                      size_t count, double *out) const {
+  // The keys of the missed rows as short columns, evaluated in one batch.
+  size_t arity = keys.size();
+  std::vector<double> columns(arity * count + count);
+  std::vector<Binding> bindings(arity);
+  for (size_t k = 0; k < arity; k++) {
+    double *column = &columns[k * count];
+    for (size_t j = 0; j < count; j++) {
+      column[j] = operands[k][rows[j]];
+    }
+    bindings[k] = {placeholders[k], {column, count}};
+  }
+  std::span<double> results(&columns[arity * count], count);
+  body->evaluate(bindings, results);
+
+  uint64_t key[memoization::MemoTable::maxKeys];
+  for (size_t j = 0; j < count; j++) {
+    for (size_t k = 0; k < arity; k++) {
+      key[k] = std::bit_cast<uint64_t>(columns[k * count + j]);
+    }
+    table.insert(key, results[j]);
+    out[rows[j]] = results[j];
+  }
+}
+
+size_t MemoizedOperation::record(Tape &tape, const size_t *operands) const {
+  // The subtree is recorded node by node, with its placeholders read from
+  // the operand slots, so derivatives go through it unchanged.
+  const auto &code = body->getCode();
+  std::vector<size_t> slots(code.nodes.size());
+  std::vector<size_t> args(code.maxArity);
+  for (size_t i = 0; i < code.nodes.size(); i++) {
+    const auto &node = code.nodes[i];
+    if (!node.operation) {
+      auto key = std::find(placeholders.begin(), placeholders.end(), node.expression);
+      slots[i] = key != placeholders.end() ? operands[key - placeholders.begin()]
+                                           : node.expression->record(tape, nullptr);
+      continue;
+    }
+    for (uint32_t k = 0; k < node.arity; k++) {
+      args[k] = slots[code.operands[node.firstOperand + k]];
+    }
+    slots[i] = node.expression->record(tape, args.data());
+  }
+  return slots.back();
+}
+
+ExpressionPtr MemoizedOperation::expand() const {
+  std::unordered_map<const Expression *, ExpressionPtr> replacements;
+  for (size_t k = 0; k < keys.size(); k++) {
+    if (keys[k].get() != placeholders[k]) {
+      replacements.emplace(placeholders[k], keys[k]);
+    }
+  }
+  return copyTree(getBody(), replacements);
+}
+
+ExpressionPtr MemoizedOperation::rebuild(const ExpressionPtr *operands) const {
+  std::vector<PlaceHolderPtr> renamed;
+  std::unordered_map<const Expression *, ExpressionPtr> replacements;
+  for (size_t k = 0; k < keys.size(); k++) {
+    if (auto placeholder = std::dynamic_pointer_cast<PlaceHolder>(operands[k])) {
+      renamed.push_back(std::move(placeholder));
+    }
+    if (operands[k].get() != placeholders[k]) {
+      replacements.emplace(placeholders[k], operands[k]);
+    }
+  }
+  auto copy = copyTree(getBody(), replacements);
+  if (renamed.size() == keys.size()) {
+    return std::make_shared<MemoizedOperation>(std::move(copy), std::move(renamed),
+                                               table.capacity());
+  }
+  return copy;
+}
+
+} // namespace operations
+
+namespace {
+
+// Subtrees at least this costly are worth a cache lookup, which costs about
+// as much as one call to the C library's sin or log.
+constexpr double minimumCost = 16;
+
+} // namespace
+
+ExpressionPtr memoize(ExpressionPtr root, const std::set<std::string, std::less<>> &keys,
+                      size_t capacity) {
+  using namespace operations;
+
+  if (keys.empty()) {
+    return root;
+  }
+
+  struct Info {
+    bool keyOnly; // Every leaf is a constant or a key
+    bool hasKey;
+    double cost;
+  };
+  std::unordered_map<const Expression *, Info> infos;
+  std::unordered_map<const Expression *, PlaceHolderPtr> leaves;
+  std::unordered_map<const Expression *, ExpressionPtr> wrapped;
+
+  auto worthwhile = [&](const ExpressionPtr &node) {
+    const auto &info = infos.at(node.get());
+    return info.keyOnly && info.hasKey && info.cost >= minimumCost &&
+           !dynamic_cast<const MemoizedOperation *>(node.get());
+  };
+
+  auto wrap = [&](const ExpressionPtr &node) -> ExpressionPtr {
+    auto it = wrapped.find(node.get());
+    if (it != wrapped.end()) {
+      return it->second;
+    }
+    std::vector<PlaceHolderPtr> placeholders;
+    for (const auto &n : linearize(*node).nodes) {
+      auto leaf = leaves.find(n.expression);
+      if (!n.operation && leaf != leaves.end()) {
+        placeholders.push_back(leaf->second);
+      }
+    }
+    ExpressionPtr result = node;
+    if (placeholders.size() <= memoization::MemoTable::maxKeys) {
+      // Caches inside the subtree are replaced by the one around it.
+      auto body = transform(node, [](const ExpressionPtr &n) -> ExpressionPtr {
+        auto memo = dynamic_cast<const MemoizedOperation *>(n.get());
+        return memo ? memo->expand() : n;
+      });
+      result = std::make_shared<MemoizedOperation>(std::move(body), std::move(placeholders),
+                                                   capacity);
+    }
+    wrapped.emplace(node.get(), result);
+    return result;
+  };
+
+  root = transform(std::move(root), [&](const ExpressionPtr &node) -> ExpressionPtr {
+    auto operation = dynamic_cast<Operation *>(node.get());
+    if (!operation) {
+      auto placeholder = std::dynamic_pointer_cast<PlaceHolder>(node);
+      bool key = placeholder && keys.contains(placeholder->getIdentifier());
+      if (key) {
+        leaves.emplace(node.get(), std::move(placeholder));
+      }
+      infos[node.get()] = {key || typeid(*node) == typeid(ConstExpression), key, 0};
+      return node;
+    }
+
+    // Streaming operations depend on the rows before, not only on the key.
+    Info info{operation->isPure(), false, operation->cost()};
+    for (size_t i = 0; i < operation->arity(); i++) {
+      const auto &operand = infos.at(operation->getOperandAt(i).get());
+      info.keyOnly &= operand.keyOnly;
+      info.hasKey |= operand.hasKey;
+      info.cost += operand.cost;
+    }
+    if (!info.keyOnly) {
+      for (size_t i = 0; i < operation->arity(); i++) {
+        if (worthwhile(operation->getOperandAt(i))) {
+          operation->setOperandAt(i, wrap(operation->getOperandAt(i)));
+        }
+      }
+    }
+    infos[node.get()] = info;
+    return node;
+  });
+  return worthwhile(root) ? wrap(root) : root;
+}
+
+MemoStatistics memoStatistics(const Expression &expression) {
+  auto compiled = dynamic_cast<const CompiledExpression *>(&expression);
+  auto code = compiled ? compiled->getCode() : linearize(expression);
+  MemoStatistics total;
+  for (const auto &node : code.nodes) {
+    if (auto memo = dynamic_cast<const operations::MemoizedOperation *>(node.operation)) {
+      auto statistics = memo->statistics();
+      total.hits += statistics.hits;
+      total.misses += statistics.misses;
+      total.evictions += statistics.evictions;
+      total.capacity += statistics.capacity;
+    }
+  }
+  return total;
+}
+
+} // namespace expression_solver
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "CompiledExpression.hpp"
+#include "Operation.hpp"
+
+namespace expression_solver {
+
+struct MemoStatistics {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0; // Entries overwritten by a different key
+  size_t capacity = 0;    // Slots, summed over the memoization nodes
+
+  double hitRate() const {
+    return hits + misses == 0 ? 0 : static_cast<double>(hits) / (hits + misses);
+  }
+};
+
+namespace memoization {
+
+// Fixed-size cache from a tuple of up to maxKeys doubles to a double.
+//
+// Open addressing: an entry lives in one of the probes slots following the
+// hash of its key, and the slots are stored flat, key next to value, so a
+// lookup reads one or two cache lines. When the probe window is full, the
+// first slot of the window is overwritten. Keys are compared by bit
+// pattern, so NaN keys hit too.
+//
+// Threads evaluating one compiled expression share its tables. Every slot
+// is a seqlock: writers take it by moving its sequence number to odd and
+// skip the insert if another writer holds it, and readers retry nothing but
+// treat a slot that changed under them as a miss.
+class MemoTable {
+public:
+  static constexpr size_t maxKeys = 8;
+  static constexpr size_t probes = 4;
+
+  // capacity is rounded up to a power of two.
+  MemoTable(size_t keys, size_t capacity);
+
+  size_t keys() const { return keyCount; }
+  size_t capacity() const { return mask + 1; }
+
+  bool lookup(const uint64_t *key, double &value) const;
+  // False when the entry was not stored because another thread was
+  // writing the slot.
+  bool insert(const uint64_t *key, double value);
+
+  MemoStatistics statistics() const;
+  void count(uint64_t hits, uint64_t misses);
+
+private:
+  size_t keyCount;
+  size_t stride; // Words per slot: sequence, value, then the key
+  size_t mask;
+  std::unique_ptr<std::atomic<uint64_t>[]> words;
+  std::atomic<uint64_t> hits = 0;
+  std::atomic<uint64_t> misses = 0;
+  std::atomic<uint64_t> evictions = 0;
+
+  size_t hash(const uint64_t *key) const;
+  std::atomic<uint64_t> *slot(size_t index) const { return &words[index * stride]; }
+};
+
+} // namespace memoization
+
+namespace operations {
+
+// Caches a pure subtree that depends only on a few placeholders, keyed by
+// their values. Its operands are those placeholders, so the program around
+// it only computes the key; the subtree itself runs on misses, in one batch
+// for all the missed rows of a block.
+class MemoizedOperation : public Operation {
+  std::vector<ExpressionPtr> keys;
+  std::vector<const PlaceHolder *> placeholders;
+  std::shared_ptr<const CompiledExpression> body;
+  mutable memoization::MemoTable table;
+
+  void computeMisses(const double *const *operands, const uint32_t *rows, size_t count,
+                     double *out) const;
+
+public:
+  // keys must be the distinct placeholders of body, at most
+  // MemoTable::maxKeys of them.
+  MemoizedOperation(ExpressionPtr body, std::vector<PlaceHolderPtr> keys, size_t capacity);
+
+  constexpr std::string_view identifier() const override { return "memo"; }
+  constexpr int precedence() const override { return 4; }
+
+  double evaluate() const override;
+  size_t record(Tape &tape, const size_t *operands) const override;
+
+  size_t arity() const override { return keys.size(); }
+  const ExpressionPtr &getOperandAt(size_t index) const override { return keys[index]; }
+  void setOperandAt(size_t index, ExpressionPtr operand) override {
+    keys[index] = std::move(operand);
+  }
+
+  double applyOperands(const double *values) const override;
+  void applyBatch(const double *const *operands, double *out, size_t count) const override;
+
+  // A lookup, about one call to sin or log; misses also run the subtree.
+  double cost() const override { return 16; }
+
+  // Operands replaced by other placeholders give a new node over the same
+  // subtree; any other replacement gives the subtree with it substituted,
+  // which the next compile pass may memoize again.
+  ExpressionPtr rebuild(const ExpressionPtr *operands) const override;
+
+  const ExpressionPtr &getBody() const { return body->getRoot(); }
+  // Copy of the subtree over the current operands, without the cache.
+  ExpressionPtr expand() const;
+
+  MemoStatistics statistics() const { return table.statistics(); }
+};
+
+} // namespace operations
+
+// Puts every maximal subtree whose leaves are constants and placeholders
+// named in keys, and which costs about a transcendental function or more,
+// behind a MemoizedOperation with capacity slots. Nothing changes when keys
+// is empty.
+ExpressionPtr memoize(ExpressionPtr root, const std::set<std::string, std::less<>> &keys,
+                      size_t capacity);
+
+// Statistics of all memoization nodes in a compiled expression.
+MemoStatistics memoStatistics(const Expression &expression);
+
+} // namespace expression_solver
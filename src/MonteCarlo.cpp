@@ -0,0 +1,323 @@
+#include "MonteCarlo.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <future>
+#include <stdexcept>
+
+namespace expression_solver {
+
+namespace {
+
+constexpr double nan = std::numeric_limits<double>::quiet_NaN();
+
+// Uniform in [0, 1) from the top 52 bits, placed in the mantissa of a
+// number in [1, 2). Unlike a conversion from a 64-bit integer, this has
+// SSE2 instructions, so the loops that call it vectorize.
+double unit(uint32_t high, uint32_t low) {
+  uint64_t bits = (static_cast<uint64_t>(high) << 32) | low;
+  return std::bit_cast<double>((bits >> 12) | 0x3FF0000000000000) - 1;
+}
+
+} // namespace
+
+void QuantileSketch::Store::add(int32_t index, uint64_t count) {
+  if (index >= offset && static_cast<size_t>(index - offset) < counts.size()) {
+    counts[index - offset] += count;
+    return;
+  }
+  if (counts.empty()) {
+    offset = index;
+  }
+  if (index < offset) {
+    // Room below as well, so values that creep down do not move the store
+    // every time.
+    size_t grow = std::max<size_t>(offset - index, counts.size() / 2);
+    counts.insert(counts.begin(), grow, 0);
+    offset -= static_cast<int32_t>(grow);
+  } else if (static_cast<size_t>(index - offset) >= counts.size()) {
+    counts.resize(index - offset + 1);
+  }
+  counts[index - offset] += count;
+}
+
+void QuantileSketch::Store::merge(const Store &other) {
+  for (size_t i = 0; i < other.counts.size(); i++) {
+    if (other.counts[i] != 0) {
+      add(other.offset + static_cast<int32_t>(i), other.counts[i]);
+    }
+  }
+}
+
+// log2Like grows at least as fast as ln(x), so a bucket 1 / multiplier
+// wide in it spans at most a factor gamma in x.
+QuantileSketch::QuantileSketch(double relativeAccuracy)
+    : relativeAccuracy(relativeAccuracy),
+      multiplier(1 / std::log((1 + relativeAccuracy) / (1 - relativeAccuracy))) {
+  if (!(relativeAccuracy > 0 && relativeAccuracy < 1)) {
+    throw std::invalid_argument("Relative accuracy must be between 0 and 1");
+  }
+}
+
+// e + f for a normal x = 2^e (1 + f): exact at powers of two, linear in
+// between.
+double QuantileSketch::log2Like(double magnitude) {
+  auto bits = std::bit_cast<uint64_t>(magnitude);
+  auto exponent = static_cast<int32_t>(bits >> 52) - 1023;
+  double mantissa = std::bit_cast<double>((bits & ((uint64_t(1) << 52) - 1)) | 0x3FF0000000000000);
+  return exponent + (mantissa - 1);
+}
+
+double QuantileSketch::inverseLog2Like(double y) {
+  double exponent = std::floor(y);
+  return std::ldexp(1 + (y - exponent), static_cast<int>(exponent));
+}
+
+// Rounds up without a call to ceil, which SSE2 lacks.
+int32_t QuantileSketch::index(double magnitude) const {
+  double y = log2Like(magnitude) * multiplier;
+  auto truncated = static_cast<int32_t>(y);
+  return truncated + (truncated < y);
+}
+
+// The point of the bucket equally far, relatively, from both of its bounds.
+double QuantileSketch::value(int32_t index) const {
+  double lower = inverseLog2Like((index - 1) / multiplier);
+  double upper = inverseLog2Like(index / multiplier);
+  return 2 * lower * upper / (lower + upper);
+}
+
+void QuantileSketch::add(double x) {
+  total++;
+  double magnitude = std::abs(x);
+  if (magnitude < std::numeric_limits<double>::min()) {
+    zeros++;
+  } else if (x > 0) {
+    positive.add(index(magnitude), 1);
+  } else {
+    negative.add(index(magnitude), 1);
+  }
+}
+
+void QuantileSketch::merge(const QuantileSketch &other) {
+  if (other.multiplier != multiplier) {
+    throw std::invalid_argument("Sketches of different accuracies");
+  }
+  positive.merge(other.positive);
+  negative.merge(other.negative);
+  zeros += other.zeros;
+  total += other.total;
+}
+
+double QuantileSketch::quantile(double q) const {
+  if (total == 0 || !(q >= 0 && q <= 1)) {
+    return nan;
+  }
+  auto rank = static_cast<uint64_t>(q * static_cast<double>(total - 1));
+  // Negative values from the largest magnitude down, then zeros, then
+  // positive values from the smallest magnitude up.
+  uint64_t seen = 0;
+  for (size_t i = negative.counts.size(); i-- > 0;) {
+    seen += negative.counts[i];
+    if (seen > rank) {
+      return -value(negative.offset + static_cast<int32_t>(i));
+    }
+  }
+  seen += zeros;
+  if (seen > rank) {
+    return 0;
+  }
+  for (size_t i = 0; i < positive.counts.size(); i++) {
+    seen += positive.counts[i];
+    if (seen > rank) {
+      return value(positive.offset + static_cast<int32_t>(i));
+    }
+  }
+  return nan;
+}
+
+double SampleStatistics::standardError() const {
+  return std::sqrt(variance / static_cast<double>(count));
+}
+
+// Moments of the finite results of one block.
+struct MonteCarlo::Block {
+  uint64_t count = 0;
+  uint64_t nonFinite = 0;
+  double mean = 0;
+  double m2 = 0; // Sum of squared deviations from the mean
+  double min = std::numeric_limits<double>::infinity();
+  double max = -std::numeric_limits<double>::infinity();
+
+  // Parallel update of Chan, Golub and LeVeque.
+  void merge(const Block &other) {
+    if (other.count != 0) {
+      double n = static_cast<double>(count + other.count);
+      double delta = other.mean - mean;
+      mean += delta * static_cast<double>(other.count) / n;
+      m2 += other.m2 + delta * delta * static_cast<double>(count) *
+                           static_cast<double>(other.count) / n;
+      min = std::min(min, other.min);
+      max = std::max(max, other.max);
+      count += other.count;
+    }
+    nonFinite += other.nonFinite;
+  }
+};
+
+MonteCarlo::MonteCarlo(ExpressionPtr expression, std::vector<Draw> draws)
+    : draws(std::move(draws)) {
+  compiled = std::dynamic_pointer_cast<const CompiledExpression>(expression);
+  if (!compiled) {
+    compiled = std::make_shared<const CompiledExpression>(std::move(expression));
+  }
+  for (const auto &node : compiled->getCode().nodes) {
+    if (node.operation && !node.operation->isPure()) {
+      throw std::invalid_argument("Simulation needs an expression without streaming operations");
+    }
+  }
+  for (size_t k = 0; k < this->draws.size(); k++) {
+    const auto &draw = this->draws[k];
+    const auto &distribution = draw.distribution;
+    if (!draw.placeholder) {
+      throw std::invalid_argument("Draw without a placeholder");
+    }
+    for (size_t j = 0; j < k; j++) {
+      if (this->draws[j].placeholder == draw.placeholder) {
+        throw std::invalid_argument("Placeholder drawn twice: " +
+                                    std::string(draw.placeholder->getIdentifier()));
+      }
+    }
+    bool valid = std::isfinite(distribution.a) && std::isfinite(distribution.b) &&
+                 (distribution.kind == Distribution::Kind::Uniform
+                      ? distribution.a < distribution.b
+                      : distribution.b >= 0);
+    if (!valid) {
+      throw std::invalid_argument("Invalid distribution for " +
+                                  std::string(draw.placeholder->getIdentifier()));
+    }
+  }
+}
+
+// Values of samples first to first + values.size() of the draw. The counter
+// is the sample index and the draw's stream; the key is the seed. The
+// uniforms are drawn first, in a loop without branches, then transformed.
+void MonteCarlo::fill(const Draw &draw, uint32_t stream, uint64_t first,
+                      std::span<double> values, std::span<double> scratch, uint64_t seed) const {
+  std::array<uint32_t, 2> key{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)};
+  for (size_t i = 0; i < values.size(); i++) {
+    uint64_t sample = first + i;
+    auto bits = montecarlo::philox(
+        {static_cast<uint32_t>(sample), static_cast<uint32_t>(sample >> 32), stream, 0}, key);
+    values[i] = unit(bits[0], bits[1]);
+    scratch[i] = unit(bits[2], bits[3]);
+  }
+
+  const auto &distribution = draw.distribution;
+  double a = distribution.a;
+  double b = distribution.b;
+  if (distribution.kind == Distribution::Kind::Uniform) {
+    for (double &x : values) {
+      x = a + (b - a) * x;
+    }
+    return;
+  }
+  // Box-Muller, with 1 - u in (0, 1] so the logarithm is finite.
+  constexpr double twoPi = 6.28318530717958647693;
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = a + b * std::sqrt(-2 * std::log(1 - values[i])) * std::cos(twoPi * scratch[i]);
+  }
+  if (distribution.kind == Distribution::Kind::LogNormal) {
+    for (double &x : values) {
+      x = std::exp(x);
+    }
+  }
+}
+
+SampleStatistics MonteCarlo::run(const MonteCarloOptions &options, ThreadPool *pool) const {
+  SampleStatistics statistics{.sketch = QuantileSketch(options.relativeAccuracy)};
+  size_t blocks = (options.samples + blockSize - 1) / blockSize;
+  std::vector<Block> moments(blocks);
+
+  // Blocks begin to end, with buffers reused from one block to the next.
+  auto simulate = [&](size_t begin, size_t end) {
+    QuantileSketch sketch(options.relativeAccuracy);
+    std::vector<double> columns(draws.size() * blockSize);
+    std::vector<double> results(blockSize);
+    std::vector<double> scratch(blockSize);
+    std::vector<Binding> bindings(draws.size());
+    for (size_t b = begin; b < end; b++) {
+      uint64_t first = static_cast<uint64_t>(b) * blockSize;
+      size_t rows = static_cast<size_t>(std::min<uint64_t>(blockSize, options.samples - first));
+      for (size_t k = 0; k < draws.size(); k++) {
+        std::span<double> column(columns.data() + k * blockSize, rows);
+        fill(draws[k], static_cast<uint32_t>(k), first, column, {scratch.data(), rows},
+             options.seed);
+        bindings[k] = {draws[k].placeholder, column};
+      }
+      std::span<double> values(results.data(), rows);
+      compiled->evaluate(bindings, values);
+
+      auto &block = moments[b];
+      double sum = 0;
+      for (double x : values) {
+        if (std::isfinite(x)) {
+          sum += x;
+          block.count++;
+          block.min = std::min(block.min, x);
+          block.max = std::max(block.max, x);
+          sketch.add(x);
+        }
+      }
+      block.nonFinite = rows - block.count;
+      if (block.count != 0) {
+        block.mean = sum / static_cast<double>(block.count);
+        for (double x : values) {
+          if (std::isfinite(x)) {
+            block.m2 += (x - block.mean) * (x - block.mean);
+          }
+        }
+      }
+    }
+    return sketch;
+  };
+
+  if (!pool || blocks <= 1) {
+    statistics.sketch.merge(simulate(0, blocks));
+  } else {
+    // A few chunks per worker evens out the load.
+    size_t chunks = std::min(blocks, pool->size() * 4);
+    std::vector<std::future<QuantileSketch>> pending;
+    pending.reserve(chunks);
+    for (size_t chunk = 0; chunk < chunks; chunk++) {
+      pending.push_back(
+          pool->submit([&, chunk] { return simulate(blocks * chunk / chunks,
+                                                    blocks * (chunk + 1) / chunks); }));
+    }
+    for (auto &future : pending) {
+      future.wait();
+    }
+    for (auto &future : pending) {
+      statistics.sketch.merge(future.get());
+    }
+  }
+
+  Block total;
+  for (const auto &block : moments) {
+    total.merge(block);
+  }
+  statistics.count = total.count;
+  statistics.nonFinite = total.nonFinite;
+  if (total.count != 0) {
+    statistics.mean = total.mean;
+    statistics.min = total.min;
+    statistics.max = total.max;
+  }
+  if (total.count > 1) {
+    statistics.variance = total.m2 / static_cast<double>(total.count - 1);
+  }
+  return statistics;
+}
+
+} // namespace expression_solver
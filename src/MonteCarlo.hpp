@@ -0,0 +1,164 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "CompiledExpression.hpp"
+#include "ThreadPool.hpp"
+
+namespace expression_solver {
+
+namespace montecarlo {
+
+// Philox4x32-10 of Salmon et al., "Parallel random numbers: as easy as 1,
+// 2, 3": a keyed bijection of a 128-bit counter that passes BigCrush. The
+// random numbers of a sample are a function of the seed and the sample's
+// index alone, so any thread can draw any block of samples and the results
+// do not depend on how the samples are split. Inline, so the loop that
+// fills a block keeps its state in registers.
+constexpr std::array<uint32_t, 4> philox(std::array<uint32_t, 4> counter,
+                                         std::array<uint32_t, 2> key) {
+  constexpr uint64_t m0 = 0xD2511F53;
+  constexpr uint64_t m1 = 0xCD9E8D57;
+  for (int round = 0; round < 10; round++) {
+    uint64_t p0 = m0 * counter[0];
+    uint64_t p1 = m1 * counter[2];
+    counter = {static_cast<uint32_t>(p1 >> 32) ^ counter[1] ^ key[0], static_cast<uint32_t>(p1),
+               static_cast<uint32_t>(p0 >> 32) ^ counter[3] ^ key[1], static_cast<uint32_t>(p0)};
+    key[0] += 0x9E3779B9;
+    key[1] += 0xBB67AE85;
+  }
+  return counter;
+}
+
+} // namespace montecarlo
+
+// Distribution of a placeholder's values in a simulation.
+struct Distribution {
+  enum class Kind : uint8_t { Uniform, Normal, LogNormal };
+  Kind kind;
+  double a; // Lower bound, or mean (of the logarithm for LogNormal)
+  double b; // Upper bound, or standard deviation (of the logarithm)
+
+  static Distribution uniform(double lower, double upper) {
+    return {Kind::Uniform, lower, upper};
+  }
+  static Distribution normal(double mean, double deviation) {
+    return {Kind::Normal, mean, deviation};
+  }
+  // exp of a normal variable with mean mu and deviation sigma.
+  static Distribution logNormal(double mu, double sigma) {
+    return {Kind::LogNormal, mu, sigma};
+  }
+};
+
+// A placeholder whose value is drawn from distribution for every sample.
+struct Draw {
+  const PlaceHolder *placeholder;
+  Distribution distribution;
+};
+
+// Quantiles with a relative error bound from a fixed amount of memory, as
+// in DDSketch (Masson et al., 2019): values fall into buckets whose bounds
+// are at most a factor gamma = (1 + a) / (1 - a) apart, and a quantile is
+// the middle of the bucket that holds its rank, within a of the exact value.
+// Buckets are counts, so merging sketches adds them and the result does not
+// depend on the order of the merges.
+//
+// Bucket bounds follow the exponent and mantissa bits of the value, a log2
+// interpolated linearly between powers of two, instead of a logarithm: it is
+// a few integer operations per value, for about 40% more buckets.
+class QuantileSketch {
+  // Buckets of one sign, from index offset on; bucket i holds the
+  // magnitudes x with (i - 1) / multiplier < log2Like(x) <= i / multiplier.
+  struct Store {
+    std::vector<uint64_t> counts;
+    int32_t offset = 0;
+
+    void add(int32_t index, uint64_t count);
+    void merge(const Store &other);
+  };
+
+  double relativeAccuracy;
+  double multiplier;
+  Store positive;
+  Store negative;
+  uint64_t zeros = 0; // Magnitudes too small for a bucket
+  uint64_t total = 0;
+
+  int32_t index(double magnitude) const;
+  double value(int32_t index) const;
+  static double log2Like(double magnitude);
+  static double inverseLog2Like(double y);
+
+public:
+  explicit QuantileSketch(double relativeAccuracy = 0.01);
+
+  // Adds a finite value.
+  void add(double x);
+  void merge(const QuantileSketch &other);
+
+  uint64_t count() const { return total; }
+  double getRelativeAccuracy() const { return relativeAccuracy; }
+
+  // Value of rank q * (count - 1), for q in [0, 1]. NaN when empty.
+  double quantile(double q) const;
+};
+
+// Statistics of the finite values of a simulation. The samples are never
+// stored: each block contributes its moments and sketch, then its buffer is
+// reused.
+struct SampleStatistics {
+  uint64_t count = 0;
+  uint64_t nonFinite = 0; // NaN and infinite samples, left out of the rest
+  double mean = std::numeric_limits<double>::quiet_NaN();
+  double variance = std::numeric_limits<double>::quiet_NaN(); // Unbiased, n - 1
+  double min = std::numeric_limits<double>::quiet_NaN();
+  double max = std::numeric_limits<double>::quiet_NaN();
+  QuantileSketch sketch;
+
+  double quantile(double q) const { return sketch.quantile(q); }
+  // Standard error of the mean.
+  double standardError() const;
+};
+
+struct MonteCarloOptions {
+  uint64_t samples = 1'000'000;
+  uint64_t seed = 0;
+  // Of the quantiles; see QuantileSketch.
+  double relativeAccuracy = 0.01;
+};
+
+// Evaluates an expression over random draws of some of its placeholders.
+//
+// Samples are taken in fixed blocks of rows: a block fills one column per
+// draw from the counter-based generator, evaluates the compiled program over
+// the block as a batch, and folds the results into its statistics. Blocks
+// run in parallel on a thread pool. Since the draws of a block depend only
+// on the seed and the block, and the moments of the blocks are combined in
+// block order, the statistics are the same whatever the number of threads.
+class MonteCarlo {
+  std::shared_ptr<const CompiledExpression> compiled;
+  std::vector<Draw> draws;
+
+  struct Block;
+  void fill(const Draw &draw, uint32_t stream, uint64_t first, std::span<double> values,
+            std::span<double> scratch, uint64_t seed) const;
+
+public:
+  static constexpr size_t blockSize = 4096;
+
+  // Expressions with streaming operations are rejected, since their value
+  // would depend on the order of the samples. Placeholders that are not
+  // drawn keep their current values.
+  MonteCarlo(ExpressionPtr expression, std::vector<Draw> draws);
+
+  // Statistics of options.samples samples, on pool when given and on the
+  // calling thread otherwise.
+  SampleStatistics run(const MonteCarloOptions &options = {}, ThreadPool *pool = nullptr) const;
+};
+
+} // namespace expression_solver
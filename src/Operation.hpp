@@ -1,8 +1,13 @@
 #pragma once
 
 #include "Expression.hpp"
+#include <algorithm>
+#include <cmath>
 #include <memory>      // Add missing include directive for <memory>
+#include <stdexcept>
 #include <string_view> // Add missing include directive for <string_view>
+#include <utility>
+#include <vector>
 
 namespace expression_solver {
 namespace operations {
@@ -12,21 +17,151 @@ public:
   virtual ~Operation() = default;
   virtual constexpr std::string_view identifier() const = 0;
   virtual constexpr int precedence() const = 0;
+
+  // Uniform access to the operands, so tree passes can walk any operation
+  // with an explicit stack and without knowing its shape.
+  virtual size_t arity() const = 0;
+  virtual const ExpressionPtr &getOperandAt(size_t index) const = 0;
+  virtual void setOperandAt(size_t index, ExpressionPtr operand) = 0;
+
+  // Computes the operation from its evaluated operands, in order.
+  virtual double applyOperands(const double *values) const = 0;
+
+  // Computes count rows at once: operands[k][i] is operand k of row i. The
+  // default calls applyOperands per row; operations with a cheap kernel
+  // override it with a loop the compiler can vectorize.
+  virtual void applyBatch(const double *const *operands, double *out,
+                          size_t count) const {
+    constexpr size_t inlineArgs = 8;
+    double argsBuffer[inlineArgs];
+    std::vector<double> heapArgs;
+    double *args = argsBuffer;
+    if (arity() > inlineArgs) {
+      heapArgs.resize(arity());
+      args = heapArgs.data();
+    }
+    for (size_t i = 0; i < count; i++) {
+      for (size_t k = 0; k < arity(); k++) {
+        args[k] = operands[k][i];
+      }
+      out[i] = applyOperands(args);
+    }
+  }
+
+  // New node of the same operation over the given operands, arity() of them.
+  virtual ExpressionPtr rebuild(const ExpressionPtr *operands) const = 0;
+
+  // False when the result also depends on the values computed before, as
+  // for the streaming operations in Streaming.hpp. Compile passes do not
+  // fold such nodes into constants or cache their results.
+  virtual bool isPure() const { return true; }
+
+  // Rough time to compute one value, in additions, not counting the
+  // operands. Compile passes and schedulers compare these estimates; see
+  // estimateCost. Operations that call into the C library should override
+  // it.
+  virtual double cost() const { return 1; }
+
+protected:
+  // Detaches uniquely owned operand subtrees and frees them from a worklist,
+  // so destroying a deep tree does not recurse. Called by the destructors of
+  // the classes that own operands, while the operands are still alive.
+  void releaseOperands() {
+    bool deep = false;
+    for (size_t i = 0; i < arity() && !deep; i++) {
+      auto &operand = getOperandAt(i);
+      deep = operand.use_count() == 1 &&
+             dynamic_cast<const Operation *>(operand.get()) != nullptr;
+    }
+    if (!deep) {
+      return;
+    }
+
+    std::vector<ExpressionPtr> pending;
+    auto detach = [&pending](Operation &op) {
+      for (size_t i = 0; i < op.arity(); i++) {
+        if (op.getOperandAt(i)) {
+          pending.push_back(op.getOperandAt(i));
+          op.setOperandAt(i, nullptr);
+        }
+      }
+    };
+    detach(*this);
+    while (!pending.empty()) {
+      auto expression = std::move(pending.back());
+      pending.pop_back();
+      if (expression.use_count() == 1) {
+        if (auto op = dynamic_cast<Operation *>(expression.get())) {
+          detach(*op);
+        }
+      }
+    }
+  }
 };
 
 typedef std::shared_ptr<Operation> OperationPtr;
 
+class VariadicOperation;
+
 class BinaryOperation : public Operation {
 public:
   BinaryOperation(ExpressionPtr left, ExpressionPtr right)
       : left(std::move(left)), right(std::move(right)) {}
-  virtual ~BinaryOperation() = default;
+  virtual ~BinaryOperation() { releaseOperands(); }
 
   virtual constexpr std::string_view identifier() const = 0;
 
+  double evaluate() const override {
+    return apply(left->evaluate(), right->evaluate());
+  }
+
+  // Computes the operation on already evaluated operands.
+  virtual double apply(double a, double b) const = 0;
+
+  // Partial derivatives of apply(a, b) with respect to a and b, given the
+  // result y = apply(a, b). Used by the reverse-mode pass in Tape.hpp;
+  // custom operations override it to take part in differentiation.
+  using Partials = std::pair<double, double>;
+  virtual Partials partials(double /*a*/, double /*b*/, double /*y*/) const {
+    throw std::logic_error("Operation has no derivative rule");
+  }
+
+  size_t record(Tape &tape, const size_t *operands) const override;
+
+  size_t arity() const override { return 2; }
+
+  const ExpressionPtr &getOperandAt(size_t index) const override {
+    return index == 0 ? left : right;
+  }
+
+  void setOperandAt(size_t index, ExpressionPtr operand) override {
+    (index == 0 ? left : right) = std::move(operand);
+  }
+
+  double applyOperands(const double *values) const override {
+    return apply(values[0], values[1]);
+  }
+
+  void applyBatch(const double *const *operands, double *out,
+                  size_t count) const override {
+    for (size_t i = 0; i < count; i++) {
+      out[i] = apply(operands[0][i], operands[1][i]);
+    }
+  }
+
+  ExpressionPtr rebuild(const ExpressionPtr *operands) const override {
+    return create(operands[0], operands[1]);
+  }
+
   virtual ExpressionPtr create(ExpressionPtr left,
                                ExpressionPtr right) const = 0;
 
+  // N-ary form of an associative operation, used for calls with more than
+  // two arguments and for flattening chains. nullptr when there is none.
+  virtual std::shared_ptr<const VariadicOperation> variadic() const {
+    return nullptr;
+  }
+
   void setLeft(ExpressionPtr left) { this->left = std::move(left); }
   void setRight(ExpressionPtr right) { this->right = std::move(right); }
 
@@ -42,14 +177,20 @@ class AddOperation : public BinaryOperation {
 public:
   AddOperation(ExpressionPtr left, ExpressionPtr right)
       : BinaryOperation(std::move(left), std::move(right)) {}
-  double evaluate() const override {
-    return left->evaluate() + right->evaluate();
+  double apply(double a, double b) const override {
+    return a + b;
+  }
+
+  Partials partials(double, double, double) const override {
+    return {1, 1};
   }
 
   constexpr std::string_view identifier() const override { return "+"; }
 
   constexpr int precedence() const override { return 1; }
 
+  std::shared_ptr<const VariadicOperation> variadic() const override;
+
   ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
     return std::make_shared<AddOperation>(std::move(left), std::move(right));
   }
@@ -59,8 +200,12 @@ class SubtractOperation : public BinaryOperation {
 public:
   SubtractOperation(ExpressionPtr left, ExpressionPtr right)
       : BinaryOperation(std::move(left), std::move(right)) {}
-  double evaluate() const override {
-    return left->evaluate() - right->evaluate();
+  double apply(double a, double b) const override {
+    return a - b;
+  }
+
+  Partials partials(double, double, double) const override {
+    return {1, -1};
   }
 
   constexpr std::string_view identifier() const override { return "-"; }
@@ -78,14 +223,20 @@ public:
   MultiplyOperation(ExpressionPtr left, ExpressionPtr right)
       : BinaryOperation(std::move(left), std::move(right)) {}
 
-  double evaluate() const override {
-    return left->evaluate() * right->evaluate();
+  double apply(double a, double b) const override {
+    return a * b;
+  }
+
+  Partials partials(double a, double b, double) const override {
+    return {b, a};
   }
 
   constexpr std::string_view identifier() const override { return "*"; }
 
   constexpr int precedence() const override { return 2; }
 
+  std::shared_ptr<const VariadicOperation> variadic() const override;
+
   ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
     return std::make_shared<MultiplyOperation>(std::move(left),
                                                std::move(right));
@@ -97,14 +248,20 @@ public:
   DivideOperation(ExpressionPtr left, ExpressionPtr right)
       : BinaryOperation(std::move(left), std::move(right)) {}
 
-  double evaluate() const override {
-    return left->evaluate() / right->evaluate();
+  double apply(double a, double b) const override {
+    return a / b;
+  }
+
+  Partials partials(double, double b, double y) const override {
+    return {1 / b, -y / b};
   }
 
   constexpr std::string_view identifier() const override { return "/"; }
 
   constexpr int precedence() const override { return 2; }
 
+  double cost() const override { return 4; }
+
   ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
     return std::make_shared<DivideOperation>(std::move(left), std::move(right));
   }
@@ -115,14 +272,20 @@ public:
   PowerOperation(ExpressionPtr left, ExpressionPtr right)
       : BinaryOperation(std::move(left), std::move(right)) {}
 
-  double evaluate() const override {
-    return std::pow(left->evaluate(), right->evaluate());
+  double apply(double a, double b) const override {
+    return std::pow(a, b);
+  }
+
+  Partials partials(double a, double b, double y) const override {
+    return {b == 0 ? 0 : b * std::pow(a, b - 1), a > 0 ? y * std::log(a) : 0};
   }
 
   constexpr std::string_view identifier() const override { return "^"; }
 
   constexpr int precedence() const override { return 3; }
 
+  double cost() const override { return 24; }
+
   ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
     return std::make_shared<PowerOperation>(std::move(left), std::move(right));
   }
@@ -133,14 +296,20 @@ public:
   ModuloOperation(ExpressionPtr left, ExpressionPtr right)
       : BinaryOperation(std::move(left), std::move(right)) {}
 
-  double evaluate() const override {
-    return std::fmod(left->evaluate(), right->evaluate());
+  double apply(double a, double b) const override {
+    return std::fmod(a, b);
+  }
+
+  Partials partials(double a, double b, double) const override {
+    return {1, -std::trunc(a / b)};
   }
 
   constexpr std::string_view identifier() const override { return "%"; }
 
   constexpr int precedence() const override { return 2; }
 
+  double cost() const override { return 8; }
+
   ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
     return std::make_shared<ModuloOperation>(std::move(left), std::move(right));
   }
@@ -151,11 +320,46 @@ protected:
   ExpressionPtr operand;
 public:
   UnaryOperation(ExpressionPtr operand) : operand(std::move(operand)) {}
-  virtual ~UnaryOperation() = default;
+  virtual ~UnaryOperation() { releaseOperands(); }
 
   virtual constexpr std::string_view identifier() const = 0;
 
-  virtual double evaluate() const = 0;
+  double evaluate() const override { return apply(operand->evaluate()); }
+
+  // Computes the operation on an already evaluated operand.
+  virtual double apply(double x) const = 0;
+
+  // Derivative of apply at x, given the result y = apply(x).
+  virtual double derivative(double /*x*/, double /*y*/) const {
+    throw std::logic_error("Operation has no derivative rule");
+  }
+
+  size_t record(Tape &tape, const size_t *operands) const override;
+
+  size_t arity() const override { return 1; }
+
+  const ExpressionPtr &getOperandAt(size_t) const override {
+    return operand;
+  }
+
+  void setOperandAt(size_t, ExpressionPtr operand) override {
+    this->operand = std::move(operand);
+  }
+
+  double applyOperands(const double *values) const override {
+    return apply(values[0]);
+  }
+
+  void applyBatch(const double *const *operands, double *out,
+                  size_t count) const override {
+    for (size_t i = 0; i < count; i++) {
+      out[i] = apply(operands[0][i]);
+    }
+  }
+
+  ExpressionPtr rebuild(const ExpressionPtr *operands) const override {
+    return create(operands[0]);
+  }
 
   virtual ExpressionPtr create(ExpressionPtr operand) const = 0;
 
@@ -167,7 +371,11 @@ class NegateOperation : public UnaryOperation {
 public:
   NegateOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return -(operand->evaluate()); }
+  double apply(double x) const override { return -x; }
+
+  double derivative(double, double) const override {
+    return -1;
+  }
 
   constexpr std::string_view identifier() const override { return "-"; }
 
@@ -182,12 +390,18 @@ class SinOperation : public UnaryOperation {
 public:
   SinOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return std::sin(operand->evaluate()); }
+  double apply(double x) const override { return std::sin(x); }
+
+  double derivative(double x, double) const override {
+    return std::cos(x);
+  }
 
   constexpr std::string_view identifier() const override { return "sin"; }
 
   constexpr int precedence() const override { return 4; }
 
+  double cost() const override { return 16; }
+
   ExpressionPtr create(ExpressionPtr operand) const override {
     return std::make_shared<SinOperation>(std::move(operand));
   }
@@ -197,12 +411,18 @@ class CosOperation : public UnaryOperation {
 public:
   CosOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return std::cos(operand->evaluate()); }
+  double apply(double x) const override { return std::cos(x); }
+
+  double derivative(double x, double) const override {
+    return -std::sin(x);
+  }
 
   constexpr std::string_view identifier() const override { return "cos"; }
 
   constexpr int precedence() const override { return 4; }
 
+  double cost() const override { return 16; }
+
   ExpressionPtr create(ExpressionPtr operand) const override {
     return std::make_shared<CosOperation>(std::move(operand));
   }
@@ -212,12 +432,18 @@ class TanOperation : public UnaryOperation {
 public:
   TanOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return std::tan(operand->evaluate()); }
+  double apply(double x) const override { return std::tan(x); }
+
+  double derivative(double, double y) const override {
+    return 1 + y * y;
+  }
 
   constexpr std::string_view identifier() const override { return "tan"; }
 
   constexpr int precedence() const override { return 4; }
 
+  double cost() const override { return 16; }
+
   ExpressionPtr create(ExpressionPtr operand) const override {
     return std::make_shared<TanOperation>(std::move(operand));
   }
@@ -227,12 +453,18 @@ class AsinOperation : public UnaryOperation {
 public:
   AsinOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return std::asin(operand->evaluate()); }
+  double apply(double x) const override { return std::asin(x); }
+
+  double derivative(double x, double) const override {
+    return 1 / std::sqrt(1 - x * x);
+  }
 
   constexpr std::string_view identifier() const override { return "asin"; }
 
   constexpr int precedence() const override { return 4; }
 
+  double cost() const override { return 16; }
+
   ExpressionPtr create(ExpressionPtr operand) const override {
     return std::make_shared<AsinOperation>(std::move(operand));
   }
@@ -242,12 +474,18 @@ class AcosOperation : public UnaryOperation {
 public:
   AcosOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return std::acos(operand->evaluate()); }
+  double apply(double x) const override { return std::acos(x); }
+
+  double derivative(double x, double) const override {
+    return -1 / std::sqrt(1 - x * x);
+  }
 
   constexpr std::string_view identifier() const override { return "acos"; }
 
   constexpr int precedence() const override { return 4; }
 
+  double cost() const override { return 16; }
+
   ExpressionPtr create(ExpressionPtr operand) const override {
     return std::make_shared<AcosOperation>(std::move(operand));
   }
@@ -257,12 +495,18 @@ class AtanOperation : public UnaryOperation {
 public:
   AtanOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return std::atan(operand->evaluate()); }
+  double apply(double x) const override { return std::atan(x); }
+
+  double derivative(double x, double) const override {
+    return 1 / (1 + x * x);
+  }
 
   constexpr std::string_view identifier() const override { return "atan"; }
 
   constexpr int precedence() const override { return 4; }
 
+  double cost() const override { return 16; }
+
   ExpressionPtr create(ExpressionPtr operand) const override {
     return std::make_shared<AtanOperation>(std::move(operand));
   }
@@ -272,12 +516,18 @@ class LogOperation : public UnaryOperation {
 public:
   LogOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return std::log(operand->evaluate()); }
+  double apply(double x) const override { return std::log(x); }
+
+  double derivative(double x, double) const override {
+    return 1 / x;
+  }
 
   constexpr std::string_view identifier() const override { return "log"; }
 
   constexpr int precedence() const override { return 4; }
 
+  double cost() const override { return 16; }
+
   ExpressionPtr create(ExpressionPtr operand) const override {
     return std::make_shared<LogOperation>(std::move(operand));
   }
@@ -287,12 +537,18 @@ class SqrtOperation : public UnaryOperation {
 public:
   SqrtOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return std::sqrt(operand->evaluate()); }
+  double apply(double x) const override { return std::sqrt(x); }
+
+  double derivative(double, double y) const override {
+    return 0.5 / y;
+  }
 
   constexpr std::string_view identifier() const override { return "sqrt"; }
 
   constexpr int precedence() const override { return 4; }
 
+  double cost() const override { return 4; }
+
   ExpressionPtr create(ExpressionPtr operand) const override {
     return std::make_shared<SqrtOperation>(std::move(operand));
   }
@@ -302,7 +558,11 @@ class AbsOperation : public UnaryOperation {
 public:
   AbsOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return std::abs(operand->evaluate()); }
+  double apply(double x) const override { return std::abs(x); }
+
+  double derivative(double x, double) const override {
+    return (x > 0) - (x < 0);
+  }
 
   constexpr std::string_view identifier() const override { return "abs"; }
 
@@ -317,12 +577,18 @@ class ExpOperation : public UnaryOperation {
 public:
   ExpOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return std::exp(operand->evaluate()); }
+  double apply(double x) const override { return std::exp(x); }
+
+  double derivative(double, double y) const override {
+    return y;
+  }
 
   constexpr std::string_view identifier() const override { return "exp"; }
 
   constexpr int precedence() const override { return 4; }
 
+  double cost() const override { return 16; }
+
   ExpressionPtr create(ExpressionPtr operand) const override {
     return std::make_shared<ExpOperation>(std::move(operand));
   }
@@ -332,7 +598,11 @@ class CeilOperation : public UnaryOperation {
 public:
   CeilOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return std::ceil(operand->evaluate()); }
+  double apply(double x) const override { return std::ceil(x); }
+
+  double derivative(double, double) const override {
+    return 0;
+  }
 
   constexpr std::string_view identifier() const override { return "ceil"; }
 
@@ -347,7 +617,11 @@ class FloorOperation : public UnaryOperation {
 public:
   FloorOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return std::floor(operand->evaluate()); }
+  double apply(double x) const override { return std::floor(x); }
+
+  double derivative(double, double) const override {
+    return 0;
+  }
 
   constexpr std::string_view identifier() const override { return "floor"; }
 
@@ -362,7 +636,11 @@ class RoundOperation : public UnaryOperation {
 public:
   RoundOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return std::round(operand->evaluate()); }
+  double apply(double x) const override { return std::round(x); }
+
+  double derivative(double, double) const override {
+    return 0;
+  }
 
   constexpr std::string_view identifier() const override { return "round"; }
 
@@ -377,7 +655,11 @@ class TruncOperation : public UnaryOperation {
 public:
   TruncOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return std::trunc(operand->evaluate()); }
+  double apply(double x) const override { return std::trunc(x); }
+
+  double derivative(double, double) const override {
+    return 0;
+  }
 
   constexpr std::string_view identifier() const override { return "trunc"; }
 
@@ -393,14 +675,20 @@ public:
   MinOperation(ExpressionPtr left, ExpressionPtr right)
       : BinaryOperation(std::move(left), std::move(right)) {}
 
-  double evaluate() const override {
-    return std::min(left->evaluate(), right->evaluate());
+  double apply(double a, double b) const override {
+    return std::min(a, b);
+  }
+
+  Partials partials(double a, double b, double) const override {
+    return b < a ? Partials{0, 1} : Partials{1, 0};
   }
 
   constexpr std::string_view identifier() const override { return "min"; }
 
   constexpr int precedence() const override { return 4; }
 
+  std::shared_ptr<const VariadicOperation> variadic() const override;
+
   ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
     return std::make_shared<MinOperation>(std::move(left), std::move(right));
   }
@@ -411,14 +699,20 @@ public:
   MaxOperation(ExpressionPtr left, ExpressionPtr right)
       : BinaryOperation(std::move(left), std::move(right)) {}
 
-  double evaluate() const override {
-    return std::max(left->evaluate(), right->evaluate());
+  double apply(double a, double b) const override {
+    return std::max(a, b);
+  }
+
+  Partials partials(double a, double b, double) const override {
+    return a < b ? Partials{0, 1} : Partials{1, 0};
   }
 
   constexpr std::string_view identifier() const override { return "max"; }
 
   constexpr int precedence() const override { return 4; }
 
+  std::shared_ptr<const VariadicOperation> variadic() const override;
+
   ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
     return std::make_shared<MaxOperation>(std::move(left), std::move(right));
   }
@@ -429,14 +723,21 @@ public:
   Atan2Operation(ExpressionPtr left, ExpressionPtr right)
       : BinaryOperation(std::move(left), std::move(right)) {}
 
-  double evaluate() const override {
-    return std::atan2(left->evaluate(), right->evaluate());
+  double apply(double a, double b) const override {
+    return std::atan2(a, b);
+  }
+
+  Partials partials(double a, double b, double) const override {
+    auto r2 = a * a + b * b;
+    return {b / r2, -a / r2};
   }
 
   constexpr std::string_view identifier() const override { return "atan2"; }
 
   constexpr int precedence() const override { return 4; }
 
+  double cost() const override { return 24; }
+
   ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
     return std::make_shared<Atan2Operation>(std::move(left), std::move(right));
   }
@@ -447,14 +748,20 @@ public:
   HypotOperation(ExpressionPtr left, ExpressionPtr right)
       : BinaryOperation(std::move(left), std::move(right)) {}
 
-  double evaluate() const override {
-    return std::hypot(left->evaluate(), right->evaluate());
+  double apply(double a, double b) const override {
+    return std::hypot(a, b);
+  }
+
+  Partials partials(double a, double b, double y) const override {
+    return y == 0 ? Partials{0, 0} : Partials{a / y, b / y};
   }
 
   constexpr std::string_view identifier() const override { return "hypot"; }
 
   constexpr int precedence() const override { return 4; }
 
+  double cost() const override { return 16; }
+
   ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
     return std::make_shared<HypotOperation>(std::move(left), std::move(right));
   }
@@ -465,10 +772,19 @@ public:
   LogicalAndOperation(ExpressionPtr left, ExpressionPtr right)
       : BinaryOperation(std::move(left), std::move(right)) {}
 
+  // Keeps the short-circuit of the right operand.
   double evaluate() const override {
     return left->evaluate() && right->evaluate();
   }
 
+  double apply(double a, double b) const override {
+    return a && b;
+  }
+
+  Partials partials(double, double, double) const override {
+    return {0, 0};
+  }
+
   constexpr std::string_view identifier() const override { return "&&"; }
 
   constexpr int precedence() const override { return 0; }
@@ -487,6 +803,14 @@ public:
     return left->evaluate() || right->evaluate();
   }
 
+  double apply(double a, double b) const override {
+    return a || b;
+  }
+
+  Partials partials(double, double, double) const override {
+    return {0, 0};
+  }
+
   constexpr std::string_view identifier() const override { return "||"; }
 
   constexpr int precedence() const override { return 0; }
@@ -500,7 +824,11 @@ class LogicalNotOperation : public UnaryOperation {
 public:
   LogicalNotOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
 
-  double evaluate() const override { return !operand->evaluate(); }
+  double apply(double x) const override { return !x; }
+
+  double derivative(double, double) const override {
+    return 0;
+  }
 
   constexpr std::string_view identifier() const override { return "!"; }
 
@@ -516,8 +844,12 @@ public:
   LogicalEqualOperation(ExpressionPtr left, ExpressionPtr right)
       : BinaryOperation(std::move(left), std::move(right)) {}
 
-  double evaluate() const override {
-    return left->evaluate() == right->evaluate();
+  double apply(double a, double b) const override {
+    return a == b;
+  }
+
+  Partials partials(double, double, double) const override {
+    return {0, 0};
   }
 
   constexpr std::string_view identifier() const override { return "=="; }
@@ -529,5 +861,299 @@ public:
   }
 };
 
+// Operation over any number of operands, written with call syntax such as
+// sum(a, b, c). The optimizer also flattens chains of the associative binary
+// operations into these nodes.
+class VariadicOperation : public Operation {
+protected:
+  std::vector<ExpressionPtr> operands;
+
+public:
+  explicit VariadicOperation(std::vector<ExpressionPtr> operands)
+      : operands(std::move(operands)) {}
+  virtual ~VariadicOperation() { releaseOperands(); }
+
+  virtual constexpr std::string_view identifier() const = 0;
+
+  double evaluate() const override {
+    constexpr size_t inlineCount = 16;
+    double buffer[inlineCount];
+    std::vector<double> heap;
+    double *values = buffer;
+    if (operands.size() > inlineCount) {
+      heap.resize(operands.size());
+      values = heap.data();
+    }
+    for (size_t i = 0; i < operands.size(); i++) {
+      values[i] = operands[i]->evaluate();
+    }
+    return apply(values, operands.size());
+  }
+
+  // Computes the operation on count already evaluated operands.
+  virtual double apply(const double *values, size_t count) const = 0;
+
+  // Writes the partial derivative with respect to each operand to out.
+  virtual void partials(const double * /*values*/, size_t /*count*/, double /*y*/,
+                        double * /*out*/) const {
+    throw std::logic_error("Operation has no derivative rule");
+  }
+
+  size_t record(Tape &tape, const size_t *operands) const override;
+
+  size_t arity() const override { return operands.size(); }
+
+  const ExpressionPtr &getOperandAt(size_t index) const override {
+    return operands[index];
+  }
+
+  void setOperandAt(size_t index, ExpressionPtr operand) override {
+    operands[index] = std::move(operand);
+  }
+
+  double applyOperands(const double *values) const override {
+    return apply(values, operands.size());
+  }
+
+  ExpressionPtr rebuild(const ExpressionPtr *operands) const override {
+    return create(std::vector<ExpressionPtr>(operands, operands + arity()));
+  }
+
+  virtual ExpressionPtr create(std::vector<ExpressionPtr> operands) const = 0;
+
+  // One binary operation per operand after the first.
+  double cost() const override {
+    return operands.size() > 1 ? static_cast<double>(operands.size() - 1) : 1;
+  }
+
+  // Whether the operands may be regrouped and reordered, which lets the
+  // optimizer fold the constant ones together.
+  virtual bool commutative() const { return false; }
+
+  // Moves the operands out, leaving the operation empty. For passes that own
+  // the node and merge it into another.
+  std::vector<ExpressionPtr> takeOperands() { return std::move(operands); }
+};
+
+// Pairwise summation: the error grows with log(n) instead of n, and the two
+// halves have no dependency on each other.
+class SumOperation : public VariadicOperation {
+public:
+  explicit SumOperation(std::vector<ExpressionPtr> operands)
+      : VariadicOperation(std::move(operands)) {}
+
+  static double sum(const double *values, size_t count) {
+    if (count <= 8) {
+      double result = 0;
+      for (size_t i = 0; i < count; i++) {
+        result += values[i];
+      }
+      return result;
+    }
+    size_t half = count / 2;
+    return sum(values, half) + sum(values + half, count - half);
+  }
+
+  double apply(const double *values, size_t count) const override {
+    return sum(values, count);
+  }
+
+  void partials(const double *, size_t count, double,
+                double *out) const override {
+    std::fill(out, out + count, 1.0);
+  }
+
+  bool commutative() const override { return true; }
+
+  constexpr std::string_view identifier() const override { return "sum"; }
+
+  constexpr int precedence() const override { return 4; }
+
+  ExpressionPtr create(std::vector<ExpressionPtr> operands) const override {
+    return std::make_shared<SumOperation>(std::move(operands));
+  }
+};
+
+// Balanced product tree, for the same reasons as SumOperation.
+class ProductOperation : public VariadicOperation {
+public:
+  explicit ProductOperation(std::vector<ExpressionPtr> operands)
+      : VariadicOperation(std::move(operands)) {}
+
+  static double product(const double *values, size_t count) {
+    if (count <= 8) {
+      double result = 1;
+      for (size_t i = 0; i < count; i++) {
+        result *= values[i];
+      }
+      return result;
+    }
+    size_t half = count / 2;
+    return product(values, half) * product(values + half, count - half);
+  }
+
+  double apply(const double *values, size_t count) const override {
+    return product(values, count);
+  }
+
+  // Product of all the other operands, from prefix and suffix products so a
+  // zero operand does not need a division.
+  void partials(const double *values, size_t count, double,
+                double *out) const override {
+    double prefix = 1;
+    for (size_t i = 0; i < count; i++) {
+      out[i] = prefix;
+      prefix *= values[i];
+    }
+    double suffix = 1;
+    for (size_t i = count; i-- > 0;) {
+      out[i] *= suffix;
+      suffix *= values[i];
+    }
+  }
+
+  bool commutative() const override { return true; }
+
+  constexpr std::string_view identifier() const override { return "product"; }
+
+  constexpr int precedence() const override { return 4; }
+
+  ExpressionPtr create(std::vector<ExpressionPtr> operands) const override {
+    return std::make_shared<ProductOperation>(std::move(operands));
+  }
+};
+
+class VariadicMinOperation : public VariadicOperation {
+public:
+  explicit VariadicMinOperation(std::vector<ExpressionPtr> operands)
+      : VariadicOperation(std::move(operands)) {}
+
+  double apply(const double *values, size_t count) const override {
+    return *std::min_element(values, values + count);
+  }
+
+  void partials(const double *values, size_t count, double,
+                double *out) const override {
+    std::fill(out, out + count, 0.0);
+    out[std::min_element(values, values + count) - values] = 1;
+  }
+
+  constexpr std::string_view identifier() const override { return "min"; }
+
+  constexpr int precedence() const override { return 4; }
+
+  ExpressionPtr create(std::vector<ExpressionPtr> operands) const override {
+    return std::make_shared<VariadicMinOperation>(std::move(operands));
+  }
+};
+
+class VariadicMaxOperation : public VariadicOperation {
+public:
+  explicit VariadicMaxOperation(std::vector<ExpressionPtr> operands)
+      : VariadicOperation(std::move(operands)) {}
+
+  double apply(const double *values, size_t count) const override {
+    return *std::max_element(values, values + count);
+  }
+
+  void partials(const double *values, size_t count, double,
+                double *out) const override {
+    std::fill(out, out + count, 0.0);
+    out[std::max_element(values, values + count) - values] = 1;
+  }
+
+  constexpr std::string_view identifier() const override { return "max"; }
+
+  constexpr int precedence() const override { return 4; }
+
+  ExpressionPtr create(std::vector<ExpressionPtr> operands) const override {
+    return std::make_shared<VariadicMaxOperation>(std::move(operands));
+  }
+};
+
+inline std::shared_ptr<const VariadicOperation> AddOperation::variadic() const {
+  static const auto prototype =
+      std::make_shared<SumOperation>(std::vector<ExpressionPtr>{});
+  return prototype;
+}
+
+inline std::shared_ptr<const VariadicOperation>
+MultiplyOperation::variadic() const {
+  static const auto prototype =
+      std::make_shared<ProductOperation>(std::vector<ExpressionPtr>{});
+  return prototype;
+}
+
+inline std::shared_ptr<const VariadicOperation> MinOperation::variadic() const {
+  static const auto prototype =
+      std::make_shared<VariadicMinOperation>(std::vector<ExpressionPtr>{});
+  return prototype;
+}
+
+inline std::shared_ptr<const VariadicOperation> MaxOperation::variadic() const {
+  static const auto prototype =
+      std::make_shared<VariadicMaxOperation>(std::vector<ExpressionPtr>{});
+  return prototype;
+}
+
+// a * b + c. Not reachable from the parser; the optimizer emits it when
+// rewriting polynomials into Horner form. Uses a single rounding when the
+// target has a hardware fused multiply-add.
+class FusedMultiplyAddOperation : public Operation {
+  ExpressionPtr a;
+  ExpressionPtr b;
+  ExpressionPtr c;
+
+public:
+  FusedMultiplyAddOperation(ExpressionPtr a, ExpressionPtr b, ExpressionPtr c)
+      : a(std::move(a)), b(std::move(b)), c(std::move(c)) {}
+  ~FusedMultiplyAddOperation() { releaseOperands(); }
+
+  static double apply(double a, double b, double c) {
+#ifdef FP_FAST_FMA
+    return std::fma(a, b, c);
+#else
+    return a * b + c;
+#endif
+  }
+
+  double evaluate() const override {
+    return apply(a->evaluate(), b->evaluate(), c->evaluate());
+  }
+
+  size_t record(Tape &tape, const size_t *operands) const override;
+
+  size_t arity() const override { return 3; }
+
+  const ExpressionPtr &getOperandAt(size_t index) const override {
+    return index == 0 ? a : index == 1 ? b : c;
+  }
+
+  void setOperandAt(size_t index, ExpressionPtr operand) override {
+    (index == 0 ? a : index == 1 ? b : c) = std::move(operand);
+  }
+
+  double applyOperands(const double *values) const override {
+    return apply(values[0], values[1], values[2]);
+  }
+
+  ExpressionPtr rebuild(const ExpressionPtr *operands) const override {
+    return std::make_shared<FusedMultiplyAddOperation>(operands[0], operands[1],
+                                                       operands[2]);
+  }
+
+  constexpr std::string_view identifier() const override { return "fma"; }
+
+  constexpr int precedence() const override { return 4; }
+
+  void setMultiplicand(ExpressionPtr a) { this->a = std::move(a); }
+  void setMultiplier(ExpressionPtr b) { this->b = std::move(b); }
+  void setAddend(ExpressionPtr c) { this->c = std::move(c); }
+
+  ExpressionPtr getMultiplicand() const { return a; }
+  ExpressionPtr getMultiplier() const { return b; }
+  ExpressionPtr getAddend() const { return c; }
+};
+
 } // namespace operations
 } // namespace expression_solver
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Binary protocol between EvaluationServer and EvaluationClient. Both ends
+// run on the same host, so values are in native byte order. Every message,
+// in either direction, is a FrameHeader followed by size bytes of payload:
+//
+//   Lookup      request:  program name
+//               response: u32 program, u32 inputs, then per input a u16
+//                         length and the input name
+//   Evaluate    request:  u32 program, u32 rows, then inputs * rows doubles,
+//                         one column per input in lookup order
+//               response: rows doubles
+//   Statistics  request:  empty
+//               response: a Statistics
+//
+// A response repeats the id of its request; responses to one connection may
+// arrive out of order. On failure the status is not Ok and the payload is
+// an error message.
+namespace expression_solver::protocol {
+
+enum class MessageType : uint16_t { Lookup = 1, Evaluate = 2, Statistics = 3 };
+
+enum class Status : uint16_t { Ok = 0, UnknownProgram = 1, BadRequest = 2 };
+
+struct FrameHeader {
+  uint32_t size; // Payload bytes after the header
+  uint32_t id;
+  MessageType type;
+  Status status;
+};
+
+// Frames above this size are rejected and the connection is closed.
+constexpr uint32_t maxFrameSize = 64 << 20;
+
+struct Statistics {
+  uint64_t requests;      // Evaluate requests answered
+  uint64_t rows;          // Rows evaluated
+  uint64_t batches;       // Batch evaluations run; below requests when coalesced
+  double p50Microseconds; // Request latency, from read to results ready
+  double p99Microseconds;
+  double requestsPerSecond; // Since the server started
+  double rowsPerSecond;
+};
+
+// Appends trivially copyable values to a payload.
+class Writer {
+  std::vector<char> &buffer;
+
+public:
+  explicit Writer(std::vector<char> &buffer) : buffer(buffer) {}
+
+  template <typename T> void put(const T &value) { put(&value, sizeof(T)); }
+
+  void put(const void *data, size_t size) {
+    auto bytes = static_cast<const char *>(data);
+    buffer.insert(buffer.end(), bytes, bytes + size);
+  }
+
+  void putString(std::string_view value) {
+    put(static_cast<uint16_t>(value.size()));
+    put(value.data(), value.size());
+  }
+};
+
+// Reads values back from a payload; ok() turns false on a short payload.
+class Reader {
+  const char *data;
+  size_t size;
+  bool valid = true;
+
+public:
+  Reader(const char *data, size_t size) : data(data), size(size) {}
+
+  template <typename T> T get() {
+    T value{};
+    get(&value, sizeof(T));
+    return value;
+  }
+
+  void get(void *out, size_t count) {
+    if (count > size) {
+      valid = false;
+      size = 0;
+      return;
+    }
+    std::memcpy(out, data, count);
+    data += count;
+    size -= count;
+  }
+
+  std::string getString() {
+    std::string value(get<uint16_t>(), '\0');
+    get(value.data(), value.size());
+    return value;
+  }
+
+  const char *position() const { return data; }
+  size_t remaining() const { return size; }
+  bool ok() const { return valid; }
+};
+
+} // namespace expression_solver::protocol
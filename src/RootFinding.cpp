@@ -0,0 +1,428 @@
+#include "RootFinding.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace expression_solver {
+
+namespace {
+
+constexpr double epsilon = std::numeric_limits<double>::epsilon();
+constexpr double missing = std::numeric_limits<double>::quiet_NaN();
+
+// Rows whose iterations are interleaved, so the state of a chunk stays in
+// cache whatever the size of the batch.
+constexpr size_t chunkRows = 4096;
+
+} // namespace
+
+// Value and tangent columns of every node for one block of points.
+struct RootFinder::Columns {
+  size_t block;
+  std::vector<double> values;
+  std::vector<double> tangents;
+  std::vector<const double *> bound;
+  std::vector<const double *> args;
+  std::vector<double> operands; // Row of a variadic node, and its partials
+  std::vector<double> weights;
+};
+
+RootFinder::RootFinder(ExpressionPtr expression, const PlaceHolder &unknown)
+    : expression(std::move(expression)), unknown(&unknown) {
+  using namespace operations;
+
+  auto compiled = dynamic_cast<const CompiledExpression *>(this->expression.get());
+  code = compiled ? compiled->getCode() : linearize(*this->expression);
+  rules.resize(code.nodes.size());
+  depends.resize(code.nodes.size());
+
+  // A derivative rule exists when calling it does not throw; the rules of
+  // the built-in operations are defined everywhere.
+  auto probe = [](auto &&rule) {
+    try {
+      rule();
+      return true;
+    } catch (const std::logic_error &) {
+      return false;
+    }
+  };
+
+  for (size_t i = 0; i < code.nodes.size(); i++) {
+    const auto &node = code.nodes[i];
+    if (!node.operation) {
+      depends[i] = node.expression == this->unknown;
+      rules[i] = depends[i] ? Rule::Unknown : Rule::Leaf;
+      continue;
+    }
+    if (!node.operation->isPure()) {
+      throw std::invalid_argument("Root finding needs an expression without streaming operations");
+    }
+    for (uint32_t k = 0; k < node.arity; k++) {
+      if (depends[code.operands[node.firstOperand + k]]) {
+        depends[i] = true;
+      }
+    }
+
+    bool known;
+    if (auto unary = dynamic_cast<const UnaryOperation *>(node.operation)) {
+      rules[i] = Rule::Unary;
+      known = probe([&] { unary->derivative(0.5, unary->apply(0.5)); });
+    } else if (auto binary = dynamic_cast<const BinaryOperation *>(node.operation)) {
+      rules[i] = Rule::Binary;
+      known = probe([&] { binary->partials(0.5, 0.5, binary->apply(0.5, 0.5)); });
+    } else if (auto variadic = dynamic_cast<const VariadicOperation *>(node.operation)) {
+      rules[i] = Rule::Variadic;
+      std::vector<double> values(node.arity, 0.5), weights(node.arity);
+      known = probe([&] {
+        variadic->partials(values.data(), node.arity, variadic->apply(values.data(), node.arity),
+                           weights.data());
+      });
+    } else if (dynamic_cast<const FusedMultiplyAddOperation *>(node.operation)) {
+      rules[i] = Rule::FusedMultiplyAdd;
+      known = true;
+    } else {
+      rules[i] = Rule::None;
+      known = false;
+    }
+    if (depends[i] && !known) {
+      differentiable = false;
+    }
+  }
+  if (!depends.back()) {
+    throw std::invalid_argument("Expression does not depend on the unknown");
+  }
+}
+
+void RootFinder::evaluate(Columns &columns, const uint32_t *rows, const double *points,
+                          size_t count, double *values, double *slopes) const {
+  using namespace operations;
+
+  size_t block = columns.block;
+  size_t last = code.nodes.size() - 1;
+  const uint32_t *operands = code.operands.data();
+  for (size_t start = 0; start < count; start += block) {
+    size_t n = std::min(block, count - start);
+    for (size_t i = 0; i < code.nodes.size(); i++) {
+      const auto &node = code.nodes[i];
+      double *y = &columns.values[i * block];
+      double *dy = slopes && depends[i] ? &columns.tangents[i * block] : nullptr;
+      if (rules[i] == Rule::Unknown) {
+        std::copy_n(points + start, n, y);
+        if (dy) {
+          std::fill_n(dy, n, 1.0);
+        }
+        continue;
+      }
+      if (rules[i] == Rule::Leaf) {
+        if (const double *column = columns.bound[i]) {
+          for (size_t r = 0; r < n; r++) {
+            y[r] = column[rows[start + r]];
+          }
+        }
+        continue; // Unbound leaves were filled once
+      }
+
+      for (uint32_t k = 0; k < node.arity; k++) {
+        columns.args[k] = &columns.values[operands[node.firstOperand + k] * block];
+      }
+      node.operation->applyBatch(columns.args.data(), y, n);
+      if (!dy) {
+        continue;
+      }
+
+      // Forward mode: the tangent of a node is the sum of its partials times
+      // the tangents of the operands that depend on the unknown.
+      auto tangent = [&](uint32_t k) -> const double * {
+        uint32_t operand = operands[node.firstOperand + k];
+        return depends[operand] ? &columns.tangents[operand * block] : nullptr;
+      };
+      const double *const *x = columns.args.data();
+      switch (rules[i]) {
+      case Rule::Unary: {
+        auto op = static_cast<const UnaryOperation *>(node.operation);
+        const double *dx = tangent(0);
+        for (size_t r = 0; r < n; r++) {
+          dy[r] = op->derivative(x[0][r], y[r]) * dx[r];
+        }
+        break;
+      }
+      case Rule::Binary: {
+        auto op = static_cast<const BinaryOperation *>(node.operation);
+        const double *da = tangent(0), *db = tangent(1);
+        for (size_t r = 0; r < n; r++) {
+          auto [pa, pb] = op->partials(x[0][r], x[1][r], y[r]);
+          dy[r] = (da ? pa * da[r] : 0) + (db ? pb * db[r] : 0);
+        }
+        break;
+      }
+      case Rule::Variadic: {
+        auto op = static_cast<const VariadicOperation *>(node.operation);
+        auto &row = columns.operands;
+        auto &weights = columns.weights;
+        std::fill_n(dy, n, 0.0);
+        for (size_t r = 0; r < n; r++) {
+          for (uint32_t k = 0; k < node.arity; k++) {
+            row[k] = x[k][r];
+          }
+          op->partials(row.data(), node.arity, y[r], weights.data());
+          for (uint32_t k = 0; k < node.arity; k++) {
+            if (const double *dk = tangent(k)) {
+              dy[r] += weights[k] * dk[r];
+            }
+          }
+        }
+        break;
+      }
+      case Rule::FusedMultiplyAdd: {
+        const double *da = tangent(0), *db = tangent(1), *dc = tangent(2);
+        for (size_t r = 0; r < n; r++) {
+          dy[r] = (da ? x[1][r] * da[r] : 0) + (db ? x[0][r] * db[r] : 0) + (dc ? dc[r] : 0);
+        }
+        break;
+      }
+      default:
+        break; // Not reached: such expressions are not differentiable
+      }
+    }
+    std::copy_n(&columns.values[last * block], n, values + start);
+    if (slopes) {
+      std::copy_n(&columns.tangents[last * block], n, slopes + start);
+    }
+  }
+}
+
+size_t RootFinder::solve(std::span<const Binding> bindings, std::span<const double> targets,
+                         double lower, double upper, std::span<double> roots,
+                         std::span<RootStatus> status, const RootOptions &options) const {
+  size_t rows = roots.size();
+  for (const auto &binding : bindings) {
+    if (binding.values.size() < rows) {
+      throw std::invalid_argument("Binding has fewer values than roots");
+    }
+  }
+  if (!targets.empty() && targets.size() != rows) {
+    throw std::invalid_argument("Targets must be empty or hold one value per root");
+  }
+  if (!status.empty() && status.size() != rows) {
+    throw std::invalid_argument("Status must be empty or hold one value per root");
+  }
+  if (!(lower < upper) || !std::isfinite(lower) || !std::isfinite(upper)) {
+    throw std::invalid_argument("Interval must be finite with lower < upper");
+  }
+
+  bool newton = options.useDerivative && differentiable;
+  Columns columns;
+  size_t count = code.nodes.size();
+  columns.block = std::clamp<size_t>((size_t(1) << 18) / count, 1, 256);
+  columns.values.resize(count * columns.block);
+  columns.tangents.resize(newton ? count * columns.block : 0);
+  columns.bound.assign(count, nullptr);
+  columns.args.resize(std::max<size_t>(code.maxArity, 1));
+  columns.operands.resize(code.maxArity);
+  columns.weights.resize(code.maxArity);
+  for (size_t i = 0; i < count; i++) {
+    if (rules[i] != Rule::Leaf) {
+      continue;
+    }
+    auto binding = std::find_if(bindings.begin(), bindings.end(), [&](const auto &b) {
+      return b.placeholder == code.nodes[i].expression;
+    });
+    if (binding != bindings.end()) {
+      columns.bound[i] = binding->values.data();
+    } else {
+      std::fill_n(&columns.values[i * columns.block], columns.block,
+                  code.nodes[i].expression->evaluate());
+    }
+  }
+
+  // Per-row state. Newton keeps the bracket as xl, xh with f(xl) < 0 <
+  // f(xh), and the last two steps. Brent keeps its points a, b, c, their
+  // values and its last two steps in d and e; b is the estimate.
+  struct State {
+    double xl, xh, x, dx, dxold;
+    double a, b, c, fa, fb, fc, d, e;
+    size_t iterations;
+  };
+  std::vector<State> states(std::min(rows, chunkRows));
+  std::vector<uint32_t> chunkRowIds(states.size()), active(states.size()), activeRows(states.size());
+  std::vector<double> points(states.size()), values(states.size()), slopes(states.size());
+  std::vector<double> ends(states.size());
+  size_t converged = 0;
+
+  auto tolerance = [&](double x) { return options.tolerance + 4 * epsilon * std::abs(x); };
+  auto finish = [&](size_t row, double root, RootStatus result) {
+    roots[row] = root;
+    if (!status.empty()) {
+      status[row] = result;
+    }
+    converged += result == RootStatus::Converged;
+  };
+
+  enum class Step { Continue, Converged, Failed };
+
+  // rtsafe: Newton while it stays inside the bracket and halves the step at
+  // least every other iteration, bisection otherwise.
+  auto newtonStep = [&](State &s, double f, double df) {
+    if (std::isnan(f)) {
+      return Step::Failed;
+    }
+    if (f == 0) {
+      return Step::Converged;
+    }
+    (f < 0 ? s.xl : s.xh) = s.x;
+    bool inside = std::isfinite(df) && df != 0 &&
+                  ((s.x - s.xh) * df - f) * ((s.x - s.xl) * df - f) <= 0 &&
+                  std::abs(2 * f) <= std::abs(s.dxold * df);
+    s.dxold = s.dx;
+    if (inside) {
+      s.dx = f / df;
+      s.x -= s.dx;
+    } else {
+      s.dx = 0.5 * (s.xh - s.xl);
+      s.x = s.xl + s.dx;
+    }
+    return std::abs(s.dx) <= tolerance(s.x) ? Step::Converged : Step::Continue;
+  };
+
+  // One iteration of Brent's method (zbrent), given the value fb at b.
+  auto brentStep = [&](State &s) {
+    if (std::isnan(s.fb)) {
+      return Step::Failed;
+    }
+    if ((s.fb > 0 && s.fc > 0) || (s.fb < 0 && s.fc < 0)) {
+      s.c = s.a;
+      s.fc = s.fa;
+      s.e = s.d = s.b - s.a;
+    }
+    if (std::abs(s.fc) < std::abs(s.fb)) {
+      s.a = s.b;
+      s.b = s.c;
+      s.c = s.a;
+      s.fa = s.fb;
+      s.fb = s.fc;
+      s.fc = s.fa;
+    }
+    double tol = 0.5 * tolerance(s.b);
+    double xm = 0.5 * (s.c - s.b);
+    if (std::abs(xm) <= tol || s.fb == 0) {
+      return Step::Converged;
+    }
+    if (std::abs(s.e) >= tol && std::abs(s.fa) > std::abs(s.fb)) {
+      double p, q, r, t = s.fb / s.fa;
+      if (s.a == s.c) {
+        p = 2 * xm * t;
+        q = 1 - t;
+      } else {
+        q = s.fa / s.fc;
+        r = s.fb / s.fc;
+        p = t * (2 * xm * q * (q - r) - (s.b - s.a) * (r - 1));
+        q = (q - 1) * (r - 1) * (t - 1);
+      }
+      if (p > 0) {
+        q = -q;
+      }
+      p = std::abs(p);
+      if (2 * p < std::min(3 * xm * q - std::abs(tol * q), std::abs(s.e * q))) {
+        s.e = s.d;
+        s.d = p / q;
+      } else {
+        s.d = xm;
+        s.e = s.d;
+      }
+    } else {
+      s.d = xm;
+      s.e = s.d;
+    }
+    s.a = s.b;
+    s.fa = s.fb;
+    s.b += std::abs(s.d) > tol ? s.d : std::copysign(tol, xm);
+    return Step::Continue;
+  };
+
+  for (size_t first = 0; first < rows; first += chunkRows) {
+    size_t m = std::min(chunkRows, rows - first);
+    for (size_t j = 0; j < m; j++) {
+      chunkRowIds[j] = static_cast<uint32_t>(first + j);
+    }
+    auto target = [&](size_t row) { return targets.empty() ? 0 : targets[row]; };
+
+    // Values at both ends of the interval decide which rows have a root.
+    std::fill_n(points.begin(), m, lower);
+    evaluate(columns, chunkRowIds.data(), points.data(), m, ends.data(), nullptr);
+    std::fill_n(points.begin(), m, upper);
+    evaluate(columns, chunkRowIds.data(), points.data(), m, values.data(), nullptr);
+
+    size_t pending = 0;
+    for (size_t j = 0; j < m; j++) {
+      size_t row = first + j;
+      double fl = ends[j] - target(row);
+      double fu = values[j] - target(row);
+      if (fl == 0 || fu == 0) {
+        finish(row, fl == 0 ? lower : upper, RootStatus::Converged);
+        continue;
+      }
+      if (std::isnan(fl) || std::isnan(fu) || (fl > 0) == (fu > 0)) {
+        finish(row, missing, RootStatus::NotBracketed);
+        continue;
+      }
+      State &s = states[j];
+      s.iterations = 0;
+      if (newton) {
+        s.xl = fl < 0 ? lower : upper;
+        s.xh = fl < 0 ? upper : lower;
+        s.x = 0.5 * (lower + upper);
+        s.dx = s.dxold = upper - lower;
+      } else {
+        s.a = lower;
+        s.b = s.c = upper;
+        s.fa = fl;
+        s.fb = s.fc = fu;
+        s.d = s.e = 0;
+        brentStep(s);
+      }
+      active[pending++] = static_cast<uint32_t>(j);
+    }
+
+    // Lockstep iterations over the rows still active, compacted after each.
+    while (pending > 0) {
+      for (size_t k = 0; k < pending; k++) {
+        const State &s = states[active[k]];
+        activeRows[k] = static_cast<uint32_t>(first + active[k]);
+        points[k] = newton ? s.x : s.b;
+      }
+      evaluate(columns, activeRows.data(), points.data(), pending, values.data(),
+               newton ? slopes.data() : nullptr);
+
+      size_t kept = 0;
+      for (size_t k = 0; k < pending; k++) {
+        size_t j = active[k];
+        size_t row = first + j;
+        State &s = states[j];
+        double f = values[k] - target(row);
+        Step step;
+        if (newton) {
+          step = newtonStep(s, f, slopes[k]);
+        } else {
+          s.fb = f;
+          step = brentStep(s);
+        }
+        double estimate = newton ? s.x : s.b;
+        if (step == Step::Converged) {
+          finish(row, estimate, RootStatus::Converged);
+        } else if (step == Step::Failed) {
+          finish(row, missing, RootStatus::NoConvergence);
+        } else if (++s.iterations >= options.maxIterations) {
+          finish(row, estimate, RootStatus::NoConvergence);
+        } else {
+          active[kept++] = static_cast<uint32_t>(j);
+        }
+      }
+      pending = kept;
+    }
+  }
+  return converged;
+}
+
+} // namespace expression_solver
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "CompiledExpression.hpp"
+
+namespace expression_solver {
+
+enum class RootStatus : uint8_t {
+  Converged,
+  NotBracketed, // The expression has the same sign at both ends of the interval
+  NoConvergence // Out of iterations, or NaN inside the interval
+};
+
+struct RootOptions {
+  // Absolute accuracy of the root; a few ulps of the root are added to it.
+  double tolerance = 1e-12;
+  size_t maxIterations = 100;
+  // Newton steps from the derivative of the expression. Without it, or for
+  // expressions with an operation that has no derivative rule, Brent's
+  // method is used.
+  bool useDerivative = true;
+};
+
+// Solves expression = target for one placeholder, the unknown, over a batch
+// of rows that differ in their other inputs and targets.
+//
+// Every row has the interval [lower, upper], whose ends must give the
+// expression opposite signs. Rows then iterate in lockstep: each iteration
+// evaluates the expression, and with Newton its derivative by forward mode,
+// at one point per unfinished row as columns over the compiled program.
+// Rows drop out of the batch as they converge, so the cost follows the rows
+// still iterating. Newton steps that leave the bracket or shrink it too
+// slowly fall back to bisection, as in rtsafe; Brent's method mixes inverse
+// quadratic interpolation, secant steps and bisection.
+class RootFinder {
+  enum class Rule : uint8_t { Leaf, Unknown, Unary, Binary, Variadic, FusedMultiplyAdd, None };
+
+  ExpressionPtr expression;
+  const PlaceHolder *unknown;
+  Linearization code;
+  std::vector<Rule> rules;
+  std::vector<bool> depends; // Node depends on the unknown
+  bool differentiable = true;
+
+  struct Columns;
+  void evaluate(Columns &columns, const uint32_t *rows, const double *points, size_t count,
+                double *values, double *slopes) const;
+
+public:
+  // Expressions with streaming operations are rejected, since every
+  // iteration would take a sample.
+  RootFinder(ExpressionPtr expression, const PlaceHolder &unknown);
+
+  // Writes the root of row i to roots[i], and its status to status[i] when
+  // status is not empty; roots of rows without a root are NaN. targets holds
+  // one value per row, or is empty to find zeros. Returns the number of
+  // converged rows.
+  size_t solve(std::span<const Binding> bindings, std::span<const double> targets, double lower,
+               double upper, std::span<double> roots, std::span<RootStatus> status = {},
+               const RootOptions &options = {}) const;
+
+  // False when some operation the unknown flows through has no derivative
+  // rule, so only Brent's method is available.
+  bool hasDerivative() const { return differentiable; }
+};
+
+} // namespace expression_solver
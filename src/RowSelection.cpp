@@ -0,0 +1,135 @@
+#include "RowSelection.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <stdexcept>
+
+namespace expression_solver {
+
+RowSelector::RowSelector(ExpressionPtr expression) {
+  compiled = std::dynamic_pointer_cast<const CompiledExpression>(expression);
+  if (!compiled) {
+    compiled = std::make_shared<const CompiledExpression>(std::move(expression));
+  }
+  for (const auto &node : compiled->getCode().nodes) {
+    pure &= !node.operation || node.operation->isPure();
+  }
+}
+
+// Evaluates the rows chunk by chunk and folds each chunk's values into a
+// State, one per task; the states of the tasks are merged in row order.
+template <typename State, typename Fold, typename Merge>
+State RowSelector::run(std::span<const Binding> bindings, size_t rows, ThreadPool *pool,
+                       Fold &&fold, Merge &&merge) const {
+  if (rows > std::numeric_limits<uint32_t>::max()) {
+    throw std::invalid_argument("Too many rows for a selection vector");
+  }
+  for (const auto &binding : bindings) {
+    if (binding.values.size() < rows) {
+      throw std::invalid_argument("Binding has fewer values than rows");
+    }
+  }
+  size_t chunks = (rows + chunkSize - 1) / chunkSize;
+  auto work = [&](size_t begin, size_t end) {
+    State state;
+    std::vector<double> values(std::min(chunkSize, rows));
+    std::vector<Binding> window(bindings.begin(), bindings.end());
+    for (size_t chunk = begin; chunk < end; chunk++) {
+      size_t start = chunk * chunkSize;
+      size_t n = std::min(chunkSize, rows - start);
+      for (size_t k = 0; k < bindings.size(); k++) {
+        window[k].values = bindings[k].values.subspan(start, n);
+      }
+      auto chunkValues = std::span(values).first(n);
+      compiled->evaluate(window, chunkValues);
+      fold(state, static_cast<uint32_t>(start), std::span<const double>(chunkValues));
+    }
+    return state;
+  };
+
+  if (!pool || !pure || chunks <= 1) {
+    return work(0, chunks);
+  }
+  // A few tasks per worker evens out the load.
+  size_t tasks = std::min(chunks, pool->size() * 4);
+  std::vector<std::future<State>> pending;
+  pending.reserve(tasks);
+  for (size_t task = 0; task < tasks; task++) {
+    pending.push_back(pool->submit(
+        [&, task] { return work(chunks * task / tasks, chunks * (task + 1) / tasks); }));
+  }
+  for (auto &future : pending) {
+    future.wait();
+  }
+  State result = pending[0].get();
+  for (size_t task = 1; task < tasks; task++) {
+    merge(result, pending[task].get());
+  }
+  return result;
+}
+
+std::vector<RankedRow> RowSelector::top(std::span<const Binding> bindings, size_t rows, size_t k,
+                                        Rank rank, ThreadPool *pool) const {
+  if (k == 0) {
+    return {};
+  }
+  auto better = [highest = rank == Rank::Highest](const RankedRow &a, const RankedRow &b) {
+    if (a.value != b.value) {
+      return highest ? a.value > b.value : a.value < b.value;
+    }
+    return a.row < b.row;
+  };
+  // A heap with the worst of the k best rows so far on top, so most rows
+  // cost one comparison with it.
+  using Heap = std::vector<RankedRow>;
+  auto offer = [&](Heap &heap, const RankedRow &candidate) {
+    if (heap.size() < k) {
+      heap.push_back(candidate);
+      std::push_heap(heap.begin(), heap.end(), better);
+    } else if (better(candidate, heap.front())) {
+      std::pop_heap(heap.begin(), heap.end(), better);
+      heap.back() = candidate;
+      std::push_heap(heap.begin(), heap.end(), better);
+    }
+  };
+  auto heap = run<Heap>(
+      bindings, rows, pool,
+      [&](Heap &heap, uint32_t start, std::span<const double> values) {
+        for (size_t i = 0; i < values.size(); i++) {
+          if (!std::isnan(values[i])) {
+            offer(heap, {static_cast<uint32_t>(start + i), values[i]});
+          }
+        }
+      },
+      [&](Heap &heap, const Heap &other) {
+        for (const auto &row : other) {
+          offer(heap, row);
+        }
+      });
+  std::sort(heap.begin(), heap.end(), better);
+  return heap;
+}
+
+std::vector<uint32_t> RowSelector::above(std::span<const Binding> bindings, size_t rows,
+                                         double threshold, ThreadPool *pool) const {
+  using Indices = std::vector<uint32_t>;
+  return run<Indices>(
+      bindings, rows, pool,
+      [&](Indices &indices, uint32_t start, std::span<const double> values) {
+        // Branch-free: every row is written, only passing rows advance.
+        size_t count = indices.size();
+        indices.resize(count + values.size());
+        for (size_t i = 0; i < values.size(); i++) {
+          indices[count] = static_cast<uint32_t>(start + i);
+          count += values[i] > threshold;
+        }
+        indices.resize(count);
+      },
+      [](Indices &indices, const Indices &other) {
+        indices.insert(indices.end(), other.begin(), other.end());
+      });
+}
+
+} // namespace expression_solver
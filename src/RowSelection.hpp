@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "CompiledExpression.hpp"
+#include "ThreadPool.hpp"
+
+namespace expression_solver {
+
+// A row of a batch and the value of the expression on it.
+struct RankedRow {
+  uint32_t row;
+  double value;
+
+  bool operator==(const RankedRow &) const = default;
+};
+
+// Which end of the values top keeps.
+enum class Rank { Highest, Lowest };
+
+// Queries over the values of an expression on a batch that need only a few
+// of the rows: the k best, or the ones above a threshold. Rows are evaluated
+// in chunks and folded into the answer as they come, so the values of the
+// batch are never stored: top keeps a bounded heap of k rows per thread,
+// and above keeps the indices that pass. Chunks run in parallel on a thread
+// pool when one is given, and the answers of the threads are merged, with
+// the same result as on one thread.
+class RowSelector {
+  std::shared_ptr<const CompiledExpression> compiled;
+  bool pure = true;
+
+  template <typename State, typename Fold, typename Merge>
+  State run(std::span<const Binding> bindings, size_t rows, ThreadPool *pool, Fold &&fold,
+            Merge &&merge) const;
+
+public:
+  static constexpr size_t chunkSize = 16384;
+
+  // Expressions with streaming operations run on the calling thread, in
+  // row order, whatever the pool.
+  explicit RowSelector(ExpressionPtr expression);
+
+  // The k rows with the highest (or lowest) values, best first; ties go to
+  // the lower row. NaN values are never selected. Every binding must hold
+  // at least rows values.
+  std::vector<RankedRow> top(std::span<const Binding> bindings, size_t rows, size_t k,
+                             Rank rank = Rank::Highest, ThreadPool *pool = nullptr) const;
+
+  // The rows whose value is above threshold, in row order.
+  std::vector<uint32_t> above(std::span<const Binding> bindings, size_t rows, double threshold,
+                              ThreadPool *pool = nullptr) const;
+};
+
+} // namespace expression_solver
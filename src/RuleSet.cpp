@@ -0,0 +1,34 @@
+#include "RuleSet.hpp"
+#include "ExpressionSolver.hpp"
+
+namespace expression_solver {
+
+bool RuleSetHolder::publish(RuleSetPtr rules) {
+  auto expected = current.load(std::memory_order_acquire);
+  do {
+    if (expected->getVersion() > rules->getVersion()) {
+      return false;
+    }
+  } while (!current.compare_exchange_weak(expected, rules,
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_acquire));
+  return true;
+}
+
+std::future<RuleSetPtr>
+RuleSetHolder::publishAsync(const ExpressionSolver &solver,
+                            std::vector<std::pair<std::string, std::string>> sources,
+                            ThreadPool &pool) {
+  uint64_t version = nextVersion++;
+  return pool.submit([this, solver, sources = std::move(sources), version] {
+    StringMap<ExpressionPtr> rules;
+    rules.reserve(sources.size());
+    for (const auto &[name, expression] : sources) {
+      rules.insert_or_assign(name, solver.compile(expression));
+    }
+    auto set = std::make_shared<const RuleSet>(std::move(rules), version);
+    return publish(set) ? RuleSetPtr(set) : nullptr;
+  });
+}
+
+} // namespace expression_solver
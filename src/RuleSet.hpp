@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Context.hpp"
+#include "Expression.hpp"
+#include "ThreadPool.hpp"
+
+namespace expression_solver {
+
+class ExpressionSolver;
+
+// Immutable set of named, compiled rules. A new configuration is a new
+// RuleSet, published as a whole through a RuleSetHolder.
+class RuleSet {
+  StringMap<ExpressionPtr> rules;
+  uint64_t version;
+
+public:
+  explicit RuleSet(StringMap<ExpressionPtr> rules = {}, uint64_t version = 0)
+      : rules(std::move(rules)), version(version) {}
+
+  uint64_t getVersion() const { return version; }
+  size_t size() const { return rules.size(); }
+
+  bool has(std::string_view name) const { return rules.contains(name); }
+
+  const ExpressionPtr &get(std::string_view name) const {
+    auto it = rules.find(name);
+    if (it == rules.end()) {
+      throw std::invalid_argument("Rule not found: " + std::string(name));
+    }
+    return it->second;
+  }
+
+  double evaluate(std::string_view name) const { return get(name)->evaluate(); }
+
+  const StringMap<ExpressionPtr> &getRules() const { return rules; }
+};
+
+typedef std::shared_ptr<const RuleSet> RuleSetPtr;
+
+// Holds the current rule set, RCU style. Readers take a snapshot with load()
+// and keep evaluating it while newer sets are published; a set is freed when
+// its last reader drops it. Readers never wait for a compile. load() is not
+// lock-free, though: std::atomic<std::shared_ptr> is implemented with a
+// small internal lock, held by load() and publish() only while they copy
+// the pointer and its reference count. Readers that evaluate many rules
+// should load once and keep the snapshot.
+class RuleSetHolder {
+  std::atomic<RuleSetPtr> current;
+  std::atomic<uint64_t> nextVersion{1};
+
+public:
+  RuleSetHolder() : current(std::make_shared<const RuleSet>()) {}
+  explicit RuleSetHolder(RuleSetPtr rules) : current(std::move(rules)) {
+    nextVersion = current.load()->getVersion() + 1;
+  }
+
+  RuleSetPtr load() const { return current.load(std::memory_order_acquire); }
+
+  // Makes rules current unless a newer version is already published, so
+  // compiles finishing out of order never roll the set back. Returns whether
+  // rules was published.
+  bool publish(RuleSetPtr rules);
+
+  // Compiles every (name, expression) pair on pool and publishes the result
+  // as the next version. The future yields the set once it is current, or
+  // nullptr when a newer version was published first. If any expression
+  // fails to compile nothing is published and the future rethrows the
+  // error. The solver is copied; the holder must outlive the task.
+  std::future<RuleSetPtr>
+  publishAsync(const ExpressionSolver &solver,
+               std::vector<std::pair<std::string, std::string>> sources,
+               ThreadPool &pool = ThreadPool::shared());
+};
+
+} // namespace expression_solver
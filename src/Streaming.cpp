@@ -0,0 +1,250 @@
+#include "Streaming.hpp"
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "CompiledExpression.hpp"
+#include "Traversal.hpp"
+
+namespace expression_solver {
+
+namespace streaming {
+
+bool RingBuffer::push(double x) {
+  if (values.empty()) {
+    values.resize(n);
+  }
+  values[next] = x;
+  filled += filled < n;
+  next = next + 1 == n ? 0 : next + 1;
+  return next == 0;
+}
+
+double MonotonicWindow::push(double x) {
+  if (ring.empty()) {
+    ring.resize(window);
+  }
+  uint64_t index = samples++;
+  if (count > 0 && ring[head].index + window <= index) {
+    head = head + 1 == ring.size() ? 0 : head + 1;
+    count--;
+  }
+  if (!std::isnan(x)) {
+    size_t end = head + count;
+    end -= end >= ring.size() ? ring.size() : 0;
+    while (count > 0) {
+      size_t back = end == 0 ? ring.size() - 1 : end - 1;
+      if (greatest ? ring[back].value > x : ring[back].value < x) {
+        break;
+      }
+      end = back;
+      count--;
+    }
+    ring[end] = {index, x};
+    count++;
+  }
+  return count > 0 ? ring[head].value : std::numeric_limits<double>::quiet_NaN();
+}
+
+} // namespace streaming
+
+namespace operations {
+
+namespace {
+
+constexpr double maxWindow = 1 << 24;
+
+// Whether the operand is built from literals and pure operations only, such
+// as 1 + 1, so it has the same value on every row. The parser builds nodes
+// before the optimizer folds them, so a literal check alone would reject it.
+bool isConstant(const ExpressionPtr &operand) {
+  for (const auto &node : linearize(*operand).nodes) {
+    if (node.operation ? !node.operation->isPure()
+                       : !dynamic_cast<const ConstExpression *>(node.expression)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Window length from the constant second operand. Prototypes registered in
+// a context have no operands and get a window of one.
+size_t windowOf(const ExpressionPtr &operand, std::string_view name) {
+  if (!operand) {
+    return 1;
+  }
+  if (!isConstant(operand)) {
+    throw std::invalid_argument("Window of " + std::string(name) + " must be a constant");
+  }
+  double n = operand->evaluate();
+  if (!(n >= 1 && n <= maxWindow && n == std::floor(n))) {
+    throw std::invalid_argument("Window of " + std::string(name) +
+                                " must be a whole number from 1 to 16777216");
+  }
+  return static_cast<size_t>(n);
+}
+
+} // namespace
+
+size_t StreamingBinaryOperation::record(Tape &, const size_t *) const {
+  throw std::logic_error("Streaming operations have no derivative");
+}
+
+size_t DeltaOperation::record(Tape &, const size_t *) const {
+  throw std::logic_error("Streaming operations have no derivative");
+}
+
+LagOperation::LagOperation(ExpressionPtr left, ExpressionPtr right)
+    : StreamingBinaryOperation(std::move(left), right), buffer(windowOf(right, "lag")) {}
+
+double LagOperation::apply(double x, double) const {
+  double y = buffer.full() ? buffer.oldest() : std::numeric_limits<double>::quiet_NaN();
+  buffer.push(x);
+  return y;
+}
+
+void LagOperation::applyBatch(const double *const *operands, double *out, size_t count) const {
+  const double *x = operands[0];
+  for (size_t i = 0; i < count; i++) {
+    out[i] = apply(x[i], 0);
+  }
+}
+
+EmaOperation::EmaOperation(ExpressionPtr left, ExpressionPtr right)
+    : StreamingBinaryOperation(std::move(left), right) {
+  if (right) {
+    if (!isConstant(right)) {
+      throw std::invalid_argument("Smoothing factor of ema must be a constant");
+    }
+    alpha = right->evaluate();
+    if (!(alpha > 0 && alpha <= 1)) {
+      throw std::invalid_argument("Smoothing factor of ema must be in (0, 1]");
+    }
+  }
+}
+
+double EmaOperation::apply(double x, double) const {
+  if (!std::isnan(x)) {
+    average = started ? average + alpha * (x - average) : x;
+    started = true;
+  }
+  return started ? average : std::numeric_limits<double>::quiet_NaN();
+}
+
+void EmaOperation::applyBatch(const double *const *operands, double *out, size_t count) const {
+  const double *x = operands[0];
+  for (size_t i = 0; i < count; i++) {
+    out[i] = apply(x[i], 0);
+  }
+}
+
+RollingMeanOperation::RollingMeanOperation(ExpressionPtr left, ExpressionPtr right)
+    : StreamingBinaryOperation(std::move(left), right),
+      buffer(windowOf(right, "rolling_mean")) {}
+
+void RollingMeanOperation::tally(double x, int direction) const {
+  if (std::isnan(x)) {
+    nans += direction;
+  } else if (std::isinf(x)) {
+    (x > 0 ? positiveInfinities : negativeInfinities) += direction;
+  } else {
+    sum += direction * x;
+  }
+}
+
+double RollingMeanOperation::apply(double x, double) const {
+  if (buffer.full()) {
+    tally(buffer.oldest(), -1);
+  }
+  tally(x, 1);
+  if (buffer.push(x)) {
+    sum = 0;
+    for (double value : buffer.data()) {
+      sum += std::isfinite(value) ? value : 0;
+    }
+  }
+  if (nans > 0 || (positiveInfinities > 0 && negativeInfinities > 0)) {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  if (positiveInfinities > 0 || negativeInfinities > 0) {
+    return positiveInfinities > 0 ? std::numeric_limits<double>::infinity()
+                                  : -std::numeric_limits<double>::infinity();
+  }
+  return sum / static_cast<double>(buffer.size());
+}
+
+void RollingMeanOperation::applyBatch(const double *const *operands, double *out,
+                                      size_t count) const {
+  const double *x = operands[0];
+  for (size_t i = 0; i < count; i++) {
+    out[i] = apply(x[i], 0);
+  }
+}
+
+void RollingMeanOperation::reset() const {
+  buffer.clear();
+  sum = 0;
+  nans = positiveInfinities = negativeInfinities = 0;
+}
+
+RollingMaxOperation::RollingMaxOperation(ExpressionPtr left, ExpressionPtr right)
+    : StreamingBinaryOperation(std::move(left), right),
+      window(windowOf(right, "rolling_max"), true) {}
+
+void RollingMaxOperation::applyBatch(const double *const *operands, double *out,
+                                     size_t count) const {
+  const double *x = operands[0];
+  for (size_t i = 0; i < count; i++) {
+    out[i] = window.push(x[i]);
+  }
+}
+
+RollingMinOperation::RollingMinOperation(ExpressionPtr left, ExpressionPtr right)
+    : StreamingBinaryOperation(std::move(left), right),
+      window(windowOf(right, "rolling_min"), false) {}
+
+void RollingMinOperation::applyBatch(const double *const *operands, double *out,
+                                     size_t count) const {
+  const double *x = operands[0];
+  for (size_t i = 0; i < count; i++) {
+    out[i] = window.push(x[i]);
+  }
+}
+
+double DeltaOperation::apply(double x) const {
+  double y = started ? x - previous : std::numeric_limits<double>::quiet_NaN();
+  previous = x;
+  started = true;
+  return y;
+}
+
+void DeltaOperation::applyBatch(const double *const *operands, double *out,
+                                size_t count) const {
+  const double *x = operands[0];
+  for (size_t i = 0; i < count; i++) {
+    out[i] = apply(x[i]);
+  }
+}
+
+} // namespace operations
+
+ExpressionPtr newStream(const ExpressionPtr &expression) {
+  if (auto compiled = std::dynamic_pointer_cast<const CompiledExpression>(expression)) {
+    return std::make_shared<CompiledExpression>(copyTree(compiled->getRoot()));
+  }
+  return copyTree(expression);
+}
+
+void resetStreams(const Expression &expression) {
+  auto compiled = dynamic_cast<const CompiledExpression *>(&expression);
+  auto code = compiled ? compiled->getCode() : linearize(expression);
+  for (const auto &node : code.nodes) {
+    if (auto stream = dynamic_cast<const operations::StreamingOperation *>(node.operation)) {
+      stream->reset();
+    }
+  }
+}
+
+} // namespace expression_solver
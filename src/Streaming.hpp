@@ -0,0 +1,241 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "Operation.hpp"
+
+namespace expression_solver {
+
+// Streaming operations see the rows of an expression as a time series: every
+// evaluation, scalar or batch row, is the next sample, and each node keeps
+// the state its window needs. Each sample costs O(1), whatever the window.
+//
+// A compiled expression that uses them is therefore one stream. Evaluate it
+// from one thread at a time and in sample order; newStream gives a copy that
+// starts empty, for another stream.
+namespace streaming {
+
+// The last n samples, overwritten oldest first. The storage is allocated
+// with the first sample, so building an expression costs no memory.
+class RingBuffer {
+  std::vector<double> values;
+  size_t n;
+  size_t next = 0;
+  size_t filled = 0;
+
+public:
+  explicit RingBuffer(size_t n) : n(n) {}
+
+  size_t capacity() const { return n; }
+  bool full() const { return filled == n; }
+  // Sample leaving the window when the next one arrives; valid when full().
+  double oldest() const { return values[next]; }
+  // Adds x and returns true when next wrapped around to the first slot.
+  bool push(double x);
+  void clear() { next = filled = 0; }
+  const std::vector<double> &data() const { return values; }
+  size_t size() const { return filled; }
+};
+
+// Largest (or smallest) of the last n samples. Candidates that can still
+// become the extreme are kept in a monotonic deque stored in a ring: a new
+// sample drops every candidate it beats, so each sample is pushed and popped
+// at most once. NaN samples take their place in the window but are never
+// candidates, as with fmax. The ring is allocated with the first sample.
+class MonotonicWindow {
+  struct Candidate {
+    uint64_t index;
+    double value;
+  };
+
+  std::vector<Candidate> ring;
+  size_t window;
+  bool greatest;
+  size_t head = 0;
+  size_t count = 0;
+  uint64_t samples = 0;
+
+public:
+  MonotonicWindow(size_t n, bool greatest) : window(n), greatest(greatest) {}
+
+  size_t capacity() const { return window; }
+
+  // Adds x and returns the extreme of the window, NaN while it holds no
+  // number.
+  double push(double x);
+  void clear() { head = count = samples = 0; }
+};
+
+} // namespace streaming
+
+namespace operations {
+
+// Operations that hold per-stream state.
+class StreamingOperation {
+public:
+  virtual ~StreamingOperation() = default;
+  // Forgets every sample seen so far.
+  virtual void reset() const = 0;
+  // Samples the operation keeps once it runs; what budgets of untrusted
+  // expressions count. See CompileOptions::maxSamples.
+  virtual size_t samples() const { return 1; }
+};
+
+// Base of the streaming operations over a sample and a constant parameter.
+// The parameter may be any expression of literals and pure operations, such
+// as 2 * 30; placeholders and streaming operations are rejected.
+class StreamingBinaryOperation : public BinaryOperation, public StreamingOperation {
+public:
+  using BinaryOperation::BinaryOperation;
+
+  constexpr int precedence() const override { return 4; }
+  bool isPure() const override { return false; }
+
+  // Recording would take a sample from the stream.
+  size_t record(Tape &tape, const size_t *operands) const override;
+};
+
+// lag(x, n): the sample n steps back, NaN for the first n samples.
+class LagOperation : public StreamingBinaryOperation {
+  mutable streaming::RingBuffer buffer;
+
+public:
+  LagOperation(ExpressionPtr left, ExpressionPtr right);
+
+  constexpr std::string_view identifier() const override { return "lag"; }
+
+  double apply(double x, double) const override;
+  void applyBatch(const double *const *operands, double *out, size_t count) const override;
+  void reset() const override { buffer.clear(); }
+  size_t samples() const override { return buffer.capacity(); }
+
+  ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
+    return std::make_shared<LagOperation>(std::move(left), std::move(right));
+  }
+};
+
+// ema(x, alpha): exponential moving average s += alpha * (x - s), starting
+// at the first sample; alpha is a constant in (0, 1]. NaN samples leave the
+// average as it is.
+class EmaOperation : public StreamingBinaryOperation {
+  double alpha = 1;
+  mutable double average = 0;
+  mutable bool started = false;
+
+public:
+  EmaOperation(ExpressionPtr left, ExpressionPtr right);
+
+  constexpr std::string_view identifier() const override { return "ema"; }
+
+  double apply(double x, double) const override;
+  void applyBatch(const double *const *operands, double *out, size_t count) const override;
+  void reset() const override { started = false; }
+
+  ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
+    return std::make_shared<EmaOperation>(std::move(left), std::move(right));
+  }
+};
+
+// rolling_mean(x, n): mean of the last n samples, or of all of them before
+// there are n. The running sum holds finite samples only, with infinities
+// and NaNs counted apart so they leave the window cleanly, and is summed
+// again from the window each time the ring wraps, so rounding errors do not
+// pile up.
+class RollingMeanOperation : public StreamingBinaryOperation {
+  mutable streaming::RingBuffer buffer;
+  mutable double sum = 0;
+  mutable size_t nans = 0;
+  mutable size_t positiveInfinities = 0;
+  mutable size_t negativeInfinities = 0;
+
+  void tally(double x, int direction) const;
+
+public:
+  RollingMeanOperation(ExpressionPtr left, ExpressionPtr right);
+
+  constexpr std::string_view identifier() const override { return "rolling_mean"; }
+  double cost() const override { return 2; }
+
+  double apply(double x, double) const override;
+  void applyBatch(const double *const *operands, double *out, size_t count) const override;
+  void reset() const override;
+  size_t samples() const override { return buffer.capacity(); }
+
+  ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
+    return std::make_shared<RollingMeanOperation>(std::move(left), std::move(right));
+  }
+};
+
+// rolling_max(x, n) and rolling_min(x, n): extreme of the last n samples.
+class RollingMaxOperation : public StreamingBinaryOperation {
+  mutable streaming::MonotonicWindow window;
+
+public:
+  RollingMaxOperation(ExpressionPtr left, ExpressionPtr right);
+
+  constexpr std::string_view identifier() const override { return "rolling_max"; }
+  double cost() const override { return 4; }
+
+  double apply(double x, double) const override { return window.push(x); }
+  void applyBatch(const double *const *operands, double *out, size_t count) const override;
+  void reset() const override { window.clear(); }
+  size_t samples() const override { return window.capacity(); }
+
+  ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
+    return std::make_shared<RollingMaxOperation>(std::move(left), std::move(right));
+  }
+};
+
+class RollingMinOperation : public StreamingBinaryOperation {
+  mutable streaming::MonotonicWindow window;
+
+public:
+  RollingMinOperation(ExpressionPtr left, ExpressionPtr right);
+
+  constexpr std::string_view identifier() const override { return "rolling_min"; }
+  double cost() const override { return 4; }
+
+  double apply(double x, double) const override { return window.push(x); }
+  void applyBatch(const double *const *operands, double *out, size_t count) const override;
+  void reset() const override { window.clear(); }
+  size_t samples() const override { return window.capacity(); }
+
+  ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
+    return std::make_shared<RollingMinOperation>(std::move(left), std::move(right));
+  }
+};
+
+// delta(x): change from the previous sample, NaN for the first.
+class DeltaOperation : public UnaryOperation, public StreamingOperation {
+  mutable double previous = 0;
+  mutable bool started = false;
+
+public:
+  explicit DeltaOperation(ExpressionPtr operand) : UnaryOperation(std::move(operand)) {}
+
+  constexpr std::string_view identifier() const override { return "delta"; }
+  constexpr int precedence() const override { return 4; }
+  bool isPure() const override { return false; }
+
+  double apply(double x) const override;
+  void applyBatch(const double *const *operands, double *out, size_t count) const override;
+  size_t record(Tape &tape, const size_t *operands) const override;
+  void reset() const override { started = false; }
+
+  ExpressionPtr create(ExpressionPtr operand) const override {
+    return std::make_shared<DeltaOperation>(std::move(operand));
+  }
+};
+
+} // namespace operations
+
+// Copy of the expression whose streaming operations start with no samples.
+ExpressionPtr newStream(const ExpressionPtr &expression);
+
+// Forgets the samples seen by every streaming operation of the expression.
+void resetStreams(const Expression &expression);
+
+} // namespace expression_solver
@@ -0,0 +1,484 @@
+#include "Surrogate.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numbers>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+namespace expression_solver {
+
+namespace operations {
+
+// Coefficients of the pieces in powers of the local coordinates t (and u),
+// which run from -1 to 1 across a piece: in 1D, c[k] multiplies t^k; in 2D,
+// c[i * (degree + 1) + j] multiplies t^i * u^j.
+struct SurrogatePieces {
+  size_t dimension;
+  size_t pieces; // Per axis
+  size_t degree;
+  double lower[2];
+  double upper[2];
+  double scale[2]; // Pieces per unit of the argument
+  std::vector<double> coefficients;
+  std::shared_ptr<const CompiledExpression> original;
+  std::vector<const PlaceHolder *> placeholders;
+
+  bool contains(const double *arguments) const {
+    bool inside = true;
+    for (size_t k = 0; k < dimension; k++) {
+      inside &= arguments[k] >= lower[k] && arguments[k] <= upper[k];
+    }
+    return inside;
+  }
+
+  // Piece along axis k of an argument in the domain, and its coordinate in
+  // the piece.
+  size_t locate(size_t k, double x, double &t) const {
+    double position = (x - lower[k]) * scale[k];
+    size_t piece = std::min(static_cast<size_t>(static_cast<int64_t>(position)), pieces - 1);
+    t = 2 * (position - static_cast<double>(piece)) - 1;
+    return piece;
+  }
+
+  // Value at arguments in the domain, by Horner's rule.
+  double value(const double *arguments) const {
+    size_t n = degree + 1;
+    double t;
+    size_t piece = locate(0, arguments[0], t);
+    if (dimension == 1) {
+      const double *c = coefficients.data() + piece * n;
+      double result = c[degree];
+      for (size_t i = degree; i-- > 0;) {
+        result = FusedMultiplyAddOperation::apply(result, t, c[i]);
+      }
+      return result;
+    }
+    double u;
+    piece = piece * pieces + locate(1, arguments[1], u);
+    const double *c = coefficients.data() + piece * n * n;
+    double result = 0;
+    for (size_t i = n; i-- > 0;) {
+      const double *row = c + i * n;
+      double inner = row[degree];
+      for (size_t j = degree; j-- > 0;) {
+        inner = FusedMultiplyAddOperation::apply(inner, u, row[j]);
+      }
+      result = FusedMultiplyAddOperation::apply(result, t, inner);
+    }
+    return result;
+  }
+
+  // Values of the original expression at count rows.
+  void fallback(const double *const *columns, size_t count, double *out) const {
+    Binding bindings[2];
+    for (size_t k = 0; k < dimension; k++) {
+      bindings[k] = {placeholders[k], std::span(columns[k], count)};
+    }
+    original->evaluate(std::span(bindings, dimension), std::span(out, count));
+  }
+
+  double evaluate(const double *arguments) const {
+    if (contains(arguments)) {
+      return value(arguments);
+    }
+    const double *columns[2] = {&arguments[0], dimension == 2 ? &arguments[1] : nullptr};
+    double result;
+    fallback(columns, 1, &result);
+    return result;
+  }
+};
+
+} // namespace operations
+
+namespace {
+
+using operations::SurrogatePieces;
+
+// Power coefficients of the Chebyshev polynomials T_0 .. T_{n-1}: row k
+// holds those of T_k.
+std::vector<double> chebyshevPowers(size_t n) {
+  std::vector<double> powers(n * n);
+  powers[0] = 1;
+  if (n > 1) {
+    powers[n + 1] = 1;
+  }
+  for (size_t k = 2; k < n; k++) {
+    for (size_t i = 0; i < n; i++) {
+      double shifted = i > 0 ? 2 * powers[(k - 1) * n + i - 1] : 0;
+      powers[k * n + i] = shifted - powers[(k - 2) * n + i];
+    }
+  }
+  return powers;
+}
+
+// Chebyshev coefficients from values at the n nodes cos(pi (j + 1/2) / n),
+// for one axis of values read with stride.
+void chebyshevCoefficients(const double *values, size_t stride, size_t n, double *out,
+                           size_t outStride) {
+  for (size_t k = 0; k < n; k++) {
+    double sum = 0;
+    for (size_t j = 0; j < n; j++) {
+      sum += values[j * stride] *
+             std::cos(std::numbers::pi * static_cast<double>(k) * (static_cast<double>(j) + 0.5) /
+                      static_cast<double>(n));
+    }
+    out[k * outStride] = sum * (k == 0 ? 1.0 : 2.0) / static_cast<double>(n);
+  }
+}
+
+// Evaluates expression at every point of the pieces' local grids, given by
+// the local coordinates of one axis; point p of piece (a, b) is at
+// offset ((a * pieces + b) * points + p) in 2D, with points = size^2. The
+// arguments of the points are left in columns.
+std::vector<double> sample(const CompiledExpression &expression, const SurrogatePieces &pieces,
+                           const std::vector<double> &local, std::vector<double> (&columns)[2]) {
+  size_t size = local.size();
+  size_t dimension = pieces.dimension;
+  size_t points = dimension == 1 ? size : size * size;
+  size_t total = points * (dimension == 1 ? pieces.pieces : pieces.pieces * pieces.pieces);
+  for (size_t k = 0; k < dimension; k++) {
+    columns[k].resize(total);
+  }
+  auto coordinate = [&](size_t k, size_t piece, double t) {
+    double width = (pieces.upper[k] - pieces.lower[k]) / static_cast<double>(pieces.pieces);
+    double x = pieces.lower[k] + width * (static_cast<double>(piece) + (t + 1) / 2);
+    return std::clamp(x, pieces.lower[k], pieces.upper[k]);
+  };
+  for (size_t row = 0; row < total; row++) {
+    size_t piece = row / points;
+    size_t point = row % points;
+    if (dimension == 1) {
+      columns[0][row] = coordinate(0, piece, local[point]);
+    } else {
+      columns[0][row] = coordinate(0, piece / pieces.pieces, local[point / size]);
+      columns[1][row] = coordinate(1, piece % pieces.pieces, local[point % size]);
+    }
+  }
+  Binding bindings[2];
+  for (size_t k = 0; k < dimension; k++) {
+    bindings[k] = {pieces.placeholders[k], columns[k]};
+  }
+  std::vector<double> values(total);
+  expression.evaluate(std::span(bindings, dimension), values);
+  for (double value : values) {
+    if (!std::isfinite(value)) {
+      throw std::invalid_argument("Expression is not finite over the domain");
+    }
+  }
+  return values;
+}
+
+} // namespace
+
+Surrogate buildSurrogate(const ExpressionPtr &expression, std::span<const SurrogateAxis> axes,
+                         const SurrogateOptions &options) {
+  if (axes.empty() || axes.size() > 2) {
+    throw std::invalid_argument("A surrogate has 1 or 2 axes");
+  }
+  if (!(options.tolerance > 0) || options.maxDegree < 1 || options.maxDegree > 32 ||
+      options.maxPieces < 1) {
+    throw std::invalid_argument("Invalid surrogate options");
+  }
+  auto compiled = std::dynamic_pointer_cast<const CompiledExpression>(expression);
+  if (!compiled) {
+    compiled = std::make_shared<const CompiledExpression>(expression);
+  }
+
+  auto pieces = std::make_shared<SurrogatePieces>();
+  pieces->dimension = axes.size();
+  pieces->original = compiled;
+  for (size_t k = 0; k < axes.size(); k++) {
+    const auto &axis = axes[k];
+    if (!axis.placeholder || (k == 1 && axis.placeholder == axes[0].placeholder)) {
+      throw std::invalid_argument("Axes must be distinct placeholders");
+    }
+    if (!std::isfinite(axis.lower) || !std::isfinite(axis.upper) || !(axis.lower < axis.upper)) {
+      throw std::invalid_argument("Axis bounds must be finite and increasing");
+    }
+    pieces->lower[k] = axis.lower;
+    pieces->upper[k] = axis.upper;
+    pieces->placeholders.push_back(axis.placeholder);
+  }
+
+  // The operands of the surrogate are the axes' own placeholder nodes.
+  std::vector<ExpressionPtr> operands(axes.size());
+  auto adopt = [&](const ExpressionPtr &node) {
+    for (size_t k = 0; k < axes.size(); k++) {
+      if (node.get() == axes[k].placeholder) {
+        operands[k] = node;
+      }
+    }
+  };
+  adopt(compiled->getRoot());
+  for (const auto &node : compiled->getCode().nodes) {
+    if (node.operation) {
+      if (!node.operation->isPure()) {
+        throw std::invalid_argument(
+            "Surrogates need an expression without streaming operations");
+      }
+      for (size_t k = 0; k < node.arity; k++) {
+        adopt(node.operation->getOperandAt(k));
+      }
+    } else if (auto placeholder = dynamic_cast<const PlaceHolder *>(node.expression)) {
+      if (std::find(pieces->placeholders.begin(), pieces->placeholders.end(), placeholder) ==
+          pieces->placeholders.end()) {
+        throw std::invalid_argument("Expression depends on placeholders that are not axes");
+      }
+    }
+  }
+  if (std::find(operands.begin(), operands.end(), nullptr) != operands.end()) {
+    throw std::invalid_argument("Every axis must appear in the expression");
+  }
+
+  size_t dimension = axes.size();
+  size_t n = options.maxDegree + 1;
+  auto powers = chebyshevPowers(n);
+  std::vector<double> nodes(n);
+  for (size_t j = 0; j < n; j++) {
+    nodes[j] = std::cos(std::numbers::pi * (static_cast<double>(j) + 0.5) / static_cast<double>(n));
+  }
+  std::vector<double> checks(2 * options.maxDegree + 3);
+  for (size_t j = 0; j < checks.size(); j++) {
+    checks[j] = -1 + 2 * static_cast<double>(j) / static_cast<double>(checks.size() - 1);
+  }
+
+  // Pieces are doubled until the tolerance is met, then while each doubling
+  // still saves a quarter of the multiply-adds per value.
+  double best = std::numeric_limits<double>::infinity();
+  std::optional<SurrogatePieces> accepted;
+  double acceptedError = 0;
+  auto terms = [&](size_t degree) {
+    return dimension == 1 ? degree + 1 : (degree + 1) * (degree + 1);
+  };
+  for (size_t perAxis = 1;; perAxis *= 2) {
+    size_t count = dimension == 1 ? perAxis : perAxis * perAxis;
+    if (count > options.maxPieces) {
+      break;
+    }
+    pieces->pieces = perAxis;
+    for (size_t k = 0; k < dimension; k++) {
+      pieces->scale[k] = static_cast<double>(perAxis) / (pieces->upper[k] - pieces->lower[k]);
+    }
+
+    // Chebyshev coefficients of every piece at the highest degree.
+    size_t size = dimension == 1 ? n : n * n;
+    std::vector<double> columns[2];
+    auto values = sample(*compiled, *pieces, nodes, columns);
+    std::vector<double> chebyshev(count * size);
+    std::vector<double> partial(size);
+    for (size_t piece = 0; piece < count; piece++) {
+      const double *v = values.data() + piece * size;
+      double *c = chebyshev.data() + piece * size;
+      if (dimension == 1) {
+        chebyshevCoefficients(v, 1, n, c, 1);
+      } else {
+        // Along u for every row of nodes, then along t for every degree in u.
+        for (size_t i = 0; i < n; i++) {
+          chebyshevCoefficients(v + i * n, 1, n, partial.data() + i * n, 1);
+        }
+        for (size_t j = 0; j < n; j++) {
+          chebyshevCoefficients(partial.data() + j, n, n, c + j, n);
+        }
+      }
+    }
+
+    // Lowest degree whose truncated terms could stay within half the
+    // tolerance in every piece; the check points decide.
+    size_t degree = 0;
+    for (size_t piece = 0; piece < count; piece++) {
+      const double *c = chebyshev.data() + piece * size;
+      double tail = 0;
+      size_t needed = options.maxDegree;
+      for (size_t d = options.maxDegree; d > 0; d--) {
+        for (size_t i = 0; i < (dimension == 1 ? 1 : n); i++) {
+          for (size_t j = 0; j < n; j++) {
+            size_t order = dimension == 1 ? j : std::max(i, j);
+            if (order == d) {
+              tail += std::abs(c[i * n + j]);
+            }
+          }
+        }
+        if (tail > options.tolerance / 2) {
+          break;
+        }
+        needed = d - 1;
+      }
+      degree = std::max(degree, needed);
+    }
+
+    auto exact = sample(*compiled, *pieces, checks, columns);
+    if (accepted && 4 * terms(degree) > 3 * terms(accepted->degree)) {
+      break;
+    }
+    bool met = false;
+    for (; degree <= options.maxDegree && !met; degree++) {
+      size_t m = degree + 1;
+      pieces->degree = degree;
+      pieces->coefficients.assign(count * (dimension == 1 ? m : m * m), 0);
+      for (size_t piece = 0; piece < count; piece++) {
+        const double *c = chebyshev.data() + piece * size;
+        if (dimension == 1) {
+          double *a = pieces->coefficients.data() + piece * m;
+          for (size_t k = 0; k < m; k++) {
+            for (size_t i = 0; i <= k; i++) {
+              a[i] += c[k] * powers[k * n + i];
+            }
+          }
+        } else {
+          double *a = pieces->coefficients.data() + piece * m * m;
+          for (size_t k = 0; k < m; k++) {
+            for (size_t l = 0; l < m; l++) {
+              for (size_t i = 0; i <= k; i++) {
+                for (size_t j = 0; j <= l; j++) {
+                  a[i * m + j] += c[k * n + l] * powers[k * n + i] * powers[l * n + j];
+                }
+              }
+            }
+          }
+        }
+      }
+      double error = 0;
+      for (size_t row = 0; row < exact.size(); row++) {
+        double arguments[2] = {columns[0][row], dimension == 2 ? columns[1][row] : 0};
+        error = std::max(error, std::abs(pieces->value(arguments) - exact[row]));
+      }
+      best = std::min(best, error);
+      met = error <= options.tolerance;
+      if (met && (!accepted || 4 * terms(degree) <= 3 * terms(accepted->degree))) {
+        accepted = *pieces;
+        acceptedError = error;
+      }
+    }
+    if (accepted && accepted->pieces != perAxis) {
+      break;
+    }
+  }
+  if (!accepted) {
+    throw std::invalid_argument("No surrogate within the tolerance: " + std::to_string(best) +
+                                " at best");
+  }
+  size_t perAxis = accepted->pieces;
+  size_t degree = accepted->degree;
+  auto node = std::make_shared<operations::SurrogateOperation>(
+      std::move(operands), std::make_shared<const SurrogatePieces>(std::move(*accepted)));
+  return {std::make_shared<CompiledExpression>(std::move(node)), acceptedError, perAxis, degree};
+}
+
+namespace operations {
+
+double SurrogateOperation::apply(const double *values, size_t) const {
+  return pieces->evaluate(values);
+}
+
+void SurrogateOperation::applyBatch(const double *const *operands, double *out,
+                                    size_t count) const {
+  // A tile of rows is located first, then every row's polynomial advances
+  // one coefficient at a time, so the multiply-add chains of different rows
+  // overlap instead of waiting on each other.
+  constexpr size_t tile = 256;
+  const auto &p = *pieces;
+  size_t m = p.degree + 1;
+  size_t block = p.dimension == 1 ? m : m * m;
+  const double *c = p.coefficients.data();
+  size_t offsets[tile];
+  double ts[tile];
+  double us[tile];
+  double inner[tile];
+  size_t outside = 0;
+  for (size_t start = 0; start < count; start += tile) {
+    size_t n = std::min(tile, count - start);
+    double *o = out + start;
+    for (size_t k = 0; k < p.dimension; k++) {
+      const double *x = operands[k] + start;
+      double *local = k == 0 ? ts : us;
+      for (size_t i = 0; i < n; i++) {
+        // Rows outside are clamped here and replaced below; NaN goes low.
+        double v = x[i] >= p.lower[k] ? x[i] : p.lower[k];
+        v = v <= p.upper[k] ? v : p.upper[k];
+        outside += v != x[i];
+        size_t piece = p.locate(k, v, local[i]);
+        offsets[i] = k == 0 ? piece : offsets[i] * p.pieces + piece;
+      }
+    }
+    for (size_t i = 0; i < n; i++) {
+      offsets[i] *= block;
+    }
+    if (p.dimension == 1) {
+      for (size_t i = 0; i < n; i++) {
+        o[i] = c[offsets[i] + p.degree];
+      }
+      for (size_t a = p.degree; a-- > 0;) {
+        for (size_t i = 0; i < n; i++) {
+          o[i] = FusedMultiplyAddOperation::apply(o[i], ts[i], c[offsets[i] + a]);
+        }
+      }
+      continue;
+    }
+    std::fill_n(o, n, 0.0);
+    for (size_t a = m; a-- > 0;) {
+      for (size_t i = 0; i < n; i++) {
+        inner[i] = c[offsets[i] + a * m + p.degree];
+      }
+      for (size_t b = p.degree; b-- > 0;) {
+        for (size_t i = 0; i < n; i++) {
+          inner[i] = FusedMultiplyAddOperation::apply(inner[i], us[i], c[offsets[i] + a * m + b]);
+        }
+      }
+      for (size_t i = 0; i < n; i++) {
+        o[i] = FusedMultiplyAddOperation::apply(o[i], ts[i], inner[i]);
+      }
+    }
+  }
+  if (outside == 0) {
+    return;
+  }
+  // The original expression over the rows outside the domain, gathered.
+  std::vector<double> gathered[2];
+  std::vector<size_t> rows;
+  double arguments[2] = {};
+  for (size_t i = 0; i < count; i++) {
+    for (size_t k = 0; k < p.dimension; k++) {
+      arguments[k] = operands[k][i];
+    }
+    if (!p.contains(arguments)) {
+      rows.push_back(i);
+      for (size_t k = 0; k < p.dimension; k++) {
+        gathered[k].push_back(arguments[k]);
+      }
+    }
+  }
+  const double *columns[2] = {gathered[0].data(), gathered[1].data()};
+  std::vector<double> values(rows.size());
+  p.fallback(columns, rows.size(), values.data());
+  for (size_t r = 0; r < rows.size(); r++) {
+    out[rows[r]] = values[r];
+  }
+}
+
+// Central differences: the polynomial's own derivative jumps between pieces
+// and is not defined outside the domain.
+void SurrogateOperation::partials(const double *values, size_t count, double,
+                                  double *out) const {
+  double arguments[2];
+  for (size_t k = 0; k < count; k++) {
+    std::copy_n(values, count, arguments);
+    double h = 1e-6 * std::max(1.0, std::abs(values[k]));
+    arguments[k] = values[k] + h;
+    double above = pieces->evaluate(arguments);
+    arguments[k] = values[k] - h;
+    double below = pieces->evaluate(arguments);
+    out[k] = (above - below) / (2 * h);
+  }
+}
+
+double SurrogateOperation::cost() const {
+  double terms = static_cast<double>(pieces->degree + 1);
+  return (pieces->dimension == 1 ? terms : terms * terms) + 4;
+}
+
+} // namespace operations
+
+} // namespace expression_solver
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "CompiledExpression.hpp"
+#include "Operation.hpp"
+
+namespace expression_solver {
+
+// The range of one placeholder over which a surrogate replaces an
+// expression.
+struct SurrogateAxis {
+  const PlaceHolder *placeholder;
+  double lower;
+  double upper;
+};
+
+struct SurrogateOptions {
+  double tolerance = 1e-10; // Largest absolute error accepted over the domain
+  size_t maxDegree = 12;    // Per axis, in every piece
+  size_t maxPieces = 4096;  // In total, over all axes
+};
+
+struct Surrogate {
+  ExpressionPtr expression;
+  double maxError; // Largest error measured on the check points
+  size_t pieces;   // Per axis
+  size_t degree;   // Per axis
+};
+
+// Replaces an expression of one or two placeholders over a bounded domain
+// with a piecewise polynomial: the domain is cut into equal pieces along each
+// axis, and each piece gets the Chebyshev interpolant of the expression,
+// truncated to the lowest degree that meets the tolerance and rewritten in
+// powers of the local coordinate, so a value costs a piece lookup and a
+// chain of multiply-adds (degree + 1 of them in 1D, (degree + 1)^2 in 2D)
+// instead of the expression's libm calls.
+//
+// Pieces are doubled along every axis until the tolerance is met at
+// maxDegree or below, then for as long as doubling them again saves a
+// quarter of the multiply-adds. The error is measured, not proven: each piece is
+// checked against the expression on a grid of 2 * maxDegree + 3 points per
+// axis, ends included, and the largest difference is reported. Rows outside
+// the domain evaluate the original expression.
+//
+// The expression must be pure and depend on no placeholders but the axes.
+Surrogate buildSurrogate(const ExpressionPtr &expression, std::span<const SurrogateAxis> axes,
+                         const SurrogateOptions &options = {});
+
+namespace operations {
+
+struct SurrogatePieces;
+
+// The piecewise polynomial of a surrogate; the operands are the placeholders
+// of its axes.
+class SurrogateOperation : public VariadicOperation {
+  std::shared_ptr<const SurrogatePieces> pieces;
+
+public:
+  SurrogateOperation(std::vector<ExpressionPtr> operands,
+                     std::shared_ptr<const SurrogatePieces> pieces)
+      : VariadicOperation(std::move(operands)), pieces(std::move(pieces)) {}
+
+  double apply(const double *values, size_t count) const override;
+  void applyBatch(const double *const *operands, double *out, size_t count) const override;
+  void partials(const double *values, size_t count, double y, double *out) const override;
+
+  double cost() const override;
+
+  constexpr std::string_view identifier() const override { return "surrogate"; }
+  constexpr int precedence() const override { return 4; }
+
+  ExpressionPtr create(std::vector<ExpressionPtr> operands) const override {
+    return std::make_shared<SurrogateOperation>(std::move(operands), pieces);
+  }
+};
+
+} // namespace operations
+
+} // namespace expression_solver
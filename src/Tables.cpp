@@ -0,0 +1,305 @@
+#include "Tables.hpp"
+
+#include <cmath>
+#include <tuple>
+
+#include "Vectors.hpp"
+
+namespace expression_solver {
+
+TableAxis::TableAxis(std::vector<double> knots) : knots(std::move(knots)) {
+  const auto &k = this->knots;
+  if (k.size() < 2) {
+    throw std::invalid_argument("A table axis needs at least 2 knots");
+  }
+  for (size_t i = 0; i < k.size(); i++) {
+    if (!std::isfinite(k[i]) || (i > 0 && !(k[i] > k[i - 1]))) {
+      throw std::invalid_argument("Table knots must be finite and strictly increasing");
+    }
+  }
+  first = k.front();
+  last = k.back();
+  double step = (last - first) / static_cast<double>(k.size() - 1);
+  uniform = true;
+  for (size_t i = 1; i + 1 < k.size() && uniform; i++) {
+    uniform = std::abs(k[i] - (first + step * static_cast<double>(i))) <= step * 1e-9;
+  }
+  if (uniform) {
+    inverseStep = 1 / step;
+  }
+}
+
+TableAxis TableAxis::range(double first, double last, size_t count) {
+  if (count < 2) {
+    throw std::invalid_argument("A table axis needs at least 2 knots");
+  }
+  std::vector<double> knots(count);
+  for (size_t i = 0; i < count; i++) {
+    knots[i] = first + (last - first) * static_cast<double>(i) / static_cast<double>(count - 1);
+  }
+  knots.back() = last;
+  return TableAxis(std::move(knots));
+}
+
+namespace {
+
+// Slopes at the knots of axis of the values read with stride: the slope of
+// the parabola through each knot and its two neighbours, so quadratics are
+// exact, and through the first or last three knots at the ends.
+void estimateSlopes(const TableAxis &axis, const double *values, size_t stride, double *out) {
+  const auto &k = axis.getKnots();
+  size_t n = k.size();
+  auto v = [&](size_t i) { return values[i * stride]; };
+  auto secant = [&](size_t i) { return (v(i + 1) - v(i)) / (k[i + 1] - k[i]); };
+  if (n == 2) {
+    out[0] = out[stride] = secant(0);
+    return;
+  }
+  for (size_t i = 1; i + 1 < n; i++) {
+    double h0 = k[i] - k[i - 1];
+    double h1 = k[i + 1] - k[i];
+    out[i * stride] = (h1 * secant(i - 1) + h0 * secant(i)) / (h0 + h1);
+  }
+  double h0 = k[1] - k[0];
+  double h1 = k[2] - k[1];
+  out[0] = ((2 * h0 + h1) * secant(0) - h0 * secant(1)) / (h0 + h1);
+  h0 = k[n - 1] - k[n - 2];
+  h1 = k[n - 2] - k[n - 3];
+  out[(n - 1) * stride] = ((2 * h0 + h1) * secant(n - 2) - h0 * secant(n - 3)) / (h0 + h1);
+}
+
+// Cubic Hermite on an interval of width h, at position t in [0, 1], from the
+// values and slopes at its ends.
+double hermite(double t, double h, double y0, double y1, double d0, double d1) {
+  double t2 = t * t;
+  double t3 = t2 * t;
+  return (2 * t3 - 3 * t2 + 1) * y0 + (t3 - 2 * t2 + t) * h * d0 + (3 * t2 - 2 * t3) * y1 +
+         (t3 - t2) * h * d1;
+}
+
+// Its derivative with respect to the argument, not to t.
+double hermiteSlope(double t, double h, double y0, double y1, double d0, double d1) {
+  double t2 = t * t;
+  return ((6 * t2 - 6 * t) * (y0 - y1)) / h + (3 * t2 - 4 * t + 1) * d0 + (3 * t2 - 2 * t) * d1;
+}
+
+double width(const TableAxis &axis, size_t i) {
+  return axis.getKnots()[i + 1] - axis.getKnots()[i];
+}
+
+} // namespace
+
+Table::Table(TableAxis axis, std::vector<double> values, Interpolation interpolation)
+    : interpolation(interpolation), values(std::move(values)) {
+  if (this->values.size() != axis.size()) {
+    throw std::invalid_argument("Expected one table value per knot");
+  }
+  axes.push_back(std::move(axis));
+  if (interpolation == Interpolation::Cubic) {
+    slopes.resize(this->values.size());
+    estimateSlopes(axes[0], this->values.data(), 1, slopes.data());
+  }
+}
+
+Table::Table(TableAxis rows, TableAxis columns, std::vector<double> values,
+             Interpolation interpolation)
+    : interpolation(interpolation), values(std::move(values)) {
+  size_t m = rows.size();
+  size_t n = columns.size();
+  if (this->values.size() != m * n) {
+    throw std::invalid_argument("Expected one table value per pair of knots");
+  }
+  axes.push_back(std::move(rows));
+  axes.push_back(std::move(columns));
+  if (interpolation == Interpolation::Cubic) {
+    slopes.resize(m * n);
+    columnSlopes.resize(m * n);
+    crossSlopes.resize(m * n);
+    for (size_t j = 0; j < n; j++) {
+      estimateSlopes(axes[0], &this->values[j], n, &slopes[j]);
+    }
+    for (size_t i = 0; i < m; i++) {
+      estimateSlopes(axes[1], &this->values[i * n], 1, &columnSlopes[i * n]);
+    }
+    for (size_t j = 0; j < n; j++) {
+      estimateSlopes(axes[0], &columnSlopes[j], n, &crossSlopes[j]);
+    }
+  }
+}
+
+// Value in interval i at position t, and the derivative when asked.
+inline double Table::at1(size_t i, double t, double *gradient) const {
+  const double *v = values.data() + i;
+  double h = width(axes[0], i);
+  if (interpolation == Interpolation::Linear) {
+    if (gradient) {
+      gradient[0] = (v[1] - v[0]) / h;
+    }
+    return v[0] + t * (v[1] - v[0]);
+  }
+  const double *d = slopes.data() + i;
+  if (gradient) {
+    gradient[0] = hermiteSlope(t, h, v[0], v[1], d[0], d[1]);
+  }
+  return hermite(t, h, v[0], v[1], d[0], d[1]);
+}
+
+// Value in the cell of row interval i and column interval j, at positions t
+// and u, and the derivatives when asked.
+inline double Table::at2(size_t i, double t, size_t j, double u, double *gradient) const {
+  size_t n = axes[1].size();
+  size_t corner = i * n + j;
+  const double *v0 = values.data() + corner;
+  const double *v1 = v0 + n;
+  double hx = width(axes[0], i);
+  double hy = width(axes[1], j);
+  if (interpolation == Interpolation::Linear) {
+    double bottom = v0[0] + u * (v0[1] - v0[0]);
+    double top = v1[0] + u * (v1[1] - v1[0]);
+    if (gradient) {
+      gradient[0] = (top - bottom) / hx;
+      gradient[1] = ((1 - t) * (v0[1] - v0[0]) + t * (v1[1] - v1[0])) / hy;
+    }
+    return bottom + t * (top - bottom);
+  }
+  // Along the columns on both row knots, for the values and for the slopes
+  // along the rows, then along the rows between them.
+  const double *dx0 = slopes.data() + corner;
+  const double *dx1 = dx0 + n;
+  const double *dy0 = columnSlopes.data() + corner;
+  const double *dy1 = dy0 + n;
+  const double *dxy0 = crossSlopes.data() + corner;
+  const double *dxy1 = dxy0 + n;
+  double g0 = hermite(u, hy, v0[0], v0[1], dy0[0], dy0[1]);
+  double g1 = hermite(u, hy, v1[0], v1[1], dy1[0], dy1[1]);
+  double s0 = hermite(u, hy, dx0[0], dx0[1], dxy0[0], dxy0[1]);
+  double s1 = hermite(u, hy, dx1[0], dx1[1], dxy1[0], dxy1[1]);
+  if (gradient) {
+    gradient[0] = hermiteSlope(t, hx, g0, g1, s0, s1);
+    gradient[1] = hermite(t, hx, hermiteSlope(u, hy, v0[0], v0[1], dy0[0], dy0[1]),
+                          hermiteSlope(u, hy, v1[0], v1[1], dy1[0], dy1[1]),
+                          hermiteSlope(u, hy, dx0[0], dx0[1], dxy0[0], dxy0[1]),
+                          hermiteSlope(u, hy, dx1[0], dx1[1], dxy1[0], dxy1[1]));
+  }
+  return hermite(t, hx, g0, g1, s0, s1);
+}
+
+double Table::evaluate(const double *arguments, double *gradient) const {
+  size_t dimensions = axes.size();
+  for (size_t k = 0; k < dimensions; k++) {
+    if (std::isnan(arguments[k])) {
+      if (gradient) {
+        std::fill_n(gradient, dimensions, arguments[k]);
+      }
+      return arguments[k];
+    }
+  }
+  double result;
+  auto [i, t] = axes[0].locate(arguments[0]);
+  if (dimensions == 1) {
+    result = at1(i, t, gradient);
+  } else {
+    auto [j, u] = axes[1].locate(arguments[1]);
+    result = at2(i, t, j, u, gradient);
+  }
+  // Flat outside the knots.
+  for (size_t k = 0; gradient && k < dimensions; k++) {
+    if (axes[k].clamps(arguments[k])) {
+      gradient[k] = 0;
+    }
+  }
+  return result;
+}
+
+void Table::evaluate(const double *const *columns, double *out, size_t count) const {
+  // Locates a tile of rows on each axis first, then interpolates them, so
+  // neither loop switches between the two kinds of work.
+  constexpr size_t tile = 256;
+  size_t intervals[2][tile];
+  double positions[2][tile];
+  bool twoAxes = axes.size() == 2;
+  for (size_t start = 0; start < count; start += tile) {
+    size_t n = std::min(tile, count - start);
+    for (size_t k = 0; k < axes.size(); k++) {
+      const double *x = columns[k] + start;
+      for (size_t i = 0; i < n; i++) {
+        std::tie(intervals[k][i], positions[k][i]) = axes[k].locate(x[i]);
+      }
+    }
+    double *o = out + start;
+    if (twoAxes) {
+      for (size_t i = 0; i < n; i++) {
+        o[i] = at2(intervals[0][i], positions[0][i], intervals[1][i], positions[1][i], nullptr);
+      }
+    } else {
+      for (size_t i = 0; i < n; i++) {
+        o[i] = at1(intervals[0][i], positions[0][i], nullptr);
+      }
+    }
+    // NaN arguments were located at the first knot; give them back.
+    for (size_t k = 0; k < axes.size(); k++) {
+      const double *x = columns[k] + start;
+      for (size_t i = 0; i < n; i++) {
+        o[i] = x[i] != x[i] ? x[i] : o[i];
+      }
+    }
+  }
+}
+
+double Table::cost() const {
+  double result = interpolation == Interpolation::Linear ? 3 : 12;
+  if (axes.size() == 2) {
+    result = interpolation == Interpolation::Linear ? 8 : 48;
+  }
+  for (const auto &axis : axes) {
+    result += axis.isUniform() ? 4 : 2 * std::log2(static_cast<double>(axis.size())) + 2;
+  }
+  return result;
+}
+
+namespace operations {
+
+double InterpolateOperation::apply(const double *values, size_t count) const {
+  if (!table || count != table->dimension()) {
+    throw std::logic_error("interp needs a table and one argument per dimension");
+  }
+  return table->evaluate(values);
+}
+
+void InterpolateOperation::applyBatch(const double *const *operands, double *out,
+                                      size_t count) const {
+  if (!table) {
+    throw std::logic_error("interp needs a table");
+  }
+  table->evaluate(operands, out, count);
+}
+
+void InterpolateOperation::partials(const double *values, size_t, double,
+                                    double *out) const {
+  table->evaluate(values, out);
+}
+
+ExpressionPtr InterpolateOperation::call(std::vector<ExpressionPtr> arguments) const {
+  if (arguments.empty() || !isTable(arguments[0])) {
+    throw std::invalid_argument("The first argument of interp must be a table");
+  }
+  auto table = static_cast<const TableReference &>(*arguments[0]).getTable();
+  std::vector<ExpressionPtr> rest(std::make_move_iterator(arguments.begin() + 1),
+                                  std::make_move_iterator(arguments.end()));
+  if (rest.size() != table->dimension()) {
+    throw std::invalid_argument("Wrong number of arguments in call to interp");
+  }
+  if (std::any_of(rest.begin(), rest.end(), isTable)) {
+    throw std::invalid_argument("Tables can only be passed to interp");
+  }
+  if (auto result = componentwise(rest, [&](const std::vector<ExpressionPtr> &slice) {
+        return ExpressionPtr(std::make_shared<InterpolateOperation>(slice, table));
+      })) {
+    return result;
+  }
+  return std::make_shared<InterpolateOperation>(std::move(rest), std::move(table));
+}
+
+} // namespace operations
+
+} // namespace expression_solver
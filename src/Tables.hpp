@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "Operation.hpp"
+
+namespace expression_solver {
+
+// Lookup tables of 1 or 2 dimensions, such as calibration curves, that
+// expressions interpolate with interp(name, x) or interp(name, x, y). A table
+// is immutable once built and is shared by pointer: the contexts that
+// register it and the compiled expressions that call it hold the same
+// object, and any number of threads read it without locks.
+
+enum class Interpolation : uint8_t {
+  Linear,
+  // Cubic Hermite, with the slopes at the knots estimated from their
+  // neighbours: exact for quadratics, continuous first derivative. On a
+  // uniform axis, Catmull-Rom.
+  Cubic,
+};
+
+// The knots of one axis of a table, increasing. Arguments outside the knots
+// are clamped to the first or last one, so the table extends flat.
+class TableAxis {
+  std::vector<double> knots;
+  double first;
+  double last;
+  double inverseStep = 0; // Knots per unit of the argument, when uniform
+  bool uniform = false;
+
+public:
+  // At least 2 finite, strictly increasing knots. Knots evenly spaced up to
+  // rounding count as uniform.
+  explicit TableAxis(std::vector<double> knots);
+
+  // count evenly spaced knots from first to last, both included.
+  static TableAxis range(double first, double last, size_t count);
+
+  size_t size() const { return knots.size(); }
+  bool isUniform() const { return uniform; }
+  const std::vector<double> &getKnots() const { return knots; }
+
+  // Interval [knots[i], knots[i + 1]] of the clamped argument, and the
+  // position t in [0, 1] of the argument within it. A multiplication on a
+  // uniform axis; otherwise a binary search whose steps are conditional
+  // moves instead of branches. NaN gives interval 0.
+  std::pair<size_t, double> locate(double x) const {
+    x = x > first ? x : first;
+    x = x < last ? x : last;
+    if (uniform) {
+      double position = (x - first) * inverseStep;
+      size_t i = std::min(static_cast<size_t>(position), knots.size() - 2);
+      return {i, position - static_cast<double>(i)};
+    }
+    size_t i = 0;
+    for (size_t length = knots.size() - 1; length > 1; length -= length / 2) {
+      size_t middle = i + length / 2;
+      i = knots[middle] <= x ? middle : i;
+    }
+    return {i, (x - knots[i]) / (knots[i + 1] - knots[i])};
+  }
+
+  // Whether the argument is outside the knots, where the table is flat.
+  bool clamps(double x) const { return x < first || x > last; }
+};
+
+class Table {
+  std::vector<TableAxis> axes;
+  Interpolation interpolation;
+  std::vector<double> values; // Row-major: the last axis varies fastest
+  // Slopes at the knots for cubic tables: along the first axis, the second,
+  // and the cross derivative, for 2 dimensions.
+  std::vector<double> slopes;
+  std::vector<double> columnSlopes;
+  std::vector<double> crossSlopes;
+
+  double at1(size_t i, double t, double *gradient) const;
+  double at2(size_t i, double t, size_t j, double u, double *gradient) const;
+
+public:
+  // values[i] at knots[i] of axis.
+  Table(TableAxis axis, std::vector<double> values,
+        Interpolation interpolation = Interpolation::Linear);
+
+  // values[i * columns.size() + j] at row knot i and column knot j; the first
+  // argument of interp is the row.
+  Table(TableAxis rows, TableAxis columns, std::vector<double> values,
+        Interpolation interpolation = Interpolation::Linear);
+
+  size_t dimension() const { return axes.size(); }
+  const TableAxis &getAxis(size_t index) const { return axes[index]; }
+  Interpolation getInterpolation() const { return interpolation; }
+
+  // Value at arguments[0..dimension()), and its partial derivatives to
+  // gradient when given. NaN arguments give NaN.
+  double evaluate(const double *arguments, double *gradient = nullptr) const;
+
+  // Values of count rows: columns[k][i] is argument k of row i.
+  void evaluate(const double *const *columns, double *out, size_t count) const;
+
+  // Rough cost of one value, in additions.
+  double cost() const;
+};
+
+typedef std::shared_ptr<const Table> TablePtr;
+
+// A table named in an expression while parsing. It has no value: the parser
+// accepts it only as the first argument of interp.
+class TableReference : public Expression {
+  TablePtr table;
+
+public:
+  explicit TableReference(TablePtr table) : table(std::move(table)) {}
+
+  double evaluate() const override {
+    throw std::logic_error("A table has no value; use interp(table, x)");
+  }
+
+  const TablePtr &getTable() const { return table; }
+};
+
+inline bool isTable(const ExpressionPtr &expression) {
+  return dynamic_cast<const TableReference *>(expression.get()) != nullptr;
+}
+
+namespace operations {
+
+// interp(table, x) or interp(table, x, y): the operands are the arguments
+// after the table, which the node holds.
+class InterpolateOperation : public VariadicOperation {
+  TablePtr table;
+
+public:
+  explicit InterpolateOperation(std::vector<ExpressionPtr> operands, TablePtr table = nullptr)
+      : VariadicOperation(std::move(operands)), table(std::move(table)) {}
+
+  double apply(const double *values, size_t count) const override;
+  void applyBatch(const double *const *operands, double *out, size_t count) const override;
+  void partials(const double *values, size_t count, double y, double *out) const override;
+
+  // The node for a call as written, with the table reference first. Vector
+  // arguments give one node per component.
+  ExpressionPtr call(std::vector<ExpressionPtr> arguments) const;
+
+  const TablePtr &getTable() const { return table; }
+
+  double cost() const override { return table ? table->cost() : 1; }
+
+  constexpr std::string_view identifier() const override { return "interp"; }
+  constexpr int precedence() const override { return 4; }
+
+  ExpressionPtr create(std::vector<ExpressionPtr> operands) const override {
+    return std::make_shared<InterpolateOperation>(std::move(operands), table);
+  }
+};
+
+} // namespace operations
+
+} // namespace expression_solver
@@ -0,0 +1,172 @@
+#include "Tape.hpp"
+#include "CompiledExpression.hpp"
+#include "Operation.hpp"
+
+namespace expression_solver {
+
+size_t Expression::record(Tape &, const size_t *) const {
+  throw std::logic_error("Expression has no derivative rule");
+}
+
+size_t ConstExpression::record(Tape &tape, const size_t *) const {
+  return tape.constant(evaluate());
+}
+
+size_t PlaceHolder::record(Tape &tape, const size_t *) const {
+  return tape.input(*this);
+}
+
+namespace operations {
+
+size_t UnaryOperation::record(Tape &tape, const size_t *operands) const {
+  double x = tape.valueAt(operands[0]);
+  double y = apply(x);
+  return tape.unary(y, operands[0], derivative(x, y));
+}
+
+size_t BinaryOperation::record(Tape &tape, const size_t *operands) const {
+  double a = tape.valueAt(operands[0]);
+  double b = tape.valueAt(operands[1]);
+  double y = apply(a, b);
+  auto [da, db] = partials(a, b, y);
+  return tape.binary(y, operands[0], da, operands[1], db);
+}
+
+size_t FusedMultiplyAddOperation::record(Tape &tape,
+                                         const size_t *operands) const {
+  double av = tape.valueAt(operands[0]);
+  double bv = tape.valueAt(operands[1]);
+  double cv = tape.valueAt(operands[2]);
+  // Split as t = a * b followed by t + c to keep two parents per entry.
+  auto product = tape.binary(av * bv, operands[0], bv, operands[1], av);
+  return tape.binary(apply(av, bv, cv), product, 1, operands[2], 1);
+}
+
+size_t VariadicOperation::record(Tape &tape, const size_t *operands) const {
+  size_t count = arity();
+  std::vector<double> values(count);
+  std::vector<double> weights(count);
+  for (size_t i = 0; i < count; i++) {
+    values[i] = tape.valueAt(operands[i]);
+  }
+  double y = apply(values.data(), count);
+  partials(values.data(), count, y, weights.data());
+  return tape.nary(y, operands, weights.data(), count);
+}
+
+} // namespace operations
+
+double Tape::record(const Expression &expression) {
+  if (auto compiled = dynamic_cast<const CompiledExpression *>(&expression)) {
+    return record(compiled->getCode());
+  }
+  return record(linearize(expression));
+}
+
+double Tape::record(const Linearization &code) {
+  clear();
+  slots.resize(code.nodes.size());
+  args.resize(code.maxArity);
+  for (size_t i = 0; i < code.nodes.size(); i++) {
+    const auto &node = code.nodes[i];
+    for (uint32_t k = 0; k < node.arity; k++) {
+      args[k] = slots[code.operands[node.firstOperand + k]];
+    }
+    slots[i] = node.expression->record(*this, args.data());
+  }
+  return value();
+}
+
+void Tape::clear() {
+  values.clear();
+  entries.clear();
+  adjoints.clear();
+  inputs.clear();
+  inputIndex.clear();
+}
+
+size_t Tape::constant(double value) {
+  values.push_back(value);
+  entries.push_back({none, none, 0, 0});
+  return values.size() - 1;
+}
+
+size_t Tape::input(const PlaceHolder &placeholder) {
+  auto it = inputIndex.find(&placeholder);
+  if (it != inputIndex.end()) {
+    return it->second;
+  }
+  auto index = static_cast<uint32_t>(constant(placeholder.evaluate()));
+  inputs.emplace_back(&placeholder, index);
+  inputIndex.emplace(&placeholder, index);
+  return index;
+}
+
+size_t Tape::unary(double value, size_t operand, double doperand) {
+  values.push_back(value);
+  entries.push_back({static_cast<uint32_t>(operand), none, doperand, 0});
+  return values.size() - 1;
+}
+
+size_t Tape::binary(double value, size_t left, double dleft, size_t right,
+                    double dright) {
+  values.push_back(value);
+  entries.push_back({static_cast<uint32_t>(left), static_cast<uint32_t>(right),
+                     dleft, dright});
+  return values.size() - 1;
+}
+
+size_t Tape::nary(double value, const size_t *operands, const double *weights,
+                  size_t count) {
+  if (count == 1) {
+    return unary(value, operands[0], weights[0]);
+  }
+  // A chain of two-parent entries; only the weights matter to backward(),
+  // so the intermediate entries carry no value.
+  size_t index = binary(0, operands[0], weights[0], operands[1], weights[1]);
+  for (size_t i = 2; i < count; i++) {
+    index = binary(0, index, 1, operands[i], weights[i]);
+  }
+  values[index] = value;
+  return index;
+}
+
+void Tape::backward() {
+  adjoints.assign(values.size(), 0.0);
+  if (values.empty()) {
+    return;
+  }
+  adjoints.back() = 1;
+  for (size_t i = values.size(); i-- > 0;) {
+    double adjoint = adjoints[i];
+    if (adjoint == 0) {
+      continue;
+    }
+    const auto &entry = entries[i];
+    if (entry.left != none) {
+      adjoints[entry.left] += adjoint * entry.dleft;
+    }
+    if (entry.right != none) {
+      adjoints[entry.right] += adjoint * entry.dright;
+    }
+  }
+}
+
+double Tape::gradient(const PlaceHolder &placeholder) const {
+  auto it = inputIndex.find(&placeholder);
+  if (it == inputIndex.end() || adjoints.empty()) {
+    return 0;
+  }
+  return adjoints[it->second];
+}
+
+std::unordered_map<std::string, double> Tape::gradient() const {
+  std::unordered_map<std::string, double> result;
+  for (const auto &[placeholder, index] : inputs) {
+    result[std::string(placeholder->getIdentifier())] =
+        adjoints.empty() ? 0 : adjoints[index];
+  }
+  return result;
+}
+
+} // namespace expression_solver
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Expression.hpp"
+#include "Traversal.hpp"
+
+namespace expression_solver {
+
+// Reverse-mode automatic differentiation.
+//
+// record() evaluates an expression once, writing every intermediate value and
+// the local partial derivatives to a flat tape. backward() then walks the tape
+// from the result to the leaves, accumulating adjoints, which yields the
+// derivative with respect to every placeholder in a single pass. A tape can be
+// reused between evaluations to avoid reallocating.
+class Tape {
+  static constexpr uint32_t none = UINT32_MAX;
+
+  // Each entry has at most two parents, weighted by the local derivative.
+  struct Entry {
+    uint32_t left;
+    uint32_t right;
+    double dleft;
+    double dright;
+  };
+
+  std::vector<double> values;
+  std::vector<Entry> entries;
+  std::vector<double> adjoints;
+  std::vector<std::pair<const PlaceHolder *, uint32_t>> inputs;
+  std::unordered_map<const PlaceHolder *, uint32_t> inputIndex;
+
+  // Scratch for record(), kept to avoid reallocating between evaluations.
+  std::vector<size_t> slots;
+  std::vector<size_t> args;
+
+public:
+  // Clears the tape and records the expression. Returns its value. The
+  // tree is walked with an explicit stack, and compiled expressions reuse
+  // their linearization.
+  double record(const Expression &expression);
+  double record(const Linearization &code);
+
+  // Propagates adjoints from the recorded result back to the inputs.
+  void backward();
+
+  double value() const { return values.empty() ? 0 : values.back(); }
+  double valueAt(size_t index) const { return values[index]; }
+  size_t size() const { return values.size(); }
+  void clear();
+
+  // Derivative of the result with respect to the placeholder. Placeholders
+  // that do not appear in the expression have a derivative of zero.
+  double gradient(const PlaceHolder &placeholder) const;
+
+  // Derivatives of the result keyed by placeholder identifier.
+  std::unordered_map<std::string, double> gradient() const;
+
+  size_t constant(double value);
+  size_t input(const PlaceHolder &placeholder);
+  size_t unary(double value, size_t operand, double doperand);
+  size_t binary(double value, size_t left, double dleft, size_t right,
+                double dright);
+  size_t nary(double value, const size_t *operands, const double *weights,
+              size_t count);
+};
+
+struct GradientResult {
+  double value;
+  std::unordered_map<std::string, double> gradient;
+};
+
+} // namespace expression_solver
@@ -0,0 +1,47 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+namespace expression_solver {
+
+ThreadPool::ThreadPool(size_t threads) {
+  threads = std::max<size_t>(threads, 1);
+  workers.reserve(threads);
+  for (size_t i = 0; i < threads; i++) {
+    workers.emplace_back([this] { run(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  ready.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::run() {
+  while (true) {
+    std::move_only_function<void()> task;
+    {
+      std::unique_lock lock(mutex);
+      ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+      if (tasks.empty()) {
+        return;
+      }
+      task = std::move(tasks.front());
+      tasks.pop();
+    }
+    task();
+  }
+}
+
+ThreadPool &ThreadPool::shared() {
+  static ThreadPool pool;
+  return pool;
+}
+
+} // namespace expression_solver
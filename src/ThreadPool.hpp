@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace expression_solver {
+
+// Fixed set of worker threads running submitted tasks in FIFO order. Used to
+// compile expressions away from the thread that serves requests.
+class ThreadPool {
+  std::vector<std::thread> workers;
+  std::queue<std::move_only_function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable ready;
+  bool stopping = false;
+
+  void run();
+
+public:
+  explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+
+  // Runs the tasks already queued, then joins the workers.
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t size() const { return workers.size(); }
+
+  // Queues task and returns a future for its result. An exception thrown by
+  // the task is rethrown by the future's get().
+  template <typename Task>
+  auto submit(Task &&task) -> std::future<std::invoke_result_t<std::decay_t<Task>>> {
+    using Result = std::invoke_result_t<std::decay_t<Task>>;
+    std::packaged_task<Result()> packaged(std::forward<Task>(task));
+    auto future = packaged.get_future();
+    {
+      std::lock_guard lock(mutex);
+      if (stopping) {
+        throw std::logic_error("Thread pool is shutting down");
+      }
+      tasks.emplace(std::move(packaged));
+    }
+    ready.notify_one();
+    return future;
+  }
+
+  // Process-wide pool with one thread per hardware thread, started on first
+  // use.
+  static ThreadPool &shared();
+};
+
+} // namespace expression_solver
@@ -0,0 +1,98 @@
+#include <algorithm>
+
+#include "Traversal.hpp"
+
+namespace expression_solver {
+
+Linearization linearize(const Expression &root) {
+  using operations::Operation;
+
+  struct Frame {
+    const Expression *node;
+    const Operation *operation;
+    uint32_t next;
+    bool shared;
+  };
+
+  Linearization result;
+  std::vector<Frame> stack;
+  std::vector<uint32_t> done; // Positions of the finished operands
+  std::unordered_map<const Expression *, uint32_t> shared;
+
+  stack.push_back({&root, dynamic_cast<const Operation *>(&root), 0, false});
+  while (!stack.empty()) {
+    auto &frame = stack.back();
+    if (frame.operation && frame.next < frame.operation->arity()) {
+      const auto &operand = frame.operation->getOperandAt(frame.next++);
+      bool isShared = operand.use_count() > 1;
+      if (isShared) {
+        auto it = shared.find(operand.get());
+        if (it != shared.end()) {
+          done.push_back(it->second);
+          continue;
+        }
+      }
+      stack.push_back({operand.get(),
+                       dynamic_cast<const Operation *>(operand.get()), 0,
+                       isShared});
+      continue;
+    }
+
+    uint32_t arity = frame.operation ? frame.next : 0;
+    auto position = static_cast<uint32_t>(result.nodes.size());
+    auto first = static_cast<uint32_t>(result.operands.size());
+    result.operands.insert(result.operands.end(), done.end() - arity,
+                           done.end());
+    done.resize(done.size() - arity);
+    result.nodes.push_back({frame.node, frame.operation, first, arity});
+    result.maxArity = std::max<size_t>(result.maxArity, arity);
+    if (frame.shared) {
+      shared.emplace(frame.node, position);
+    }
+    done.push_back(position);
+    stack.pop_back();
+  }
+  return result;
+}
+
+double estimateCost(const Linearization &code) {
+  double cost = 0;
+  for (const auto &node : code.nodes) {
+    cost += node.operation ? node.operation->cost() : 0;
+  }
+  return cost;
+}
+
+ExpressionPtr copyTree(
+    const ExpressionPtr &root,
+    const std::unordered_map<const Expression *, ExpressionPtr> &replacements) {
+  auto code = linearize(*root);
+  std::vector<ExpressionPtr> copies(code.nodes.size());
+  std::vector<ExpressionPtr> args(code.maxArity);
+
+  // Leaves are only reachable through their parents; find their owners.
+  for (size_t i = 0; i < code.nodes.size(); i++) {
+    const auto &node = code.nodes[i];
+    if (!node.operation) {
+      continue;
+    }
+    for (uint32_t k = 0; k < node.arity; k++) {
+      auto position = code.operands[node.firstOperand + k];
+      if (!copies[position]) {
+        const auto &leaf = node.operation->getOperandAt(k);
+        auto it = replacements.find(leaf.get());
+        copies[position] = it != replacements.end() ? it->second : leaf;
+      }
+      args[k] = copies[position];
+    }
+    copies[i] = node.operation->rebuild(args.data());
+  }
+
+  if (!copies.back()) {
+    auto it = replacements.find(root.get());
+    return it != replacements.end() ? it->second : root;
+  }
+  return copies.back();
+}
+
+} // namespace expression_solver
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "Operation.hpp"
+
+namespace expression_solver {
+
+// Distinct nodes of a tree in post-order: every node comes after all of its
+// operands, and a node shared by several parents appears once.
+struct Linearization {
+  struct Node {
+    const Expression *expression;
+    const operations::Operation *operation; // nullptr for leaves
+    uint32_t firstOperand; // Index of the first operand slot in operands
+    uint32_t arity;
+  };
+
+  std::vector<Node> nodes;
+  std::vector<uint32_t> operands; // Positions in nodes, per node operand
+  size_t maxArity = 0;
+};
+
+// Builds the linearization with an explicit stack, so trees of any depth
+// are safe.
+Linearization linearize(const Expression &root);
+
+// Sum of Operation::cost over the operation nodes.
+double estimateCost(const Linearization &code);
+
+// Copies every operation node of the tree, keeping its shape and shared
+// nodes. Leaves found in replacements are swapped for the mapped expression;
+// other leaves are shared with the original.
+ExpressionPtr copyTree(
+    const ExpressionPtr &root,
+    const std::unordered_map<const Expression *, ExpressionPtr> &replacements = {});
+
+// Rebuilds the tree bottom-up. rewrite(node) is called once all operands of
+// node have been rewritten, and its result replaces node in the parent.
+// Uses an explicit stack; shared operation nodes are rewritten once.
+template <typename Rewrite>
+ExpressionPtr transform(ExpressionPtr root, Rewrite &&rewrite) {
+  using operations::Operation;
+
+  struct Frame {
+    ExpressionPtr node;
+    Operation *operation;
+    size_t next;
+  };
+  std::vector<Frame> stack;
+  std::unordered_map<const Expression *, ExpressionPtr> shared;
+
+  auto push = [&stack](ExpressionPtr node) {
+    auto operation = dynamic_cast<Operation *>(node.get());
+    stack.push_back({std::move(node), operation, 0});
+  };
+
+  push(std::move(root));
+  while (true) {
+    auto &frame = stack.back();
+    if (frame.operation && frame.next < frame.operation->arity()) {
+      const auto &operand = frame.operation->getOperandAt(frame.next);
+      if (operand.use_count() > 1) {
+        auto it = shared.find(operand.get());
+        if (it != shared.end()) {
+          frame.operation->setOperandAt(frame.next++, it->second);
+          continue;
+        }
+      }
+      push(operand);
+      continue;
+    }
+
+    const Expression *original = frame.node.get();
+    bool isShared = frame.node.use_count() > 2;
+    ExpressionPtr done = rewrite(frame.node);
+    stack.pop_back();
+    if (stack.empty()) {
+      return done;
+    }
+    if (isShared && dynamic_cast<const Operation *>(original)) {
+      shared.emplace(original, done);
+    }
+    auto &parent = stack.back();
+    parent.operation->setOperandAt(parent.next++, std::move(done));
+  }
+}
+
+} // namespace expression_solver
@@ -0,0 +1,462 @@
+#include "TypeInference.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <typeinfo>
+
+namespace expression_solver {
+
+using namespace operations;
+
+ValueInfo ValueInfo::range(double low, double high, bool integral) {
+  if (!std::isfinite(low) || !std::isfinite(high)) {
+    return unknown();
+  }
+  bool whole = integral && low >= -maxInteger && high <= maxInteger;
+  return {whole ? ValueType::Integer : ValueType::Real, true, integral, low, high};
+}
+
+ValueInfo ValueInfo::constant(double value) {
+  return range(value, value, std::isfinite(value) && value == std::trunc(value));
+}
+
+ValueInfo ValueInfo::of(std::span<const double> values) {
+  if (values.empty()) {
+    return unknown();
+  }
+  // Branch-free passes over chunks of the column. Adding and subtracting
+  // 1.5 * 2^52 rounds to a whole number when |value| <= 2^51, and leaves NaN
+  // unequal. Only whole numbers start integer chains, so the scan gives up
+  // at the first chunk with anything else and leaves the column unknown.
+  constexpr double shift = 0x1.8p52;
+  constexpr size_t chunk = 256;
+  double low = values[0];
+  double high = values[0];
+  for (size_t start = 0; start < values.size(); start += chunk) {
+    size_t end = std::min(values.size(), start + chunk);
+    uint64_t fractional = 0;
+    for (size_t i = start; i < end; i++) {
+      double value = values[i];
+      low = value < low ? value : low;
+      high = value > high ? value : high;
+      fractional |= (value + shift) - shift != value;
+    }
+    if (fractional) {
+      return unknown();
+    }
+  }
+  return range(low, high, low >= -0x1p51 && high <= 0x1p51);
+}
+
+namespace {
+
+using Kernel = TypedEvaluator::Kernel;
+
+Kernel kernelOf(const Operation &operation) {
+  const auto &type = typeid(operation);
+  if (type == typeid(LogicalAndOperation)) return Kernel::And;
+  if (type == typeid(LogicalOrOperation)) return Kernel::Or;
+  if (type == typeid(LogicalNotOperation)) return Kernel::Not;
+  if (type == typeid(LogicalEqualOperation)) return Kernel::Equal;
+  if (type == typeid(AddOperation) || type == typeid(SumOperation)) return Kernel::Add;
+  if (type == typeid(SubtractOperation)) return Kernel::Subtract;
+  if (type == typeid(MultiplyOperation)) return Kernel::Multiply;
+  if (type == typeid(NegateOperation)) return Kernel::Negate;
+  if (type == typeid(AbsOperation)) return Kernel::Abs;
+  if (type == typeid(MinOperation) || type == typeid(VariadicMinOperation)) return Kernel::Min;
+  if (type == typeid(MaxOperation) || type == typeid(VariadicMaxOperation)) return Kernel::Max;
+  if (type == typeid(ModuloOperation)) return Kernel::Modulo;
+  if (type == typeid(FloorOperation)) return Kernel::Floor;
+  if (type == typeid(CeilOperation)) return Kernel::Ceil;
+  if (type == typeid(RoundOperation)) return Kernel::Round;
+  if (type == typeid(TruncOperation)) return Kernel::Trunc;
+  return Kernel::Generic;
+}
+
+bool logical(Kernel kernel) {
+  return kernel == Kernel::And || kernel == Kernel::Or || kernel == Kernel::Not ||
+         kernel == Kernel::Equal;
+}
+
+bool rounding(Kernel kernel) {
+  return kernel == Kernel::Floor || kernel == Kernel::Ceil || kernel == Kernel::Round ||
+         kernel == Kernel::Trunc;
+}
+
+double roundWith(Kernel kernel, double x) {
+  switch (kernel) {
+  case Kernel::Floor:
+    return std::floor(x);
+  case Kernel::Ceil:
+    return std::ceil(x);
+  case Kernel::Round:
+    return std::round(x);
+  default:
+    return std::trunc(x);
+  }
+}
+
+// Sets bit i of out from bit(i), for rows [0, count). The conditions go to
+// a byte per row first, a loop the compiler vectorizes, and each 8 bytes of
+// 0 or 1 are then gathered into 8 bits with one multiplication.
+template <typename Bit> void pack(uint64_t *out, size_t count, Bit &&bit) {
+  constexpr uint64_t gather = 0x0102040810204080;
+  uint8_t bytes[64];
+  for (size_t base = 0; base < count; base += 64) {
+    size_t width = std::min<size_t>(64, count - base);
+    for (size_t j = 0; j < width; j++) {
+      bytes[j] = bit(base + j);
+    }
+    std::fill(bytes + width, bytes + 64, 0);
+    uint64_t word = 0;
+    for (size_t group = 0; group < 8; group++) {
+      uint64_t eight;
+      std::memcpy(&eight, bytes + group * 8, 8);
+      word |= ((eight * gather) >> 56) << (group * 8);
+    }
+    out[base / 64] = word;
+  }
+}
+
+bool test(const uint64_t *mask, size_t row) { return (mask[row / 64] >> (row % 64)) & 1; }
+
+} // namespace
+
+TypedEvaluator::TypedEvaluator(const Linearization &code) {
+  kernels.reserve(code.nodes.size());
+  for (const auto &node : code.nodes) {
+    kernels.push_back(node.operation ? kernelOf(*node.operation) : Kernel::Generic);
+    Kernel kernel = kernels.back();
+    anyInteger |= kernel == Kernel::Modulo || rounding(kernel);
+    anyKernel |= anyInteger || logical(kernel);
+  }
+}
+
+void TypedEvaluator::infer(const Linearization &code, std::span<ValueInfo> infos) const {
+  const uint32_t *operands = code.operands.data();
+  for (size_t i = 0; i < code.nodes.size(); i++) {
+    const auto &node = code.nodes[i];
+    if (!node.operation) {
+      continue;
+    }
+    auto arg = [&](size_t k) -> const ValueInfo & {
+      return infos[operands[node.firstOperand + k]];
+    };
+    Kernel kernel = kernels[i];
+    if (logical(kernel)) {
+      infos[i] = ValueInfo::boolean();
+      continue;
+    }
+    bool finite = true;
+    bool integral = true;
+    for (uint32_t k = 0; k < node.arity; k++) {
+      finite &= arg(k).finite;
+      integral &= arg(k).integral;
+    }
+    if (!finite || node.arity == 0) {
+      infos[i] = ValueInfo::unknown();
+      continue;
+    }
+
+    const ValueInfo &a = arg(0);
+    const ValueInfo &b = arg(node.arity > 1 ? 1 : 0);
+    switch (kernel) {
+    case Kernel::Add: {
+      // Partial sums of the int64 kernel must not overflow either.
+      double low = 0, high = 0, magnitude = 0;
+      for (uint32_t k = 0; k < node.arity; k++) {
+        low += arg(k).low;
+        high += arg(k).high;
+        magnitude += std::max(std::abs(arg(k).low), std::abs(arg(k).high));
+      }
+      infos[i] = ValueInfo::range(low, high, integral && magnitude <= 0x1p62);
+      break;
+    }
+    case Kernel::Subtract:
+      infos[i] = ValueInfo::range(a.low - b.high, a.high - b.low, integral);
+      break;
+    case Kernel::Multiply: {
+      double products[] = {a.low * b.low, a.low * b.high, a.high * b.low, a.high * b.high};
+      infos[i] = ValueInfo::range(*std::min_element(products, products + 4),
+                                  *std::max_element(products, products + 4), integral);
+      break;
+    }
+    case Kernel::Negate:
+      infos[i] = ValueInfo::range(-a.high, -a.low, integral);
+      break;
+    case Kernel::Abs:
+      infos[i] = a.low >= 0   ? ValueInfo::range(a.low, a.high, integral)
+                 : a.high <= 0 ? ValueInfo::range(-a.high, -a.low, integral)
+                               : ValueInfo::range(0, std::max(-a.low, a.high), integral);
+      break;
+    case Kernel::Min:
+    case Kernel::Max: {
+      double low = a.low, high = a.high;
+      for (uint32_t k = 1; k < node.arity; k++) {
+        low = kernel == Kernel::Min ? std::min(low, arg(k).low) : std::max(low, arg(k).low);
+        high = kernel == Kernel::Min ? std::min(high, arg(k).high) : std::max(high, arg(k).high);
+      }
+      infos[i] = ValueInfo::range(low, high, integral);
+      break;
+    }
+    case Kernel::Modulo: {
+      // fmod(a, b) takes the sign of a and is smaller than b in magnitude;
+      // a divisor range containing zero may give NaN.
+      if (b.low <= 0 && b.high >= 0) {
+        infos[i] = ValueInfo::unknown();
+        break;
+      }
+      double limit = std::max(std::abs(b.low), std::abs(b.high)) - (integral ? 1 : 0);
+      infos[i] = ValueInfo::range(a.low < 0 ? std::max(-limit, a.low) : 0,
+                                  a.high > 0 ? std::min(limit, a.high) : 0, integral);
+      break;
+    }
+    case Kernel::Floor:
+    case Kernel::Ceil:
+    case Kernel::Round:
+    case Kernel::Trunc:
+      infos[i] = ValueInfo::range(roundWith(kernel, a.low), roundWith(kernel, a.high), true);
+      break;
+    default:
+      infos[i] = ValueInfo::unknown();
+      break;
+    }
+  }
+}
+
+void TypedEvaluator::plan(const Linearization &code, std::span<const ValueInfo> infos,
+                          std::vector<Representation> &native,
+                          std::vector<Representation> &reads) const {
+  size_t count = code.nodes.size();
+  native.assign(count, Representation::Real);
+  reads.assign(count, Representation::Real);
+  for (size_t i = 0; i < count; i++) {
+    const auto &node = code.nodes[i];
+    if (!node.operation) {
+      continue;
+    }
+    const uint32_t *args = code.operands.data() + node.firstOperand;
+    bool whole = true;      // No operand is Real
+    bool integers = false;  // Some operand is already in int64s
+    for (uint32_t k = 0; k < node.arity; k++) {
+      whole &= infos[args[k]].type != ValueType::Real;
+      integers |= native[args[k]] == Representation::Integer;
+    }
+
+    Kernel kernel = kernels[i];
+    if (logical(kernel)) {
+      native[i] = Representation::Mask;
+      bool masks = kernel != Kernel::Equal ||
+                   (infos[args[0]].type == ValueType::Boolean &&
+                    infos[args[1]].type == ValueType::Boolean);
+      reads[i] = masks                ? Representation::Mask
+                 : whole && integers ? Representation::Integer
+                                     : Representation::Real;
+      continue;
+    }
+    if (infos[i].type != ValueType::Integer || !whole) {
+      continue;
+    }
+    // An integer chain starts where it saves work: % instead of fmod, and
+    // rounding of whole numbers, which is free. Elsewhere the conversions
+    // would cost more than the int64 kernel gains.
+    if (kernel == Kernel::Modulo || (kernel != Kernel::Generic && integers)) {
+      native[i] = reads[i] = Representation::Integer;
+    }
+  }
+}
+
+bool TypedEvaluator::applies(const Linearization &code,
+                             std::span<const ValueInfo> infos) const {
+  std::vector<Representation> native, reads;
+  plan(code, infos, native, reads);
+  return std::any_of(native.begin(), native.end(),
+                     [](Representation r) { return r != Representation::Real; });
+}
+
+void TypedEvaluator::evaluate(const Linearization &code, std::span<const ValueInfo> infos,
+                              std::span<const double *const> bound,
+                              std::span<double> results, size_t block) const {
+  constexpr uint8_t needReal = 1, needInteger = 2, needMask = 4;
+  size_t count = code.nodes.size();
+  size_t rows = results.size();
+  const uint32_t *operands = code.operands.data();
+  // Whole words of mask per block.
+  block = block >= 64 ? block / 64 * 64 : block;
+  size_t words = (block + 63) / 64;
+
+  // Representation of every node and of the operands it reads, and which
+  // others its consumers need.
+  std::vector<Representation> native, reads;
+  plan(code, infos, native, reads);
+  std::vector<uint8_t> needs(count, 0);
+  auto flag = [](Representation r) {
+    return r == Representation::Real ? needReal
+           : r == Representation::Integer ? needInteger
+                                          : needMask;
+  };
+  for (size_t i = 0; i < count; i++) {
+    const auto &node = code.nodes[i];
+    for (uint32_t k = 0; k < node.arity; k++) {
+      needs[operands[node.firstOperand + k]] |= flag(reads[i]);
+    }
+  }
+  needs[count - 1] |= needReal;
+
+  // Columns of every node, in the layouts it is produced or read in. The
+  // root writes its doubles to results.
+  std::vector<size_t> realAt(count, SIZE_MAX), integerAt(count, SIZE_MAX), maskAt(count, SIZE_MAX);
+  size_t reals = 0, integers = 0, masks = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint8_t has = needs[i] | flag(native[i]);
+    if ((has & needReal) && !bound[i] && i + 1 != count) {
+      realAt[i] = reals++ * block;
+    }
+    if (has & needInteger) {
+      integerAt[i] = integers++ * block;
+    }
+    if (has & needMask) {
+      maskAt[i] = masks++ * words;
+    }
+  }
+  std::vector<double> realColumns(reals * block);
+  std::vector<int64_t> integerColumns(integers * block);
+  std::vector<uint64_t> maskColumns(masks * words);
+  for (size_t i = 0; i + 1 < count; i++) {
+    if (!code.nodes[i].operation && !bound[i]) {
+      std::fill_n(&realColumns[realAt[i]], block, code.nodes[i].expression->evaluate());
+    }
+  }
+
+  std::vector<const double *> real(count);
+  std::vector<const int64_t *> integer(count);
+  std::vector<const uint64_t *> mask(count);
+  std::vector<const double *> realArgs(std::max<size_t>(code.maxArity, 1));
+
+  for (size_t start = 0; start < rows; start += block) {
+    size_t n = std::min(block, rows - start);
+    for (size_t i = 0; i < count; i++) {
+      const auto &node = code.nodes[i];
+      const uint32_t *args = operands + node.firstOperand;
+      double *realOut = i + 1 == count ? results.data() + start
+                        : realAt[i] != SIZE_MAX ? &realColumns[realAt[i]]
+                                                : nullptr;
+      int64_t *integerOut = integerAt[i] != SIZE_MAX ? &integerColumns[integerAt[i]] : nullptr;
+      uint64_t *maskOut = maskAt[i] != SIZE_MAX ? &maskColumns[maskAt[i]] : nullptr;
+      Kernel kernel = kernels[i];
+
+      if (!node.operation) {
+        real[i] = bound[i] ? bound[i] + start : realOut;
+      } else if (native[i] == Representation::Real) {
+        for (uint32_t k = 0; k < node.arity; k++) {
+          realArgs[k] = real[args[k]];
+        }
+        node.operation->applyBatch(realArgs.data(), realOut, n);
+        real[i] = realOut;
+      } else if (native[i] == Representation::Integer) {
+        const int64_t *a = integer[args[0]];
+        int64_t *out = integerOut;
+        switch (kernel) {
+        case Kernel::Add:
+        case Kernel::Min:
+        case Kernel::Max:
+          std::copy_n(a, n, out);
+          for (uint32_t k = 1; k < node.arity; k++) {
+            const int64_t *b = integer[args[k]];
+            if (kernel == Kernel::Add) {
+              for (size_t r = 0; r < n; r++) out[r] += b[r];
+            } else if (kernel == Kernel::Min) {
+              for (size_t r = 0; r < n; r++) out[r] = std::min(out[r], b[r]);
+            } else {
+              for (size_t r = 0; r < n; r++) out[r] = std::max(out[r], b[r]);
+            }
+          }
+          break;
+        case Kernel::Subtract:
+          for (size_t r = 0; r < n; r++) out[r] = a[r] - integer[args[1]][r];
+          break;
+        case Kernel::Multiply:
+          for (size_t r = 0; r < n; r++) out[r] = a[r] * integer[args[1]][r];
+          break;
+        case Kernel::Modulo:
+          for (size_t r = 0; r < n; r++) out[r] = a[r] % integer[args[1]][r];
+          break;
+        case Kernel::Negate:
+          for (size_t r = 0; r < n; r++) out[r] = -a[r];
+          break;
+        case Kernel::Abs:
+          for (size_t r = 0; r < n; r++) out[r] = a[r] < 0 ? -a[r] : a[r];
+          break;
+        default: // Whole numbers round to themselves
+          out = nullptr;
+          break;
+        }
+        integer[i] = out ? out : a;
+      } else {
+        uint64_t *out = maskOut;
+        size_t used = (n + 63) / 64;
+        if (kernel == Kernel::Equal) {
+          if (reads[i] == Representation::Mask) {
+            for (size_t w = 0; w < used; w++) out[w] = ~(mask[args[0]][w] ^ mask[args[1]][w]);
+          } else if (reads[i] == Representation::Integer) {
+            const int64_t *a = integer[args[0]], *b = integer[args[1]];
+            pack(out, n, [&](size_t r) { return a[r] == b[r]; });
+          } else {
+            const double *a = real[args[0]], *b = real[args[1]];
+            pack(out, n, [&](size_t r) { return a[r] == b[r]; });
+          }
+        } else if (kernel == Kernel::Not) {
+          for (size_t w = 0; w < used; w++) out[w] = ~mask[args[0]][w];
+        } else {
+          std::copy_n(mask[args[0]], used, out);
+          for (uint32_t k = 1; k < node.arity; k++) {
+            const uint64_t *b = mask[args[k]];
+            if (kernel == Kernel::And) {
+              for (size_t w = 0; w < used; w++) out[w] &= b[w];
+            } else {
+              for (size_t w = 0; w < used; w++) out[w] |= b[w];
+            }
+          }
+        }
+        mask[i] = out;
+      }
+
+      // Layouts the consumers read in, converted from the native one.
+      uint8_t wanted = needs[i] & ~flag(native[i]);
+      if (wanted & needReal) {
+        if (native[i] == Representation::Integer) {
+          const int64_t *from = integer[i];
+          for (size_t r = 0; r < n; r++) realOut[r] = static_cast<double>(from[r]);
+        } else {
+          const uint64_t *from = mask[i];
+          for (size_t r = 0; r < n; r++) realOut[r] = test(from, r);
+        }
+        real[i] = realOut;
+      }
+      if (wanted & needInteger) {
+        if (native[i] == Representation::Real) {
+          const double *from = real[i];
+          for (size_t r = 0; r < n; r++) integerOut[r] = static_cast<int64_t>(from[r]);
+        } else {
+          const uint64_t *from = mask[i];
+          for (size_t r = 0; r < n; r++) integerOut[r] = test(from, r);
+        }
+        integer[i] = integerOut;
+      }
+      if (wanted & needMask) {
+        // Truth as in a condition: any value but zero, NaN included.
+        if (native[i] == Representation::Real) {
+          const double *from = real[i];
+          pack(maskOut, n, [&](size_t r) { return from[r] != 0; });
+        } else {
+          const int64_t *from = integer[i];
+          pack(maskOut, n, [&](size_t r) { return from[r] != 0; });
+        }
+        mask[i] = maskOut;
+      }
+    }
+  }
+}
+
+} // namespace expression_solver
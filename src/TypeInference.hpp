@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "Traversal.hpp"
+
+namespace expression_solver {
+
+// Kind of every value a node takes. Boolean values are 0 or 1 and Integer
+// values are whole numbers of magnitude at most 2^53, so both convert to and
+// from double exactly.
+enum class ValueType : uint8_t { Boolean, Integer, Real };
+
+// What is known about the values of a node over a batch.
+struct ValueInfo {
+  static constexpr double maxInteger = 9007199254740992.0; // 2^53
+
+  ValueType type = ValueType::Real;
+  bool finite = false;   // No NaN or infinity; low and high bound every value
+  bool integral = false; // Every value is a whole number
+  double low = -std::numeric_limits<double>::infinity();
+  double high = std::numeric_limits<double>::infinity();
+
+  static ValueInfo unknown() { return {}; }
+  static ValueInfo boolean() { return {ValueType::Boolean, true, true, 0, 1}; }
+  static ValueInfo constant(double value);
+  // Range of a column of whole numbers, found with one pass over it. Unknown
+  // for columns with fractions or NaN; those are not worth bounding.
+  static ValueInfo of(std::span<const double> values);
+  // Info with the given bounds, typed from them.
+  static ValueInfo range(double low, double high, bool integral);
+};
+
+// Batch evaluation of a linearization with typed columns. Boolean nodes
+// (&&, ||, !, ==) are computed as bitmasks of 64 rows per word. Integer
+// nodes run int64 kernels once a chain has started at a % of whole numbers
+// or at rounding of an integer, which is free; +, -, *, min, max and abs
+// then continue it. Everything else runs its double applyBatch over
+// converted operands.
+//
+// Results match the double evaluation, except that an integer zero is never
+// negative.
+class TypedEvaluator {
+public:
+  enum class Kernel : uint8_t {
+    Generic,
+    And,
+    Or,
+    Not,
+    Equal,
+    Add,
+    Subtract,
+    Multiply,
+    Negate,
+    Abs,
+    Min,
+    Max,
+    Modulo,
+    Floor,
+    Ceil,
+    Round,
+    Trunc,
+  };
+
+  // Picks the kernel of every node of code. The other members must be
+  // given the same code.
+  explicit TypedEvaluator(const Linearization &code);
+
+  // False when no operation of the program can start a typed column.
+  bool candidates() const { return anyKernel; }
+
+  // Whether the ranges of the inputs matter: integer chains start at % and
+  // at rounding, while logical operations are Boolean whatever their inputs.
+  bool usesRanges() const { return anyInteger; }
+
+  // Fills infos[i] for every operation node from the infos of its operands;
+  // the entries of leaves must be set by the caller.
+  void infer(const Linearization &code, std::span<ValueInfo> infos) const;
+
+  // True when some operation runs a Boolean or Integer kernel for infos.
+  bool applies(const Linearization &code, std::span<const ValueInfo> infos) const;
+
+  // Evaluates one row per element of results, block rows at a time, with
+  // the types in infos. bound[i] is the input column of leaf i, or nullptr
+  // when the leaf keeps its value over the batch.
+  void evaluate(const Linearization &code, std::span<const ValueInfo> infos,
+                std::span<const double *const> bound, std::span<double> results,
+                size_t block) const;
+
+private:
+  // Layout of a node's column: doubles, int64s or bitmask words.
+  enum class Representation : uint8_t { Real, Integer, Mask };
+
+  std::vector<Kernel> kernels;
+  bool anyKernel = false;
+  bool anyInteger = false;
+
+  // Representation every node is computed in, and the one it reads its
+  // operands in.
+  void plan(const Linearization &code, std::span<const ValueInfo> infos,
+            std::vector<Representation> &native, std::vector<Representation> &reads) const;
+};
+
+} // namespace expression_solver
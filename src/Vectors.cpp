@@ -0,0 +1,243 @@
+#include "Vectors.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace expression_solver {
+
+VectorPlaceHolder::VectorPlaceHolder(std::string identifier, size_t dimension)
+    : identifier(std::move(identifier)) {
+  if (dimension < 2 || dimension > maxDimension) {
+    throw std::invalid_argument("Vectors have 2 to 4 components");
+  }
+  constexpr const char *suffixes[] = {"_x", "_y", "_z", "_w"};
+  for (size_t k = 0; k < dimension; k++) {
+    components.push_back(std::make_shared<PlaceHolder>(this->identifier + suffixes[k], 0));
+  }
+}
+
+void VectorPlaceHolder::setValue(std::span<const double> values) {
+  if (values.size() != components.size()) {
+    throw std::invalid_argument("Expected one value per component");
+  }
+  for (size_t k = 0; k < components.size(); k++) {
+    components[k]->setValue(values[k]);
+  }
+}
+
+std::vector<Binding> VectorPlaceHolder::bind(std::span<const double> columns) const {
+  if (columns.size() % components.size() != 0) {
+    throw std::invalid_argument("Expected the same number of rows per component");
+  }
+  size_t rows = columns.size() / components.size();
+  std::vector<Binding> bindings;
+  for (size_t k = 0; k < components.size(); k++) {
+    bindings.push_back({components[k].get(), columns.subspan(k * rows, rows)});
+  }
+  return bindings;
+}
+
+namespace operations {
+
+namespace {
+
+// Components of the arguments, in order; a scalar argument is one.
+std::vector<ExpressionPtr> componentsOf(std::vector<ExpressionPtr> &arguments) {
+  std::vector<ExpressionPtr> components;
+  for (auto &argument : arguments) {
+    if (auto vector = dynamic_cast<const VectorExpression *>(argument.get())) {
+      const auto &inner = vector->getComponents();
+      components.insert(components.end(), inner.begin(), inner.end());
+    } else {
+      components.push_back(std::move(argument));
+    }
+  }
+  return components;
+}
+
+// Sum of the squares of the columns, row by row.
+void sumOfSquares(const double *const *operands, size_t n, double *out, size_t count) {
+  const double *x = operands[0];
+  for (size_t i = 0; i < count; i++) {
+    out[i] = x[i] * x[i];
+  }
+  for (size_t k = 1; k < n; k++) {
+    x = operands[k];
+    for (size_t i = 0; i < count; i++) {
+      out[i] += x[i] * x[i];
+    }
+  }
+}
+
+double sumOfSquares(const double *values, size_t count) {
+  double result = 0;
+  for (size_t k = 0; k < count; k++) {
+    result += values[k] * values[k];
+  }
+  return result;
+}
+
+} // namespace
+
+double DotOperation::apply(const double *values, size_t count) const {
+  size_t n = count / 2;
+  double result = 0;
+  for (size_t k = 0; k < n; k++) {
+    result += values[k] * values[n + k];
+  }
+  return result;
+}
+
+// One pass per component over contiguous columns, rather than a gather of
+// every operand per row.
+void DotOperation::applyBatch(const double *const *operands, double *out,
+                              size_t count) const {
+  size_t n = this->operands.size() / 2;
+  const double *a = operands[0];
+  const double *b = operands[n];
+  for (size_t i = 0; i < count; i++) {
+    out[i] = a[i] * b[i];
+  }
+  for (size_t k = 1; k < n; k++) {
+    a = operands[k];
+    b = operands[n + k];
+    for (size_t i = 0; i < count; i++) {
+      out[i] += a[i] * b[i];
+    }
+  }
+}
+
+void DotOperation::partials(const double *values, size_t count, double,
+                            double *out) const {
+  size_t n = count / 2;
+  for (size_t k = 0; k < n; k++) {
+    out[k] = values[n + k];
+    out[n + k] = values[k];
+  }
+}
+
+ExpressionPtr DotOperation::call(std::vector<ExpressionPtr> arguments) const {
+  auto dimension = [](const ExpressionPtr &argument) {
+    auto vector = dynamic_cast<const VectorExpression *>(argument.get());
+    return vector ? vector->dimension() : 1;
+  };
+  if (arguments.size() != 2 || dimension(arguments[0]) != dimension(arguments[1])) {
+    throw std::invalid_argument("dot takes two vectors of the same dimension");
+  }
+  return create(componentsOf(arguments));
+}
+
+double NormOperation::apply(const double *values, size_t count) const {
+  return std::sqrt(sumOfSquares(values, count));
+}
+
+void NormOperation::applyBatch(const double *const *operands, double *out,
+                               size_t count) const {
+  sumOfSquares(operands, this->operands.size(), out, count);
+  for (size_t i = 0; i < count; i++) {
+    out[i] = std::sqrt(out[i]);
+  }
+}
+
+void NormOperation::partials(const double *values, size_t count, double y,
+                             double *out) const {
+  for (size_t k = 0; k < count; k++) {
+    out[k] = values[k] / y;
+  }
+}
+
+ExpressionPtr NormOperation::call(std::vector<ExpressionPtr> arguments) const {
+  if (arguments.empty()) {
+    throw std::invalid_argument("Wrong number of arguments in call to norm");
+  }
+  return create(componentsOf(arguments));
+}
+
+// Component c of a x b is a[i] * b[j] - a[j] * b[i], with i and j the next
+// two components after c.
+double CrossOperation::apply(const double *values, size_t) const {
+  size_t i = (component + 1) % 3;
+  size_t j = (component + 2) % 3;
+  return values[i] * values[3 + j] - values[j] * values[3 + i];
+}
+
+void CrossOperation::applyBatch(const double *const *operands, double *out,
+                                size_t count) const {
+  size_t i = (component + 1) % 3;
+  size_t j = (component + 2) % 3;
+  const double *ai = operands[i];
+  const double *aj = operands[j];
+  const double *bi = operands[3 + i];
+  const double *bj = operands[3 + j];
+  for (size_t r = 0; r < count; r++) {
+    out[r] = ai[r] * bj[r] - aj[r] * bi[r];
+  }
+}
+
+void CrossOperation::partials(const double *values, size_t count, double,
+                              double *out) const {
+  size_t i = (component + 1) % 3;
+  size_t j = (component + 2) % 3;
+  std::fill(out, out + count, 0.0);
+  out[i] = values[3 + j];
+  out[3 + j] = values[i];
+  out[j] = -values[3 + i];
+  out[3 + i] = -values[j];
+}
+
+ExpressionPtr CrossOperation::call(std::vector<ExpressionPtr> arguments) const {
+  auto isVector3 = [](const ExpressionPtr &argument) {
+    auto vector = dynamic_cast<const VectorExpression *>(argument.get());
+    return vector && vector->dimension() == 3;
+  };
+  if (arguments.size() != 2 || !isVector3(arguments[0]) || !isVector3(arguments[1])) {
+    throw std::invalid_argument("cross takes two vectors of dimension 3");
+  }
+  auto operands = componentsOf(arguments);
+  std::vector<ExpressionPtr> components;
+  for (size_t c = 0; c < 3; c++) {
+    components.push_back(std::make_shared<CrossOperation>(operands, c));
+  }
+  return std::make_shared<VectorExpression>(std::move(components));
+}
+
+double NormalizeOperation::apply(const double *values, size_t count) const {
+  return values[component] / std::sqrt(sumOfSquares(values, count));
+}
+
+void NormalizeOperation::applyBatch(const double *const *operands, double *out,
+                                    size_t count) const {
+  sumOfSquares(operands, this->operands.size(), out, count);
+  const double *x = operands[component];
+  for (size_t i = 0; i < count; i++) {
+    out[i] = x[i] / std::sqrt(out[i]);
+  }
+}
+
+// d(x[c] / r) / dx[k] = (c == k) / r - x[c] x[k] / r^3, and x[c] / r is y.
+void NormalizeOperation::partials(const double *values, size_t count, double y,
+                                  double *out) const {
+  double r = std::sqrt(sumOfSquares(values, count));
+  for (size_t k = 0; k < count; k++) {
+    out[k] = ((k == component ? 1 : 0) - y * values[k] / r) / r;
+  }
+}
+
+ExpressionPtr NormalizeOperation::call(std::vector<ExpressionPtr> arguments) const {
+  if (arguments.empty()) {
+    throw std::invalid_argument("Wrong number of arguments in call to normalize");
+  }
+  auto operands = componentsOf(arguments);
+  if (operands.size() == 1) {
+    return std::make_shared<NormalizeOperation>(std::move(operands), 0);
+  }
+  std::vector<ExpressionPtr> components;
+  for (size_t c = 0; c < operands.size(); c++) {
+    components.push_back(std::make_shared<NormalizeOperation>(operands, c));
+  }
+  return std::make_shared<VectorExpression>(std::move(components));
+}
+
+} // namespace operations
+
+} // namespace expression_solver
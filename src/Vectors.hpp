@@ -0,0 +1,216 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "CompiledExpression.hpp"
+#include "Operation.hpp"
+
+namespace expression_solver {
+
+// Vectors of 2 to 4 components, such as positions and quaternions. They
+// exist only while an expression is parsed: each component is an ordinary
+// scalar expression, and the compiled tree holds those and the vector
+// operations below, which take the components as operands. Batches keep
+// every component in its own contiguous column, so the loops of the vector
+// operations run down the rows and the compiler vectorizes them.
+
+// A vector of placeholders, one per component, named after the vector with
+// the suffixes _x, _y, _z and _w: the vector "a" of dimension 3 has the
+// placeholders a_x, a_y and a_z.
+class VectorPlaceHolder {
+  std::string identifier;
+  std::vector<PlaceHolderPtr> components;
+
+public:
+  static constexpr size_t maxDimension = 4;
+
+  VectorPlaceHolder(std::string identifier, size_t dimension);
+
+  std::string_view getIdentifier() const { return identifier; }
+  size_t dimension() const { return components.size(); }
+  const std::vector<PlaceHolderPtr> &getComponents() const { return components; }
+
+  // Sets every component; values holds one per component.
+  void setValue(std::span<const double> values);
+
+  // Bindings of the components for batch evaluation, from columns laid out
+  // one after the other: component k of row i is columns[k * rows + i].
+  std::vector<Binding> bind(std::span<const double> columns) const;
+};
+
+typedef std::shared_ptr<VectorPlaceHolder> VectorPlaceHolderPtr;
+
+// The value of a vector subexpression while parsing. It has no scalar value:
+// compile rejects expressions that are vectors, and compileVector compiles
+// each component on its own.
+class VectorExpression : public Expression {
+  std::vector<ExpressionPtr> components;
+
+public:
+  explicit VectorExpression(std::vector<ExpressionPtr> components)
+      : components(std::move(components)) {}
+
+  double evaluate() const override {
+    throw std::logic_error("A vector has no scalar value");
+  }
+
+  size_t dimension() const { return components.size(); }
+  const std::vector<ExpressionPtr> &getComponents() const { return components; }
+};
+
+inline bool isVector(const ExpressionPtr &expression) {
+  return dynamic_cast<const VectorExpression *>(expression.get()) != nullptr;
+}
+
+// Calls build once per component when some argument is a vector, with that
+// component of each vector argument and the scalar arguments unchanged, and
+// returns the vector of the results. Vector arguments must have the same
+// dimension. nullptr when no argument is a vector.
+template <typename Build>
+ExpressionPtr componentwise(const std::vector<ExpressionPtr> &arguments, Build &&build) {
+  size_t dimension = 0;
+  for (const auto &argument : arguments) {
+    if (auto vector = dynamic_cast<const VectorExpression *>(argument.get())) {
+      if (dimension != 0 && vector->dimension() != dimension) {
+        throw std::invalid_argument("Vectors of different dimensions");
+      }
+      dimension = vector->dimension();
+    }
+  }
+  if (dimension == 0) {
+    return nullptr;
+  }
+  std::vector<ExpressionPtr> components;
+  for (size_t i = 0; i < dimension; i++) {
+    // A fresh slice per component: build may move from it.
+    std::vector<ExpressionPtr> slice(arguments.size());
+    for (size_t k = 0; k < arguments.size(); k++) {
+      auto vector = dynamic_cast<const VectorExpression *>(arguments[k].get());
+      slice[k] = vector ? vector->getComponents()[i] : arguments[k];
+    }
+    components.push_back(build(slice));
+  }
+  return std::make_shared<VectorExpression>(std::move(components));
+}
+
+namespace operations {
+
+// Operations whose calls take vectors. The parser hands them the arguments
+// as written, vectors included, instead of applying them component-wise.
+class VectorFunction {
+public:
+  virtual ~VectorFunction() = default;
+  // The value of the call, a scalar or a VectorExpression.
+  virtual ExpressionPtr call(std::vector<ExpressionPtr> arguments) const = 0;
+};
+
+// dot(a, b): the operands are the components of a, then those of b.
+class DotOperation : public VariadicOperation, public VectorFunction {
+public:
+  explicit DotOperation(std::vector<ExpressionPtr> operands)
+      : VariadicOperation(std::move(operands)) {}
+
+  double apply(const double *values, size_t count) const override;
+  void applyBatch(const double *const *operands, double *out, size_t count) const override;
+  void partials(const double *values, size_t count, double y, double *out) const override;
+
+  ExpressionPtr call(std::vector<ExpressionPtr> arguments) const override;
+
+  double cost() const override { return static_cast<double>(operands.size()); }
+
+  constexpr std::string_view identifier() const override { return "dot"; }
+  constexpr int precedence() const override { return 4; }
+
+  ExpressionPtr create(std::vector<ExpressionPtr> operands) const override {
+    return std::make_shared<DotOperation>(std::move(operands));
+  }
+};
+
+// norm(a): Euclidean length, as sqrt(dot(a, a)), without the scaling hypot
+// does against overflow. Scalar arguments and the components of vector
+// ones are taken together, so norm(x, y) is the length of (x, y).
+class NormOperation : public VariadicOperation, public VectorFunction {
+public:
+  explicit NormOperation(std::vector<ExpressionPtr> operands)
+      : VariadicOperation(std::move(operands)) {}
+
+  double apply(const double *values, size_t count) const override;
+  void applyBatch(const double *const *operands, double *out, size_t count) const override;
+  void partials(const double *values, size_t count, double y, double *out) const override;
+
+  ExpressionPtr call(std::vector<ExpressionPtr> arguments) const override;
+
+  double cost() const override { return static_cast<double>(operands.size()) * 2 + 4; }
+
+  constexpr std::string_view identifier() const override { return "norm"; }
+  constexpr int precedence() const override { return 4; }
+
+  ExpressionPtr create(std::vector<ExpressionPtr> operands) const override {
+    return std::make_shared<NormOperation>(std::move(operands));
+  }
+};
+
+// One component of cross(a, b) for vectors of dimension 3: the operands are
+// the components of a, then those of b. The call gives the vector of the
+// three components over the same operands.
+class CrossOperation : public VariadicOperation, public VectorFunction {
+  size_t component;
+
+public:
+  explicit CrossOperation(std::vector<ExpressionPtr> operands, size_t component = 0)
+      : VariadicOperation(std::move(operands)), component(component) {}
+
+  double apply(const double *values, size_t count) const override;
+  void applyBatch(const double *const *operands, double *out, size_t count) const override;
+  void partials(const double *values, size_t count, double y, double *out) const override;
+
+  ExpressionPtr call(std::vector<ExpressionPtr> arguments) const override;
+
+  size_t getComponent() const { return component; }
+
+  double cost() const override { return 3; }
+
+  constexpr std::string_view identifier() const override { return "cross"; }
+  constexpr int precedence() const override { return 4; }
+
+  ExpressionPtr create(std::vector<ExpressionPtr> operands) const override {
+    return std::make_shared<CrossOperation>(std::move(operands), component);
+  }
+};
+
+// One component of normalize(a), a divided by norm(a). Each component
+// computes the norm again, which for at most four operands is cheaper than
+// another column in every batch.
+class NormalizeOperation : public VariadicOperation, public VectorFunction {
+  size_t component;
+
+public:
+  explicit NormalizeOperation(std::vector<ExpressionPtr> operands, size_t component = 0)
+      : VariadicOperation(std::move(operands)), component(component) {}
+
+  double apply(const double *values, size_t count) const override;
+  void applyBatch(const double *const *operands, double *out, size_t count) const override;
+  void partials(const double *values, size_t count, double y, double *out) const override;
+
+  ExpressionPtr call(std::vector<ExpressionPtr> arguments) const override;
+
+  size_t getComponent() const { return component; }
+
+  double cost() const override { return static_cast<double>(operands.size()) * 2 + 8; }
+
+  constexpr std::string_view identifier() const override { return "normalize"; }
+  constexpr int precedence() const override { return 4; }
+
+  ExpressionPtr create(std::vector<ExpressionPtr> operands) const override {
+    return std::make_shared<NormalizeOperation>(std::move(operands), component);
+  }
+};
+
+} // namespace operations
+
+} // namespace expression_solver
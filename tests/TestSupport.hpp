@@ -0,0 +1,31 @@
+#pragma once
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// Counters and checks shared by the test executables. Each test is one
+// translation unit, and main returns failed == 0 ? 0 : 1.
+
+inline int passed = 0;
+inline int failed = 0;
+
+inline void check(bool condition, const std::string &name) {
+  if (condition) {
+    std::cout << "Test passed: " << name << std::endl;
+    passed++;
+  } else {
+    std::cout << "Test failed: " << name << std::endl;
+    failed++;
+  }
+}
+
+// Whether f throws std::invalid_argument. Other exceptions propagate.
+template <typename F> bool throws(F &&f) {
+  try {
+    f();
+  } catch (const std::invalid_argument &) {
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,158 @@
+#include "../src/Approximation.hpp"
+#include "../src/ExpressionSolver.hpp"
+#include "TestSupport.hpp"
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+using namespace expression_solver;
+using namespace expression_solver::approximation;
+
+namespace {
+
+std::vector<double> grid(double from, double to, size_t count) {
+  std::vector<double> values(count);
+  for (size_t i = 0; i < count; i++) {
+    values[i] = from + (to - from) * i / (count - 1);
+  }
+  return values;
+}
+
+// Largest error of the scalar and batch forms against the exact function,
+// relative to max(|exact|, floor).
+double maxError(const std::vector<double> &inputs, const std::function<double(double)> &exact,
+                const std::function<double(double)> &scalar,
+                const std::function<void(const double *, double *, size_t)> &batch, double floor) {
+  std::vector<double> out(inputs.size());
+  batch(inputs.data(), out.data(), inputs.size());
+  double worst = 0;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    double y = exact(inputs[i]);
+    double scale = std::max(std::abs(y), floor);
+    worst = std::max({worst, std::abs(scalar(inputs[i]) - y) / scale, std::abs(out[i] - y) / scale});
+  }
+  return worst;
+}
+
+bool same(double a, double b) { return a == b || (std::isnan(a) && std::isnan(b)); }
+
+} // namespace
+
+int main() {
+  auto angles = grid(-100, 100, 100001);
+  auto exponents = grid(-700, 700, 100001);
+  auto positives = grid(1e-6, 1e6, 100001);
+  for (double x : grid(0.5, 2, 20001)) {
+    positives.push_back(x);
+  }
+
+  for (double tolerance : {1e-3, 1e-6, 1e-9, 1e-12}) {
+    auto name = std::to_string(tolerance);
+    SinCos sinCos(tolerance);
+    Exp exp(tolerance);
+    Log log(tolerance);
+    Pow pow(tolerance);
+    check(sinCos.valid() && exp.valid() && log.valid() && pow.valid() && pow.maxError() <= tolerance,
+          "kernels for tolerance " + name);
+
+    check(maxError(angles, [](double x) { return std::sin(x); }, [&](double x) { return sinCos.sin(x); },
+                   [&](const double *x, double *out, size_t n) { sinCos.sin(x, out, n); }, 1) <= tolerance,
+          "sin within " + name);
+    check(maxError(angles, [](double x) { return std::cos(x); }, [&](double x) { return sinCos.cos(x); },
+                   [&](const double *x, double *out, size_t n) { sinCos.cos(x, out, n); }, 1) <= tolerance,
+          "cos within " + name);
+    check(maxError(exponents, [](double x) { return std::exp(x); }, [&](double x) { return exp(x); },
+                   [&](const double *x, double *out, size_t n) { exp(x, out, n); }, 0) <= tolerance,
+          "exp within " + name);
+    check(maxError(positives, [](double x) { return std::log(x); }, [&](double x) { return log(x); },
+                   [&](const double *x, double *out, size_t n) { log(x, out, n); }, 0) <= tolerance,
+          "log within " + name);
+
+    std::vector<double> bases = grid(0.01, 50, 2001), powers = grid(-10, 10, 2001);
+    std::vector<double> out(bases.size());
+    pow(bases.data(), powers.data(), out.data(), bases.size());
+    double worst = 0;
+    for (size_t i = 0; i < bases.size(); i++) {
+      double y = std::pow(bases[i], powers[i]);
+      worst = std::max({worst, std::abs(out[i] - y) / y, std::abs(pow(bases[i], powers[i]) - y) / y});
+    }
+    check(worst <= tolerance, "pow within " + name);
+  }
+
+  check(!Exp(1e-17).valid() && !SinCos(0).valid(), "no kernel below machine precision");
+
+  // Out-of-range inputs fall back to the C library.
+  SinCos sinCos(1e-6);
+  Exp exp(1e-6);
+  Log log(1e-6);
+  Pow pow(1e-6);
+  const double inf = std::numeric_limits<double>::infinity(), nan = std::numeric_limits<double>::quiet_NaN();
+  std::vector<double> specials = {inf, -inf, nan, 0, -0.0, -1, 1e300, -1e300, 5e-324, 1e10};
+  std::vector<double> out(specials.size());
+  bool exact = true;
+  exp(specials.data(), out.data(), specials.size());
+  for (size_t i = 0; i < specials.size(); i++) {
+    exact = exact && (std::abs(specials[i]) <= 708 ||
+                      (same(out[i], std::exp(specials[i])) && same(exp(specials[i]), std::exp(specials[i]))));
+  }
+  log(specials.data(), out.data(), specials.size());
+  for (size_t i = 0; i < specials.size(); i++) {
+    exact = exact && ((specials[i] >= 1e-300 && specials[i] <= 1e300) ||
+                      (same(out[i], std::log(specials[i])) && same(log(specials[i]), std::log(specials[i]))));
+  }
+  sinCos.sin(specials.data(), out.data(), specials.size());
+  for (size_t i = 0; i < specials.size(); i++) {
+    exact = exact && (std::abs(specials[i]) <= 1e5 ||
+                      (same(out[i], std::sin(specials[i])) && same(sinCos.sin(specials[i]), std::sin(specials[i]))));
+  }
+  exact = exact && pow(-2, 3) == -8 && same(pow(-2, 0.5), std::pow(-2, 0.5)) && pow(0, 2) == 0 && pow(2, 1000) == std::pow(2, 1000);
+  check(exact, "special values");
+
+  // Compiling with a tolerance swaps the operations and keeps results in range,
+  // scalar and batch alike.
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.5);
+  context.addPlaceholder(x);
+  std::string expression = "sin(x) * exp(x / 10) + log(x + 2) * cos(x) + (x + 1) ^ 1.5";
+  auto exactCompiled = ExpressionSolver(context).compile(expression);
+  context.setTolerance(1e-6);
+  ExpressionSolver solver(context);
+  auto approximate = std::dynamic_pointer_cast<CompiledExpression>(solver.compile(expression));
+  size_t swapped = 0;
+  for (const auto &node : approximate->getCode().nodes) {
+    swapped += dynamic_cast<const operations::ApproximateSinOperation *>(node.expression) ||
+               dynamic_cast<const operations::ApproximateCosOperation *>(node.expression) ||
+               dynamic_cast<const operations::ApproximateExpOperation *>(node.expression) ||
+               dynamic_cast<const operations::ApproximateLogOperation *>(node.expression) ||
+               dynamic_cast<const operations::ApproximatePowerOperation *>(node.expression);
+  }
+  check(swapped == 5, "compile swaps all five operations");
+
+  auto inputs = grid(0, 20, 10000);
+  std::vector<double> batch(inputs.size()), exactBatch(inputs.size());
+  Binding binding{x.get(), inputs};
+  solver.solve(approximate, {&binding, 1}, batch);
+  solver.solve(exactCompiled, {&binding, 1}, exactBatch);
+  double worst = 0, batchDifference = 0;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    x->setValue(inputs[i]);
+    double y = exactCompiled->evaluate();
+    worst = std::max(worst, std::abs(batch[i] - y) / std::max(1.0, std::abs(y)));
+    batchDifference = std::max(batchDifference, std::abs(exactBatch[i] - y));
+  }
+  check(worst <= 1e-4 && worst > 0, "compiled expression within tolerance");
+  check(batchDifference == 0, "batch evaluation matches scalar evaluation");
+
+  bool rejected = false;
+  try {
+    context.setTolerance(-1);
+  } catch (const std::invalid_argument &) {
+    rejected = true;
+  }
+  check(rejected, "negative tolerance rejected");
+
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+#include "../src/ExpressionSolver.hpp"
+#include "../src/RuleSet.hpp"
+#include "TestSupport.hpp"
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+
+using namespace expression_solver;
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 2.0);
+  context.addPlaceholder(x);
+  ExpressionSolver solver(context);
+  ThreadPool pool(2);
+
+  auto single = solver.compileAsync("x^2 + 1", pool);
+  auto batch = solver.compileAsync(std::vector<std::string>{"x * 3", "sin(0)", "x max 5"}, pool);
+  auto broken = solver.compileAsync("x +* (", pool);
+  check(single.get()->evaluate() == 5, "compileAsync single expression");
+  auto compiled = batch.get();
+  check(compiled.size() == 3 && compiled[0]->evaluate() == 6 && compiled[1]->evaluate() == 0 &&
+            compiled[2]->evaluate() == 5,
+        "compileAsync batch");
+  bool rethrown = false;
+  try {
+    broken.get();
+  } catch (const std::exception &) {
+    rethrown = true;
+  }
+  check(rethrown, "compileAsync rethrows compile errors");
+
+  // Bulk compile: every input gets its own result, errors included.
+  std::vector<std::string> sources;
+  for (int i = 0; i < 2000; i++) {
+    sources.push_back(i % 97 == 0 ? "x + * " + std::to_string(i) : "x * " + std::to_string(i) + " + sin(x) ^ 2");
+  }
+  auto results = solver.compileAll(sources, pool);
+  bool bulk = results.size() == sources.size();
+  for (size_t i = 0; bulk && i < sources.size(); i++) {
+    if (i % 97 == 0) {
+      bulk = !results[i].has_value() && !results[i].error().empty();
+    } else {
+      bulk = results[i].has_value() && (*results[i])->evaluate() == solver.compile(sources[i])->evaluate();
+    }
+  }
+  check(bulk, "compileAll reports results and errors per input");
+  check(solver.compileAll({}, pool).empty(), "compileAll with no input");
+
+  // In-flight readers keep their snapshot while a new set is published.
+  RuleSetHolder holder;
+  auto first = holder.publishAsync(solver, {{"price", "x * 10"}, {"fee", "1"}}, pool).get();
+  auto snapshot = holder.load();
+  check(snapshot == first && snapshot->evaluate("price") == 20, "publishAsync publishes the set");
+  auto second = holder.publishAsync(solver, {{"price", "x * 20"}, {"fee", "2"}}, pool).get();
+  check(snapshot->evaluate("price") == 20 && holder.load()->evaluate("price") == 40 &&
+            second->getVersion() > first->getVersion(),
+        "old snapshot survives publish");
+
+  bool failedCompile = false;
+  try {
+    holder.publishAsync(solver, {{"price", "x * "}}, pool).get();
+  } catch (const std::exception &) {
+    failedCompile = true;
+  }
+  check(failedCompile && holder.load() == second, "failed compile publishes nothing");
+
+  check(!holder.publish(first) && holder.load() == second, "older version is not published");
+
+  // A compile that finishes after a newer version is published yields
+  // nullptr instead of a set that never became current.
+  RuleSetHolder raced;
+  auto newer = std::make_shared<const RuleSet>(StringMap<ExpressionPtr>{}, 100);
+  check(raced.publish(newer) && !raced.publishAsync(solver, {{"fee", "1"}}, pool).get() &&
+            raced.load() == newer,
+        "superseded publishAsync yields nullptr");
+
+  // Readers evaluating concurrently with publishes always see a whole set:
+  // fee and price come from the same version.
+  std::atomic<bool> done = false;
+  std::atomic<bool> consistent = true;
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 2; i++) {
+    readers.emplace_back([&] {
+      while (!done) {
+        auto rules = holder.load();
+        if (rules->evaluate("price") != rules->evaluate("fee") * 20) {
+          consistent = false;
+        }
+      }
+    });
+  }
+  for (int version = 1; version <= 50; version++) {
+    auto factor = std::to_string(version * 20);
+    holder.publishAsync(solver, {{"price", "x * " + factor}, {"fee", std::to_string(version * 2)}}, pool).get();
+  }
+  done = true;
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  check(consistent && holder.load()->evaluate("fee") == 100, "concurrent readers see whole sets");
+
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+#include "../src/ExpressionSolver.hpp"
+#include "TestSupport.hpp"
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <string>
+
+using namespace expression_solver;
+
+namespace {
+
+bool rejected(const std::expected<ExpressionPtr, CompileError> &result, CompileError::Kind kind) {
+  return !result && result.error().kind == kind;
+}
+
+std::string nested(size_t depth) {
+  return std::string(depth, '(') + "x" + std::string(depth, ')');
+}
+
+} // namespace
+
+int main() {
+  using Kind = CompileError::Kind;
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.5);
+  context.addPlaceholder(x);
+  ExpressionSolver solver(context);
+
+  auto compiled = solver.tryCompile("sin(x) * 2 + max(x, 3)");
+  check(compiled && (*compiled)->evaluate() == solver.compile("sin(x) * 2 + max(x, 3)")->evaluate(),
+        "expressions within budget compile as usual");
+
+  CompileOptions options;
+  options.maxLength = 10;
+  check(rejected(solver.tryCompile("x + x + x + x", options), Kind::Length) &&
+            solver.tryCompile("x + x", options),
+        "input length");
+
+  options = {};
+  options.maxTokens = 5;
+  auto tokens = solver.tryCompile("x + x + x + x", options);
+  check(rejected(tokens, Kind::Tokens) && tokens.error().position < 13 &&
+            solver.tryCompile("x + x + x", options),
+        "token count");
+
+  options = {};
+  options.maxDepth = 8;
+  auto deep = solver.tryCompile(nested(9), options);
+  check(rejected(deep, Kind::Depth) && deep.error().position == 8 &&
+            solver.tryCompile(nested(8), options) &&
+            solver.tryCompile("(x) + (x) + (((x)))", options),
+        "nesting depth");
+
+  // Inlined calls grow the tree beyond the input.
+  solver.define("f(a) = a * a + a * 2 + sin(a)");
+  options = {};
+  options.maxNodes = 20;
+  check(rejected(solver.tryCompile("f(f(f(f(f(f(x))))))", options), Kind::Nodes) &&
+            solver.tryCompile("f(x)", options),
+        "node count");
+
+  // Calls of functions that call others double the tree at each level; the
+  // budget stops the inlining, not the count after it.
+  solver.define("g0(a) = sin(a) + cos(a)");
+  for (int level = 1; level <= 12; level++) {
+    solver.define("g" + std::to_string(level) + "(a) = g" + std::to_string(level - 1) + "(g" +
+                  std::to_string(level - 1) + "(a))");
+  }
+  options = {};
+  auto inlined = solver.tryCompile("g12(x) + g12(x) + g12(x) + g12(x) + g12(x)", options);
+  check(rejected(inlined, Kind::Nodes) &&
+            inlined.error().message.find("inlined") != std::string::npos &&
+            solver.tryCompile("g12(x)", options),
+        "node count while inlining");
+
+  // Windows are allocated on the first sample, and their size is budgeted.
+  std::string lags = "lag(x, 16777216)";
+  for (int i = 1; i < 40; i++) {
+    lags += " + lag(x, 16777216)";
+  }
+  options = {};
+  check(rejected(solver.tryCompile(lags, options), Kind::Samples) &&
+            solver.tryCompile("lag(x, 1000) + rolling_max(x, 1000)", options),
+        "streaming window samples");
+  options.maxSamples = std::numeric_limits<size_t>::max();
+  check(bool(solver.tryCompile(lags, options)), "windows take no memory until evaluated");
+
+  options = {};
+  options.maxCost = 50;
+  check(rejected(solver.tryCompile("exp(x) + exp(x * 2) + exp(x * 3) + exp(x * 4)", options),
+                 Kind::Cost) &&
+            solver.tryCompile("x * 2 + 1", options),
+        "evaluation cost");
+
+  auto unknown = solver.tryCompile("x + unknown");
+  auto unbalanced = solver.tryCompile("(x + 1");
+  auto invalid = solver.tryCompile("x $ 1");
+  check(rejected(unknown, Kind::Syntax) && rejected(unbalanced, Kind::Syntax) &&
+            rejected(invalid, Kind::Syntax) && !unknown.error().message.empty(),
+        "syntax errors are returned");
+
+  // Budgets can be lifted one by one.
+  options = {};
+  options.maxLength = options.maxTokens = options.maxDepth = options.maxNodes =
+      options.maxSamples = std::numeric_limits<size_t>::max();
+  options.maxCost = std::numeric_limits<double>::infinity();
+  check(bool(solver.tryCompile(nested(1000), options)), "unlimited budgets");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
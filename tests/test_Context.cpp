@@ -0,0 +1,92 @@
+#include "../src/Builtins.hpp"
+#include "../src/ExpressionSolver.hpp"
+#include "TestSupport.hpp"
+#include <cmath>
+#include <iostream>
+#include <string>
+
+using namespace expression_solver;
+
+namespace {
+
+const double pi = 3.14159265358979323846;
+
+constexpr builtins::PerfectHash<4> colors({"red", "green", "blue", "cyan"});
+static_assert(colors.find("blue") == 2 && !colors.find("pink") && !colors.find(""));
+
+// Doubles the sum of its operands, under a symbol that starts like a
+// built-in one.
+class DoubleAddOperation : public operations::BinaryOperation {
+public:
+  using BinaryOperation::BinaryOperation;
+  double apply(double a, double b) const override { return 2 * (a + b); }
+  constexpr std::string_view identifier() const override { return "++"; }
+  constexpr int precedence() const override { return 1; }
+  ExpressionPtr create(ExpressionPtr left, ExpressionPtr right) const override {
+    return std::make_shared<DoubleAddOperation>(std::move(left), std::move(right));
+  }
+};
+
+} // namespace
+
+int main() {
+  const auto &defaults = Context::getDefaultContext();
+
+  bool consistent = true;
+  for (size_t i = 0; i < builtins::operationCount; i++) {
+    auto identifier = builtins::operationIdentifier(i);
+    auto op = defaults.getOperation(identifier);
+    consistent &= builtins::findOperation(identifier) == i && op &&
+                  (*op)->identifier() == identifier && *op == builtins::operation(i);
+  }
+  for (size_t i = 0; i < builtins::variableCount; i++) {
+    consistent &= builtins::findVariable(builtins::variableName(i)) == i;
+  }
+  check(consistent, "built-in table matches its operations");
+
+  check(defaults.getVariable("PI") == pi && defaults.hasVariable("EPSILON") &&
+            defaults.hasOperation("rolling_mean") && !defaults.hasOperation("pi") &&
+            !defaults.getVariable("Pi"),
+        "default context lookups");
+  check(!Context().hasOperation("+") && !Context().hasVariable("PI"),
+        "empty context has no built-ins");
+
+  // Copies share the prototypes and own their changes.
+  Context copy = defaults;
+  check(*copy.getOperation("sin") == *defaults.getOperation("sin"), "copies share prototypes");
+  copy.setVariable("PI", 3);
+  copy.removeVariable("E");
+  copy.removeOperation("%");
+  check(copy.getVariable("PI") == 3 && !copy.hasVariable("E") && !copy.hasOperation("%") &&
+            defaults.getVariable("PI") == pi && defaults.hasVariable("E") &&
+            defaults.hasOperation("%"),
+        "copies override and remove built-ins");
+  copy.removeVariable("PI");
+  check(!copy.hasVariable("PI"), "removing an override removes the built-in too");
+  copy.setVariable("E", 1);
+  check(copy.getVariable("E") == 1, "removed built-ins can be set again");
+  copy.clearVariables();
+  check(!copy.hasVariable("E") && !copy.hasVariable("TRUE"), "clear removes built-ins");
+
+  ExpressionSolver solver(copy);
+  check(throws([&] { solver.solve("5 % 2"); }) && solver.solve("5 - 2") == 3,
+        "removed operators do not parse");
+
+  // The tokenizer takes the longest symbol, user defined or built in.
+  Context custom = defaults;
+  custom.addOperation(std::make_shared<DoubleAddOperation>(nullptr, nullptr));
+  ExpressionSolver customSolver(custom);
+  check(customSolver.solve("2 ++ 3") == 10 && customSolver.solve("2 + 3") == 5 &&
+            customSolver.solve("2 == 2") == 1,
+        "longest operator wins");
+  check(*custom.matchOperation("rolling_max(x, 3)") == *defaults.getOperation("rolling_max") &&
+            *custom.matchOperation("==1") == *defaults.getOperation("==") &&
+            !custom.matchOperation("@1") && !custom.matchOperation(""),
+        "built-in prefixes");
+  custom.removeOperation("++");
+  check(*custom.matchOperation("++3") == *defaults.getOperation("+"),
+        "removed user operators do not match");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
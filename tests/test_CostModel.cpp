@@ -0,0 +1,142 @@
+#include "../src/CostModel.hpp"
+#include "../src/ExpressionSolver.hpp"
+#include "TestSupport.hpp"
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+using namespace expression_solver;
+
+namespace {
+
+bool same(double a, double b) { return (std::isnan(a) && std::isnan(b)) || a == b; }
+
+// Costly operation that counts the values it computes.
+size_t calls = 0;
+
+class SlowOperation : public operations::UnaryOperation {
+public:
+  using UnaryOperation::UnaryOperation;
+  double apply(double x) const override {
+    calls++;
+    return std::sin(x);
+  }
+  constexpr std::string_view identifier() const override { return "slow"; }
+  constexpr int precedence() const override { return 4; }
+  double cost() const override { return 100; }
+  ExpressionPtr create(ExpressionPtr operand) const override {
+    return std::make_shared<SlowOperation>(std::move(operand));
+  }
+};
+
+const operations::Operation *rootOf(const ExpressionPtr &expression) {
+  auto compiled = std::dynamic_pointer_cast<CompiledExpression>(expression);
+  return dynamic_cast<const operations::Operation *>(compiled->getRoot().get());
+}
+
+} // namespace
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  auto y = std::make_shared<PlaceHolder>("y", 0.0);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  context.addOperation(std::make_shared<SlowOperation>(nullptr));
+  ExpressionSolver solver(context);
+
+  auto compiled = std::dynamic_pointer_cast<CompiledExpression>(solver.compile("sin(x) + y / 2"));
+  check(compiled->cost() == 16 + 4 + 1 && estimateCost(*compiled) == compiled->cost() &&
+            estimateCost(*compiled->getRoot()) == compiled->cost(),
+        "estimated cost of an expression");
+  check(estimateCost(*solver.compile("slow(x) * 2")) == 101, "custom operations set their cost");
+  check(estimateCost(*solver.compile("sum(x, y, x * y)")) == 3 && estimateCost(ConstExpression(2)) == 0,
+        "variadic operations and leaves");
+
+  // The cheap comparison moves in front and guards the costly one.
+  auto ordered = solver.compile("(slow(x) == 0) && (y == 1)");
+  auto root = dynamic_cast<const operations::ShortCircuitOperation *>(rootOf(ordered));
+  check(root && root->isConjunction() &&
+            typeid(*root->getOperandAt(0)) == typeid(operations::LogicalEqualOperation),
+        "cheap operand first");
+  check(typeid(*rootOf(solver.compile("(x == 1) || (y == 2)"))) ==
+            typeid(operations::LogicalOrOperation),
+        "cheap operands stay plain");
+
+  // Values match the tree, row by row and in batches, with NaN inputs and
+  // blocks where none, some or all rows take the costly side.
+  const char *expressions[] = {
+      "(floor(slow(x)) == 0) && (y == 1)",
+      "(y == 1) && (slow(x) == slow(x))",
+      "(slow(x) * 0 == 0) || (y == 2) || !(x)",
+      "((y == 1) || (slow(y) == 0)) && (exp(x) == 1 || slow(x + y) == 0)",
+  };
+  size_t rows = 3000;
+  std::vector<double> xs(rows), ys(rows);
+  for (size_t i = 0; i < rows; i++) {
+    xs[i] = i % 13 == 0 ? std::numeric_limits<double>::quiet_NaN() : static_cast<double>(i % 5);
+    ys[i] = i < 1000 ? 1 : i < 2000 ? 0 : static_cast<double>(i % 3);
+  }
+  Binding bindings[] = {{x.get(), xs}, {y.get(), ys}};
+  for (const char *text : expressions) {
+    auto expression = solver.compile(text);
+    auto tree = std::dynamic_pointer_cast<CompiledExpression>(expression)->getRoot();
+    std::vector<double> batch(rows);
+    solver.solve(expression, bindings, batch);
+    bool ok = true;
+    for (size_t i = 0; i < rows; i++) {
+      x->setValue(xs[i]);
+      y->setValue(ys[i]);
+      ok &= same(batch[i], solver.solve(expression)) && same(batch[i], tree->evaluate());
+    }
+    check(ok, std::string("short circuit values of ") + text);
+  }
+
+  // The costly side runs only for the rows the cheap side leaves open.
+  auto guarded = solver.compile("(y == 1) && (floor(slow(x)) == 0)");
+  std::vector<double> results(rows);
+  calls = 0;
+  solver.solve(guarded, bindings, results);
+  size_t open = 0;
+  for (double value : ys) {
+    open += value == 1;
+  }
+  check(calls == open, "costly side skipped in batches");
+  x->setValue(1);
+  y->setValue(0);
+  calls = 0;
+  solver.solve(guarded);
+  check(calls == 0, "costly side skipped for one value");
+
+  // Bodies reading more placeholders than a guard holds on the stack stay
+  // plain.
+  Context wide = context;
+  std::string body = "slow(x)";
+  for (size_t k = 0; k < operations::ShortCircuitOperation::maxPlaceholders; k++) {
+    auto name = "p" + std::to_string(k);
+    wide.addPlaceholder(std::make_shared<PlaceHolder>(name, 0.0));
+    body += " + " + name;
+  }
+  ExpressionSolver wideSolver(wide);
+  check(typeid(*rootOf(wideSolver.compile("(y == 1) && (" + body + " == 0)"))) ==
+            typeid(operations::LogicalAndOperation),
+        "too many placeholders for a guard");
+
+  // Specializing the guard away leaves the costly side alone.
+  auto special = solver.specialize(guarded, {{"y", 1}});
+  x->setValue(0.5);
+  check(solver.solve(special) == 1 && estimateCost(*special) >= 100,
+        "specialize through a short circuit");
+  auto gradient = solver.differentiate(*guarded);
+  bool flat = gradient.value == 0;
+  for (const auto &[name, slope] : gradient.gradient) {
+    flat &= slope == 0;
+  }
+  check(flat, "derivative of a short circuit");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+#include "../src/CompiledExpression.hpp"
+#include "../src/ExpressionSolver.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <string>
+
+using namespace expression_solver;
+using namespace expression_solver::operations;
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto z = std::make_shared<PlaceHolder>("z", 0.25);
+  context.addPlaceholder(z);
+  ExpressionSolver solver(context);
+  solver.define("f(x, y) = x*x + y");
+  solver.define("g(a) = f(a, a) + 1");
+  solver.define("square(x) = x^2");
+  solver.define("pi() = PI");
+  solver.define("z(z) = 2*z");
+
+  auto compiled = [](const ExpressionPtr &e) {
+    return std::dynamic_pointer_cast<CompiledExpression>(e);
+  };
+
+  std::vector<std::tuple<std::string, double, std::function<bool(const ExpressionPtr &)>>> tests = {
+      // Constant arguments fold across the call.
+      {"f(2, 3)", 7, [](const ExpressionPtr &e) { return std::dynamic_pointer_cast<ConstExpression>(e) != nullptr; }},
+      {"g(2)", 7, [](const ExpressionPtr &e) { return std::dynamic_pointer_cast<ConstExpression>(e) != nullptr; }},
+      {"pi() * 2", 2 * 3.14159265358979323846, [](const ExpressionPtr &) { return true; }},
+      {"f(z, 1) * 2", (0.25 * 0.25 + 1) * 2, [](const ExpressionPtr &) { return true; }},
+      {"f(f(z, 1), z)", (0.25 * 0.25 + 1) * (0.25 * 0.25 + 1) + 0.25, [](const ExpressionPtr &) { return true; }},
+      {"z(z) + z", 0.75, [](const ExpressionPtr &) { return true; }},
+      // An argument used twice is shared, so sin is evaluated once.
+      {"f(sin(z), 1) + 1", std::sin(0.25) * std::sin(0.25) + 2,
+       [&](const ExpressionPtr &e) {
+         auto &nodes = compiled(e)->getCode().nodes;
+         return std::count_if(nodes.begin(), nodes.end(), [](const auto &node) {
+                  return dynamic_cast<const SinOperation *>(node.expression) != nullptr;
+                }) == 1;
+       }},
+      // The inlined body takes part in the Horner rewrite of the caller.
+      {"3*square(z) + z + 1", 3 * 0.0625 + 0.25 + 1,
+       [&](const ExpressionPtr &e) {
+         return compiled(e) && std::dynamic_pointer_cast<FusedMultiplyAddOperation>(compiled(e)->getRoot());
+       }},
+  };
+
+  int passed = 0;
+  for (const auto &[expression, expected, check] : tests) {
+    auto exp = solver.compile(expression);
+    double result = exp->evaluate();
+    if (std::abs(result - expected) < 1e-12 && check(exp)) {
+      std::cout << "Test passed: " << expression << " = " << expected << std::endl;
+      passed++;
+    } else {
+      std::cout << "Test failed: " << expression << " = " << result << " (expected " << expected << ")" << std::endl;
+    }
+  }
+
+  std::vector<std::string> invalid = {
+      "f(1)", "f(1, 2, 3)", "g", "1, 2",
+  };
+  std::vector<std::string> invalidDefinitions = {
+      "h(x) = h(x)", "h(x, x) = x", "h(PI) = PI", "h x = x", "2h(x) = x",
+  };
+  for (const auto &expression : invalid) {
+    try {
+      solver.compile(expression);
+      std::cout << "Test failed: " << expression << " (expected an error)" << std::endl;
+    } catch (const std::invalid_argument &) {
+      std::cout << "Test passed: " << expression << " rejected" << std::endl;
+      passed++;
+    }
+  }
+  for (const auto &definition : invalidDefinitions) {
+    try {
+      solver.define(definition);
+      std::cout << "Test failed: " << definition << " (expected an error)" << std::endl;
+    } catch (const std::invalid_argument &) {
+      std::cout << "Test passed: " << definition << " rejected" << std::endl;
+      passed++;
+    }
+  }
+
+  return passed == static_cast<int>(tests.size() + invalid.size() + invalidDefinitions.size()) ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+#include "../src/ExpressionSolver.hpp"
+#include <cmath>
+#include <iostream>
+#include <string>
+
+using namespace expression_solver;
+
+// Central finite difference, used as the reference for every derivative rule.
+double numericDerivative(const ExpressionPtr &exp, PlaceHolder &placeholder, double at) {
+  const double h = 1e-6;
+  placeholder.setValue(at + h);
+  double up = exp->evaluate();
+  placeholder.setValue(at - h);
+  double down = exp->evaluate();
+  placeholder.setValue(at);
+  return (up - down) / (2 * h);
+}
+
+// A custom leaf that reads a placeholder but has no derivative rule.
+class Doubled : public Expression {
+  PlaceHolderPtr placeholder;
+
+public:
+  explicit Doubled(PlaceHolderPtr placeholder) : placeholder(std::move(placeholder)) {}
+  double evaluate() const override { return 2 * placeholder->evaluate(); }
+};
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.7);
+  auto y = std::make_shared<PlaceHolder>("y", 1.3);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  ExpressionSolver solver(context);
+
+  std::vector<std::string> tests = {
+      "x+y",         "x-y",          "x*y",          "x/y",
+      "x^y",         "x^3",          "x%y",          "sin(x)*y",
+      "cos(x*y)",    "tan(x)",       "asin(x)",      "acos(x)",
+      "atan(x*y)",   "log(x+y)",     "sqrt(x*y)",    "abs(x-y)",
+      "exp(x)*y",    "x max y",      "x min y",      "y atan2 x",
+      "x hypot y",   "floor(y)*x",   "(x+y)*(x-y)",  "x*x*x+y*y",
+      "exp(sin(x))*log(y)", "sqrt(x^2+y^2)/(1+x*y)",
+  };
+
+  int passed = 0;
+  Tape tape;
+  for (const auto &expression : tests) {
+    auto exp = solver.compile(expression);
+    double value = tape.record(*exp);
+    tape.backward();
+    double dx = numericDerivative(exp, *x, x->evaluate());
+    double dy = numericDerivative(exp, *y, y->evaluate());
+    bool ok = std::abs(value - exp->evaluate()) < 1e-12 &&
+              std::abs(tape.gradient(*x) - dx) < 1e-6 &&
+              std::abs(tape.gradient(*y) - dy) < 1e-6;
+    if (ok) {
+      std::cout << "Test passed: d(" << expression << ") = [" << tape.gradient(*x) << ", " << tape.gradient(*y) << "]" << std::endl;
+      passed++;
+    } else {
+      std::cout << "Test failed: d(" << expression << ") = [" << tape.gradient(*x) << ", " << tape.gradient(*y)
+                << "] (expected [" << dx << ", " << dy << "])" << std::endl;
+    }
+  }
+
+  auto result = solver.differentiate(*solver.compile("x*y+x"));
+  bool ok = result.value == 0.7 * 1.3 + 0.7 && result.gradient.size() == 2 &&
+            std::abs(result.gradient["x"] - 2.3) < 1e-12 &&
+            std::abs(result.gradient["y"] - 0.7) < 1e-12;
+  std::cout << (ok ? "Test passed: " : "Test failed: ") << "differentiate(x*y+x)" << std::endl;
+  passed += ok;
+
+  // Recording it as a constant would give a zero gradient silently.
+  bool threw = false;
+  try {
+    tape.record(Doubled(x));
+  } catch (const std::logic_error &) {
+    threw = true;
+  }
+  std::cout << (threw ? "Test passed: " : "Test failed: ")
+            << "custom expressions without a derivative rule throw" << std::endl;
+  passed += threw;
+
+  return passed == static_cast<int>(tests.size()) + 2 ? 0 : 1;
+}
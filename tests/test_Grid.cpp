@@ -0,0 +1,105 @@
+#include "../src/ExpressionSolver.hpp"
+#include "TestSupport.hpp"
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace expression_solver;
+
+namespace {
+
+// Grid values by batch evaluation over every point, the last axis fastest.
+std::vector<double> bruteForce(const ExpressionSolver &solver, const ExpressionPtr &expression,
+                               const std::vector<GridAxis> &axes) {
+  size_t points = 1;
+  for (const auto &axis : axes) {
+    points *= axis.values.size();
+  }
+  std::vector<std::vector<double>> columns(axes.size(), std::vector<double>(points));
+  for (size_t p = 0; p < points; p++) {
+    size_t rest = p;
+    for (size_t a = axes.size(); a-- > 0;) {
+      columns[a][p] = axes[a].values[rest % axes[a].values.size()];
+      rest /= axes[a].values.size();
+    }
+  }
+  std::vector<Binding> bindings;
+  for (size_t a = 0; a < axes.size(); a++) {
+    bindings.push_back({axes[a].placeholder, columns[a]});
+  }
+  std::vector<double> results(points);
+  solver.solve(expression, bindings, results);
+  return results;
+}
+
+bool matches(const ExpressionSolver &solver, const std::string &text,
+             const std::vector<GridAxis> &axes) {
+  auto expression = solver.compile(text);
+  auto expected = bruteForce(solver, expression, axes);
+  std::vector<double> results(expected.size());
+  solver.solveGrid(expression, axes, results);
+  for (size_t i = 0; i < results.size(); i++) {
+    if (std::abs(results[i] - expected[i]) > 1e-12 * (1 + std::abs(expected[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  auto y = std::make_shared<PlaceHolder>("y", 0.0);
+  auto z = std::make_shared<PlaceHolder>("z", 0.0);
+  auto k = std::make_shared<PlaceHolder>("k", 3.0);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  context.addPlaceholder(z);
+  context.addPlaceholder(k);
+  ExpressionSolver solver(context);
+
+  auto range = GridAxis::range(*x, -1, 1, 5);
+  check(range.values.front() == -1 && range.values.back() == 1 && range.values[2] == 0,
+        "evenly spaced axis");
+
+  std::vector<GridAxis> plane{GridAxis::range(*x, -2, 2, 37), GridAxis::range(*y, 0, 3, 1500)};
+  check(matches(solver, "sin(x) * cos(y) + x * y / k + exp(x / 4)", plane), "two axes");
+  check(matches(solver, "sqrt(y + 1) * x", plane), "inner node over a hoisted row");
+  check(matches(solver, "sin(x) * k + 1", plane), "root without the last axis");
+  check(matches(solver, "cos(y) - k", plane), "root on the last axis only");
+  check(matches(solver, "x", plane) && matches(solver, "k * 2", plane), "leaves and constants");
+
+  std::vector<GridAxis> volume{GridAxis::range(*x, 0, 1, 7), GridAxis::range(*y, -1, 1, 11),
+                               GridAxis::range(*z, 2, 5, 13)};
+  check(matches(solver, "sin(x + y) * z + cos(x) * exp(y) + hypot(x, y)", volume),
+        "three axes with a table over two");
+  check(matches(solver, "(x * z) ^ 2 + y", volume), "three axes mixed");
+
+  std::vector<GridAxis> line{GridAxis::range(*x, 0, 1, 100)};
+  check(matches(solver, "sin(x) * k", line), "one axis");
+
+  // Only the mixed terms run at every point.
+  GridEvaluator separable(solver.compile("sin(x) * cos(y) + exp(x) * sqrt(y)"), {x.get(), y.get()});
+  check(separable.innerCount() == 3, "per-axis terms are hoisted");
+
+  std::vector<double> results(4);
+  std::vector<double> xs{1, 2}, ys{10, 20};
+  std::span<const double> values[] = {xs, ys};
+  GridEvaluator(solver.compile("x * 100 + y"), {x.get(), y.get()}).evaluate(values, results);
+  check(results == std::vector<double>{110, 120, 210, 220}, "last axis varies fastest");
+
+  check(throws([&] { GridEvaluator(solver.compile("x + y"), {x.get(), x.get()}); }) &&
+            throws([&] { GridEvaluator(solver.compile("lag(x, 2) + y"), {x.get(), y.get()}); }) &&
+            throws([&] { GridEvaluator(solver.compile("x + y"), {}); }) &&
+            throws([&] {
+              GridEvaluator(solver.compile("x + y"), {x.get(), y.get()})
+                  .evaluate(values, std::span(results.data(), 3));
+            }),
+        "invalid grids");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
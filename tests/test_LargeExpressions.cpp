@@ -0,0 +1,74 @@
+#include "../src/ExpressionSolver.hpp"
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <string>
+
+using namespace expression_solver;
+
+std::string repeat(const std::string &text, size_t count) {
+  std::string result;
+  result.reserve(text.size() * count);
+  for (size_t i = 0; i < count; i++) {
+    result += text;
+  }
+  return result;
+}
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.5);
+  context.addPlaceholder(x);
+  ExpressionSolver solver(context);
+
+  const size_t depth = 200000;
+  std::vector<std::tuple<std::string, std::function<bool(const ExpressionPtr &)>>> tests = {
+      // Constant folding used to stop at depth 20.
+      {"1" + repeat("+1", 5000),
+       [](const ExpressionPtr &e) {
+         return std::dynamic_pointer_cast<ConstExpression>(e) && e->evaluate() == 5001;
+       }},
+      {"x" + repeat("+1", depth),
+       [&](const ExpressionPtr &e) { return e->evaluate() == 0.5 + depth; }},
+      {repeat("(", depth) + "x" + repeat(")", depth),
+       [](const ExpressionPtr &e) { return e->evaluate() == 0.5; }},
+      {repeat("sin(", depth) + "x" + repeat(")", depth),
+       [](const ExpressionPtr &e) {
+         double v = 0.5;
+         for (size_t i = 0; i < depth; i++) {
+           v = std::sin(v);
+         }
+         return e->evaluate() == v;
+       }},
+      {repeat("abs(x-", depth) + "x" + repeat(")", depth),
+       [&](const ExpressionPtr &e) {
+         double v = 0.5;
+         for (size_t i = 0; i < depth; i++) {
+           v = std::abs(0.5 - v);
+         }
+         Tape tape;
+         tape.record(*e);
+         tape.backward();
+         return e->evaluate() == v && std::isfinite(tape.gradient(*x));
+       }},
+  };
+
+  int passed = 0;
+  for (const auto &[expression, check] : tests) {
+    bool ok;
+    {
+      // Compiling, evaluating and freeing must not overflow the stack.
+      auto exp = solver.compile(expression);
+      ok = check(exp);
+    }
+    auto name = expression.substr(0, 12) + "... (" + std::to_string(expression.size()) + " chars)";
+    if (ok) {
+      std::cout << "Test passed: " << name << std::endl;
+      passed++;
+    } else {
+      std::cout << "Test failed: " << name << std::endl;
+    }
+  }
+
+  return passed == static_cast<int>(tests.size()) ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+#include "../src/CompiledExpression.hpp"
+#include "../src/ExpressionSolver.hpp"
+#include "../src/Memoization.hpp"
+#include "TestSupport.hpp"
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace expression_solver;
+
+namespace {
+
+bool close(double a, double b) { return std::abs(a - b) <= 1e-12 * (1 + std::abs(b)); }
+
+} // namespace
+
+int main() {
+  Context plain = Context::getDefaultContext();
+  auto k = std::make_shared<PlaceHolder>("k", 0.0);
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  plain.addPlaceholder(k);
+  plain.addPlaceholder(x);
+  Context context = plain;
+  context.setMemoized({"k"}, 64);
+  ExpressionSolver solver(context);
+  ExpressionSolver reference(plain);
+
+  const std::string text = "exp(sin(k) * 2 + log(k + 1)) * x + atan2(k, 3)";
+  auto memoized = solver.compile(text);
+  auto expected = reference.compile(text);
+  check(memoStatistics(*memoized).capacity > 0, "subtrees of the key are memoized");
+  check(memoStatistics(*expected).capacity == 0, "nothing is memoized by default");
+  check(memoStatistics(*solver.compile("sin(x) + k * 2")).capacity == 0,
+        "cheap or mixed subtrees are not memoized");
+
+  // A category column with few distinct values, longer than one block.
+  size_t rows = 5000;
+  std::vector<double> ks(rows), xs(rows);
+  for (size_t i = 0; i < rows; i++) {
+    ks[i] = static_cast<double>((i * 7) % 40);
+    xs[i] = 0.01 * i;
+  }
+  Binding bindings[] = {{k.get(), ks}, {x.get(), xs}};
+  std::vector<double> got(rows), want(rows);
+  solver.solve(memoized, bindings, got);
+  reference.solve(expected, bindings, want);
+  bool same = true;
+  for (size_t i = 0; i < rows; i++) {
+    same &= close(got[i], want[i]);
+  }
+  check(same, "batch results match the unmemoized expression");
+  auto statistics = memoStatistics(*memoized);
+  check(statistics.hits + statistics.misses == 2 * rows && statistics.hitRate() > 0.9,
+        "repeated keys hit the cache");
+
+  // More distinct keys than slots evict, and stay correct.
+  for (size_t i = 0; i < rows; i++) {
+    ks[i] = 0.5 * i;
+  }
+  solver.solve(memoized, bindings, got);
+  reference.solve(expected, bindings, want);
+  same = true;
+  for (size_t i = 0; i < rows; i++) {
+    same &= close(got[i], want[i]);
+  }
+  check(same && memoStatistics(*memoized).evictions > 0, "evictions keep results exact");
+
+  // Scalar evaluation goes through the same cache.
+  k->setValue(3);
+  x->setValue(2);
+  check(close(memoized->evaluate(), expected->evaluate()) &&
+            close(solver.solve(memoized), expected->evaluate()),
+        "scalar evaluation");
+
+  auto gradient = solver.differentiate(*memoized).gradient;
+  auto exact = reference.differentiate(*expected).gradient;
+  check(close(gradient["k"], exact["k"]) && close(gradient["x"], exact["x"]),
+        "gradient through the cache");
+
+  auto fixed = solver.specialize(memoized, {{"k", 3.0}});
+  check(close(fixed->evaluate(), expected->evaluate()) &&
+            memoStatistics(*fixed).capacity == 0,
+        "fixing a key folds the cached subtree");
+  auto byX = solver.specialize(memoized, {{"x", 2.0}});
+  check(close(byX->evaluate(), expected->evaluate()) && memoStatistics(*byX).capacity > 0,
+        "fixing another placeholder keeps the cache");
+
+  check(throws([&] { context.setMemoized({"k"}, 0); }), "capacity must be positive");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
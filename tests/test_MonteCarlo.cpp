@@ -0,0 +1,108 @@
+#include "../src/ExpressionSolver.hpp"
+#include "TestSupport.hpp"
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace expression_solver;
+
+namespace {
+
+bool same(const SampleStatistics &a, const SampleStatistics &b) {
+  return a.count == b.count && a.mean == b.mean && a.variance == b.variance && a.min == b.min &&
+         a.max == b.max && a.quantile(0.01) == b.quantile(0.01) &&
+         a.quantile(0.5) == b.quantile(0.5) && a.quantile(0.99) == b.quantile(0.99);
+}
+
+} // namespace
+
+int main() {
+  // Known answers from the Random123 distribution.
+  auto zero = montecarlo::philox({0, 0, 0, 0}, {0, 0});
+  auto ones = montecarlo::philox({~0u, ~0u, ~0u, ~0u}, {~0u, ~0u});
+  check(zero == std::array<uint32_t, 4>{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8} &&
+            ones == std::array<uint32_t, 4>{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd},
+        "Philox4x32-10 known answers");
+
+  QuantileSketch sketch(0.01);
+  for (int i = 1; i <= 10000; i++) {
+    sketch.add(i);
+    sketch.add(-i);
+  }
+  check(std::abs(sketch.quantile(0.75) - 5000) <= 0.01 * 5000 + 1 &&
+            std::abs(sketch.quantile(0.25) + 5000) <= 0.01 * 5000 + 1 &&
+            std::abs(sketch.quantile(1) - 10000) <= 100 && sketch.count() == 20000,
+        "sketch quantiles within the relative accuracy");
+
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  auto y = std::make_shared<PlaceHolder>("y", 0.0);
+  auto z = std::make_shared<PlaceHolder>("z", 0.0);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  context.addPlaceholder(z);
+  ExpressionSolver solver(context);
+
+  MonteCarloOptions options{.samples = 1'000'000, .seed = 42};
+  auto uniform = solver.simulate(solver.compile("x"), {{x.get(), Distribution::uniform(2, 4)}},
+                                 options);
+  check(uniform.count == options.samples && std::abs(uniform.mean - 3) < 4 * uniform.standardError() &&
+            std::abs(uniform.variance - 4.0 / 12) < 0.005 && uniform.min >= 2 && uniform.max < 4 &&
+            std::abs(uniform.quantile(0.5) - 3) < 0.05,
+        "uniform");
+
+  auto normal = solver.simulate(solver.compile("y"), {{y.get(), Distribution::normal(2, 3)}},
+                                options);
+  check(std::abs(normal.mean - 2) < 4 * normal.standardError() &&
+            std::abs(std::sqrt(normal.variance) - 3) < 0.01 &&
+            std::abs(normal.quantile(0.975) - (2 + 3 * 1.959964)) < 0.1,
+        "normal");
+
+  auto logNormal = solver.simulate(solver.compile("z"),
+                                   {{z.get(), Distribution::logNormal(0, 0.5)}}, options);
+  check(std::abs(logNormal.mean - std::exp(0.125)) < 4 * logNormal.standardError() &&
+            std::abs(logNormal.quantile(0.5) - 1) < 0.02 && logNormal.min > 0,
+        "lognormal");
+
+  // Draws of different placeholders are independent.
+  auto product = solver.simulate(solver.compile("(x - 3) * (y - 2)"),
+                                 {{x.get(), Distribution::uniform(2, 4)},
+                                  {y.get(), Distribution::normal(2, 3)}},
+                                 options);
+  check(std::abs(product.mean) < 4 * product.standardError(), "independent streams");
+
+  // The same seed gives the same statistics on any number of threads.
+  auto expression = solver.compile("exp(y / 4) * x + sin(z)");
+  std::vector<Draw> draws{{x.get(), Distribution::uniform(0, 1)},
+                          {y.get(), Distribution::normal(0, 1)},
+                          {z.get(), Distribution::logNormal(0, 1)}};
+  MonteCarloOptions odd{.samples = 100'003, .seed = 7};
+  MonteCarlo simulation(expression, draws);
+  auto serial = simulation.run(odd);
+  ThreadPool one(1), three(3);
+  check(same(serial, simulation.run(odd, &one)) && same(serial, simulation.run(odd, &three)),
+        "reproducible across thread counts");
+  check(!same(serial, simulation.run({.samples = 100'003, .seed = 8})), "seed changes the draws");
+
+  auto partial = solver.simulate(solver.compile("log(x - 0.5)"),
+                                 {{x.get(), Distribution::uniform(0, 1)}}, options);
+  check(partial.count + partial.nonFinite == options.samples &&
+            std::abs(static_cast<double>(partial.nonFinite) / options.samples - 0.5) < 0.01,
+        "non-finite samples are counted apart");
+
+  check(throws([&] {
+          solver.simulate(solver.compile("lag(x, 2)"), {{x.get(), Distribution::uniform(0, 1)}});
+        }) && throws([&] {
+          solver.simulate(solver.compile("x + 1"), {{x.get(), Distribution::uniform(1, 1)}});
+        }) && throws([&] {
+          solver.simulate(solver.compile("x + 1"), {{x.get(), Distribution::normal(0, -1)}});
+        }) && throws([&] {
+          solver.simulate(solver.compile("x + 1"), {{x.get(), Distribution::uniform(0, 1)},
+                                                    {x.get(), Distribution::uniform(0, 1)}});
+        }),
+        "invalid simulations");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
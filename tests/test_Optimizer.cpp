@@ -0,0 +1,94 @@
+#include "../src/CompiledExpression.hpp"
+#include "../src/ExpressionSolver.hpp"
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <string>
+
+using namespace expression_solver;
+using namespace expression_solver::operations;
+
+// Optimized tree behind a compiled expression.
+ExpressionPtr root(const ExpressionPtr &exp) {
+  auto compiled = std::dynamic_pointer_cast<CompiledExpression>(exp);
+  return compiled ? compiled->getRoot() : exp;
+}
+
+struct OptimizerTest {
+  std::string expression;
+  std::function<double(double)> reference;
+  std::function<bool(const ExpressionPtr &)> shape;
+};
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0);
+  context.addPlaceholder(x);
+  ExpressionSolver solver(context);
+
+  auto isFma = [](const ExpressionPtr &e) {
+    return std::dynamic_pointer_cast<FusedMultiplyAddOperation>(e) != nullptr;
+  };
+  auto isHorner = [](const ExpressionPtr &e) {
+    return std::dynamic_pointer_cast<FusedMultiplyAddOperation>(e) ||
+           std::dynamic_pointer_cast<MultiplyOperation>(e);
+  };
+  auto isSin = [](const ExpressionPtr &e) {
+    auto sin = std::dynamic_pointer_cast<SinOperation>(e);
+    return sin && std::dynamic_pointer_cast<FusedMultiplyAddOperation>(sin->getOperand());
+  };
+  auto any = [](const ExpressionPtr &) { return true; };
+
+  // g5 applies g0 32 times, and each application uses its argument three
+  // times: 3^32 paths through few distinct nodes, so the passes must visit
+  // each node once.
+  solver.define("g0(a) = sin(a) + a * a");
+  for (int level = 1; level <= 5; level++) {
+    auto below = "g" + std::to_string(level - 1);
+    solver.define("g" + std::to_string(level) + "(a) = " + below + "(" + below + "(a))");
+  }
+  auto nested = [](double v) {
+    for (int i = 0; i < 32; i++) {
+      v = std::sin(v) + v * v;
+    }
+    return v;
+  };
+
+  std::vector<OptimizerTest> tests = {
+      {"2*x^3 + 3*x^2 - x + 5", [](double v) { return 2 * v * v * v + 3 * v * v - v + 5; }, isFma},
+      {"x*x*x - 1", [](double v) { return v * v * v - 1; }, any},
+      {"(x+1)^2", [](double v) { return (v + 1) * (v + 1); }, isFma},
+      {"(x-1)*(x+1)/4", [](double v) { return (v - 1) * (v + 1) / 4; }, isFma},
+      {"2*3*x - x^2", [](double v) { return 6 * v - v * v; }, isHorner},
+      {"sin(0.5*x^2 + x + 1)", [](double v) { return std::sin(0.5 * v * v + v + 1); }, isSin},
+      {"x^2.5 + x", [](double v) { return std::pow(v, 2.5) + v; }, any},
+      {"x + 1", [](double v) { return v + 1; }, any},
+      {"g5(x)", nested, any},
+      // Left alone: the zero coefficients would give 0/0 or 0*inf = NaN.
+      {"x^2/0", [](double v) { return v * v / 0.0; }, any},
+      {"(x*x+x)/0", [](double v) { return (v * v + v) / 0.0; }, any},
+      {"x^2*INF", [](double v) { return v * v * HUGE_VAL; }, any},
+      {"(x+INF)*x", [](double v) { return (v + HUGE_VAL) * v; }, any},
+  };
+
+  int passed = 0;
+  for (const auto &test : tests) {
+    auto exp = solver.compile(test.expression);
+    bool ok = test.shape(root(exp));
+    for (double v : {-2.0, -0.5, 0.0, 0.3, 1.0, 7.25}) {
+      x->setValue(v);
+      double expected = test.reference(v);
+      double actual = exp->evaluate();
+      ok = ok && ((std::isnan(actual) && std::isnan(expected)) || actual == expected ||
+                  std::abs(actual - expected) <= 1e-12 * std::max(1.0, std::abs(expected)));
+    }
+    if (ok) {
+      std::cout << "Test passed: " << test.expression << std::endl;
+      passed++;
+    } else {
+      std::cout << "Test failed: " << test.expression << std::endl;
+    }
+  }
+
+  return passed == static_cast<int>(tests.size()) ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+#include "../src/ExpressionSolver.hpp"
+#include "../src/RootFinding.hpp"
+#include "TestSupport.hpp"
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace expression_solver;
+
+namespace {
+
+// An operation without a derivative rule.
+class CubeRootOperation : public operations::UnaryOperation {
+public:
+  using UnaryOperation::UnaryOperation;
+  double apply(double x) const override { return std::cbrt(x); }
+  constexpr std::string_view identifier() const override { return "cbrt"; }
+  constexpr int precedence() const override { return 4; }
+  ExpressionPtr create(ExpressionPtr operand) const override {
+    return std::make_shared<CubeRootOperation>(std::move(operand));
+  }
+};
+
+} // namespace
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto r = std::make_shared<PlaceHolder>("r", 0.0);
+  auto c = std::make_shared<PlaceHolder>("c", 0.0);
+  auto n = std::make_shared<PlaceHolder>("n", 0.0);
+  context.addPlaceholder(r);
+  context.addPlaceholder(c);
+  context.addPlaceholder(n);
+  context.addOperation(std::make_shared<CubeRootOperation>(nullptr));
+  ExpressionSolver solver(context);
+
+  check(std::abs(solver.solveFor(solver.compile("r^2 - 2"), *r, 0, 0, 2) - std::sqrt(2.0)) <
+            1e-12,
+        "scalar root");
+  check(std::abs(solver.solveFor(solver.compile("r"), *r, 0.25, 0, 1) - 0.25) < 1e-12,
+        "bare placeholder");
+
+  // Yield of a bond from its price: coupon c for n periods and 100 at the
+  // end. More rows than one chunk, each with its own inputs and target.
+  auto price = solver.compile("c * (1 - (1 + r) ^ (0 - n)) / r + 100 * (1 + r) ^ (0 - n)");
+  size_t rows = 5000;
+  std::vector<double> coupons(rows), periods(rows), rates(rows), prices(rows);
+  for (size_t i = 0; i < rows; i++) {
+    coupons[i] = 1 + static_cast<double>(i % 9);
+    periods[i] = 1 + static_cast<double>(i % 30);
+    rates[i] = 0.001 + 0.15 * static_cast<double>((i * 7919) % 1000) / 1000;
+  }
+  Binding withRates[] = {{r.get(), rates}, {c.get(), coupons}, {n.get(), periods}};
+  solver.solve(price, withRates, prices);
+
+  Binding bindings[] = {{c.get(), coupons}, {n.get(), periods}};
+  RootFinder finder(price, *r);
+  check(finder.hasDerivative(), "built-in operations have derivatives");
+  std::vector<double> roots(rows);
+  std::vector<RootStatus> status(rows);
+  for (bool derivative : {true, false}) {
+    std::fill(roots.begin(), roots.end(), 0);
+    size_t converged =
+        finder.solve(bindings, prices, 1e-6, 1, roots, status, {.useDerivative = derivative});
+    bool accurate = converged == rows;
+    for (size_t i = 0; i < rows; i++) {
+      accurate &= status[i] == RootStatus::Converged && std::abs(roots[i] - rates[i]) < 1e-10;
+    }
+    check(accurate, derivative ? "implied rates by Newton" : "implied rates by Brent");
+  }
+
+  // Targets out of reach have no root in the interval.
+  std::vector<double> targets{50, 1e6, 120};
+  std::vector<double> coupon{5, 5, 5}, period{10, 10, 10}, few(3);
+  std::vector<RootStatus> fewStatus(3);
+  Binding fewBindings[] = {{c.get(), coupon}, {n.get(), period}};
+  size_t converged = solver.solveFor(price, *r, fewBindings, targets, 1e-6, 1, few, fewStatus);
+  check(converged == 2 && fewStatus[1] == RootStatus::NotBracketed && std::isnan(few[1]) &&
+            fewStatus[0] == RootStatus::Converged,
+        "unbracketed rows are reported");
+
+  // Operations without a derivative rule fall back to Brent's method.
+  auto cube = solver.compile("cbrt(r) * 2 - 3");
+  check(!RootFinder(cube, *r).hasDerivative() &&
+            std::abs(solver.solveFor(cube, *r, 0, 0, 10) - 3.375) < 1e-10,
+        "Brent without derivatives");
+
+  RootOptions short_{.maxIterations = 2};
+  double root = 0;
+  RootStatus shortStatus;
+  RootFinder(solver.compile("exp(r) - 5"), *r)
+      .solve({}, {}, 0, 100, std::span(&root, 1), std::span(&shortStatus, 1), short_);
+  check(shortStatus == RootStatus::NoConvergence, "iteration limit");
+
+  check(throws([&] { RootFinder(solver.compile("c * 2 + n"), *r); }) &&
+            throws([&] { RootFinder(solver.compile("lag(r, 1) - 1"), *r); }) &&
+            throws([&] { solver.solveFor(price, *r, 0, 1, 1); }),
+        "invalid problems");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
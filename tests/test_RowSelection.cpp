@@ -0,0 +1,85 @@
+#include "../src/ExpressionSolver.hpp"
+#include "TestSupport.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+using namespace expression_solver;
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  auto y = std::make_shared<PlaceHolder>("y", 0.0);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  ExpressionSolver solver(context);
+
+  // More rows than several chunks, with repeated values for ties.
+  size_t rows = 100'000;
+  std::vector<double> xs(rows), ys(rows), values(rows);
+  for (size_t i = 0; i < rows; i++) {
+    xs[i] = static_cast<double>((i * 7919) % 1000);
+    ys[i] = static_cast<double>(i % 13);
+  }
+  Binding bindings[] = {{x.get(), xs}, {y.get(), ys}};
+  auto score = solver.compile("sin(x / 50) * 100 + y");
+  solver.solve(score, bindings, values);
+
+  // The expected answer from the materialized values.
+  std::vector<RankedRow> all(rows);
+  for (size_t i = 0; i < rows; i++) {
+    all[i] = {static_cast<uint32_t>(i), values[i]};
+  }
+  auto ranked = all;
+  std::stable_sort(ranked.begin(), ranked.end(),
+                   [](const RankedRow &a, const RankedRow &b) { return a.value > b.value; });
+  std::vector<RankedRow> expected(ranked.begin(), ranked.begin() + 100);
+
+  RowSelector selector(score);
+  ThreadPool pool(3);
+  check(selector.top(bindings, rows, 100) == expected, "top 100");
+  check(selector.top(bindings, rows, 100, Rank::Highest, &pool) == expected,
+        "top 100 merged across threads");
+  std::stable_sort(ranked.begin(), ranked.end(),
+                   [](const RankedRow &a, const RankedRow &b) { return a.value < b.value; });
+  check(selector.top(bindings, rows, 5, Rank::Lowest, &pool) ==
+            std::vector<RankedRow>(ranked.begin(), ranked.begin() + 5),
+        "lowest rows");
+  check(selector.top(bindings, 3, 10).size() == 3 && selector.top(bindings, rows, 0).empty(),
+        "k larger than rows, and zero");
+
+  std::vector<uint32_t> passing;
+  for (size_t i = 0; i < rows; i++) {
+    if (values[i] > 95) {
+      passing.push_back(static_cast<uint32_t>(i));
+    }
+  }
+  check(selector.above(bindings, rows, 95) == passing &&
+            solver.solveAbove(score, bindings, rows, 95, pool) == passing,
+        "rows above a threshold in row order");
+
+  // NaN rows never qualify.
+  auto partial = solver.compile("sqrt(x - 500)");
+  auto top = solver.solveTop(partial, bindings, rows, 3, Rank::Lowest, pool);
+  check(top.size() == 3 && top[0].value == 0 && !std::isnan(top[2].value) &&
+            solver.solveAbove(partial, bindings, rows, -1, pool).size() ==
+                static_cast<size_t>(std::count_if(xs.begin(), xs.end(),
+                                                  [](double v) { return v >= 500; })),
+        "NaN rows are skipped");
+
+  // Streaming expressions keep row order on one thread.
+  auto streaming = solver.compile("delta(x)");
+  std::vector<double> deltas(rows);
+  solver.solve(solver.compile("delta(x)"), bindings, deltas);
+  auto best = RowSelector(streaming).top(bindings, rows, 1, Rank::Highest, &pool);
+  check(best.size() == 1 && best[0].value == *std::max_element(deltas.begin() + 1, deltas.end()),
+        "streaming expressions in row order");
+
+  check(throws([&] { selector.top(bindings, rows + 1, 10); }), "short bindings");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+#include "../src/CompiledExpression.hpp"
+#include "../src/ExpressionSolver.hpp"
+#include "TestSupport.hpp"
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace expression_solver;
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  auto y = std::make_shared<PlaceHolder>("y", 0.0);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  ExpressionSolver solver(context);
+
+  // More rows than one chunk, with every 20th row passing the guard.
+  size_t rows = 10000;
+  std::vector<double> xs(rows), ys(rows);
+  for (size_t i = 0; i < rows; i++) {
+    xs[i] = static_cast<double>(i % 20);
+    ys[i] = 0.001 * i;
+  }
+  Binding bindings[] = {{x.get(), xs}, {y.get(), ys}};
+  auto guard = solver.compile("x == 7");
+  auto expression = solver.compile("sin(y) * 3 + x");
+  auto expected = [&](size_t i) { return std::sin(ys[i]) * 3 + xs[i]; };
+
+  std::vector<double> scattered(rows, -1);
+  std::vector<uint32_t> selected;
+  size_t count = solver.solveWhere(guard, expression, bindings, scattered,
+                                   SelectionOutput::Scatter, &selected);
+  bool scatterOk = count == rows / 20 && selected.size() == count;
+  for (size_t i = 0; i < rows; i++) {
+    scatterOk &= i % 20 == 7 ? scattered[i] == expected(i) : scattered[i] == -1;
+  }
+  check(scatterOk, "scatter writes only the selected rows");
+
+  std::vector<double> compacted(rows, -1);
+  count = solver.solveWhere(guard, expression, bindings, compacted, SelectionOutput::Compact);
+  bool compactOk = count == selected.size();
+  for (size_t j = 0; compactOk && j < count; j++) {
+    compactOk = selected[j] % 20 == 7 && compacted[j] == expected(selected[j]) &&
+                (j == 0 || selected[j] > selected[j - 1]);
+  }
+  check(compactOk && compacted[count] == -1, "compact packs the selected rows in order");
+
+  std::vector<double> untouched(rows, -1);
+  check(solver.solveWhere(solver.compile("x == 99"), expression, bindings, untouched) == 0 &&
+            untouched[0] == -1 && untouched[rows - 1] == -1,
+        "no selected rows skips the expression");
+
+  // NaN counts as true, as in a condition; a bare placeholder is a guard.
+  std::vector<double> flags{0, std::nan(""), 2, 0};
+  std::vector<double> out(4, -1);
+  Binding flagBindings[] = {{x.get(), flags}, {y.get(), ys}};
+  check(solver.solveWhere(solver.compile("x"), solver.compile("y + 1"), flagBindings, out) == 2 &&
+            out[0] == -1 && out[1] == ys[1] + 1 && out[2] == ys[2] + 1 && out[3] == -1,
+        "non-zero and NaN guards select");
+
+  // Selected rows of a compiled expression directly.
+  auto compiled = std::dynamic_pointer_cast<CompiledExpression>(expression);
+  std::vector<uint32_t> picks{9999, 3, 3, 500};
+  std::vector<double> picked(picks.size());
+  compiled->evaluate(bindings, picks, picked);
+  bool pickedOk = true;
+  for (size_t j = 0; j < picks.size(); j++) {
+    pickedOk &= picked[j] == expected(picks[j]);
+  }
+  check(pickedOk, "evaluate listed rows in any order");
+  check(throws([&] {
+          std::vector<uint32_t> past{static_cast<uint32_t>(rows)};
+          compiled->evaluate(bindings, past, std::span(picked).first(1));
+        }),
+        "selection past the bindings is an error");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
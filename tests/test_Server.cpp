@@ -0,0 +1,111 @@
+#include "../src/EvaluationClient.hpp"
+#include "../src/EvaluationServer.hpp"
+#include "TestSupport.hpp"
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace expression_solver;
+
+int main() {
+  EvaluationServer::Options options;
+  options.socketPath = "/tmp/expression_solver_test_" + std::to_string(::getpid()) + ".sock";
+  options.workers = 2;
+  EvaluationServer server(options);
+  server.define("price(qty, rate) = qty * rate + 1");
+  server.define("wave(t) = sin(t) * 2 + cos(t)");
+  server.define("answer() = 42");
+  server.start();
+
+  // Programs above the cost limit are rejected.
+  {
+    EvaluationServer::Options limited;
+    limited.maxCost = 20;
+    EvaluationServer strict(limited);
+    strict.define("cheap(a) = sin(a) + a");
+    check(throws([&] { strict.define("costly(a) = sin(a) * cos(a)"); }),
+          "programs above the cost limit are rejected");
+  }
+
+  // Workers share programs, so they must hold no stream state.
+  {
+    EvaluationServer streaming(options);
+    check(throws([&] { streaming.define("p(x) = lag(x, 1) + rolling_mean(x, 4)"); }) &&
+              throws([&] { streaming.define("q(x) = x + ema(x, 0.5)"); }),
+          "programs with streaming operations are rejected");
+  }
+
+  {
+    EvaluationClient client(options.socketPath);
+    auto price = client.lookup("price");
+    check(price.inputs == std::vector<std::string>{"qty", "rate"}, "lookup returns the inputs");
+    std::vector<double> columns{1, 2, 3, 10, 20, 30};
+    auto results = client.evaluate(price.id, columns, 3);
+    check(results == std::vector<double>{11, 41, 91}, "evaluate one request");
+    check(throws([&] { client.lookup("missing"); }), "unknown program is an error");
+    check(throws([&] { client.evaluate(price.id, columns, 2); }),
+          "wrong column count is an error");
+    check(client.evaluate(price.id, columns, 3).size() == 3,
+          "connection usable after an error");
+    auto answer = client.lookup("answer");
+    check(client.evaluate(answer.id, {}, 2) == std::vector<double>{42, 42},
+          "program without inputs");
+    check(throws([&] { client.evaluate(answer.id, {}, 0xFFFFFFFF); }),
+          "too many rows is an error");
+    check(client.evaluate(price.id, columns, 3).size() == 3,
+          "server usable after too many rows");
+  }
+
+  // Concurrent clients: the workers coalesce their requests but every client
+  // gets back its own rows.
+  std::atomic<int> mismatches = 0;
+  std::vector<std::thread> clients;
+  for (int c = 0; c < 4; c++) {
+    clients.emplace_back([&, c] {
+      EvaluationClient client(options.socketPath);
+      auto price = client.lookup("price");
+      auto wave = client.lookup("wave");
+      for (int i = 0; i < 200; i++) {
+        size_t rows = 1 + (i * 7 + c) % 50;
+        std::vector<double> columns(2 * rows);
+        for (size_t r = 0; r < rows; r++) {
+          columns[r] = c * 1000 + i + r;
+          columns[rows + r] = 0.5 * r;
+        }
+        bool usePrice = (i + c) % 2 == 0;
+        auto results = usePrice ? client.evaluate(price.id, columns, rows)
+                                : client.evaluate(wave.id, std::span(columns).first(rows), rows);
+        for (size_t r = 0; r < rows; r++) {
+          double x = columns[r];
+          double expected = usePrice ? x * columns[rows + r] + 1 : std::sin(x) * 2 + std::cos(x);
+          if (std::abs(results[r] - expected) > 1e-9 * (1 + std::abs(expected))) {
+            mismatches++;
+          }
+        }
+      }
+    });
+  }
+  for (auto &thread : clients) {
+    thread.join();
+  }
+  check(mismatches == 0, "concurrent clients get their own results");
+
+  EvaluationClient client(options.socketPath);
+  auto statistics = client.statistics();
+  check(statistics.requests == 804 && statistics.batches <= statistics.requests &&
+            statistics.rows > 0,
+        "statistics counts requests");
+  check(statistics.p50Microseconds > 0 && statistics.p99Microseconds >= statistics.p50Microseconds,
+        "statistics latency percentiles");
+
+  server.stop();
+  check(::access(options.socketPath.c_str(), F_OK) != 0, "stop removes the socket");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
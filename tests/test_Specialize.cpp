@@ -0,0 +1,80 @@
+#include "../src/Approximation.hpp"
+#include "../src/CompiledExpression.hpp"
+#include "../src/ExpressionSolver.hpp"
+#include "TestSupport.hpp"
+#include <cmath>
+#include <iostream>
+#include <string>
+
+using namespace expression_solver;
+using namespace expression_solver::operations;
+
+namespace {
+
+size_t size(const ExpressionPtr &e) {
+  auto compiled = std::dynamic_pointer_cast<CompiledExpression>(e);
+  return compiled ? compiled->size() : 1;
+}
+
+template <typename T> size_t count(const ExpressionPtr &e) {
+  auto compiled = std::dynamic_pointer_cast<CompiledExpression>(e);
+  size_t result = 0;
+  for (const auto &node : compiled->getCode().nodes) {
+    result += dynamic_cast<const T *>(node.expression) != nullptr;
+  }
+  return result;
+}
+
+} // namespace
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 1.5);
+  auto a = std::make_shared<PlaceHolder>("a", 7.0);
+  auto b = std::make_shared<PlaceHolder>("b", 7.0);
+  auto region = std::make_shared<PlaceHolder>("region", 7.0);
+  for (const auto &placeholder : {x, a, b, region}) {
+    context.addPlaceholder(placeholder);
+  }
+  ExpressionSolver solver(context);
+
+  auto formula = solver.compile("a*x^2 + b*x + exp(region * 0.1) * sin(region) + sqrt(a + b)");
+  auto special = solver.specialize(formula, {{"a", 2}, {"b", 3}, {"region", 0.5}});
+  bool matches = true;
+  for (double value : {-2.0, 0.0, 0.25, 3.0}) {
+    x->setValue(value);
+    double expected = 2 * value * value + 3 * value + std::exp(0.05) * std::sin(0.5) + std::sqrt(5.0);
+    matches = matches && std::abs(special->evaluate() - expected) < 1e-12;
+  }
+  check(matches, "specialized value");
+  check(count<SinOperation>(special) == 0 && count<ExpOperation>(special) == 0 &&
+            count<SqrtOperation>(special) == 0,
+        "bound subtrees folded");
+  check(size(special) < size(formula), "specialized expression is smaller");
+
+  // The original still reads its placeholders.
+  x->setValue(1);
+  a->setValue(1);
+  b->setValue(1);
+  region->setValue(0);
+  check(std::abs(formula->evaluate() - (1 + 1 + 0 + std::sqrt(2.0))) < 1e-12, "original unchanged");
+
+  auto sum = solver.specialize(solver.compile("sum(x, a, b, 4)"), {{"a", 1}, {"b", 2}});
+  auto root = std::dynamic_pointer_cast<SumOperation>(std::dynamic_pointer_cast<CompiledExpression>(sum)->getRoot());
+  check(root && root->arity() == 2 && sum->evaluate() == 8, "constant operands of a sum merge");
+
+  auto constant = solver.specialize(formula, {{"x", 1}, {"a", 1}, {"b", 1}, {"region", 0}});
+  check(std::dynamic_pointer_cast<ConstExpression>(constant) && constant->evaluate() == 2 + std::sqrt(2.0),
+        "fully bound expression is a constant");
+
+  check(solver.specialize(x, {{"x", 4}})->evaluate() == 4 && solver.specialize(x, {{"y", 4}}) == x,
+        "placeholder roots and unknown names");
+
+  // Specializing keeps the approximations of the original compile.
+  context.setTolerance(1e-6);
+  ExpressionSolver approximate(context);
+  auto wave = approximate.specialize(approximate.compile("sin(x * a) + cos(b)"), {{"a", 2}});
+  check(count<ApproximateSinOperation>(wave) == 1 && count<CosOperation>(wave) == 1, "approximations kept");
+
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+#include "../src/CompiledExpression.hpp"
+#include "../src/ExpressionSolver.hpp"
+#include "../src/Streaming.hpp"
+#include "TestSupport.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+using namespace expression_solver;
+
+namespace {
+
+bool same(double a, double b) {
+  return (std::isnan(a) && std::isnan(b)) || std::abs(a - b) <= 1e-9 * (1 + std::abs(b));
+}
+
+const double missing = std::numeric_limits<double>::quiet_NaN();
+
+// Reference results computed from the whole history at every sample.
+std::vector<double> naive(const std::string &op, const std::vector<double> &xs, size_t n) {
+  std::vector<double> out(xs.size());
+  for (size_t t = 0; t < xs.size(); t++) {
+    size_t first = t + 1 >= n ? t + 1 - n : 0;
+    if (op == "lag") {
+      out[t] = t >= n ? xs[t - n] : missing;
+    } else if (op == "delta") {
+      out[t] = t >= 1 ? xs[t] - xs[t - 1] : missing;
+    } else if (op == "rolling_mean") {
+      double sum = 0;
+      for (size_t i = first; i <= t; i++) {
+        sum += xs[i];
+      }
+      out[t] = sum / static_cast<double>(t + 1 - first);
+    } else {
+      double best = missing;
+      for (size_t i = first; i <= t; i++) {
+        best = op == "rolling_max" ? std::fmax(best, xs[i]) : std::fmin(best, xs[i]);
+      }
+      out[t] = best;
+    }
+  }
+  return out;
+}
+
+} // namespace
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  context.addPlaceholder(x);
+  ExpressionSolver solver(context);
+
+  // Longer than a batch block, with repeats, trends and a NaN.
+  std::vector<double> xs(1000);
+  for (size_t i = 0; i < xs.size(); i++) {
+    xs[i] = std::sin(0.05 * i) * 10 + static_cast<double>(i % 7) - 0.01 * i;
+  }
+  Binding bindings[] = {{x.get(), xs}};
+
+  for (std::string op : {"lag", "rolling_mean", "rolling_max", "rolling_min"}) {
+    for (size_t n : {1, 5, 300}) {
+      auto compiled = solver.compile(op + "(x, " + std::to_string(n) + ")");
+      std::vector<double> batch(xs.size());
+      solver.solve(compiled, bindings, batch);
+
+      auto stream = newStream(compiled);
+      auto expected = naive(op, xs, n);
+      bool ok = true;
+      for (size_t t = 0; t < xs.size(); t++) {
+        x->setValue(xs[t]);
+        double scalar = solver.solve(stream);
+        ok &= same(batch[t], expected[t]) && same(scalar, expected[t]);
+      }
+      check(ok, op + " over a window of " + std::to_string(n));
+    }
+  }
+
+  auto delta = solver.compile("delta(x) * 2");
+  std::vector<double> deltas(xs.size());
+  solver.solve(delta, bindings, deltas);
+  auto expectedDeltas = naive("delta", xs, 1);
+  bool deltaOk = true;
+  for (size_t t = 0; t < xs.size(); t++) {
+    deltaOk &= same(deltas[t], expectedDeltas[t] * 2);
+  }
+  check(deltaOk, "delta");
+
+  auto ema = solver.compile("ema(x, 0.25)");
+  double average = xs[0];
+  bool emaOk = true;
+  for (size_t t = 0; t < 50; t++) {
+    x->setValue(xs[t]);
+    average = t == 0 ? xs[0] : average + 0.25 * (xs[t] - average);
+    emaOk &= same(solver.solve(ema), average);
+  }
+  check(emaOk, "ema");
+
+  // Batches continue the stream where the previous one stopped.
+  auto split = solver.compile("rolling_max(x, 40) - lag(x, 3)");
+  auto whole = newStream(split);
+  std::vector<double> once(xs.size()), parts(xs.size());
+  solver.solve(whole, bindings, once);
+  for (size_t start = 0; start < xs.size(); start += 333) {
+    size_t count = std::min<size_t>(333, xs.size() - start);
+    Binding part[] = {{x.get(), std::span(xs).subspan(start, count)}};
+    solver.solve(split, part, std::span(parts).subspan(start, count));
+  }
+  check(std::equal(once.begin(), once.end(), parts.begin(), same), "batches resume the stream");
+
+  resetStreams(*split);
+  std::vector<double> again(xs.size());
+  solver.solve(split, bindings, again);
+  check(std::equal(once.begin(), once.end(), again.begin(), same), "reset starts over");
+
+  // Non-finite samples enter and leave the window.
+  std::vector<double> spiky{1, missing, 2, 3, std::numeric_limits<double>::infinity(), 4, 5, 6};
+  std::vector<double> means(spiky.size()), maxima(spiky.size());
+  Binding spikyBindings[] = {{x.get(), spiky}};
+  solver.solve(solver.compile("rolling_mean(x, 2)"), spikyBindings, means);
+  solver.solve(solver.compile("rolling_max(x, 2)"), spikyBindings, maxima);
+  check(same(means[0], 1) && std::isnan(means[1]) && std::isnan(means[2]) &&
+            same(means[3], 2.5) && std::isinf(means[4]) && std::isinf(means[5]) &&
+            same(means[6], 4.5),
+        "rolling mean with NaN and infinity");
+  check(same(maxima[1], 1) && same(maxima[2], 2) && std::isinf(maxima[5]) && same(maxima[6], 5),
+        "rolling max skips NaN");
+
+  // Constant inputs are not folded away.
+  auto constant = solver.compile("delta(3) + lag(2, 1)");
+  check(std::isnan(solver.solve(constant)) && solver.solve(constant) == 2,
+        "streaming operations are not folded");
+
+  // Windows written as expressions of literals.
+  auto folded = solver.compile("lag(x, 1 + 1) + rolling_max(x, 2 * 2)");
+  std::vector<double> foldedValues(xs.size());
+  solver.solve(folded, bindings, foldedValues);
+  auto lags = naive("lag", xs, 2);
+  auto maxes = naive("rolling_max", xs, 4);
+  bool foldedOk = true;
+  for (size_t t = 0; t < xs.size(); t++) {
+    foldedOk &= same(foldedValues[t], lags[t] + maxes[t]);
+  }
+  check(foldedOk && solver.solve("ema(3, 1 / 2)") == 3, "windows from constant expressions");
+
+  check(throws([&] { solver.compile("lag(x, 0)"); }) &&
+            throws([&] { solver.compile("rolling_mean(x, 2.5)"); }) &&
+            throws([&] { solver.compile("rolling_max(x, x)"); }) &&
+            throws([&] { solver.compile("ema(x, 1.5)"); }) &&
+            throws([&] { solver.compile("lag(x, 1 + x)"); }) &&
+            throws([&] { solver.compile("lag(x, lag(2, 1) + 1)"); }),
+        "invalid windows");
+
+  bool noDerivative = false;
+  try {
+    solver.differentiate(*solver.compile("lag(x, 1) * x"));
+  } catch (const std::logic_error &) {
+    noDerivative = true;
+  }
+  check(noDerivative, "streaming operations have no derivative");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
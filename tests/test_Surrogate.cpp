@@ -0,0 +1,107 @@
+#include "../src/ExpressionSolver.hpp"
+#include "TestSupport.hpp"
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace expression_solver;
+
+namespace {
+
+// Largest difference between the two expressions over random rows of the
+// bindings, in a batch.
+double maxDifference(const ExpressionSolver &solver, const ExpressionPtr &a,
+                     const ExpressionPtr &b, std::span<const Binding> bindings, size_t rows) {
+  std::vector<double> first(rows), second(rows);
+  solver.solve(a, bindings, first);
+  solver.solve(b, bindings, second);
+  double difference = 0;
+  for (size_t i = 0; i < rows; i++) {
+    difference = std::max(difference, std::abs(first[i] - second[i]));
+  }
+  return difference;
+}
+
+} // namespace
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  auto y = std::make_shared<PlaceHolder>("y", 0.0);
+  auto z = std::make_shared<PlaceHolder>("z", 0.0);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  context.addPlaceholder(z);
+  ExpressionSolver solver(context);
+  std::mt19937_64 engine(11);
+
+  auto chain = solver.compile("exp(sin(x) * cos(x / 3)) + log(2 + sin(x * x)) * atan(x)");
+  SurrogateAxis axis[] = {{x.get(), 0, 5}};
+  auto fit = solver.surrogate(chain, axis, {.tolerance = 1e-9});
+  check(fit.maxError <= 1e-9 && fit.degree <= 12 && fit.pieces > 1, "1D surrogate meets tolerance");
+
+  size_t rows = 20000;
+  std::vector<double> xs(rows), ys(rows);
+  std::uniform_real_distribution<double> inside(0, 5);
+  for (auto &v : xs) {
+    v = inside(engine);
+  }
+  Binding bindings[] = {{x.get(), xs}, {y.get(), ys}};
+  check(maxDifference(solver, chain, fit.expression, bindings, rows) <= 2e-9,
+        "1D error between check points");
+  x->setValue(1.7);
+  check(std::abs(fit.expression->evaluate() - chain->evaluate()) <= 1e-9, "row at a time");
+
+  // Polynomials need one piece of their own degree.
+  auto cubic = solver.surrogate(solver.compile("x * x * x - 2 * x + 1"), axis);
+  check(cubic.pieces == 1 && cubic.degree == 3, "polynomials are exact");
+
+  // Outside the domain the original expression is used.
+  std::vector<double> outside = {-1, 0, 5, 6.5, std::numeric_limits<double>::quiet_NaN()};
+  std::vector<double> expected(outside.size()), actual(outside.size());
+  Binding edge[] = {{x.get(), outside}};
+  solver.solve(chain, edge, expected);
+  solver.solve(fit.expression, edge, actual);
+  check(actual[0] == expected[0] && actual[3] == expected[3] && std::isnan(actual[4]) &&
+            std::abs(actual[1] - expected[1]) <= 1e-9,
+        "rows outside the domain");
+
+  // Two placeholders.
+  auto surface = solver.compile("sin(x) * exp(0 - y / 2) + cos(x * y / 4)");
+  SurrogateAxis plane[] = {{x.get(), -2, 2}, {y.get(), 0, 3}};
+  auto fit2 = solver.surrogate(surface, plane, {.tolerance = 1e-8});
+  std::uniform_real_distribution<double> across(-2, 2), up(0, 3);
+  for (size_t i = 0; i < rows; i++) {
+    xs[i] = across(engine);
+    ys[i] = up(engine);
+  }
+  check(fit2.maxError <= 1e-8 && maxDifference(solver, surface, fit2.expression, bindings, rows) <= 2e-8,
+        "2D surrogate meets tolerance");
+
+  // Gradients follow the original.
+  x->setValue(0.7);
+  y->setValue(1.1);
+  auto exact = solver.differentiate(*surface).gradient;
+  auto approximate = solver.differentiate(*fit2.expression).gradient;
+  check(std::abs(exact["x"] - approximate["x"]) < 1e-5 &&
+            std::abs(exact["y"] - approximate["y"]) < 1e-5,
+        "gradient");
+
+  check(throws([&] { solver.surrogate(solver.compile("sqrt(x - 1)"), axis); }),
+        "not finite over the domain");
+  check(throws([&] { solver.surrogate(solver.compile("x * z"), axis); }),
+        "other placeholders");
+  check(throws([&] {
+          solver.surrogate(solver.compile("abs(x - 2.3)"), axis,
+                           {.tolerance = 1e-14, .maxDegree = 4, .maxPieces = 8});
+        }),
+        "tolerance out of reach");
+  SurrogateAxis backwards[] = {{x.get(), 5, 0}};
+  check(throws([&] { solver.surrogate(chain, backwards); }), "bounds must increase");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+#include "../src/ExpressionSolver.hpp"
+#include "TestSupport.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace expression_solver;
+
+namespace {
+
+bool near(double a, double b, double tolerance = 1e-12) { return std::abs(a - b) <= tolerance; }
+
+std::vector<double> sampled(const std::vector<double> &knots, double (*f)(double)) {
+  std::vector<double> values;
+  for (double k : knots) {
+    values.push_back(f(k));
+  }
+  return values;
+}
+
+} // namespace
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  auto y = std::make_shared<PlaceHolder>("y", 0.0);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+
+  auto square = [](double v) { return v * v; };
+  auto uniform = TableAxis::range(0, 4, 5);
+  std::vector<double> uneven = {0, 0.5, 1.5, 3, 3.25, 4};
+  check(uniform.isUniform() && !TableAxis(uneven).isUniform(), "uniform axes are detected");
+
+  context.addTable("lin", std::make_shared<Table>(uniform, sampled(uniform.getKnots(), square)));
+  context.addTable("cub", std::make_shared<Table>(TableAxis(uneven), sampled(uneven, square),
+                                                  Interpolation::Cubic));
+  ExpressionSolver solver(context);
+
+  auto linear = solver.compile("interp(lin, x)");
+  x->setValue(2.5);
+  check(near(linear->evaluate(), 6.5), "linear between knots");
+  x->setValue(3);
+  check(near(linear->evaluate(), 9), "linear at a knot");
+  x->setValue(-1);
+  double low = linear->evaluate();
+  x->setValue(9);
+  check(low == 0 && linear->evaluate() == 16, "clamped outside the knots");
+
+  // Cubic Hermite reproduces quadratics exactly, on uneven knots too.
+  auto cubic = solver.compile("interp(cub, x)");
+  bool exact = true;
+  for (double v = 0; v <= 4; v += 0.03125) {
+    x->setValue(v);
+    exact &= near(cubic->evaluate(), v * v, 1e-12);
+  }
+  check(exact, "cubic is exact for quadratics");
+
+  // The binary search finds the same interval as std::upper_bound.
+  std::mt19937_64 engine(3);
+  std::vector<double> knots(1000);
+  std::uniform_real_distribution<double> gap(0.01, 1);
+  for (size_t i = 1; i < knots.size(); i++) {
+    knots[i] = knots[i - 1] + gap(engine);
+  }
+  TableAxis axis(knots);
+  std::uniform_real_distribution<double> anywhere(-1, knots.back() + 1);
+  bool located = true;
+  for (int n = 0; n < 10000; n++) {
+    double v = anywhere(engine);
+    double clamped = std::clamp(v, knots.front(), knots.back());
+    size_t expected = std::min<size_t>(
+        std::upper_bound(knots.begin(), knots.end(), clamped) - knots.begin() - 1, knots.size() - 2);
+    auto [i, t] = axis.locate(v);
+    located &= i == expected && t >= 0 && t <= 1;
+  }
+  check(located, "binary search matches upper_bound");
+
+  // 2D: bilinear, and bicubic exact for a quadratic in both arguments.
+  auto bowl = [](double a, double b) { return a * a + a * b - 2 * b * b + 3; };
+  auto rows = TableAxis::range(-1, 1, 9);
+  TableAxis columns({0, 0.25, 1, 1.5, 3});
+  std::vector<double> grid;
+  for (double a : rows.getKnots()) {
+    for (double b : columns.getKnots()) {
+      grid.push_back(bowl(a, b));
+    }
+  }
+  context.addTable("bowl", std::make_shared<Table>(rows, columns, grid, Interpolation::Cubic));
+  context.addTable("flat", std::make_shared<Table>(rows, columns, grid));
+  solver = ExpressionSolver(context);
+  auto bicubic = solver.compile("interp(bowl, x, y)");
+  auto bilinear = solver.compile("interp(flat, x, y)");
+  exact = true;
+  bool corners = true;
+  for (double a = -1; a <= 1; a += 0.125) {
+    for (double b = 0; b <= 3; b += 0.1875) {
+      x->setValue(a);
+      y->setValue(b);
+      exact &= near(bicubic->evaluate(), bowl(a, b), 1e-11);
+    }
+  }
+  x->setValue(0.25);
+  y->setValue(1);
+  corners &= near(bilinear->evaluate(), bowl(0.25, 1));
+  x->setValue(0.125);
+  y->setValue(0.5);
+  corners &= near(bilinear->evaluate(),
+                  0.5 * (2.0 / 3 * bowl(0, 0.25) + 1.0 / 3 * bowl(0, 1)) +
+                      0.5 * (2.0 / 3 * bowl(0.25, 0.25) + 1.0 / 3 * bowl(0.25, 1)));
+  check(exact, "bicubic is exact for quadratics");
+  check(corners, "bilinear at knots and between them");
+
+  // Batches give the row-at-a-time values, NaN and clamping included.
+  size_t count = 1000;
+  std::vector<double> xs(count), ys(count), batch(count);
+  std::uniform_real_distribution<double> wide(-2, 5);
+  for (size_t i = 0; i < count; i++) {
+    xs[i] = wide(engine);
+    ys[i] = wide(engine);
+  }
+  xs[7] = std::numeric_limits<double>::quiet_NaN();
+  ys[11] = std::numeric_limits<double>::quiet_NaN();
+  Binding bindings[] = {{x.get(), xs}, {y.get(), ys}};
+  bool matches = true;
+  for (const auto &expression : {linear, cubic, bicubic, bilinear}) {
+    solver.solve(expression, bindings, batch);
+    for (size_t i = 0; i < count; i++) {
+      x->setValue(xs[i]);
+      y->setValue(ys[i]);
+      double row = expression->evaluate();
+      matches &= (std::isnan(row) && std::isnan(batch[i])) || near(row, batch[i]);
+    }
+  }
+  check(matches && std::isnan(batch[7]) && std::isnan(batch[11]), "batches match rows");
+
+  // Gradients through the interpolant.
+  x->setValue(0.3);
+  y->setValue(1.2);
+  auto gradient = solver.differentiate(*bicubic).gradient;
+  check(near(gradient["x"], 2 * 0.3 + 1.2, 1e-10) && near(gradient["y"], 0.3 - 4 * 1.2, 1e-10),
+        "bicubic gradient");
+  x->setValue(7);
+  check(solver.differentiate(*linear).gradient["x"] == 0, "flat beyond the knots");
+
+  // Constant arguments fold, and vector arguments apply per component.
+  check(near(solver.compile("interp(lin, 1.5) * 2")->evaluate(), 5), "constant arguments");
+  auto v = std::make_shared<VectorPlaceHolder>("v", 2);
+  context.addVector(v);
+  solver = ExpressionSolver(context);
+  v->setValue(std::vector<double>{1, 2.5});
+  auto components = solver.compileVector("interp(lin, v)");
+  check(components.size() == 2 && near(components[1]->evaluate(), 6.5), "vector arguments");
+
+  check(throws([&] { solver.compile("interp(x, 1)"); }), "first argument must be a table");
+  check(throws([&] { solver.compile("interp(lin, x, y)"); }), "argument count");
+  check(throws([&] { solver.compile("lin + 1"); }) && throws([&] { solver.compile("lin"); }) &&
+            throws([&] { solver.compile("max(lin, 1)"); }),
+        "tables outside interp");
+  check(throws([] { TableAxis({0, 1, 1}); }) && throws([] { TableAxis({0}); }),
+        "knots must increase");
+  check(throws([&] { Table(uniform, {1, 2}); }), "one value per knot");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+#include "../src/CompiledExpression.hpp"
+#include "../src/ExpressionSolver.hpp"
+#include "TestSupport.hpp"
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace expression_solver;
+
+namespace {
+
+bool same(double a, double b) { return a == b || (std::isnan(a) && std::isnan(b)); }
+
+// Batch results of expression over the columns agree with evaluating each
+// row on its own.
+bool matchesScalar(ExpressionSolver &solver, const PlaceHolderPtr &x, const PlaceHolderPtr &y,
+                   const std::string &expression, const std::vector<double> &xs,
+                   const std::vector<double> &ys) {
+  auto compiled = solver.compile(expression);
+  std::vector<double> results(xs.size());
+  Binding bindings[] = {{x.get(), xs}, {y.get(), ys}};
+  solver.solve(compiled, bindings, results);
+  bool ok = true;
+  for (size_t i = 0; i < xs.size(); i++) {
+    x->setValue(xs[i]);
+    y->setValue(ys[i]);
+    if (!same(results[i], compiled->evaluate())) {
+      std::cout << "  " << expression << " row " << i << ": " << results[i]
+                << " != " << compiled->evaluate() << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+} // namespace
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.0);
+  auto y = std::make_shared<PlaceHolder>("y", 0.0);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  ExpressionSolver solver(context);
+
+  std::vector<double> counts(1000), fractions(1000), mixed(1000), small(1000);
+  for (size_t i = 0; i < counts.size(); i++) {
+    counts[i] = static_cast<double>(i % 37) - 11;
+    fractions[i] = 0.37 * i - 90;
+    small[i] = static_cast<double>(i % 5);
+    mixed[i] = i % 7 == 0 ? std::nan("") : i % 11 == 0 ? 1e300 : 0.5 * (i % 13);
+  }
+
+  // Inference
+  auto compiled = std::dynamic_pointer_cast<CompiledExpression>(
+      solver.compile("(floor(x) % 7 + (x == 3)) * y"));
+  Binding integerBindings[] = {{x.get(), counts}, {y.get(), small}};
+  auto infos = compiled->inferTypes(integerBindings, counts.size());
+  check(infos.back().type == ValueType::Integer && infos.back().low == -24 &&
+            infos.back().high == 28,
+        "integer inputs give an integer result and its range");
+  size_t booleans = 0;
+  for (auto &info : infos) {
+    booleans += info.type == ValueType::Boolean;
+  }
+  check(booleans == 1, "comparison is boolean");
+
+  Binding fractionBindings[] = {{x.get(), fractions}, {y.get(), fractions}};
+  infos = compiled->inferTypes(fractionBindings, fractions.size());
+  check(infos.back().type == ValueType::Real, "fractional inputs give a real result");
+  Binding nanBindings[] = {{x.get(), mixed}, {y.get(), small}};
+  infos = compiled->inferTypes(nanBindings, mixed.size());
+  check(!infos.back().finite, "NaN inputs leave the range unknown");
+
+  auto info = ValueInfo::of(counts);
+  check(info.type == ValueType::Integer && info.low == -11 && info.high == 25,
+        "column range");
+  check(ValueInfo::constant(0.5).type == ValueType::Real &&
+            ValueInfo::constant(1e300).type == ValueType::Real &&
+            ValueInfo::constant(-4).type == ValueType::Integer,
+        "constant types");
+
+  // Typed kernels agree with the double evaluation, whatever the inputs.
+  const char *expressions[] = {
+      "(x == 3) || ((y == 2) && !(x))",
+      "floor(x) % 7 + round(y) * 3",
+      "(x % y) + min(x, y, 4) - max(x, 0) + abs(x)",
+      "(floor(x / 2) == y) * x + ((x == y) == (y == 1))",
+      "sum(x, y, 5, floor(x)) * ceil(y) + trunc(x * 0.5)",
+      "sin(x) * (x == 1) + (x && y) + (x || 0)",
+      "(x * y) % 5 == 0",
+  };
+  const std::vector<double> *columns[] = {&counts, &fractions, &small, &mixed};
+  bool all = true;
+  for (const char *expression : expressions) {
+    for (auto xs : columns) {
+      for (auto ys : columns) {
+        all &= matchesScalar(solver, x, y, expression, *xs, *ys);
+      }
+    }
+  }
+  check(all, "typed batches match scalar evaluation");
+
+  // Short batches end inside a mask word.
+  std::vector<double> shortCounts(counts.begin(), counts.begin() + 70);
+  std::vector<double> shortSmall(small.begin(), small.begin() + 70);
+  check(matchesScalar(solver, x, y, "!((x == 1) || (y == 2))", shortCounts, shortSmall) &&
+            matchesScalar(solver, x, y, "(x == 1) && (y == 2)",
+                          {shortCounts.begin(), shortCounts.begin() + 3},
+                          {shortSmall.begin(), shortSmall.begin() + 3}),
+        "partial mask words");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+#include "../src/CompiledExpression.hpp"
+#include "../src/ExpressionSolver.hpp"
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <string>
+
+using namespace expression_solver;
+using namespace expression_solver::operations;
+
+namespace {
+
+ExpressionPtr root(const ExpressionPtr &e) {
+  auto compiled = std::dynamic_pointer_cast<CompiledExpression>(e);
+  return compiled ? compiled->getRoot() : e;
+}
+
+template <typename T> std::function<bool(const ExpressionPtr &)> is(size_t arity) {
+  return [arity](const ExpressionPtr &e) {
+    auto op = std::dynamic_pointer_cast<T>(root(e));
+    return op && op->arity() == arity;
+  };
+}
+
+} // namespace
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto x = std::make_shared<PlaceHolder>("x", 0.5);
+  auto y = std::make_shared<PlaceHolder>("y", 2.0);
+  auto z = std::make_shared<PlaceHolder>("z", -1.5);
+  context.addPlaceholder(x);
+  context.addPlaceholder(y);
+  context.addPlaceholder(z);
+  ExpressionSolver solver(context);
+
+  auto any = [](const ExpressionPtr &) { return true; };
+  std::vector<std::tuple<std::string, double, std::function<bool(const ExpressionPtr &)>>> tests = {
+      // Call syntax for variadic and binary operations.
+      {"sum(x, y, z)", 1.0, is<SumOperation>(3)},
+      {"product(x, y, z, 2)", -3.0, is<ProductOperation>(4)},
+      {"min(x, y, z)", -1.5, is<VariadicMinOperation>(3)},
+      {"max(x, y, z, 1)", 2.0, is<VariadicMaxOperation>(4)},
+      {"max(x, y)", 2.0, is<MaxOperation>(2)},
+      {"atan2(y, x) * 2", 2 * std::atan2(2.0, 0.5), any},
+      {"sum(x)", 0.5, any},
+      {"2 * sum(3, 4) + min(5, 6)", 19, any},
+      {"sin(x) + sum(sin(x), 1)", 2 * std::sin(0.5) + 1, any},
+      {"max(1, (y), (x + z))", 2.0, is<VariadicMaxOperation>(3)},
+      // Infix use of named operations is unchanged.
+      {"3 max 5 max 7", 7, any},
+      {"x max (y)", 2.0, any},
+      // Chains of associative operations are flattened.
+      {"x + y + z + x", 1.5, is<SumOperation>(4)},
+      {"x * y * z * y", -3.0, is<ProductOperation>(4)},
+      {"(x + y) + (z + x)", 1.5, is<SumOperation>(4)},
+      {"x max y max z", 2.0, is<VariadicMaxOperation>(3)},
+      {"x + y", 2.5, is<AddOperation>(2)},
+      {"x - y - z", 0, is<SubtractOperation>(2)},
+  };
+
+  int passed = 0;
+  for (const auto &[expression, expected, check] : tests) {
+    auto exp = solver.compile(expression);
+    double result = exp->evaluate();
+    if (std::abs(result - expected) < 1e-12 && check(exp)) {
+      std::cout << "Test passed: " << expression << " = " << expected << std::endl;
+      passed++;
+    } else {
+      std::cout << "Test failed: " << expression << " = " << result << " (expected " << expected << ")" << std::endl;
+    }
+  }
+
+  // Gradients flow through n-ary nodes.
+  auto gradient = solver.differentiate(*solver.compile("x * y * z * y + sum(x, y, z) + max(x, y, z)"));
+  double dx = 2.0 * -1.5 * 2.0 + 1, dy = 2 * 0.5 * 2.0 * -1.5 + 1 + 1, dz = 0.5 * 2.0 * 2.0 + 1;
+  if (std::abs(gradient.gradient["x"] - dx) < 1e-12 && std::abs(gradient.gradient["y"] - dy) < 1e-12 &&
+      std::abs(gradient.gradient["z"] - dz) < 1e-12) {
+    std::cout << "Test passed: gradient through n-ary operations" << std::endl;
+    passed++;
+  } else {
+    std::cout << "Test failed: gradient through n-ary operations" << std::endl;
+  }
+
+  // Long chains stay linear to compile and are evaluated with a balanced reduction.
+  std::string chain = "x";
+  for (int i = 0; i < 100000; i++) {
+    chain += "+x";
+  }
+  auto longSum = solver.compile(chain);
+  if (std::abs(longSum->evaluate() - 100001 * 0.5) < 1e-9 && is<SumOperation>(100001)(longSum)) {
+    std::cout << "Test passed: flattened chain of 100001 terms" << std::endl;
+    passed++;
+  } else {
+    std::cout << "Test failed: flattened chain of 100001 terms" << std::endl;
+  }
+
+  std::vector<std::string> invalid = {"min()", "sin(x, y)", "atan2(x, y, z)", "x sum y",
+                                      "(2, 3)", "max(1, (2, 3))", "sum((1, 2), 3)"};
+  for (const auto &expression : invalid) {
+    try {
+      solver.compile(expression);
+      std::cout << "Test failed: " << expression << " (expected an error)" << std::endl;
+    } catch (const std::invalid_argument &) {
+      std::cout << "Test passed: " << expression << " rejected" << std::endl;
+      passed++;
+    }
+  }
+
+  return passed == static_cast<int>(tests.size() + 2 + invalid.size()) ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+#include "../src/ExpressionSolver.hpp"
+#include "TestSupport.hpp"
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace expression_solver;
+
+namespace {
+
+bool near(double a, double b) { return std::abs(a - b) < 1e-12; }
+
+} // namespace
+
+int main() {
+  Context context = Context::getDefaultContext();
+  auto a = std::make_shared<VectorPlaceHolder>("a", 3);
+  auto b = std::make_shared<VectorPlaceHolder>("b", 3);
+  auto q = std::make_shared<VectorPlaceHolder>("q", 4);
+  auto s = std::make_shared<PlaceHolder>("s", 2.0);
+  context.addVector(a);
+  context.addVector(b);
+  context.addVector(q);
+  context.addPlaceholder(s);
+  ExpressionSolver solver(context);
+
+  double av[] = {1, 2, 3};
+  double bv[] = {4, -5, 6};
+  double qv[] = {1, 1, 1, 1};
+  a->setValue(av);
+  b->setValue(bv);
+  q->setValue(qv);
+
+  check(solver.solve("dot(a, b)") == 12, "dot");
+  check(near(solver.solve("norm(a)"), std::sqrt(14.0)), "norm");
+  check(solver.solve("norm(q)") == 2, "norm of dimension 4");
+  check(near(solver.solve("norm(a_x, a_y)"), std::sqrt(5.0)), "norm of scalars");
+  check(solver.solve("a_x + b_z") == 7, "components are placeholders");
+
+  auto cross = solver.compileVector("cross(a, b)");
+  check(cross.size() == 3 && solver.solve(cross[0]) == 27 && solver.solve(cross[1]) == 6 &&
+            solver.solve(cross[2]) == -13,
+        "cross");
+  check(solver.solve("dot(cross(a, b), a)") == 0, "cross is orthogonal");
+
+  auto unit = solver.compileVector("normalize(a)");
+  check(unit.size() == 3 && near(solver.solve(unit[1]), 2 / std::sqrt(14.0)), "normalize");
+  check(near(solver.solve("norm(normalize(b))"), 1), "normalized length");
+
+  auto combined = solver.compileVector("(a + b) * s - 1");
+  check(combined.size() == 3 && solver.solve(combined[0]) == 9 &&
+            solver.solve(combined[1]) == -7 && solver.solve(combined[2]) == 17,
+        "component-wise arithmetic with broadcast scalars");
+  auto calls = solver.compileVector("max(a, b)");
+  check(solver.solve(calls[0]) == 4 && solver.solve(calls[1]) == 2, "component-wise calls");
+  check(solver.compileVector("dot(a, a)").size() == 1, "scalar from compileVector");
+  auto sums = solver.compileVector("sum(a)");
+  check(sums.size() == 3 && solver.solve(sums[2]) == 3, "component-wise variadic call");
+  auto products = solver.compileVector("product(a, b, s)");
+  check(products.size() == 3 && solver.solve(products[0]) == 8 &&
+            solver.solve(products[1]) == -20 && solver.solve(products[2]) == 36,
+        "component-wise variadic call of several vectors");
+  auto maxima = solver.compileVector("max(a, b, 1)");
+  check(maxima.size() == 3 && solver.solve(maxima[0]) == 4 && solver.solve(maxima[1]) == 2 &&
+            solver.solve(maxima[2]) == 6,
+        "component-wise n-ary binary call");
+
+  // Batches read each component from its own column.
+  size_t rows = 1000;
+  std::vector<double> columnsA(rows * 3), columnsB(rows * 3), results(rows);
+  for (size_t i = 0; i < rows * 3; i++) {
+    columnsA[i] = std::sin(static_cast<double>(i));
+    columnsB[i] = std::cos(static_cast<double>(i) * 0.7);
+  }
+  auto bindings = a->bind(columnsA);
+  auto bindingsB = b->bind(columnsB);
+  bindings.insert(bindings.end(), bindingsB.begin(), bindingsB.end());
+  auto expression = solver.compile("dot(normalize(a), b) + norm(cross(a, b))");
+  auto written = solver.compile(
+      "(a_x * b_x + a_y * b_y + a_z * b_z) / sqrt(a_x * a_x + a_y * a_y + a_z * a_z) + "
+      "sqrt((a_y * b_z - a_z * b_y) ^ 2 + (a_z * b_x - a_x * b_z) ^ 2 + "
+      "(a_x * b_y - a_y * b_x) ^ 2)");
+  std::vector<double> expected(rows);
+  solver.solve(expression, bindings, results);
+  solver.solve(written, bindings, expected);
+  bool same = true;
+  for (size_t i = 0; i < rows; i++) {
+    same &= std::abs(results[i] - expected[i]) < 1e-9;
+  }
+  check(same, "batch matches the expression written out");
+
+  // Derivatives through the vector operations.
+  auto gradient = solver.differentiate(*solver.compile("dot(normalize(a), b) * norm(b)")).gradient;
+  double h = 1e-6;
+  bool accurate = true;
+  for (const auto &component : a->getComponents()) {
+    double x = component->evaluate();
+    auto f = solver.compile("dot(normalize(a), b) * norm(b)");
+    component->setValue(x + h);
+    double up = solver.solve(f);
+    component->setValue(x - h);
+    double down = solver.solve(f);
+    component->setValue(x);
+    accurate &= std::abs(gradient[std::string(component->getIdentifier())] -
+                         (up - down) / (2 * h)) < 1e-6;
+  }
+  check(accurate, "gradient through normalize, dot and norm");
+
+  check(throws([&] { solver.compile("a + b"); }) &&
+            throws([&] { solver.compile("dot(a, q)"); }) &&
+            throws([&] { solver.compile("cross(q, q)"); }) &&
+            throws([&] { solver.compile("a + q"); }) &&
+            throws([&] { solver.define("f(x) = a * x"); }) &&
+            throws([] { VectorPlaceHolder("v", 5); }),
+        "invalid vector expressions");
+
+  std::cout << passed << " passed, " << failed << " failed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}